@@ -0,0 +1,87 @@
+// check that DAG packets (libwish/packets/dag_packet.c) round-trip, and that truncated or overlong ones are refused
+// with nothing left allocated, instead of unpacking past the payload or leaving nodes half-filled.
+//
+// usage: dag_packet_check
+
+#include "libwish.h"
+
+static int failures = 0;
+
+static void check( bool ok, char const* what ) {
+   printf("%s: %s\n", (ok ? "ok" : "FAIL"), what );
+   if( !ok )
+      failures++;
+}
+
+// is a DAG packet empty, as a failed unpack must leave it?
+static bool check_empty( struct wish_dag_packet* p ) {
+   return p->num_nodes == 0 && p->nodes == NULL && p->num_gpids == 0 && p->gpids == NULL;
+}
+
+int main( int argc, char** argv ) {
+   struct wish_dag_packet d;
+   wish_init_dag_packet( NULL, &d, 42, 1000, 1000, 022 );
+   uint32_t a = wish_add_dag_node( &d, "a", DAG_ANY_HOST, "true", 0 );
+   uint32_t b = wish_add_dag_node( &d, "b", "localhost", "echo b", 10 );
+   uint32_t c = wish_add_dag_node( &d, "c", DAG_ANY_HOST, "echo c", 0 );
+   wish_add_dag_dep( &d, b, a, DAG_AFTER_OK );
+   wish_add_dag_dep( &d, c, a, DAG_AFTER_ANY );
+   wish_add_dag_dep( &d, c, b, DAG_AFTER_OK );
+   
+   struct wish_packet wp;
+   wish_pack_dag_packet( NULL, &wp, &d );
+   
+   // a DAG comes back as it went out
+   struct wish_dag_packet p;
+   int rc = wish_unpack_dag_packet( NULL, &wp, &p );
+   check( rc == 0 && p.dag_id == 42 && p.num_nodes == 3 && wish_check_dag_packet( &p ) == 0, "a DAG round-trips, and checks out" );
+   check( rc == 0 && strcmp( p.nodes[1].cmd_text, "echo b" ) == 0 && p.nodes[2].num_deps == 2 && p.nodes[2].deps[1].node == b, "nodes and deps round-trip" );
+   wish_free_dag_packet( &p );
+   
+   // every truncation is refused, whichever field it cuts
+   uint32_t full_len = wp.hdr.payload_len;
+   bool all_refused = true;
+   for( uint32_t len = 0; len < full_len; len++ ) {
+      wp.hdr.payload_len = len;
+      rc = wish_unpack_dag_packet( NULL, &wp, &p );
+      if( rc != -EINVAL || !check_empty( &p ) )
+         all_refused = false;
+   }
+   check( all_refused, "every truncated packet is refused, with nothing left allocated" );
+   wp.hdr.payload_len = full_len;
+   
+   // a node claiming more dependencies than a DAG may have nodes is refused, not left with later nodes unset
+   uint8_t* payload = wp.payload;
+   off_t num_deps_at = sizeof(uint64_t) + 4 * sizeof(uint32_t) + strlen("a") + 1 + strlen(DAG_ANY_HOST) + 1 + strlen("true") + 1 + sizeof(int64_t);
+   off_t offset = num_deps_at;
+   wish_pack_uint( payload, &offset, DAG_MAX_NODES + 1 );
+   rc = wish_unpack_dag_packet( NULL, &wp, &p );
+   check( rc == -EINVAL && check_empty( &p ), "too many dependencies is refused, with nothing left allocated" );
+   
+   // ...as is a count the payload can't hold
+   offset = num_deps_at;
+   wish_pack_uint( payload, &offset, 1000 );
+   rc = wish_unpack_dag_packet( NULL, &wp, &p );
+   check( rc == -EINVAL && check_empty( &p ), "dependencies past the end of the payload are refused" );
+   
+   offset = num_deps_at;
+   wish_pack_uint( payload, &offset, 0 );
+   
+   // a string that runs off the end of the payload is refused (the payload ends in the middle of the first name)
+   wp.hdr.payload_len = sizeof(uint64_t) + 5 * sizeof(uint32_t) + strlen("a");
+   rc = wish_unpack_dag_packet( NULL, &wp, &p );
+   check( rc == -EINVAL && check_empty( &p ), "an unterminated name is refused" );
+   wp.hdr.payload_len = full_len;
+   
+   wish_free_packet( &wp );
+   
+   // a node with no name, host, or command doesn't pass the check
+   free( d.nodes[2].hostname );
+   d.nodes[2].hostname = NULL;
+   check( wish_check_dag_packet( &d ) == -EINVAL, "a node with no hostname fails the check" );
+   
+   wish_free_dag_packet( &d );
+   
+   printf("%d failures\n", failures );
+   return (failures == 0 ? 0 : 1);
+}
@@ -0,0 +1,195 @@
+// benchmark of the process and spawn tables (wishd/gpidtable.c) under concurrent spawns, joins, and output streaming.
+//
+// output threads walk their part of the table, spinning for a while on each entry as if sending its output to a slow
+// peer.  Spawners add entries, and joiners look them up and remove them, the way process_spawn and process_join do.
+// Run it sharded (each output thread locks one entry at a time, as wishd does now) and with -g (one table-wide write
+// lock held across each output thread's whole pass, as the tables used to be) to compare how long spawns and joins wait.
+//
+// usage: gpidtable_bench [-g] [-t output threads] [-w spawner/joiner threads] [-n spawns each] [-i I/O us per entry]
+
+#include "gpidtable.h"
+#include <algorithm>
+
+struct bench_entry {
+   struct gpid_entry ent;        // must come first
+   int data;
+};
+
+static struct gpid_table table;
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;    // the old table-wide lock (with -g)
+static bool global_lock = false;
+
+static int num_output = 4;
+static int num_workers = 4;
+static int num_spawns = 2000;
+static int io_us = 20;
+
+static volatile bool running = true;
+static uint64_t next_gpid = 1;
+static int num_freed = 0;
+
+struct bench_latency {
+   vector<uint64_t> spawn;
+   vector<uint64_t> join;
+};
+
+// current time, in microseconds
+static uint64_t bench_now_us(void) {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// stand in for a send to a slow peer
+static void bench_io(void) {
+   uint64_t start = bench_now_us();
+   while( bench_now_us() - start < (uint64_t)io_us );
+}
+
+static void bench_free( struct wish_state* state, struct gpid_entry* ent ) {
+   __atomic_add_fetch( &num_freed, 1, __ATOMIC_SEQ_CST );
+   free( ent );
+}
+
+// output thread: stream every entry in our part of the table
+static void* bench_output( void* arg ) {
+   int part = (int)(long)arg;
+   
+   while( running ) {
+      GpidEntryList ents;
+   
+      if( global_lock ) {
+         pthread_rwlock_wrlock( &table_lock );
+         gpid_table_snapshot_part( &table, part, num_output, &ents );
+         for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+            bench_io();
+         }
+         gpid_table_put_all( &table, &ents );
+         pthread_rwlock_unlock( &table_lock );
+      }
+      else {
+         gpid_table_snapshot_part( &table, part, num_output, &ents );
+         for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+            gpid_entry_lock( ents[i] );
+            bench_io();
+            gpid_entry_unlock( ents[i] );
+         }
+         gpid_table_put_all( &table, &ents );
+      }
+   
+      usleep( 100 );
+   }
+   return NULL;
+}
+
+// spawner/joiner: add an entry, then join on (and remove) every other one
+static void* bench_worker( void* arg ) {
+   struct bench_latency* lat = (struct bench_latency*)arg;
+   
+   for( int i = 0; i < num_spawns; i++ ) {
+      uint64_t gpid = __atomic_fetch_add( &next_gpid, 1, __ATOMIC_SEQ_CST );
+   
+      uint64_t start = bench_now_us();
+      if( global_lock )
+         pthread_rwlock_wrlock( &table_lock );
+   
+      struct bench_entry* e = (struct bench_entry*)calloc( sizeof(struct bench_entry), 1 );
+      gpid_table_insert( &table, &e->ent, gpid );
+      gpid_table_put( &table, &e->ent );
+   
+      if( global_lock )
+         pthread_rwlock_unlock( &table_lock );
+      lat->spawn.push_back( bench_now_us() - start );
+   
+      start = bench_now_us();
+      if( global_lock )
+         pthread_rwlock_wrlock( &table_lock );
+   
+      struct gpid_entry* ent = gpid_table_get( &table, gpid );
+      if( ent != NULL ) {
+         gpid_entry_lock( ent );
+         if( i % 2 == 0 )
+            gpid_table_remove( &table, ent );
+         gpid_entry_unlock( ent );
+         gpid_table_put( &table, ent );
+      }
+   
+      if( global_lock )
+         pthread_rwlock_unlock( &table_lock );
+      lat->join.push_back( bench_now_us() - start );
+   
+      usleep( 200 );
+   }
+   return NULL;
+}
+
+static void bench_report( char const* what, vector<uint64_t>* v ) {
+   sort( v->begin(), v->end() );
+   size_t n = v->size();
+   printf("%-6s n=%zu p50=%luus p99=%luus p999=%luus max=%luus\n", what, n, (*v)[n/2], (*v)[n*99/100], (*v)[n*999/1000], (*v)[n-1] );
+}
+
+int main( int argc, char** argv ) {
+   int c;
+   while( (c = getopt( argc, argv, "gt:w:n:i:" )) != -1 ) {
+      switch( c ) {
+         case 'g':
+            global_lock = true;
+            break;
+         case 't':
+            num_output = atoi( optarg );
+            break;
+         case 'w':
+            num_workers = atoi( optarg );
+            break;
+         case 'n':
+            num_spawns = atoi( optarg );
+            break;
+         case 'i':
+            io_us = atoi( optarg );
+            break;
+         default:
+            fprintf(stderr, "Usage: %s [-g] [-t output threads] [-w spawner threads] [-n spawns each] [-i I/O us per entry]\n", argv[0] );
+            exit(1);
+      }
+   }
+   
+   gpid_table_init( &table, NULL, bench_free );
+   
+   pthread_t* outputs = (pthread_t*)calloc( sizeof(pthread_t) * num_output, 1 );
+   pthread_t* workers = (pthread_t*)calloc( sizeof(pthread_t) * num_workers, 1 );
+   struct bench_latency* lats = new struct bench_latency[ num_workers ];
+   
+   for( int i = 0; i < num_output; i++ ) {
+      pthread_create( &outputs[i], NULL, bench_output, (void*)(long)i );
+   }
+   for( int i = 0; i < num_workers; i++ ) {
+      pthread_create( &workers[i], NULL, bench_worker, &lats[i] );
+   }
+   
+   for( int i = 0; i < num_workers; i++ ) {
+      pthread_join( workers[i], NULL );
+   }
+   running = false;
+   for( int i = 0; i < num_output; i++ ) {
+      pthread_join( outputs[i], NULL );
+   }
+   
+   struct bench_latency all;
+   for( int i = 0; i < num_workers; i++ ) {
+      all.spawn.insert( all.spawn.end(), lats[i].spawn.begin(), lats[i].spawn.end() );
+      all.join.insert( all.join.end(), lats[i].join.begin(), lats[i].join.end() );
+   }
+   
+   printf("%s, %d output threads, %d spawners, %dus I/O per entry, %zu entries left\n", (global_lock ? "table-wide lock" : "sharded"), num_output, num_workers, io_us, gpid_table_count( &table ) );
+   bench_report( "spawn", &all.spawn );
+   bench_report( "join", &all.join );
+   
+   gpid_table_shutdown( &table );
+   printf("freed %d of %d entries\n", num_freed, num_workers * num_spawns );
+   
+   delete[] lats;
+   free( outputs );
+   free( workers );
+   return 0;
+}
@@ -0,0 +1,331 @@
+// the heartbeat subsystem (wishd/heartbeat.c, swim.c, rank.c, sampler.c, timer.c) of one host, run on loopback.
+//
+// this is not a daemon: there's no job table, scheduler, or pinning (what the sampler reads of them is stubbed out
+// below), and the only connections accepted are heartbeats.  Run a few at once on different ports, pointed at each
+// other, to watch membership, gossip, and heartbeat timing between them.  Every second each prints what it knows of
+// every other host (marked ? while it's suspected).  Stopping one (kill -STOP) leaves its connections open but its
+// probes unanswered, so they're counted as lost until it's declared dead; killing one closes its connections.
+//
+// -b starts a host that never answers: a listener whose accept queue is full, so connects to it hang until they
+// time out.  It's passed to the heartbeats as a peer, to check that waiting on it doesn't hold up anything else.
+//
+// -q runs a placement query (heartbeat_query) each second, as an nget would: hosts with every one of the given
+// labels ("-" for any), ranked by latency and free RAM.
+//
+// -r starts that many threads reading the heartbeat state as the spawn path does (the 4 hosts with the most free
+// CPU, then each one's metrics, hostname, and port), from the third second to the end, and prints the percentiles of
+// how long each of those reads took.
+//
+// e.g. three hosts, the second killed part way through, and the first leaving cleanly:
+//    ./heartbeat_loopback -n A -p 13001 -s 16 -x &
+//    ./heartbeat_loopback -n B -p 13002 -P 13001 -s 30 & sleep 6; kill -9 $!
+//    ./heartbeat_loopback -n C -p 13003 -P 13001 -s 30
+//
+// usage: heartbeat_loopback -n name -p port [-P peer port]... [-b unanswering port] [-i interval ms] [-s seconds]
+//                           [-l labels] [-q labels] [-r readers] [-t] [-x]
+//    -t   time heartbeats by the kernel's receive timestamps
+//    -x   leave the instance at the end (heartbeat_shutdown)
+
+#include "heartbeat.h"
+#include "timer.h"
+#include "sampler.h"
+
+#define LOOPBACK_MAX_PEERS 8
+#define LOOPBACK_MAX_READERS 16
+
+// what the sampler reads of the rest of the daemon
+uint32_t scheduler_queue_depth( struct wish_state* state ) {
+   return 0;
+}
+
+uint32_t process_num_running( struct wish_state* state ) {
+   return 0;
+}
+
+uint32_t pin_free_cpus( struct wish_state* state ) {
+   return 0;
+}
+
+uint32_t pin_free_nodes( struct wish_state* state ) {
+   return 0;
+}
+
+static struct wish_state state;
+static char const* query_labels = NULL;
+static volatile bool reading = true;
+
+// hand inbound heartbeat connections to the heartbeat code, as wishd's main loop does
+static void* loopback_accept( void* arg ) {
+   while( true ) {
+      struct wish_connection* con = (struct wish_connection*)calloc( sizeof(struct wish_connection), 1 );
+      if( wish_accept( &state, con ) < 0 ) {
+         free( con );
+         continue;
+      }
+   
+      struct wish_packet wp;
+      if( wish_read_packet( &state, con, &wp ) < 0 ) {
+         wish_disconnect( &state, con );
+         free( con );
+         continue;
+      }
+   
+      if( wp.hdr.type == PACKET_TYPE_HEARTBEAT )
+         heartbeat_add( &state, con, &wp );
+      else
+         wish_disconnect( &state, con );
+   
+      wish_free_packet( &wp );
+      free( con );
+   }
+   return NULL;
+}
+
+// current time, in nanoseconds
+static uint64_t loopback_now_ns(void) {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// read what the spawn path reads until told to stop, recording how long each read takes
+static void* loopback_reader( void* arg ) {
+   vector<uint64_t>* times = (vector<uint64_t>*)arg;
+   
+   while( reading ) {
+      uint64_t start = loopback_now_ns();
+   
+      vector<uint64_t> nids;
+      heartbeat_best_range( &state, HEARTBEAT_PROP_CPU, 0, 4, &nids );
+      for( vector<uint64_t>::size_type i = 0; i < nids.size(); i++ ) {
+         struct heartbeat_metrics m;
+         heartbeat_nid_metrics( &state, nids[i], &m );
+   
+         char* hostname = heartbeat_nid_to_hostname( &state, nids[i] );
+         if( hostname != NULL )
+            free( hostname );
+   
+         heartbeat_nid_to_portnum( &state, nids[i] );
+      }
+   
+      times->push_back( loopback_now_ns() - start );
+   }
+   return NULL;
+}
+
+// listen on a port, and fill the accept queue so no connect to it completes
+static int loopback_blackhole( int port ) {
+   struct sockaddr_in addr;
+   memset( &addr, 0, sizeof(addr) );
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons( port );
+   addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+   
+   int soc = socket( AF_INET, SOCK_STREAM, 0 );
+   int one = 1;
+   setsockopt( soc, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+   if( bind( soc, (struct sockaddr*)&addr, sizeof(addr) ) != 0 || listen( soc, 0 ) != 0 ) {
+      fprintf(stderr, "loopback_blackhole: can't listen on %d, errno = %d\n", port, -errno );
+      return -1;
+   }
+   
+   for( int i = 0; i < 4; i++ ) {
+      int c = socket( AF_INET, SOCK_STREAM, 0 );
+      fcntl( c, F_SETFL, O_NONBLOCK );
+      connect( c, (struct sockaddr*)&addr, sizeof(addr) );
+   }
+   return 0;
+}
+
+static void loopback_add_peer( int* num_peers, int port ) {
+   if( *num_peers >= LOOPBACK_MAX_PEERS ) {
+      fprintf(stderr, "at most %d peers\n", LOOPBACK_MAX_PEERS );
+      exit(1);
+   }
+   
+   struct wish_hostent* peer = (struct wish_hostent*)calloc( sizeof(struct wish_hostent), 1 );
+   peer->hostname = strdup( "127.0.0.1" );
+   peer->portnum = port;
+   state.conf.initial_peers[ (*num_peers)++ ] = peer;
+}
+
+// print what we know of every other host, including those suspected (which heartbeat_nids leaves out) until they're
+// declared dead
+static void loopback_report( char const* name, int t ) {
+   static vector<uint64_t> seen;
+   
+   vector<uint64_t> nids;
+   heartbeat_nids( &state, &nids );
+   for( vector<uint64_t>::size_type i = 0; i < nids.size(); i++ ) {
+      if( find( seen.begin(), seen.end(), nids[i] ) == seen.end() )
+         seen.push_back( nids[i] );
+   }
+   
+   printf("[%s t=%d] %zu hosts:", name, t, nids.size() );
+   for( vector<uint64_t>::size_type i = 0; i < seen.size(); i++ ) {
+      if( seen[i] == state.nid )
+         continue;
+   
+      struct heartbeat_metrics m;
+      if( heartbeat_nid_metrics( &state, seen[i], &m ) != 0 )
+         continue;
+   
+      bool suspect = (find( nids.begin(), nids.end(), seen[i] ) == nids.end());
+      printf(" %d%s(lat=%.0fus jit=%.0fus loss=%.2f probes=%lu lost=%lu util=%.3f)", heartbeat_nid_to_portnum( &state, seen[i] ), (suspect ? "?" : ""), m.latency, m.latency_jitter, m.loss, m.probes, m.probes_lost, m.util );
+   }
+   printf("\n");
+   
+   if( query_labels != NULL ) {
+      struct wish_nget_packet query;
+      wish_init_nget_packet( &state, &query, 0, HEARTBEAT_PROP_QUERY, LOOPBACK_MAX_PEERS + 1 );
+      query.weights[0] = 1000;         // 1 per ms of latency
+      query.weights[2] = 100;          // -0.1 per GB of free RAM
+      if( strcmp( query_labels, "-" ) != 0 )
+         strncpy( query.labels, query_labels, HEARTBEAT_LABELS_MAX );
+   
+      vector<struct heartbeat_match> matches;
+      heartbeat_query( &state, &query, 0, LOOPBACK_MAX_PEERS + 1, &matches );
+   
+      printf("[%s t=%d] query(%s):", name, t, query_labels );
+      for( vector<struct heartbeat_match>::size_type i = 0; i < matches.size(); i++ ) {
+         int p = (matches[i].nid == state.nid ? state.conf.portnum : heartbeat_nid_to_portnum( &state, matches[i].nid ));
+         printf(" %d(%.3f)", p, matches[i].score );
+      }
+      printf("\n");
+   }
+   fflush( stdout );
+}
+
+int main( int argc, char** argv ) {
+   char const* name = NULL;
+   int port = 0;
+   int num_peers = 0;
+   int seconds = 10;
+   int num_readers = 0;
+   bool leave = false;
+   
+   memset( &state, 0, sizeof(state) );
+   pthread_rwlock_init( &state.lock, NULL );
+   state.conf.heartbeat_interval = 500;
+   state.conf.status_memory = 5;
+   state.conf.connect_timeout = 1000;
+   state.conf.files_root = strdup( "/tmp" );
+   state.conf.initial_peers = (struct wish_hostent**)calloc( sizeof(struct wish_hostent*), LOOPBACK_MAX_PEERS + 1 );
+   
+   int c;
+   while( (c = getopt( argc, argv, "n:p:P:b:i:s:l:q:r:tx" )) != -1 ) {
+      switch( c ) {
+         case 'n':
+            name = optarg;
+            break;
+         case 'p':
+            port = atoi( optarg );
+            break;
+         case 'P':
+            loopback_add_peer( &num_peers, atoi( optarg ) );
+            break;
+         case 'b':
+            if( loopback_blackhole( atoi( optarg ) ) != 0 )
+               exit(1);
+            loopback_add_peer( &num_peers, atoi( optarg ) );
+            break;
+         case 'i':
+            state.conf.heartbeat_interval = atoi( optarg );
+            break;
+         case 's':
+            seconds = atoi( optarg );
+            break;
+         case 'l':
+            state.conf.labels = strdup( optarg );
+            break;
+         case 'q':
+            query_labels = optarg;
+            break;
+         case 'r':
+            num_readers = atoi( optarg );
+            break;
+         case 't':
+            state.conf.heartbeat_timestamps = true;
+            break;
+         case 'x':
+            leave = true;
+            break;
+         default:
+            fprintf(stderr, "Usage: %s -n name -p port [-P peer port]... [-b unanswering port] [-i interval ms] [-s seconds] [-l labels] [-q labels] [-r readers] [-t] [-x]\n", argv[0] );
+            exit(1);
+      }
+   }
+   
+   if( name == NULL || port <= 0 || num_readers < 0 || num_readers > LOOPBACK_MAX_READERS ) {
+      fprintf(stderr, "Usage: %s -n name -p port [-P peer port]... [-b unanswering port] [-i interval ms] [-s seconds] [-l labels] [-q labels] [-r readers] [-t] [-x]\n", argv[0] );
+      exit(1);
+   }
+   
+   _DEBUG = 0;
+   
+   char port_str[16];
+   sprintf( port_str, "%d", port );
+   
+   state.conf.portnum = port;
+   state.hostname = strdup( "127.0.0.1" );
+   state.nid = wish_host_nid( name );
+   if( getaddrinfo( "127.0.0.1", port_str, NULL, &state.addr ) != 0 ) {
+      fprintf(stderr, "getaddrinfo failed\n");
+      exit(1);
+   }
+   
+   state.daemon_sock = socket( AF_INET, SOCK_STREAM, 0 );
+   int one = 1;
+   setsockopt( state.daemon_sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+   if( bind( state.daemon_sock, state.addr->ai_addr, state.addr->ai_addrlen ) != 0 || listen( state.daemon_sock, 64 ) != 0 ) {
+      fprintf(stderr, "can't listen on %d, errno = %d\n", port, -errno );
+      exit(1);
+   }
+   
+   signal( SIGPIPE, SIG_IGN );
+   
+   // in wishd's order
+   timer_init( &state );
+   sampler_init( &state );
+   heartbeat_init( &state );
+   
+   pthread_t accept_thread;
+   pthread_create( &accept_thread, NULL, loopback_accept, NULL );
+   
+   pthread_t readers[LOOPBACK_MAX_READERS];
+   vector<uint64_t> read_times[LOOPBACK_MAX_READERS];
+   
+   for( int t = 1; t <= seconds; t++ ) {
+      sleep( 1 );
+      loopback_report( name, t );
+   
+      // once the membership has settled
+      if( t == 2 ) {
+         for( int i = 0; i < num_readers; i++ ) {
+            pthread_create( &readers[i], NULL, loopback_reader, &read_times[i] );
+         }
+      }
+   }
+   
+   if( num_readers > 0 && seconds > 2 ) {
+      reading = false;
+   
+      vector<uint64_t> all;
+      for( int i = 0; i < num_readers; i++ ) {
+         pthread_join( readers[i], NULL );
+         all.insert( all.end(), read_times[i].begin(), read_times[i].end() );
+      }
+      sort( all.begin(), all.end() );
+   
+      size_t n = all.size();
+      if( n > 0 )
+         printf("[%s] %d readers, %zu reads: p50=%.1fus p99=%.1fus p999=%.1fus max=%.1fus\n", name, num_readers, n, all[n/2] / 1e3, all[n*99/100] / 1e3, all[n*999/1000] / 1e3, all[n-1] / 1e3 );
+      fflush( stdout );
+   }
+   
+   if( leave )
+      heartbeat_shutdown( &state );
+   
+   sampler_shutdown( &state );
+   _exit(0);
+}
@@ -0,0 +1,76 @@
+// check that nget packets carrying a placement query (libwish/packets/heartbeat_packet.c) round-trip, and that
+// packets from older clients, which stop before the query or before the count, unpack with those fields cleared.
+//
+// usage: nget_packet_check
+
+#include "libwish.h"
+
+static int failures = 0;
+
+static void check( bool ok, char const* what ) {
+   printf("%s: %s\n", (ok ? "ok" : "FAIL"), what );
+   if( !ok )
+      failures++;
+}
+
+// is every query field of a packet clear?
+static bool check_no_query( struct wish_nget_packet* p ) {
+   for( int i = 0; i < 4; i++ ) {
+      if( p->weights[i] != 0 )
+         return false;
+   }
+   return p->max_latency == 0 && p->max_load == 0 && p->min_ram == 0 && p->min_disk == 0 && p->labels[0] == 0;
+}
+
+int main( int argc, char** argv ) {
+   struct wish_nget_packet q;
+   wish_init_nget_packet( NULL, &q, 3, HEARTBEAT_PROP_QUERY, 5 );
+   q.weights[0] = 1000;
+   q.weights[1] = -250;
+   q.weights[2] = 100;
+   q.weights[3] = 7;
+   q.max_latency = 5000;
+   q.max_load = 2000;
+   q.min_ram = 8ULL << 30;
+   q.min_disk = 1ULL << 40;
+   strcpy( q.labels, "gpu,ssd" );
+   
+   struct wish_packet wp;
+   wish_pack_nget_packet( NULL, &wp, &q );
+   
+   // a query comes back as it went out
+   struct wish_nget_packet p;
+   memset( &p, 0xff, sizeof(p) );
+   wish_unpack_nget_packet( NULL, &wp, &p );
+   check( p.rank == 3 && p.props == HEARTBEAT_PROP_QUERY && p.count == 5, "rank, props, and count round-trip" );
+   check( memcmp( p.weights, q.weights, sizeof(q.weights) ) == 0, "weights round-trip (negative ones too)" );
+   check( p.max_latency == q.max_latency && p.max_load == q.max_load && p.min_ram == q.min_ram && p.min_disk == q.min_disk, "filters round-trip" );
+   check( strcmp( p.labels, q.labels ) == 0, "labels round-trip" );
+   
+   // a client that asks for a count, but sends no query (16 bytes)
+   uint32_t full_len = wp.hdr.payload_len;
+   wp.hdr.payload_len = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+   memset( &p, 0xff, sizeof(p) );
+   wish_unpack_nget_packet( NULL, &wp, &p );
+   check( p.rank == 3 && p.props == HEARTBEAT_PROP_QUERY && p.count == 5 && check_no_query( &p ), "a 16-byte packet unpacks with no query" );
+   
+   // a client that asks for one rank (12 bytes)
+   wp.hdr.payload_len = sizeof(uint64_t) + sizeof(uint32_t);
+   memset( &p, 0xff, sizeof(p) );
+   wish_unpack_nget_packet( NULL, &wp, &p );
+   check( p.rank == 3 && p.count == 0 && check_no_query( &p ), "a 12-byte packet unpacks with count 0 and no query" );
+   
+   wp.hdr.payload_len = full_len;
+   wish_free_packet( &wp );
+   
+   // labels longer than a host can announce are cut short, not overrun
+   memset( q.labels, 'x', HEARTBEAT_LABELS_MAX );
+   q.labels[ HEARTBEAT_LABELS_MAX ] = 0;
+   wish_pack_nget_packet( NULL, &wp, &q );
+   wish_unpack_nget_packet( NULL, &wp, &p );
+   check( strlen( p.labels ) == HEARTBEAT_LABELS_MAX, "the longest labels round-trip" );
+   wish_free_packet( &wp );
+   
+   printf("%d failures\n", failures );
+   return (failures == 0 ? 0 : 1);
+}
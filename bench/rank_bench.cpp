@@ -0,0 +1,160 @@
+// check and time the host rankings (wishd/rank.c).
+//
+// first, file, refile, and drop hosts at random, and check that the list always holds what a std::set would, in the
+// same order, and counts the hosts ahead of each one as the set does.  Then time, for the given number of hosts:
+// refiling a host (as a heartbeat that changes its mean does), looking up every rank in turn (as an nget per rank
+// does), getting every rank in one range call, and building and sorting a vector of every host (as each nget used to).
+//
+// usage: rank_bench [-n hosts] [-r refiles]
+
+#include "rank.h"
+#include <set>
+#include <algorithm>
+
+// keeps the compiler from dropping work whose result isn't otherwise used
+static volatile uint64_t bench_sink;
+
+// current time, in microseconds
+static double bench_now_us(void) {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// does the list hold exactly what ref does, in order, and count the hosts ahead of each one right?
+static bool bench_matches( struct rank_list* r, set< pair<double, uint64_t> >* ref ) {
+   if( r->size != ref->size() )
+      return false;
+   
+   vector<uint64_t> nids( r->size + 1 );
+   if( rank_range( r, 0, r->size + 1, &nids[0] ) != r->size )
+      return false;
+   
+   uint32_t i = 0;
+   for( set< pair<double, uint64_t> >::iterator itr = ref->begin(); itr != ref->end(); itr++, i++ ) {
+      if( nids[i] != itr->second || rank_count_below( r, itr->first, itr->second ) != i )
+         return false;
+   
+      uint64_t one = 0;
+      if( rank_range( r, i, 1, &one ) != 1 || one != itr->second )
+         return false;
+   }
+   return true;
+}
+
+// file, refile, and drop hosts at random, checking against a std::set
+static int bench_check(void) {
+   struct rank_list r;
+   rank_init( &r );
+   
+   set< pair<double, uint64_t> > ref;
+   vector<double> filed( 3000, -1 );     // each host's key, or -1 if it isn't filed
+   
+   for( int i = 0; i < 200000; i++ ) {
+      uint64_t nid = 1 + random() % filed.size();
+   
+      if( filed[nid-1] >= 0 ) {
+         if( rank_remove( &r, filed[nid-1], nid ) != 0 ) {
+            printf("FAIL: %lu isn't filed under %f\n", nid, filed[nid-1] );
+            return 1;
+         }
+         ref.erase( make_pair( filed[nid-1], nid ) );
+         filed[nid-1] = -1;
+      }
+      else if( rank_remove( &r, 0, nid ) != -ENOENT ) {
+         printf("FAIL: dropped %lu, which wasn't filed\n", nid );
+         return 1;
+      }
+   
+      // few keys, so there are plenty of ties to break by nid
+      if( random() % 3 != 0 ) {
+         double key = random() % 50;
+         rank_insert( &r, key, nid );
+         ref.insert( make_pair( key, nid ) );
+         filed[nid-1] = key;
+      }
+   
+      if( i % 1000 == 0 && !bench_matches( &r, &ref ) ) {
+         printf("FAIL: the list doesn't match after %d operations\n", i );
+         return 1;
+      }
+   }
+   
+   printf("ok: 200000 random files and drops of 3000 hosts match std::set (%u filed, %d levels)\n", r.size, r.level );
+   rank_free( &r );
+   return 0;
+}
+
+int main( int argc, char** argv ) {
+   int num_hosts = 10000;
+   int num_refiles = 1000000;
+   
+   int c;
+   while( (c = getopt( argc, argv, "n:r:" )) != -1 ) {
+      switch( c ) {
+         case 'n':
+            num_hosts = atoi( optarg );
+            break;
+         case 'r':
+            num_refiles = atoi( optarg );
+            break;
+         default:
+            fprintf(stderr, "Usage: %s [-n hosts] [-r refiles]\n", argv[0] );
+            exit(1);
+      }
+   }
+   
+   srandom( 1 );
+   
+   if( bench_check() != 0 )
+      exit(1);
+   
+   struct rank_list r;
+   rank_init( &r );
+   
+   vector<double> keys( num_hosts );
+   for( int i = 0; i < num_hosts; i++ ) {
+      keys[i] = random() % 100000;
+      rank_insert( &r, keys[i], i + 1 );
+   }
+   
+   double start = bench_now_us();
+   for( int i = 0; i < num_refiles; i++ ) {
+      int h = random() % num_hosts;
+      rank_remove( &r, keys[h], h + 1 );
+      keys[h] = random() % 100000;
+      rank_insert( &r, keys[h], h + 1 );
+   }
+   double refile = (bench_now_us() - start) / num_refiles;
+   
+   uint64_t nid = 0;
+   start = bench_now_us();
+   for( int i = 0; i < num_hosts; i++ ) {
+      rank_range( &r, i, 1, &nid );
+      bench_sink = nid;
+   }
+   double walk = bench_now_us() - start;
+   
+   vector<uint64_t> nids( num_hosts );
+   start = bench_now_us();
+   for( int i = 0; i < 100; i++ ) {
+      rank_range( &r, 0, num_hosts, &nids[0] );
+   }
+   double range = (bench_now_us() - start) / 100;
+   
+   start = bench_now_us();
+   for( int i = 0; i < 100; i++ ) {
+      vector< pair<double, uint64_t> > all;
+      for( int j = 0; j < num_hosts; j++ ) {
+         all.push_back( make_pair( keys[j], (uint64_t)(j + 1) ) );
+      }
+      sort( all.begin(), all.end() );
+      bench_sink = all[ i % num_hosts ].second;
+   }
+   double sorted = (bench_now_us() - start) / 100;
+   
+   printf("%d hosts: refile %.2fus, every rank in turn %.1fus in all, every rank in one range call %.1fus, build and sort a vector %.1fus\n", num_hosts, refile, walk, range, sorted );
+   
+   rank_free( &r );
+   return 0;
+}
@@ -0,0 +1,194 @@
+// benchmark of the origin's output writers (wishd/sink.c): throughput of job output files written by the writer pool,
+// and how long the threads receiving output spend handing each chunk over.
+//
+// receiver threads queue chunks round-robin on their share of the files, as output arrives from executors.  A file
+// that's backlogged isn't given more until it catches up, as the origin withholds its executor's credit.  Run it with
+// -s to have the receivers write() each chunk themselves instead, as the origin did before it had writers.  The time
+// is taken from the first chunk until every file is written and closed.
+//
+// usage: sink_bench [-s] [-w writer threads] [-r receiver threads] [-f files] [-c chunk bytes] [-n chunks per file]
+//                   [-y fsync policy] [-d directory]
+
+#include "sink.h"
+#include <algorithm>
+
+static bool sync_writes = false;
+static int num_writers = SINK_DEFAULT_THREADS;
+static int num_receivers = 4;
+static int num_files = 16;
+static int chunk_len = 512;
+static int num_chunks = 20000;
+static int fsync_policy = SINK_FSYNC_NONE;
+static char const* dir = "/tmp";
+
+static int* fds = NULL;
+static struct sink_file** files = NULL;
+static uint64_t num_backlogged = 0;
+
+// current time, in microseconds
+static uint64_t bench_now_us(void) {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// receiver: queue output on every file f with f % num_receivers == ours, a chunk to each in turn
+static void* bench_receiver( void* arg ) {
+   int part = (int)(long)arg;
+   vector<uint64_t>* lat = new vector<uint64_t>();
+   
+   for( int i = 0; i < num_chunks; i++ ) {
+      for( int f = part; f < num_files; f += num_receivers ) {
+         char* data = (char*)malloc( chunk_len );
+         memset( data, 'a' + (f % 26), chunk_len );
+   
+         if( sync_writes ) {
+            uint64_t start = bench_now_us();
+            write( fds[f], data, chunk_len );
+            if( fsync_policy == SINK_FSYNC_BATCH )
+               fsync( fds[f] );
+            lat->push_back( bench_now_us() - start );
+            free( data );
+            continue;
+         }
+   
+         // no credit until it catches up
+         while( sink_backlogged( files[f] ) ) {
+            __atomic_add_fetch( &num_backlogged, 1, __ATOMIC_SEQ_CST );
+            usleep( 100 );
+         }
+   
+         uint64_t start = bench_now_us();
+         sink_write( files[f], data, chunk_len );
+         lat->push_back( bench_now_us() - start );
+      }
+   }
+   
+   return lat;
+}
+
+int main( int argc, char** argv ) {
+   int c;
+   while( (c = getopt( argc, argv, "sw:r:f:c:n:y:d:" )) != -1 ) {
+      switch( c ) {
+         case 's':
+            sync_writes = true;
+            break;
+         case 'w':
+            num_writers = atoi( optarg );
+            break;
+         case 'r':
+            num_receivers = atoi( optarg );
+            break;
+         case 'f':
+            num_files = atoi( optarg );
+            break;
+         case 'c':
+            chunk_len = atoi( optarg );
+            break;
+         case 'n':
+            num_chunks = atoi( optarg );
+            break;
+         case 'y':
+            fsync_policy = atoi( optarg );
+            break;
+         case 'd':
+            dir = optarg;
+            break;
+         default:
+            fprintf(stderr, "Usage: %s [-s] [-w writer threads] [-r receiver threads] [-f files] [-c chunk bytes] [-n chunks per file] [-y fsync policy] [-d directory]\n", argv[0] );
+            exit(1);
+      }
+   }
+   
+   struct wish_state state;
+   memset( &state, 0, sizeof(state) );
+   pthread_rwlock_init( &state.lock, NULL );
+   state.conf.sink_threads = num_writers;
+   state.conf.sink_fsync = fsync_policy;
+   
+   if( !sync_writes && sink_init( &state ) != 0 ) {
+      fprintf(stderr, "sink_init failed\n");
+      exit(1);
+   }
+   
+   fds = (int*)calloc( sizeof(int) * num_files, 1 );
+   files = (struct sink_file**)calloc( sizeof(struct sink_file*) * num_files, 1 );
+   char** paths = (char**)calloc( sizeof(char*) * num_files, 1 );
+   
+   for( int i = 0; i < num_files; i++ ) {
+      paths[i] = (char*)calloc( PATH_MAX, 1 );
+      snprintf( paths[i], PATH_MAX, "%s/sink_bench.%d.%d", dir, getpid(), i );
+   
+      fds[i] = open( paths[i], O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600 );
+      if( fds[i] < 0 ) {
+         fprintf(stderr, "open %s errno = %d\n", paths[i], -errno );
+         exit(1);
+      }
+   
+      if( !sync_writes )
+         files[i] = sink_open( fds[i], paths[i] );
+   }
+   
+   pthread_t* receivers = (pthread_t*)calloc( sizeof(pthread_t) * num_receivers, 1 );
+   
+   uint64_t start = bench_now_us();
+   
+   for( int i = 0; i < num_receivers; i++ ) {
+      pthread_create( &receivers[i], NULL, bench_receiver, (void*)(long)i );
+   }
+   
+   vector<uint64_t> lat;
+   for( int i = 0; i < num_receivers; i++ ) {
+      vector<uint64_t>* l = NULL;
+      pthread_join( receivers[i], (void**)&l );
+      lat.insert( lat.end(), l->begin(), l->end() );
+      delete l;
+   }
+   
+   // write out and close everything
+   for( int i = 0; i < num_files; i++ ) {
+      if( sync_writes ) {
+         if( fsync_policy == SINK_FSYNC_CLOSE )
+            fsync( fds[i] );
+         close( fds[i] );
+      }
+      else {
+         sink_close( files[i] );
+      }
+   }
+   
+   if( !sync_writes )
+      sink_shutdown( &state );
+   
+   uint64_t elapsed = bench_now_us() - start;
+   
+   // check that every file got everything
+   uint64_t total = (uint64_t)num_files * num_chunks * chunk_len;
+   int short_files = 0;
+   for( int i = 0; i < num_files; i++ ) {
+      struct stat sb;
+      if( stat( paths[i], &sb ) != 0 || (uint64_t)sb.st_size != (uint64_t)num_chunks * chunk_len )
+         short_files++;
+      unlink( paths[i] );
+      free( paths[i] );
+   }
+   
+   sort( lat.begin(), lat.end() );
+   size_t n = lat.size();
+   
+   if( sync_writes )
+      printf("receivers write, %d receivers, %d files, %d-byte chunks, fsync %d, in %s\n", num_receivers, num_files, chunk_len, fsync_policy, dir );
+   else
+      printf("%d writers, %d receivers, %d files, %d-byte chunks, fsync %d, in %s\n", num_writers, num_receivers, num_files, chunk_len, fsync_policy, dir );
+   
+   printf("%.1f MB in %.3fs: %.1f MB/s\n", total / 1048576.0, elapsed / 1000000.0, (total / 1048576.0) / (elapsed / 1000000.0) );
+   printf("queue  n=%zu p50=%luus p99=%luus p999=%luus max=%luus, %lu backlogged waits\n", n, lat[n/2], lat[n*99/100], lat[n*999/1000], lat[n-1], num_backlogged );
+   printf("%d files short\n", short_files );
+   
+   free( paths );
+   free( files );
+   free( fds );
+   free( receivers );
+   return (short_files == 0 ? 0 : 1);
+}
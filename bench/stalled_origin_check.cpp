@@ -0,0 +1,226 @@
+// check that an executor keeps forwarding every other job's output while one job's origin has stopped reading
+// (wishd/process.c: output credit, and the writeback thread's non-blocking sends).
+//
+// this plays two origins against a running daemon, which acts as the executor for both.  The stalled origin sends a
+// job that writes a lot of output, and then never reads from its connection again.  The live origin sends a short
+// job, reads its output and grants credit for it as an origin does, and waits for it to exit.  The live job is run
+// alone first, and then alongside each kind of stalled origin: one that grants credit (JOB_CREDIT) but never any
+// more, and one that grants none (an older origin), whose output the executor sends until the socket fills.
+//
+// e.g. against a daemon listening on port 13200:
+//    ./stalled_origin_check -p 13200
+//
+// usage: stalled_origin_check -p executor port [-b bytes the stalled job writes] [-n lines the live job writes]
+//                             [-t seconds to wait for the live job]
+
+#include "libwish.h"
+
+static int portnum = -1;
+static long stalled_bytes = 64L * 1024 * 1024;
+static int live_lines = 2000;
+static int deadline = 10;
+
+static int failures = 0;
+
+static void check( bool ok, char const* what ) {
+   printf("%s: %s\n", (ok ? "ok" : "FAIL"), what );
+   if( !ok )
+      failures++;
+}
+
+// current time, in microseconds
+static uint64_t check_now_us(void) {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// connect to the executor and send it a job, as an origin daemon would.
+// return 0 on success, and the job's gpid
+static int check_start( struct wish_connection* con, char const* cmd, uint32_t flags, uint64_t* gpid ) {
+   int rc = wish_connect( NULL, con, "localhost", portnum );
+   if( rc != 0 ) {
+      fprintf(stderr, "could not connect to localhost:%d, rc = %d\n", portnum, rc );
+      return rc;
+   }
+   
+   // we're the origin (the executor only takes the address from this)
+   struct sockaddr_in origin;
+   memset( &origin, 0, sizeof(origin) );
+   origin.sin_family = AF_INET;
+   origin.sin_port = htons( portnum );
+   origin.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+   
+   struct sockaddr_storage visited;
+   memset( &visited, 0, sizeof(visited) );
+   memcpy( &visited, &origin, sizeof(origin) );
+   
+   struct wish_job_packet job;
+   wish_init_job_packet( NULL, &job, 0, 1, &visited, 1, (char*)cmd, NULL, flags | JOB_WISH_ORIGIN, -1, 0 );
+   job.owner = getuid();
+   job.group = getgid();
+   job.umask = 022;
+   *gpid = job.gpid;
+   
+   struct wish_packet pkt;
+   wish_pack_job_packet( NULL, &pkt, &job );
+   rc = wish_write_packet( NULL, con, &pkt );
+   wish_free_packet( &pkt );
+   wish_free_job_packet( &job );
+   
+   if( rc != 0 ) {
+      fprintf(stderr, "could not send job, rc = %d\n", rc );
+      wish_disconnect( NULL, con );
+   }
+   return rc;
+}
+
+// run the live job: read its output, granting credit for it, until it exits or the deadline passes.
+// return 0 if it exited, with its stdout in out and how long it took in elapsed
+static int check_live( string* out, uint64_t* elapsed ) {
+   char cmd[256];
+   sprintf(cmd, "i=0; while [ $i -lt %d ]; do echo line $i; i=$((i+1)); done", live_lines );
+   
+   struct wish_connection con;
+   uint64_t gpid = 0;
+   uint64_t start = check_now_us();
+   
+   int rc = check_start( &con, cmd, JOB_CREDIT, &gpid );
+   if( rc != 0 )
+      return rc;
+   
+   rc = -ETIMEDOUT;
+   while( check_now_us() - start < (uint64_t)deadline * 1000000 ) {
+      struct wish_packet pkt;
+      int read_rc = wish_read_packet( NULL, &con, &pkt );
+      if( read_rc != 0 ) {
+         fprintf(stderr, "live job: wish_read_packet rc = %d\n", read_rc );
+         break;
+      }
+   
+      bool done = false;
+      if( pkt.hdr.type == PACKET_TYPE_STRINGS ) {
+         struct wish_strings_packet wssp;
+         wish_unpack_strings_packet( NULL, &pkt, &wssp );
+   
+         uint32_t consumed = 0;
+         for( int i = 0; i < wssp.count; i++ ) {
+            if( wssp.packets[i].which == STRING_STDOUT )
+               out->append( wssp.packets[i].str );
+            consumed += strlen( wssp.packets[i].str );
+         }
+         wish_free_strings_packet( &wssp );
+   
+         if( consumed > 0 ) {
+            struct wish_process_packet wpp;
+            struct wish_packet reply;
+            wish_init_process_packet( NULL, &wpp, PROCESS_TYPE_CREDIT, gpid, 0, consumed );
+            wish_pack_process_packet( NULL, &reply, &wpp );
+            wish_write_packet( NULL, &con, &reply );
+            wish_free_packet( &reply );
+         }
+      }
+      else if( pkt.hdr.type == PACKET_TYPE_PROCESS ) {
+         struct wish_process_packet wpp;
+         wish_unpack_process_packet( NULL, &pkt, &wpp );
+   
+         if( wpp.type == PROCESS_TYPE_EXIT ) {
+            rc = 0;
+            done = true;
+         }
+         else if( wpp.type == PROCESS_TYPE_FAILURE || wpp.type == PROCESS_TYPE_ERROR || wpp.type == PROCESS_TYPE_TIMEOUT ) {
+            fprintf(stderr, "live job: got process reply %d, data %d\n", wpp.type, wpp.data );
+            rc = -ENOEXEC;
+            done = true;
+         }
+      }
+   
+      wish_free_packet( &pkt );
+      if( done )
+         break;
+   }
+   
+   *elapsed = check_now_us() - start;
+   wish_disconnect( NULL, &con );
+   return rc;
+}
+
+// run the live job, and check that all of its output arrived, in order, before the deadline
+static void check_live_job( char const* what, string const& expected ) {
+   string out;
+   uint64_t elapsed = 0;
+   int rc = check_live( &out, &elapsed );
+   
+   printf("live job %s: rc = %d, %zu of %zu bytes in %.1fms\n", what, rc, out.size(), expected.size(), elapsed / 1000.0 );
+   
+   char desc[256];
+   sprintf(desc, "the live job exits, with all of its output, %s", what );
+   check( rc == 0 && out == expected, desc );
+}
+
+// run the live job while another origin's job has stopped being read
+static void check_stalled( char const* what, uint32_t flags, string const& expected ) {
+   char cmd[256];
+   sprintf(cmd, "head -c %ld /dev/zero | tr '\\0' x", stalled_bytes );
+   
+   struct wish_connection stalled;
+   uint64_t gpid = 0;
+   int rc = check_start( &stalled, cmd, flags, &gpid );
+   if( rc != 0 ) {
+      check( false, "start the stalled job" );
+      return;
+   }
+   
+   // let it fill whatever it can
+   sleep( 1 );
+   
+   check_live_job( what, expected );
+   
+   // hanging up lets the executor clean it up
+   wish_disconnect( NULL, &stalled );
+   sleep( 1 );
+}
+
+int main( int argc, char** argv ) {
+   int c;
+   while( (c = getopt( argc, argv, "p:b:n:t:" )) != -1 ) {
+      switch( c ) {
+         case 'p':
+            portnum = atoi( optarg );
+            break;
+         case 'b':
+            stalled_bytes = atol( optarg );
+            break;
+         case 'n':
+            live_lines = atoi( optarg );
+            break;
+         case 't':
+            deadline = atoi( optarg );
+            break;
+         default:
+            portnum = -1;
+            break;
+      }
+   }
+   
+   if( portnum <= 0 ) {
+      fprintf(stderr, "Usage: %s -p executor port [-b bytes the stalled job writes] [-n lines the live job writes] [-t seconds to wait for the live job]\n", argv[0] );
+      exit(1);
+   }
+   
+   signal( SIGPIPE, SIG_IGN );
+   
+   string expected;
+   for( int i = 0; i < live_lines; i++ ) {
+      char line[32];
+      sprintf(line, "line %d\n", i );
+      expected.append( line );
+   }
+   
+   check_live_job( "alone", expected );
+   check_stalled( "while a crediting origin has stopped reading", JOB_CREDIT, expected );
+   check_stalled( "while a non-crediting origin has stopped reading", 0, expected );
+   
+   printf("%d failures\n", failures );
+   return (failures == 0 ? 0 : 1);
+}
@@ -0,0 +1,266 @@
+// simulation of the membership protocol (wishd/swim.c) among many hosts in one process, over a lossy network.
+//
+// every host runs its own swim, driven by a discrete-event clock instead of timers: each protocol period it ticks,
+// half way through it times out its probe, and messages arrive 1-5ms after they're sent (or not at all, with the
+// given loss).  After the hosts settle, one is killed, and we time how long it takes the others to suspect it and
+// to declare it dead, and count the messages and bytes each host sends per period beforehand (against the 2(n-1)
+// heartbeats and acks each host used to send every interval).
+//
+// usage: swim_sim [-n hosts] [-l loss %] [-s periods to settle before the kill]
+
+#include "swim.h"
+#include <queue>
+
+// a heartbeat in flight
+struct sim_message {
+   int to;
+   struct wish_heartbeat_packet h;
+};
+
+// something that happens at a given time
+struct sim_event {
+   uint64_t t;                   // in milliseconds
+   int type;                     // SIM_TICK, SIM_PROBE_TIMEOUT, or SIM_DELIVER
+   int host;
+   struct sim_message* m;        // for SIM_DELIVER
+   
+   bool operator<( const struct sim_event& other ) const {
+      return t > other.t;
+   }
+};
+
+#define SIM_TICK           0
+#define SIM_PROBE_TIMEOUT  1
+#define SIM_DELIVER        2
+
+static priority_queue<struct sim_event> events;
+static vector<struct swim*> hosts;
+static vector<bool> up;
+static uint64_t now_ms = 0;
+static uint64_t period = 1000;
+static double loss = 0;
+
+// what we measure
+static bool counting = false;
+static uint64_t bytes_sent = 0;
+static uint64_t messages_sent = 0;
+static int victim = -1;
+static vector<int64_t> suspect_at;
+static vector<int64_t> dead_at;
+static int false_suspicions = 0;
+static int false_deaths = 0;
+
+static void sim_schedule( uint64_t t, int type, int host, struct sim_message* m ) {
+   struct sim_event e;
+   e.t = t;
+   e.type = type;
+   e.host = host;
+   e.m = m;
+   events.push( e );
+}
+
+static void sim_message_free( struct sim_message* m ) {
+   wish_free_heartbeat_packet( &m->h );
+   delete m;
+}
+
+// a host sends a heartbeat
+static int sim_send( struct swim* s, uint64_t nid, struct wish_heartbeat_packet* h ) {
+   int to = (int)nid - 1;
+   
+   if( counting ) {
+      struct wish_packet wp;
+      wish_pack_heartbeat_packet( NULL, &wp, h );
+      bytes_sent += sizeof(struct wish_packet_header) + wp.hdr.payload_len;
+      messages_sent++;
+      wish_free_packet( &wp );
+   }
+   
+   // a dead host just doesn't answer
+   if( !up[to] || (double)random() / RAND_MAX < loss )
+      return 0;
+   
+   struct sim_message* m = new sim_message();
+   m->to = to;
+   m->h = *h;
+   if( h->num_updates > 0 ) {
+      m->h.updates = (struct wish_member_update*)malloc( sizeof(struct wish_member_update) * h->num_updates );
+      memcpy( m->h.updates, h->updates, sizeof(struct wish_member_update) * h->num_updates );
+   }
+   
+   sim_schedule( now_ms + 1 + random() % 5, SIM_DELIVER, to, m );
+   return 0;
+}
+
+// a host learned of a change in another's state
+static void sim_changed( struct swim* s, struct wish_member_update* m ) {
+   int host = (int)(intptr_t)s->cls;
+   int about = (int)m->nid - 1;
+   
+   if( about == victim ) {
+      if( m->state == MEMBER_SUSPECT && suspect_at[host] < 0 )
+         suspect_at[host] = now_ms;
+      if( m->state == MEMBER_DEAD && dead_at[host] < 0 )
+         dead_at[host] = now_ms;
+   }
+   else if( m->state == MEMBER_SUSPECT ) {
+      false_suspicions++;
+   }
+   else if( m->state == MEMBER_DEAD ) {
+      false_deaths++;
+   }
+}
+
+static void sim_metrics( struct swim* s, struct wish_member_update* m ) {
+}
+
+// has every host but the victim declared it dead?
+static bool sim_all_dead(void) {
+   for( int i = 0; i < (int)hosts.size(); i++ ) {
+      if( i != victim && dead_at[i] < 0 )
+         return false;
+   }
+   return true;
+}
+
+int main( int argc, char** argv ) {
+   int num_hosts = 100;
+   uint64_t settle = 30;
+   
+   int c;
+   while( (c = getopt( argc, argv, "n:l:s:" )) != -1 ) {
+      switch( c ) {
+         case 'n':
+            num_hosts = atoi( optarg );
+            break;
+         case 'l':
+            loss = atof( optarg ) / 100;
+            break;
+         case 's':
+            settle = atoi( optarg );
+            break;
+         default:
+            fprintf(stderr, "Usage: %s [-n hosts] [-l loss %%] [-s periods to settle before the kill]\n", argv[0] );
+            exit(1);
+      }
+   }
+   
+   if( num_hosts < 3 || settle < 10 ) {
+      fprintf(stderr, "%s: need at least 3 hosts and 10 periods to settle\n", argv[0] );
+      exit(1);
+   }
+   
+   srandom( 42 );
+   
+   struct swim_ops ops;
+   ops.send = sim_send;
+   ops.changed = sim_changed;
+   ops.metrics = sim_metrics;
+   
+   // everyone starts out knowing everyone, as if from the config file
+   char name[64];
+   for( int i = 0; i < num_hosts; i++ ) {
+      struct swim* s = new swim();
+      sprintf( name, "host%d", i );
+      swim_init( s, i + 1, name, 12345, 1, period, 0, &ops, (void*)(intptr_t)i );
+      hosts.push_back( s );
+      up.push_back( true );
+   }
+   for( int i = 0; i < num_hosts; i++ ) {
+      for( int j = 0; j < num_hosts; j++ ) {
+         if( i == j )
+            continue;
+   
+         sprintf( name, "host%d", j );
+         swim_add( hosts[i], j + 1, name, 12345, 0 );
+      }
+   }
+   
+   for( int i = 0; i < num_hosts; i++ ) {
+      sim_schedule( random() % period, SIM_TICK, i, NULL );
+   }
+   
+   // count traffic over the 10 periods before the kill; give up 200 periods after it
+   uint64_t count_start = (settle - 10) * period;
+   uint64_t kill_at = settle * period;
+   uint64_t end_at = (settle + 200) * period;
+   
+   suspect_at.assign( num_hosts, -1 );
+   dead_at.assign( num_hosts, -1 );
+   
+   while( !events.empty() ) {
+      struct sim_event e = events.top();
+      events.pop();
+   
+      now_ms = e.t;
+      if( now_ms > end_at || (victim >= 0 && sim_all_dead()) ) {
+         if( e.m != NULL )
+            sim_message_free( e.m );
+         break;
+      }
+   
+      counting = (now_ms >= count_start && now_ms < kill_at);
+      if( victim < 0 && now_ms >= kill_at ) {
+         victim = num_hosts / 2;
+         up[victim] = false;
+      }
+   
+      if( !up[e.host] ) {
+         if( e.m != NULL )
+            sim_message_free( e.m );
+         continue;
+      }
+   
+      switch( e.type ) {
+         case SIM_TICK:
+            swim_tick( hosts[e.host], now_ms );
+            sim_schedule( now_ms + period / 2, SIM_PROBE_TIMEOUT, e.host, NULL );
+            sim_schedule( now_ms + period, SIM_TICK, e.host, NULL );
+            break;
+   
+         case SIM_PROBE_TIMEOUT:
+            swim_probe_timeout( hosts[e.host], now_ms );
+            break;
+   
+         case SIM_DELIVER:
+            swim_recv( hosts[e.host], &e.m->h, now_ms );
+            sim_message_free( e.m );
+            break;
+      }
+   }
+   
+   while( !events.empty() ) {
+      if( events.top().m != NULL )
+         sim_message_free( events.top().m );
+      events.pop();
+   }
+   
+   // how long it took
+   int64_t first_suspect = -1;
+   vector<int64_t> deaths;
+   for( int i = 0; i < num_hosts; i++ ) {
+      if( i == victim )
+         continue;
+      if( suspect_at[i] >= 0 && (first_suspect < 0 || suspect_at[i] < first_suspect) )
+         first_suspect = suspect_at[i];
+      if( dead_at[i] >= 0 )
+         deaths.push_back( dead_at[i] );
+   }
+   sort( deaths.begin(), deaths.end() );
+   
+   printf("%d hosts, %.1f%% loss\n", num_hosts, loss * 100 );
+   if( first_suspect >= 0 )
+      printf("first suspicion   %.1fs after the kill\n", (first_suspect - (int64_t)kill_at) / 1000.0 );
+   if( deaths.size() > 0 ) {
+      printf("first death       %.1fs after the kill\n", (deaths[0] - (int64_t)kill_at) / 1000.0 );
+      printf("dead everywhere   median %.1fs, max %.1fs (%zu of %d hosts)\n", (deaths[deaths.size() / 2] - (int64_t)kill_at) / 1000.0, (deaths[deaths.size() - 1] - (int64_t)kill_at) / 1000.0, deaths.size(), num_hosts - 1 );
+   }
+   printf("per host/period   %.2f messages, %.0f bytes (all-to-all: %d messages)\n", messages_sent / 10.0 / num_hosts, bytes_sent / 10.0 / num_hosts, 2 * (num_hosts - 1) );
+   printf("false suspicions  %d, false deaths %d\n", false_suspicions, false_deaths );
+   
+   for( int i = 0; i < num_hosts; i++ ) {
+      swim_free( hosts[i] );
+      delete hosts[i];
+   }
+   return 0;
+}
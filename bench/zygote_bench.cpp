@@ -0,0 +1,188 @@
+// benchmark of job launch latency (wishd/zygote.c): the zygote's pre-forked workers against forking a wrapper from
+// the daemon, the way process_run does when there's no zygote.
+//
+// each launch runs a short command, and is timed from the start of the launch to when the shell's pid is read back
+// over the wrapper pipe (what the STATS endpoint reports as launch latency).  The daemon's heap matters to the fork
+// path, since fork copies its page tables, so -m has this process touch that many MB after the zygote starts,
+// as a daemon with a large job table, cache, and heartbeat state would have.
+//
+// usage: zygote_bench [-f] [-n launches] [-w zygote workers] [-m MB resident] [-c command]
+//    -f   fork a wrapper for each launch instead of using the zygote
+
+#include "zygote.h"
+#include <algorithm>
+
+static int num_launches = 500;
+static int num_workers = 4;
+static int resident_mb = 0;
+static bool use_fork = false;
+static char const* cmd = "true";
+
+// current time, in microseconds
+static uint64_t bench_now_us(void) {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// fork a wrapper that forks and runs the shell, and writes back its pid and wait status (process_run, without a zygote)
+static pid_t bench_fork_launch( struct wish_state* state, struct wish_job_packet* job, int child_stdin, int child_stdout, int child_stderr, int* wrapper_fds ) {
+   pid_t pid1 = fork();
+   if( pid1 != 0 )
+      return pid1;
+   
+   // wrapper process
+   close( wrapper_fds[0] );
+   
+   pid_t shell_pid = fork();
+   if( shell_pid == 0 ) {
+      dup2( child_stdin, STDIN_FILENO );
+      dup2( child_stdout, STDOUT_FILENO );
+      dup2( child_stderr, STDERR_FILENO );
+      close( wrapper_fds[1] );
+   
+      char gpid_txt[21];
+      sprintf(gpid_txt, "%lu", job->gpid );
+      setenv( WISH_GPID_ENV, gpid_txt, 1 );
+   
+      char* shell_argv[] = { state->conf.shell, state->conf.shell_argv[0], job->cmd_text, NULL };
+      execv( shell_argv[0], shell_argv );
+      exit(-1);
+   }
+   
+   write( wrapper_fds[1], &shell_pid, sizeof(shell_pid) );
+   
+   int shell_rc = 0;
+   struct rusage ru;
+   memset( &ru, 0, sizeof(ru) );
+   if( wait4( shell_pid, &shell_rc, 0, &ru ) > 0 ) {
+      write( wrapper_fds[1], &shell_rc, sizeof(shell_rc) );
+      write( wrapper_fds[1], &ru, sizeof(ru) );
+   }
+   exit(0);
+}
+
+int main( int argc, char** argv ) {
+   int c;
+   while( (c = getopt( argc, argv, "fn:w:m:c:" )) != -1 ) {
+      switch( c ) {
+         case 'f':
+            use_fork = true;
+            break;
+         case 'n':
+            num_launches = atoi( optarg );
+            break;
+         case 'w':
+            num_workers = atoi( optarg );
+            break;
+         case 'm':
+            resident_mb = atoi( optarg );
+            break;
+         case 'c':
+            cmd = optarg;
+            break;
+         default:
+            fprintf(stderr, "Usage: %s [-f] [-n launches] [-w zygote workers] [-m MB resident] [-c command]\n", argv[0] );
+            exit(1);
+      }
+   }
+   
+   struct wish_state state;
+   memset( &state, 0, sizeof(state) );
+   
+   char* shell_args[] = { (char*)"-c" };
+   state.conf.shell = (char*)"/bin/sh";
+   state.conf.shell_argc = 1;
+   state.conf.shell_argv = shell_args;
+   state.conf.zygote_workers = (use_fork ? 0 : num_workers);
+   state.daemon_sock = -1;
+   
+   // the daemon starts the zygote while it's still small
+   int rc = zygote_init( &state );
+   if( rc != 0 ) {
+      fprintf(stderr, "zygote_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   // ...and then grows
+   size_t resident_len = (size_t)resident_mb << 20;
+   char* resident = NULL;
+   if( resident_len > 0 ) {
+      resident = (char*)malloc( resident_len );
+      memset( resident, 1, resident_len );
+   }
+   
+   // let the zygote fill its pool
+   sleep( 1 );
+   
+   struct sockaddr_in origin;
+   memset( &origin, 0, sizeof(origin) );
+   origin.sin_family = AF_INET;
+   origin.sin_port = htons( 12345 );
+   origin.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+   
+   struct sockaddr_storage visited;
+   memset( &visited, 0, sizeof(visited) );
+   memcpy( &visited, &origin, sizeof(origin) );
+   
+   struct wish_job_packet job;
+   memset( &job, 0, sizeof(job) );
+   job.cmd_text = (char*)cmd;
+   job.visited = &visited;
+   job.origin_http_portnum = 8080;
+   
+   int devnull = open( "/dev/null", O_RDWR );
+   
+   vector<uint64_t> lat;
+   int failed = 0;
+   
+   for( int i = 0; i < num_launches; i++ ) {
+      job.gpid = i + 1;
+   
+      int wrapper_fds[2];
+      pipe( wrapper_fds );
+   
+      uint64_t start = bench_now_us();
+      pid_t pid1 = -1;
+   
+      if( use_fork ) {
+         pid1 = bench_fork_launch( &state, &job, devnull, devnull, devnull, wrapper_fds );
+      }
+      else {
+         rc = zygote_launch( &state, &job, NULL, NULL, devnull, devnull, devnull, wrapper_fds[1] );
+         if( rc != 0 ) {
+            fprintf(stderr, "zygote_launch rc = %d\n", rc );
+            exit(1);
+         }
+      }
+   
+      // only the wrapper may hold the write end, so we see EOF when it's done
+      close( wrapper_fds[1] );
+   
+      pid_t shell_pid = -1;
+      if( read( wrapper_fds[0], &shell_pid, sizeof(shell_pid) ) == sizeof(shell_pid) )
+         lat.push_back( bench_now_us() - start );
+      else
+         failed++;
+   
+      // wait for the job to finish before starting the next one
+      char buf[4096];
+      while( read( wrapper_fds[0], buf, sizeof(buf) ) > 0 );
+      close( wrapper_fds[0] );
+   
+      if( pid1 > 0 )
+         waitpid( pid1, NULL, 0 );
+   }
+   
+   zygote_shutdown( &state );
+   
+   sort( lat.begin(), lat.end() );
+   size_t n = lat.size();
+   printf("%s, %d MB resident, '%s'\n", (use_fork ? "fork" : "zygote"), resident_mb, cmd );
+   if( n > 0 )
+      printf("launch n=%zu p50=%luus p99=%luus max=%luus, %d failed\n", n, lat[n/2], lat[n*99/100], lat[n-1], failed );
+   
+   close( devnull );
+   free( resident );
+   return 0;
+}
@@ -5,13 +5,24 @@
 
 void usage( char* argv0 ) {
    fprintf(stderr,
-"Usage: %s [-r|-l|-d|-c|-n] [-h HOST[:PORT]] RANK\n\
+"Usage: %s [-r|-l|-d|-c|-n] [-h HOST[:PORT]] [-k COUNT] [-W WEIGHTS] [-F FILTERS] [-L LABELS] RANK\n\
 Options:\n\
    -l             lowest latency\n\
    -r             highest free RAM\n\
    -d             highest free disk\n\
-   -c             highest free CPU\n\
+   -c             lowest CPU utilization\n\
    -h HOST[:PORT] Access the daemon running on HOST[:PORT]\n\
+   -k COUNT       Print the hosts of COUNT ranks, starting at RANK, one per line\n\
+   -W WEIGHTS     Rank by a weighted score, lowest first, e.g. latency=1,load=0.5,ram=0.1\n\
+                  (latency in ms, load as utilization with 1 meaning every core\n\
+                  busy, free ram and disk in GB; more free ram and disk lowers\n\
+                  the score).  Hosts are printed with their scores.  Without it,\n\
+                  -l, -c, -r, or -d weighs that metric alone (latency if none is\n\
+                  given)\n\
+   -F FILTERS     Only consider hosts that pass every filter, e.g. ram>=8G,load<=0.8\n\
+                  (latency<=MS, load<=UTIL, ram>=BYTES, disk>=BYTES; sizes may end\n\
+                  in K, M, G, or T)\n\
+   -L LABELS      Only consider hosts with every one of these labels, e.g. gpu,ssd\n\
    -n             Don't print a host; print the number of nodes.\n\
                   If this option is given, RANK is ignored\n\
    RANK           The rank the desired host must have (0 being the highest/best\n",
@@ -20,6 +31,119 @@ argv0 );
 }
 
 
+// which metric is named, in placement query order (latency, load, ram, disk)?
+// return its index, or -1 if it isn't one
+static int parse_metric( char const* name, size_t len ) {
+   char const* names[] = { "latency", "load", "ram", "disk" };
+   for( int i = 0; i < 4; i++ ) {
+      if( strlen( names[i] ) == len && strncmp( name, names[i], len ) == 0 )
+         return i;
+   }
+   
+   // "cpu" means load, as with -c
+   if( len == 3 && strncmp( name, "cpu", 3 ) == 0 )
+      return 1;
+   
+   return -1;
+}
+
+
+// parse a number of bytes, with an optional K, M, G, or T suffix.
+// return 0 on success, or -EINVAL
+static int parse_size( char const* str, double* ret ) {
+   char* tmp;
+   double val = strtod( str, &tmp );
+   if( tmp == str )
+      return -EINVAL;
+   
+   switch( *tmp ) {
+      case 'T': case 't':
+         val *= 1024;
+         // fall through
+      case 'G': case 'g':
+         val *= 1024;
+         // fall through
+      case 'M': case 'm':
+         val *= 1024;
+         // fall through
+      case 'K': case 'k':
+         val *= 1024;
+         tmp++;
+         break;
+   }
+   
+   if( *tmp != 0 )
+      return -EINVAL;
+   
+   *ret = val;
+   return 0;
+}
+
+
+// parse weights (e.g. latency=1,load=0.5) into a query.
+// return 0 on success, or -EINVAL
+static int parse_weights( char* str, struct wish_nget_packet* npkt ) {
+   for( char* tok = strtok( str, "," ); tok != NULL; tok = strtok( NULL, "," ) ) {
+      char* eq = strchr( tok, '=' );
+      if( eq == NULL )
+         return -EINVAL;
+      
+      int metric = parse_metric( tok, eq - tok );
+      if( metric < 0 )
+         return -EINVAL;
+      
+      char* tmp;
+      double weight = strtod( eq + 1, &tmp );
+      if( tmp == eq + 1 || *tmp != 0 )
+         return -EINVAL;
+      
+      npkt->weights[metric] = (int32_t)(weight * 1000);
+   }
+   return 0;
+}
+
+
+// parse filters (e.g. ram>=8G,load<=0.8) into a query.
+// return 0 on success, or -EINVAL
+static int parse_filters( char* str, struct wish_nget_packet* npkt ) {
+   for( char* tok = strtok( str, "," ); tok != NULL; tok = strtok( NULL, "," ) ) {
+      char* op = strpbrk( tok, "<>" );
+      if( op == NULL || op[1] != '=' )
+         return -EINVAL;
+      
+      int metric = parse_metric( tok, op - tok );
+      if( metric < 0 )
+         return -EINVAL;
+      
+      // latency and load have upper bounds; free ram and disk, lower ones
+      bool at_most = (metric == 0 || metric == 1);
+      if( at_most != (op[0] == '<') )
+         return -EINVAL;
+      
+      double val = 0;
+      if( at_most ) {
+         char* tmp;
+         val = strtod( op + 2, &tmp );
+         if( tmp == op + 2 || *tmp != 0 || val <= 0 )
+            return -EINVAL;
+      }
+      else if( parse_size( op + 2, &val ) != 0 ) {
+         return -EINVAL;
+      }
+      
+      if( metric == 0 )
+         npkt->max_latency = (uint64_t)(val * 1000);
+      else if( metric == 1 )
+         npkt->max_load = (uint64_t)(val * 1000);
+      else if( metric == 2 )
+         npkt->min_ram = (uint64_t)val;
+      else
+         npkt->min_disk = (uint64_t)val;
+   }
+   return 0;
+}
+
+
 int main( int argc, char** argv ) {
    int c;
    int opt = 0;
@@ -28,8 +152,12 @@ int main( int argc, char** argv ) {
    char* hostname = NULL;
    int portnum = -1;
    uint32_t props = 0;
+   uint32_t count = 1;
+   char* weights = NULL;
+   char* filters = NULL;
+   char* labels = NULL;
    
-   while((c = getopt(argc, argv, "h:lrdcn")) != -1) {
+   while((c = getopt(argc, argv, "h:lrdcnk:W:F:L:")) != -1) {
       switch( c ) {
          case 'h': {
             // is there a hostname given?
@@ -46,6 +174,25 @@ int main( int argc, char** argv ) {
             }
             break;
          }
+         case 'k': {
+            char* tmp;
+            count = (uint32_t)strtoul( optarg, &tmp, 10 );
+            if( tmp == optarg || count == 0 )
+               usage( argv[0] );
+            break;
+         }
+         case 'W':
+            weights = optarg;
+            break;
+            
+         case 'F':
+            filters = optarg;
+            break;
+            
+         case 'L':
+            labels = optarg;
+            break;
+            
          case 'n': {
             if( !props )
                get_count = true;
@@ -155,7 +302,38 @@ int main( int argc, char** argv ) {
    struct wish_packet pkt;
    struct wish_nget_packet npkt;
    
-   wish_init_nget_packet( NULL, &npkt, rank, props );
+   wish_init_nget_packet( NULL, &npkt, rank, props, count );
+   
+   if( weights || filters || labels ) {
+      if( get_count ) {
+         fprintf(stderr, "Option -n is exclusive with -W, -F, and -L\n");
+         usage(argv[0]);
+      }
+      
+      // without weights, weigh the metric asked for
+      if( weights == NULL ) {
+         if( props == HEARTBEAT_PROP_NONE )
+            props = HEARTBEAT_PROP_LATENCY;
+         
+         npkt.weights[ props - HEARTBEAT_PROP_LATENCY ] = 1000;
+      }
+      else if( parse_weights( weights, &npkt ) != 0 ) {
+         fprintf(stderr, "Could not parse weights\n");
+         usage(argv[0]);
+      }
+      
+      if( filters && parse_filters( filters, &npkt ) != 0 ) {
+         fprintf(stderr, "Could not parse filters\n");
+         usage(argv[0]);
+      }
+      
+      if( labels ) {
+         strncpy( npkt.labels, labels, HEARTBEAT_LABELS_MAX );
+         npkt.labels[HEARTBEAT_LABELS_MAX] = 0;
+      }
+      
+      npkt.props = HEARTBEAT_PROP_QUERY;
+   }
    wish_pack_nget_packet( NULL, &pkt, &npkt );
    
    rc = wish_write_packet( NULL, &con, &pkt );
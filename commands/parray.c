@@ -0,0 +1,259 @@
+#include "parray.h"
+
+void usage( char* argv0 ) {
+   fprintf(stderr,
+"Usage: %s [-d] [-s] [-t TIMEOUT] [-h HOST[:PORT]] [-g ARRAY_ID] [-n COUNT] [-r latency|cpu|ram|disk] [-i STDIN] [-o STDOUT] [-e STDERR] [-f FILE] [-c COMMAND] [HOST...]\n\
+Run COUNT instances of a job, on the given hosts in turn (or on the hosts the daemon ranks best by -r).\n\
+In the command, stdin, stdout, and stderr, " JOB_ARRAY_INDEX_PATTERN " becomes the instance's index and " JOB_ARRAY_HOST_PATTERN " its host.\n\
+Prints the array's id (which pjoin can wait on), then each instance's gpid.\n",
+   argv0);
+   
+   exit(1);
+}
+
+int get_umask() {
+   int ret = umask(0);
+   umask(ret);
+   return ret;
+}
+
+
+int main( int argc, char** argv ) {
+   // parse options
+   int c;
+   int portnum = -1;
+   time_t timeout = -1;
+   uint32_t flags = 0;
+   uint32_t count = 0;
+   uint32_t select = HEARTBEAT_PROP_NONE;
+   char* file_path = NULL;
+   char* stdin_path = NULL;
+   char* stdout_path = NULL;
+   char* stderr_path = NULL;
+   char* cmd_str = NULL;
+   char* hostname = NULL;
+   uint64_t array_id = 0;
+   
+   while((c = getopt(argc, argv, "h:dst:f:g:n:r:c:i:o:e:")) != -1) {
+      switch( c ) {
+         case 'h': {
+            // is there a hostname given?
+            hostname = strdup( optarg );
+            char* tmp = strchr(hostname, ':');
+            if( tmp != NULL ) {
+               *tmp = 0;
+               char* tmp2;
+               portnum = strtol(tmp + 1, &tmp2, 10 );
+               if( tmp2 == tmp + 1 ) {
+                  free( hostname );
+                  usage( argv[0] );
+               }
+            }
+            break;
+         }
+         case 'd': {
+            flags |= JOB_DETACHED;
+            break;
+         }
+         case 's': {
+            flags |= JOB_STREAM_STDIN;
+            break;
+         }
+         case 'f' : {
+            if( cmd_str )
+               usage( argv[0] );
+            
+            file_path = realpath( optarg, NULL );
+            flags |= JOB_USE_FILE;
+            break;
+         }
+         case 't': {
+            int cnt = sscanf( optarg, "%ld", &timeout );
+            if( cnt != 1 )
+               usage(argv[0]);
+            break;
+         }
+         case 'g': {
+            int cnt = sscanf( optarg, "%lu", &array_id );
+            if( cnt != 1 )
+               usage(argv[0]);
+            
+            break;
+         }
+         case 'n': {
+            int cnt = sscanf( optarg, "%u", &count );
+            if( cnt != 1 || count == 0 || count > JOB_ARRAY_MAX_INSTANCES )
+               usage(argv[0]);
+            
+            break;
+         }
+         case 'r': {
+            if( strcmp( optarg, "latency" ) == 0 )
+               select = HEARTBEAT_PROP_LATENCY;
+            else if( strcmp( optarg, "cpu" ) == 0 )
+               select = HEARTBEAT_PROP_CPU;
+            else if( strcmp( optarg, "ram" ) == 0 )
+               select = HEARTBEAT_PROP_RAM;
+            else if( strcmp( optarg, "disk" ) == 0 )
+               select = HEARTBEAT_PROP_DISK;
+            else
+               usage(argv[0]);
+            
+            break;
+         }
+         case 'c': {
+            if( file_path )
+               usage( argv[0] );
+            
+            cmd_str = optarg;
+            break;
+         }
+         case 'i': {
+            stdin_path = optarg;
+            break;
+         }
+         case 'o': {
+            stdout_path = optarg;
+            break;
+         }
+         case 'e': {
+            stderr_path = optarg;
+            break;
+         }
+         default: {
+            usage( argv[0] );
+         }
+      }
+   }
+   
+   // the rest are the hosts to run on
+   char** hosts = &argv[optind];
+   uint32_t num_hosts = argc - optind;
+   
+   // one instance per host, unless told otherwise
+   if( count == 0 )
+      count = num_hosts;
+   
+   if( count == 0 ) {
+      usage( argv[0] );
+   }
+   
+   // no hostname given?  then check the environment variables
+   if( hostname == NULL ) {
+      hostname = getenv( WISH_ORIGIN_ENV );
+      if( hostname == NULL ) {
+         hostname = (char*)"localhost";
+      }
+      else {
+         char* portnum_str = getenv( WISH_PORTNUM_ENV );
+         if( portnum_str ) {
+            char* tmp;
+            long port_candidate = strtol(portnum_str, &tmp, 10 );
+            if( tmp != portnum_str ) {
+               portnum = port_candidate;
+            }
+         }
+      }
+   }
+   
+   if( cmd_str == NULL && file_path == NULL ) {
+      usage( argv[0] );
+   }
+   
+   // read the config file
+   struct wish_conf conf;
+   int rc = wish_read_conf( WISH_DEFAULT_CONFIG, &conf );
+   if( rc != 0 ) {
+      fprintf(stderr, "Config file %s could not be read\n", WISH_DEFAULT_CONFIG );
+      exit(1);
+   }
+   
+   // set portnum
+   if( conf.portnum > 0 && portnum < 0 )
+      portnum = conf.portnum;
+   
+   if( file_path ) {
+      cmd_str = file_path;
+   }
+   
+   // connect to daemon
+   struct wish_connection con;
+   rc = wish_connect( NULL, &con, hostname, portnum );
+   if( rc != 0 ) {
+      // could not connect
+      fprintf(stderr, "Could not connect to daemon on %s:%d, rc = %d\n", hostname, portnum, rc);
+      exit(1);
+   }
+   
+   // the daemon replies once every instance has been dispatched
+   struct timeval tv;
+   tv.tv_sec = 0;
+   tv.tv_usec = 0;
+   
+   rc = setsockopt( con.soc, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+   if( rc != 0 ) {
+      fprintf(stderr, "setsockopt errno = %d\n", -errno );
+      exit(1);
+   }
+   
+   struct wish_packet pkt;
+   struct wish_job_array_packet arr;
+   
+   wish_init_job_array_packet( NULL, &arr, array_id, count, hosts, num_hosts, select, cmd_str, stdin_path, stdout_path, stderr_path, getuid(), getgid(), get_umask(), flags, timeout );
+   wish_pack_job_array_packet( NULL, &pkt, &arr );
+   wish_free_job_array_packet( &arr );
+   
+   // send the array request
+   rc = wish_write_packet( NULL, &con, &pkt );
+   if( rc != 0 ) {
+      // could not write
+      fprintf(stderr, "Could not send to daemon on %s:%d, rc = %d\n", hostname, portnum, rc);
+      exit(1);
+   }
+   
+   // wait for the instances' gpids
+   wish_free_packet( &pkt );
+   rc = wish_read_packet( NULL, &con, &pkt );
+   if( rc != 0 ) {
+      // could not read
+      fprintf(stderr, "Could not read reply from daemon on %s:%d, rc = %d\n", hostname, portnum, rc);
+      exit(1);
+   }
+   
+   if( pkt.hdr.type == PACKET_TYPE_PROCESS ) {
+      struct wish_process_packet resp;
+      wish_unpack_process_packet( NULL, &pkt, &resp );
+      fprintf(stderr, "Could not spawn job array: rc = %d\n", resp.data );
+      exit(1);
+   }
+   
+   if( pkt.hdr.type != PACKET_TYPE_JOB_ARRAY ) {
+      // invalid packet
+      fprintf(stderr, "Corrupt response from daemon on %s:%d\n", hostname, portnum);
+      exit(1);
+   }
+   
+   rc = wish_unpack_job_array_packet( NULL, &pkt, &arr );
+   if( rc != 0 ) {
+      fprintf(stderr, "Corrupt response from daemon on %s:%d\n", hostname, portnum);
+      exit(1);
+   }
+   
+   printf("%lu\n", arr.array_id );
+   
+   rc = 0;
+   for( uint32_t i = 0; i < arr.num_gpids; i++ ) {
+      printf("%lu\n", arr.gpids[i] );
+      if( arr.gpids[i] == 0 ) {
+         // couldn't be started
+         rc = 1;
+      }
+   }
+   
+   wish_disconnect( NULL, &con );
+   
+   wish_free_job_array_packet( &arr );
+   wish_free_packet( &pkt );
+   
+   return rc;
+}
@@ -0,0 +1,11 @@
+#ifndef _PARRAY_H_
+#define _PARRAY_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "libwish.h"
+
+#endif
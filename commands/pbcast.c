@@ -0,0 +1,229 @@
+#include "pbcast.h"
+
+void usage( char* argv0 ) {
+   fprintf(stderr,
+"Usage: %s [-s] [-t TIMEOUT] [-h HOST[:PORT]] [-k FANOUT] [-i STDIN] [-f FILE] [-c COMMAND] HOST [HOST...]\n\
+Run a job on every HOST, launched through a tree of daemons with up to FANOUT children each (default %d).\n\
+Waits for it to end everywhere, and prints \"HOST EXITCODE\" for each host.  The job's output is not collected.\n",
+   argv0, BCAST_DEFAULT_FANOUT);
+   
+   exit(1);
+}
+
+int get_umask() {
+   int ret = umask(0);
+   umask(ret);
+   return ret;
+}
+
+
+int main( int argc, char** argv ) {
+   // parse options
+   int c;
+   int portnum = -1;
+   time_t timeout = -1;
+   uint32_t flags = JOB_BROADCAST;
+   uint32_t fanout = BCAST_DEFAULT_FANOUT;
+   char* file_path = NULL;
+   char* stdin_path = NULL;
+   char* cmd_str = NULL;
+   char* hostname = NULL;
+   
+   while((c = getopt(argc, argv, "h:st:k:f:c:i:")) != -1) {
+      switch( c ) {
+         case 'h': {
+            // is there a hostname given?
+            hostname = strdup( optarg );
+            char* tmp = strchr(hostname, ':');
+            if( tmp != NULL ) {
+               *tmp = 0;
+               char* tmp2;
+               portnum = strtol(tmp + 1, &tmp2, 10 );
+               if( tmp2 == tmp + 1 ) {
+                  free( hostname );
+                  usage( argv[0] );
+               }
+            }
+            break;
+         }
+         case 's': {
+            flags |= JOB_STREAM_STDIN;
+            break;
+         }
+         case 'f' : {
+            if( cmd_str )
+               usage( argv[0] );
+            
+            file_path = realpath( optarg, NULL );
+            flags |= JOB_USE_FILE;
+            break;
+         }
+         case 't': {
+            int cnt = sscanf( optarg, "%ld", &timeout );
+            if( cnt != 1 )
+               usage(argv[0]);
+            break;
+         }
+         case 'k': {
+            int cnt = sscanf( optarg, "%u", &fanout );
+            if( cnt != 1 || fanout == 0 || fanout > BCAST_MAX_FANOUT )
+               usage(argv[0]);
+            break;
+         }
+         case 'c': {
+            if( file_path )
+               usage( argv[0] );
+            
+            cmd_str = optarg;
+            break;
+         }
+         case 'i': {
+            stdin_path = optarg;
+            break;
+         }
+         default: {
+            usage( argv[0] );
+         }
+      }
+   }
+   
+   // the rest are the hosts to run on
+   char** hosts = &argv[optind];
+   uint32_t num_hosts = argc - optind;
+   
+   if( num_hosts == 0 || num_hosts > BCAST_MAX_TARGETS ) {
+      usage( argv[0] );
+   }
+   
+   // no hostname given?  then check the environment variables
+   if( hostname == NULL ) {
+      hostname = getenv( WISH_ORIGIN_ENV );
+      if( hostname == NULL ) {
+         hostname = (char*)"localhost";
+      }
+      else {
+         char* portnum_str = getenv( WISH_PORTNUM_ENV );
+         if( portnum_str ) {
+            char* tmp;
+            long port_candidate = strtol(portnum_str, &tmp, 10 );
+            if( tmp != portnum_str ) {
+               portnum = port_candidate;
+            }
+         }
+      }
+   }
+   
+   if( cmd_str == NULL && file_path == NULL ) {
+      usage( argv[0] );
+   }
+   
+   // read the config file
+   struct wish_conf conf;
+   int rc = wish_read_conf( WISH_DEFAULT_CONFIG, &conf );
+   if( rc != 0 ) {
+      fprintf(stderr, "Config file %s could not be read\n", WISH_DEFAULT_CONFIG );
+      exit(1);
+   }
+   
+   // set portnum
+   if( conf.portnum > 0 && portnum < 0 )
+      portnum = conf.portnum;
+   
+   if( file_path ) {
+      cmd_str = file_path;
+   }
+   
+   // connect to daemon
+   struct wish_connection con;
+   rc = wish_connect( NULL, &con, hostname, portnum );
+   if( rc != 0 ) {
+      // could not connect
+      fprintf(stderr, "Could not connect to daemon on %s:%d, rc = %d\n", hostname, portnum, rc);
+      exit(1);
+   }
+   
+   // the daemon replies once the job has ended everywhere
+   struct timeval tv;
+   tv.tv_sec = 0;
+   tv.tv_usec = 0;
+   
+   rc = setsockopt( con.soc, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+   if( rc != 0 ) {
+      fprintf(stderr, "setsockopt errno = %d\n", -errno );
+      exit(1);
+   }
+   
+   // send the job, then the hosts to run it on
+   struct wish_packet pkt;
+   struct wish_job_packet jpkt;
+   struct wish_bcast_packet bcast;
+   
+   wish_init_job_packet_client( NULL, &jpkt, 0, 0, 1, cmd_str, stdin_path, NULL, NULL, getuid(), getgid(), get_umask(), flags, timeout );
+   wish_pack_job_packet( NULL, &pkt, &jpkt );
+   
+   rc = wish_write_packet( NULL, &con, &pkt );
+   wish_free_packet( &pkt );
+   
+   if( rc == 0 ) {
+      wish_init_bcast_packet( NULL, &bcast, fanout, hosts, num_hosts );
+      wish_pack_bcast_packet( NULL, &pkt, &bcast );
+      wish_free_bcast_packet( &bcast );
+      
+      rc = wish_write_packet( NULL, &con, &pkt );
+      wish_free_packet( &pkt );
+   }
+   
+   if( rc != 0 ) {
+      // could not write
+      fprintf(stderr, "Could not send to daemon on %s:%d, rc = %d\n", hostname, portnum, rc);
+      exit(1);
+   }
+   
+   // wait for the statuses
+   rc = wish_read_packet( NULL, &con, &pkt );
+   if( rc != 0 ) {
+      // could not read
+      fprintf(stderr, "Could not read reply from daemon on %s:%d, rc = %d\n", hostname, portnum, rc);
+      exit(1);
+   }
+   
+   if( pkt.hdr.type == PACKET_TYPE_PROCESS ) {
+      struct wish_process_packet resp;
+      wish_unpack_process_packet( NULL, &pkt, &resp );
+      fprintf(stderr, "Could not broadcast job: rc = %d\n", resp.data );
+      exit(1);
+   }
+   
+   if( pkt.hdr.type != PACKET_TYPE_BCAST || wish_unpack_bcast_packet( NULL, &pkt, &bcast ) != 0 ) {
+      // invalid packet
+      fprintf(stderr, "Corrupt response from daemon on %s:%d\n", hostname, portnum);
+      exit(1);
+   }
+   
+   rc = 0;
+   for( uint32_t i = 0; i < bcast.num_results; i++ ) {
+      struct wish_bcast_result* res = &bcast.results[i];
+      
+      if( res->type == PROCESS_TYPE_EXIT ) {
+         printf("%s %d\n", res->hostname, res->data );
+         if( res->data != 0 )
+            rc = 1;
+      }
+      else if( res->type == PROCESS_TYPE_TIMEOUT ) {
+         fprintf(stderr, "%s: timed out\n", res->hostname );
+         rc = 1;
+      }
+      else {
+         fprintf(stderr, "%s: could not run, rc = %d\n", res->hostname, res->data );
+         rc = 1;
+      }
+   }
+   
+   wish_disconnect( NULL, &con );
+   
+   wish_free_bcast_packet( &bcast );
+   wish_free_job_packet( &jpkt );
+   wish_free_packet( &pkt );
+   
+   return rc;
+}
@@ -0,0 +1,387 @@
+#include "pdag.h"
+
+void usage( char* argv0 ) {
+   fprintf(stderr,
+"Usage: %s [-n] [-u] [-t TIMEOUT] [-h HOST[:PORT]] FILE\n\
+Run a DAG of jobs on the origin.  Each line of FILE is a node:\n\
+   NAME HOST AFTER COMMAND...\n\
+HOST is where the node runs (" DAG_ANY_HOST " for the least loaded host).  AFTER is - for none, or a comma-separated\n\
+list of the nodes it runs after: NAME to run only if NAME exited with status 0, ?NAME to run however NAME ended.\n\
+Lines starting with # are ignored.\n\
+Prints the DAG's id, then waits for every node and prints \"NAME EXITCODE\" for each (or \"NAME skipped\").\n\
+Options:\n\
+   -n                      Don't wait for the DAG to finish; pjoin can wait on its id later\n\
+   -u                      Also print the resources each node used\n\
+   -t TIMEOUT              Let each node run for at most TIMEOUT seconds\n\
+   -h HOST[:PORT]          Send the DAG to the daemon at HOST[:PORT]\n",
+   argv0);
+   
+   exit(1);
+}
+
+int get_umask() {
+   int ret = umask(0);
+   umask(ret);
+   return ret;
+}
+
+// find a node by name
+int find_node( struct wish_dag_packet* dag, char const* name ) {
+   for( uint32_t i = 0; i < dag->num_nodes; i++ ) {
+      if( strcmp( dag->nodes[i].name, name ) == 0 )
+         return i;
+   }
+   return -1;
+}
+
+// read a DAG file.  Return 0 on success, or the (1-based) line number that couldn't be parsed.
+int read_dag( FILE* f, struct wish_dag_packet* dag, time_t timeout ) {
+   char line[4096];
+   int lineno = 0;
+   
+   // each node's AFTER field, resolved once every node is known
+   vector<string> afters;
+   vector<int> linenos;
+   
+   while( fgets( line, sizeof(line), f ) != NULL ) {
+      lineno++;
+      
+      char* nl = strchr( line, '\n' );
+      if( nl )
+         *nl = 0;
+      
+      char* save = NULL;
+      char* name = strtok_r( line, " \t", &save );
+      if( name == NULL || name[0] == '#' )
+         continue;
+      
+      char* host = strtok_r( NULL, " \t", &save );
+      char* after = strtok_r( NULL, " \t", &save );
+      if( host == NULL || after == NULL || save == NULL )
+         return lineno;
+      
+      // the rest of the line is the command
+      char* cmd = save + strspn( save, " \t" );
+      if( strlen(cmd) == 0 )
+         return lineno;
+      
+      if( find_node( dag, name ) >= 0 || dag->num_nodes >= DAG_MAX_NODES )
+         return lineno;
+      
+      wish_add_dag_node( dag, name, host, cmd, timeout );
+      afters.push_back( string(after) );
+      linenos.push_back( lineno );
+   }
+   
+   for( uint32_t i = 0; i < dag->num_nodes; i++ ) {
+      if( afters[i] == "-" )
+         continue;
+      
+      char* deps = strdup( afters[i].c_str() );
+      char* save = NULL;
+      
+      for( char* dep = strtok_r( deps, ",", &save ); dep != NULL; dep = strtok_r( NULL, ",", &save ) ) {
+         uint32_t kind = DAG_AFTER_OK;
+         if( dep[0] == '?' ) {
+            kind = DAG_AFTER_ANY;
+            dep++;
+         }
+         
+         int d = find_node( dag, dep );
+         if( d < 0 ) {
+            fprintf(stderr, "No such node '%s'\n", dep );
+            free( deps );
+            return linenos[i];
+         }
+         
+         wish_add_dag_dep( dag, i, d, kind );
+      }
+      
+      free( deps );
+   }
+   
+   return 0;
+}
+
+// read the resource usage that follows an exit or timeout, and print it with each line starting with prefix
+void print_usage( struct wish_connection* con, char* hostname, int portnum, char const* prefix ) {
+   struct wish_packet usage_pkt;
+   int rc = wish_read_packet( NULL, con, &usage_pkt );
+   if( rc != 0 || usage_pkt.hdr.type != PACKET_TYPE_USAGE ) {
+      fprintf(stderr, "Could not read resource usage on %s:%d\n", hostname, portnum);
+      exit(1);
+   }
+   
+   struct wish_usage_packet usage;
+   wish_unpack_usage_packet( NULL, &usage_pkt, &usage );
+   wish_free_packet( &usage_pkt );
+   
+   char const* source = "none";
+   if( usage.source == USAGE_SOURCE_RUSAGE )
+      source = "rusage";
+   else if( usage.source == USAGE_SOURCE_CGROUP )
+      source = "cgroup";
+   
+   printf("%ssource %s\n%sutime_usec %lu\n%sstime_usec %lu\n%smax_rss_kb %lu\n%sread_bytes %lu\n%swrite_bytes %lu\n%swall_usec %lu\n%squeue_usec %lu\n%slaunch_usec %lu\n",
+          prefix, source, prefix, usage.utime, prefix, usage.stime, prefix, usage.maxrss, prefix, usage.read_bytes, prefix, usage.write_bytes,
+          prefix, usage.wall_time, prefix, usage.queue_delay, prefix, usage.launch_delay );
+}
+
+// wait for every node of the DAG, and print how each one ended.
+// return 0 if every node exited with status 0; 1 otherwise
+int join_dag( struct wish_dag_packet* dag, char* hostname, int portnum, int want_usage ) {
+   struct wish_connection con;
+   int rc = wish_connect( NULL, &con, hostname, portnum );
+   if( rc != 0 ) {
+      fprintf(stderr, "Could not connect to daemon on %s:%d, rc = %d\n", hostname, portnum, rc);
+      exit(1);
+   }
+   
+   // force infinite timeout
+   struct timeval tv;
+   tv.tv_sec = 0;
+   tv.tv_usec = 0;
+   
+   rc = setsockopt( con.soc, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+   if( rc != 0 ) {
+      fprintf(stderr, "setsockopt errno = %d\n", -errno );
+      exit(1);
+   }
+   
+   struct wish_packet pkt;
+   struct wish_process_packet wpp;
+   
+   wish_init_process_packet( NULL, &wpp, PROCESS_TYPE_PJOIN, dag->dag_id, (want_usage ? PROCESS_JOIN_USAGE : 0), 1 );
+   wish_pack_process_packet( NULL, &pkt, &wpp );
+   
+   rc = wish_write_packet( NULL, &con, &pkt );
+   wish_free_packet( &pkt );
+   if( rc != 0 ) {
+      fprintf(stderr, "Could not send to daemon on %s:%d\n", hostname, portnum);
+      exit(1);
+   }
+   
+   rc = wish_read_packet( NULL, &con, &pkt );
+   if( rc != 0 ) {
+      fprintf(stderr, "Could not read status of DAG %lu on %s:%d\n", dag->dag_id, hostname, portnum);
+      exit(1);
+   }
+   
+   wish_unpack_process_packet( NULL, &pkt, &wpp );
+   wish_free_packet( &pkt );
+   
+   if( wpp.type != PROCESS_TYPE_ARRAY || wpp.data != dag->num_nodes ) {
+      fprintf(stderr, "Could not join with DAG %lu: rc = %d\n", dag->dag_id, wpp.data );
+      exit(1);
+   }
+   
+   int ret = 0;
+   for( uint32_t i = 0; i < dag->num_nodes; i++ ) {
+      rc = wish_read_packet( NULL, &con, &pkt );
+      if( rc != 0 ) {
+         fprintf(stderr, "Could not read status of DAG %lu on %s:%d\n", dag->dag_id, hostname, portnum);
+         exit(1);
+      }
+      
+      wish_unpack_process_packet( NULL, &pkt, &wpp );
+      wish_free_packet( &pkt );
+      
+      char* name = dag->nodes[i].name;
+      
+      if( wpp.type == PROCESS_TYPE_EXIT ) {
+         printf("%s %u\n", name, wpp.data);
+         if( wpp.data != 0 )
+            ret = 1;
+      }
+      else if( wpp.type == PROCESS_TYPE_TIMEOUT ) {
+         fprintf(stderr, "Node %s timed out\n", name );
+         ret = 1;
+      }
+      else if( (int)wpp.data == -ECANCELED ) {
+         printf("%s skipped\n", name);
+         ret = 1;
+      }
+      else {
+         fprintf(stderr, "Could not run node %s: rc = %d\n", name, wpp.data );
+         ret = 1;
+      }
+      
+      if( want_usage && (wpp.type == PROCESS_TYPE_EXIT || wpp.type == PROCESS_TYPE_TIMEOUT) ) {
+         string prefix = string(name) + " ";
+         print_usage( &con, hostname, portnum, prefix.c_str() );
+      }
+   }
+   
+   wish_disconnect( NULL, &con );
+   return ret;
+}
+
+
+int main( int argc, char** argv ) {
+   // parse options
+   int c;
+   int portnum = -1;
+   int block = 1;
+   int want_usage = 0;
+   time_t timeout = -1;
+   char* hostname = NULL;
+   
+   while((c = getopt(argc, argv, "nuh:t:")) != -1) {
+      switch( c ) {
+         case 'n': {
+            block = 0;
+            break;
+         }
+         case 'u': {
+            want_usage = 1;
+            break;
+         }
+         case 't': {
+            int cnt = sscanf( optarg, "%ld", &timeout );
+            if( cnt != 1 )
+               usage(argv[0]);
+            break;
+         }
+         case 'h': {
+            // is there a hostname given?
+            hostname = strdup( optarg );
+            char* tmp = strchr(hostname, ':');
+            if( tmp != NULL ) {
+               *tmp = 0;
+               char* tmp2;
+               portnum = strtol(tmp + 1, &tmp2, 10 );
+               if( tmp2 == tmp + 1 ) {
+                  free( hostname );
+                  usage( argv[0] );
+               }
+            }
+            break;
+         }
+         default: {
+            usage( argv[0] );
+         }
+      }
+   }
+   
+   if( optind != argc - 1 )
+      usage( argv[0] );
+   
+   // no hostname given?  then check the environment variables
+   if( hostname == NULL ) {
+      hostname = getenv( WISH_ORIGIN_ENV );
+      if( hostname == NULL ) {
+         hostname = (char*)"localhost";
+      }
+      else {
+         char* portnum_str = getenv( WISH_PORTNUM_ENV );
+         if( portnum_str ) {
+            char* tmp;
+            long port_candidate = strtol(portnum_str, &tmp, 10 );
+            if( tmp != portnum_str ) {
+               portnum = port_candidate;
+            }
+         }
+      }
+   }
+   
+   // read the DAG
+   FILE* f = fopen( argv[optind], "r" );
+   if( f == NULL ) {
+      fprintf(stderr, "Could not open %s, errno = %d\n", argv[optind], -errno );
+      exit(1);
+   }
+   
+   struct wish_dag_packet dag;
+   wish_init_dag_packet( NULL, &dag, 0, getuid(), getgid(), get_umask() );
+   
+   int line = read_dag( f, &dag, timeout );
+   fclose( f );
+   
+   if( line != 0 ) {
+      fprintf(stderr, "Could not parse %s, line %d\n", argv[optind], line );
+      exit(1);
+   }
+   
+   int rc = wish_check_dag_packet( &dag );
+   if( rc == -ELOOP ) {
+      fprintf(stderr, "The nodes in %s depend on each other in a cycle\n", argv[optind] );
+      exit(1);
+   }
+   else if( rc != 0 ) {
+      fprintf(stderr, "Invalid DAG in %s, rc = %d\n", argv[optind], rc );
+      exit(1);
+   }
+   
+   // read the config file
+   struct wish_conf conf;
+   rc = wish_read_conf( WISH_DEFAULT_CONFIG, &conf );
+   if( rc != 0 ) {
+      fprintf(stderr, "Config file %s could not be read\n", WISH_DEFAULT_CONFIG );
+      exit(1);
+   }
+   
+   // set portnum
+   if( conf.portnum > 0 && portnum < 0 )
+      portnum = conf.portnum;
+   
+   // connect to daemon
+   struct wish_connection con;
+   rc = wish_connect( NULL, &con, hostname, portnum );
+   if( rc != 0 ) {
+      // could not connect
+      fprintf(stderr, "Could not connect to daemon on %s:%d, rc = %d\n", hostname, portnum, rc);
+      exit(1);
+   }
+   
+   struct wish_packet pkt;
+   wish_pack_dag_packet( NULL, &pkt, &dag );
+   
+   // send the DAG
+   rc = wish_write_packet( NULL, &con, &pkt );
+   wish_free_packet( &pkt );
+   if( rc != 0 ) {
+      // could not write
+      fprintf(stderr, "Could not send to daemon on %s:%d, rc = %d\n", hostname, portnum, rc);
+      exit(1);
+   }
+   
+   // wait for the DAG's id
+   rc = wish_read_packet( NULL, &con, &pkt );
+   if( rc != 0 ) {
+      // could not read
+      fprintf(stderr, "Could not read reply from daemon on %s:%d, rc = %d\n", hostname, portnum, rc);
+      exit(1);
+   }
+   
+   wish_disconnect( NULL, &con );
+   
+   if( pkt.hdr.type == PACKET_TYPE_PROCESS ) {
+      struct wish_process_packet resp;
+      wish_unpack_process_packet( NULL, &pkt, &resp );
+      fprintf(stderr, "Could not start DAG: rc = %d\n", resp.data );
+      exit(1);
+   }
+   
+   if( pkt.hdr.type != PACKET_TYPE_DAG ) {
+      // invalid packet
+      fprintf(stderr, "Corrupt response from daemon on %s:%d\n", hostname, portnum);
+      exit(1);
+   }
+   
+   struct wish_dag_packet reply;
+   wish_unpack_dag_packet( NULL, &pkt, &reply );
+   wish_free_packet( &pkt );
+   
+   dag.dag_id = reply.dag_id;
+   wish_free_dag_packet( &reply );
+   
+   printf("%lu\n", dag.dag_id );
+   fflush( stdout );
+   
+   rc = 0;
+   if( block )
+      rc = join_dag( &dag, hostname, portnum, want_usage );
+   
+   wish_free_dag_packet( &dag );
+   return rc;
+}
@@ -0,0 +1,12 @@
+#ifndef _PDAG_H_
+#define _PDAG_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <string>
+
+#include "libwish.h"
+
+#endif
@@ -2,30 +2,109 @@
 
 void usage( char* argv0 ) {
    fprintf(stderr,
-"Usage: %s [-n] [-h HOST[:PORT]] GPID\n",
+"Usage: %s [-n] [-u] [-h HOST[:PORT]] GPID\n\
+Wait for a process (or every process in a job array) to finish, and print its exit code\n\
+(or \"GPID EXITCODE\" for each process in a job array).\n\
+Options:\n\
+   -n                      Don't wait for the process to finish\n\
+   -u                      Also print the resources the process used\n\
+   -h HOST[:PORT]          Ask the daemon at HOST[:PORT]\n",
    argv0);
    
    exit(1);
 }
 
+// read the resource usage that follows an exit or timeout, and print it (each line starting with prefix, if given)
+void print_usage( struct wish_connection* con, char* hostname, int portnum, char const* prefix ) {
+   struct wish_packet usage_pkt;
+   int rc = wish_read_packet( NULL, con, &usage_pkt );
+   if( rc != 0 || usage_pkt.hdr.type != PACKET_TYPE_USAGE ) {
+      fprintf(stderr, "Could not read resource usage on %s:%d\n", hostname, portnum);
+      exit(1);
+   }
+   
+   struct wish_usage_packet usage;
+   wish_unpack_usage_packet( NULL, &usage_pkt, &usage );
+   wish_free_packet( &usage_pkt );
+   
+   char const* source = "none";
+   if( usage.source == USAGE_SOURCE_RUSAGE )
+      source = "rusage";
+   else if( usage.source == USAGE_SOURCE_CGROUP )
+      source = "cgroup";
+   
+   if( prefix == NULL )
+      prefix = "";
+   
+   printf("%ssource %s\n%sutime_usec %lu\n%sstime_usec %lu\n%smax_rss_kb %lu\n%sread_bytes %lu\n%swrite_bytes %lu\n%swall_usec %lu\n%squeue_usec %lu\n%slaunch_usec %lu\n",
+          prefix, source, prefix, usage.utime, prefix, usage.stime, prefix, usage.maxrss, prefix, usage.read_bytes, prefix, usage.write_bytes,
+          prefix, usage.wall_time, prefix, usage.queue_delay, prefix, usage.launch_delay );
+}
+
+
+// read one reply per member of a job array, printing "GPID EXITCODE" for each one that exited.
+// return 0 if every member exited; 1 otherwise
+int join_array( struct wish_connection* con, char* hostname, int portnum, uint64_t array_id, uint32_t num_members, int want_usage ) {
+   int ret = 0;
+   
+   for( uint32_t i = 0; i < num_members; i++ ) {
+      struct wish_packet pkt;
+      struct wish_process_packet wpp;
+      
+      int rc = wish_read_packet( NULL, con, &pkt );
+      if( rc != 0 ) {
+         fprintf(stderr, "Could not read status of array %lu on %s:%d\n", array_id, hostname, portnum);
+         exit(1);
+      }
+      
+      wish_unpack_process_packet( NULL, &pkt, &wpp );
+      wish_free_packet( &pkt );
+      
+      if( wpp.type == PROCESS_TYPE_EXIT ) {
+         printf("%lu %u\n", wpp.gpid, wpp.data);
+      }
+      else if( wpp.type == PROCESS_TYPE_TIMEOUT ) {
+         fprintf(stderr, "Process %lu timed out\n", wpp.gpid );
+         ret = 1;
+      }
+      else {
+         fprintf(stderr, "Could not join with process %lu: rc = %d\n", wpp.gpid, wpp.data );
+         ret = 1;
+      }
+      
+      if( want_usage && (wpp.type == PROCESS_TYPE_EXIT || wpp.type == PROCESS_TYPE_TIMEOUT) ) {
+         char prefix[30];
+         sprintf( prefix, "%lu ", wpp.gpid );
+         print_usage( con, hostname, portnum, prefix );
+      }
+   }
+   
+   return ret;
+}
+
 
 int main( int argc, char** argv ) {
    // parse options
    int c;
    uint64_t gpid = 0;
    int block = 1;
+   int want_usage = 0;
    char* hostname = NULL;
    int portnum = -1;
    
    if( argc == 1 )
       usage( argv[0] );
    
-   while((c = getopt(argc, argv, "n")) != -1) {
+   while((c = getopt(argc, argv, "nuh:")) != -1) {
       switch( c ) {
          case 'n': {
             block = 0;
             break;
          }
+         case 'u': {
+            want_usage = 1;
+            break;
+         }
          case 'h': {
             // is there a hostname given?
             hostname = strdup( optarg );
@@ -106,7 +185,7 @@ int main( int argc, char** argv ) {
    struct wish_packet pkt;
    struct wish_process_packet wpp;
    
-   wish_init_process_packet( NULL, &wpp, PROCESS_TYPE_PJOIN, gpid, 0, block );
+   wish_init_process_packet( NULL, &wpp, PROCESS_TYPE_PJOIN, gpid, (want_usage ? PROCESS_JOIN_USAGE : 0), block );
    wish_pack_process_packet( NULL, &pkt, &wpp );
    
    rc = wish_write_packet( NULL, &con, &pkt );
@@ -126,10 +205,22 @@ int main( int argc, char** argv ) {
    }
    
    wish_unpack_process_packet( NULL, &pkt, &wpp );
-   if( wpp.type == PROCESS_TYPE_EXIT ) {
+   if( wpp.type == PROCESS_TYPE_ARRAY ) {
+      // joined a job array; its members' statuses follow
+      rc = join_array( &con, hostname, portnum, gpid, wpp.data, want_usage );
+   }
+   else if( wpp.type == PROCESS_TYPE_EXIT ) {
       // successfully joined!
       printf("%u\n", wpp.data);
    }
+   else if( wpp.type == PROCESS_TYPE_TIMEOUT ) {
+      fprintf(stderr, "Process %ld timed out\n", gpid );
+   }
+   
+   if( want_usage && (wpp.type == PROCESS_TYPE_EXIT || wpp.type == PROCESS_TYPE_TIMEOUT) ) {
+      // the resource usage comes next
+      print_usage( &con, hostname, portnum, NULL );
+   }
    else if( wpp.type == PROCESS_TYPE_ERROR ) {
       // non-blocking and -EAGAIN?
       if( !block && wpp.data == (uint32_t)(-EAGAIN) ) {
@@ -2,8 +2,14 @@
 
 void usage( char* argv0 ) {
    fprintf(stderr,
-"Usage: %s [-d] [-t TIMEOUT] [-h HOST[:PORT]] [-g GPID] [-i STDIN] [-o STDOUT] [-e STDERR] [-f FILE] [-c COMMAND] HOST\n",
-   argv0);
+"Usage: %s [-d] [-s] [-t TIMEOUT] [-h HOST[:PORT]] [-g GPID] [-i STDIN] [-o STDOUT] [-e STDERR] [-C CORES | -N] [-f FILE] [-c COMMAND] HOST\n"
+"       %s -q cpu|ram|latency|spread|pack [-m MIN_RAM_MB] [-k MIN_DISK_MB] [-l MAX_LOAD] [OPTIONS...] [HOST...]\n"
+"\n"
+"With -q, the daemon queues the job and runs it on the best host by the given policy (among the given hosts, if any),\n"
+"once one has a free slot and meets the constraints.\n"
+"\n"
+"With -C, the job runs on CORES cores of its own, on one NUMA node if they fit; with -N, on a whole NUMA node of its own.\n",
+   argv0, argv0);
    
    exit(1);
 }
@@ -29,8 +35,13 @@ int main( int argc, char** argv ) {
    char* cmd_str = NULL;
    char* hostname = NULL;
    uint64_t gpid = 0;
+   uint32_t policy = 0;
+   uint64_t min_ram = 0;
+   uint64_t min_disk = 0;
+   double max_load = 0;
+   uint32_t cpus = 0;
    
-   while((c = getopt(argc, argv, "h:dt:f:g:c:i:o:e:")) != -1) {
+   while((c = getopt(argc, argv, "h:dst:f:g:c:i:o:e:q:m:k:l:C:N")) != -1) {
       switch( c ) {
          case 'h': {
             // is there a hostname given?
@@ -52,6 +63,10 @@ int main( int argc, char** argv ) {
             flags |= JOB_DETACHED;
             break;
          }
+         case 's': {
+            flags |= JOB_STREAM_STDIN;
+            break;
+         }
          case 'f' : {
             if( cmd_str )
                usage( argv[0] );
@@ -92,13 +107,63 @@ int main( int argc, char** argv ) {
             stderr_path = optarg;
             break;
          }
+         case 'q': {
+            if( strcmp( optarg, "cpu" ) == 0 )
+               policy = SCHED_POLICY_CPU;
+            else if( strcmp( optarg, "ram" ) == 0 )
+               policy = SCHED_POLICY_RAM;
+            else if( strcmp( optarg, "latency" ) == 0 )
+               policy = SCHED_POLICY_LATENCY;
+            else if( strcmp( optarg, "spread" ) == 0 )
+               policy = SCHED_POLICY_SPREAD;
+            else if( strcmp( optarg, "pack" ) == 0 )
+               policy = SCHED_POLICY_PACK;
+            else
+               usage( argv[0] );
+            
+            flags |= JOB_SCHEDULE;
+            break;
+         }
+         case 'm': {
+            int cnt = sscanf( optarg, "%lu", &min_ram );
+            if( cnt != 1 )
+               usage(argv[0]);
+            
+            min_ram *= 1024 * 1024;
+            break;
+         }
+         case 'k': {
+            int cnt = sscanf( optarg, "%lu", &min_disk );
+            if( cnt != 1 )
+               usage(argv[0]);
+            
+            min_disk *= 1024 * 1024;
+            break;
+         }
+         case 'l': {
+            int cnt = sscanf( optarg, "%lf", &max_load );
+            if( cnt != 1 || max_load < 0 )
+               usage(argv[0]);
+            break;
+         }
+         case 'C': {
+            int cnt = sscanf( optarg, "%u", &cpus );
+            if( cnt != 1 || cpus == 0 )
+               usage(argv[0]);
+            break;
+         }
+         case 'N': {
+            flags |= JOB_NUMA_NODE;
+            break;
+         }
          default: {
             usage( argv[0] );
          }
       }
    }
    
-   if( optind != argc - 1 ) {
+   // a queued job may run on any of the given hosts (or anywhere); otherwise, on exactly one
+   if( policy == 0 && optind != argc - 1 ) {
       usage( argv[0] );
    }
    
@@ -124,7 +189,11 @@ int main( int argc, char** argv ) {
       usage( argv[0] );
    }
    
-   nid = wish_host_nid( argv[argc - 1] );
+   if( cpus > 0 && (flags & JOB_NUMA_NODE) ) {
+      usage( argv[0] );
+   }
+   
+   nid = (policy == 0 ? wish_host_nid( argv[argc - 1] ) : 0);
    
    // read the config file
    struct wish_conf conf;
@@ -159,6 +228,7 @@ int main( int argc, char** argv ) {
    struct wish_job_packet jpkt;
    
    wish_init_job_packet_client( NULL, &jpkt, gpid, nid, 1, cmd_str, stdin_path, stdout_path, stderr_path, getuid(), getgid(), get_umask(), flags, timeout );
+   jpkt.cpus = cpus;
    wish_pack_job_packet( NULL, &pkt, &jpkt );
    
    // send of the job request
@@ -169,6 +239,33 @@ int main( int argc, char** argv ) {
       exit(1);
    }
    
+   if( policy != 0 ) {
+      // then how to place it
+      struct wish_sched_packet spkt;
+      wish_init_sched_packet( NULL, &spkt, policy, min_ram, min_disk, (uint32_t)(max_load * 100), argv + optind, argc - optind );
+      
+      wish_free_packet( &pkt );
+      wish_pack_sched_packet( NULL, &pkt, &spkt );
+      wish_free_sched_packet( &spkt );
+      
+      rc = wish_write_packet( NULL, &con, &pkt );
+      if( rc != 0 ) {
+         fprintf(stderr, "Could not send to daemon on %s:%d, rc = %d\n", hostname, portnum, rc);
+         exit(1);
+      }
+      
+      // the job may wait in the queue for a while before it starts
+      struct timeval tv;
+      tv.tv_sec = 0;
+      tv.tv_usec = 0;
+      
+      rc = setsockopt( con.soc, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+      if( rc != 0 ) {
+         fprintf(stderr, "setsockopt errno = %d\n", -errno );
+         exit(1);
+      }
+   }
+   
    // wait for a reply that this job has started
    wish_free_packet( &pkt );
    rc = wish_read_packet( NULL, &con, &pkt );
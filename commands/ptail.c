@@ -0,0 +1,187 @@
+#include "ptail.h"
+
+void usage( char* argv0 ) {
+   fprintf(stderr,
+"Usage: %s [-f] [-o OFFSET] [-v] [-h HOST[:PORT]] GPID\n\
+Print a job's output, as kept by its origin, from OFFSET bytes into it (default 0).\n\
+The job's stdout and stderr go to ours.  The job can be running or recently finished.\n\
+Options:\n\
+   -f                      Keep printing output as the job writes it, until it ends\n\
+   -o OFFSET               Start at this offset in the job's output\n\
+   -v                      When done, print the offset to resume from to stderr\n\
+   -h HOST[:PORT]          Ask the daemon at HOST[:PORT] (the job's origin)\n",
+   argv0);
+   
+   exit(1);
+}
+
+
+int main( int argc, char** argv ) {
+   // parse options
+   int c;
+   uint64_t gpid = 0;
+   uint64_t offset = 0;
+   uint32_t flags = 0;
+   int verbose = 0;
+   char* hostname = NULL;
+   int portnum = -1;
+   
+   while((c = getopt(argc, argv, "fo:vh:")) != -1) {
+      switch( c ) {
+         case 'f': {
+            flags |= OUTPUT_FOLLOW;
+            break;
+         }
+         case 'o': {
+            int cnt = sscanf( optarg, "%lu", &offset );
+            if( cnt != 1 )
+               usage(argv[0]);
+            break;
+         }
+         case 'v': {
+            verbose = 1;
+            break;
+         }
+         case 'h': {
+            // is there a hostname given?
+            hostname = strdup( optarg );
+            char* tmp = strchr(hostname, ':');
+            if( tmp != NULL ) {
+               *tmp = 0;
+               char* tmp2;
+               portnum = strtol(tmp + 1, &tmp2, 10 );
+               if( tmp2 == tmp + 1 ) {
+                  free( hostname );
+                  usage( argv[0] );
+               }
+            }
+            break;
+         }
+         default: {
+            usage( argv[0] );
+         }
+      }
+   }
+   
+   if( optind != argc - 1 )
+      usage( argv[0] );
+   
+   c = sscanf( argv[optind], "%lu", &gpid );
+   if( c != 1 )
+      usage( argv[0] );
+   
+   // no hostname given?  then check the environment variables
+   if( hostname == NULL ) {
+      hostname = getenv( WISH_ORIGIN_ENV );
+      if( hostname == NULL ) {
+         hostname = (char*)"localhost";
+      }
+      else {
+         char* portnum_str = getenv( WISH_PORTNUM_ENV );
+         if( portnum_str ) {
+            char* tmp;
+            long port_candidate = strtol(portnum_str, &tmp, 10 );
+            if( tmp != portnum_str ) {
+               portnum = port_candidate;
+            }
+         }
+      }
+   }
+   
+   // read the config file
+   struct wish_conf conf;
+   int rc = wish_read_conf( WISH_DEFAULT_CONFIG, &conf );
+   if( rc != 0 ) {
+      fprintf(stderr, "Config file %s could not be read\n", WISH_DEFAULT_CONFIG );
+      exit(1);
+   }
+   
+   if( portnum <= 0 )
+      portnum = conf.portnum;
+   
+   // connect to daemon
+   struct wish_connection con;
+   rc = wish_connect( NULL, &con, hostname, portnum );
+   if( rc != 0 ) {
+      // could not connect
+      fprintf(stderr, "Could not connect to daemon on %s:%d\n", hostname, portnum);
+      exit(1);
+   }
+   
+   // following can take as long as the job does
+   struct timeval tv;
+   tv.tv_sec = 0;
+   tv.tv_usec = 0;
+   
+   rc = setsockopt( con.soc, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+   if( rc != 0 ) {
+      fprintf(stderr, "setsockopt errno = %d\n", -errno );
+      exit(1);
+   }
+   
+   struct wish_packet pkt;
+   struct wish_output_packet opkt;
+   
+   wish_init_output_packet( NULL, &opkt, OUTPUT_ATTACH, gpid, offset, flags, 0, NULL );
+   wish_pack_output_packet( NULL, &pkt, &opkt );
+   wish_free_output_packet( &opkt );
+   
+   rc = wish_write_packet( NULL, &con, &pkt );
+   wish_free_packet( &pkt );
+   if( rc != 0 ) {
+      // could not write
+      fprintf(stderr, "Could not send to daemon on %s:%d\n", hostname, portnum);
+      exit(1);
+   }
+   
+   // print output until the end
+   uint64_t next = offset;
+   while( 1 ) {
+      rc = wish_read_packet( NULL, &con, &pkt );
+      if( rc != 0 ) {
+         fprintf(stderr, "Could not read output of %lu from %s:%d\n", gpid, hostname, portnum);
+         exit(1);
+      }
+      
+      if( pkt.hdr.type == PACKET_TYPE_PROCESS ) {
+         struct wish_process_packet wpp;
+         wish_unpack_process_packet( NULL, &pkt, &wpp );
+         fprintf(stderr, "Could not attach to output of %lu: rc = %d\n", gpid, (int)wpp.data );
+         exit(1);
+      }
+      
+      if( pkt.hdr.type != PACKET_TYPE_OUTPUT ) {
+         fprintf(stderr, "Corrupt response from daemon on %s:%d\n", hostname, portnum);
+         exit(1);
+      }
+      
+      wish_unpack_output_packet( NULL, &pkt, &opkt );
+      wish_free_packet( &pkt );
+      
+      if( opkt.type == OUTPUT_END ) {
+         next = opkt.offset;
+         wish_free_output_packet( &opkt );
+         break;
+      }
+      
+      if( opkt.offset > next ) {
+         // the origin has already dropped this much
+         fprintf(stderr, "(%lu bytes of output are no longer kept)\n", opkt.offset - next );
+      }
+      
+      FILE* out = (opkt.stream == STRING_STDERR ? stderr : stdout);
+      fputs( opkt.data, out );
+      fflush( out );
+      
+      next = opkt.offset + strlen( opkt.data );
+      wish_free_output_packet( &opkt );
+   }
+   
+   wish_disconnect( NULL, &con );
+   
+   if( verbose ) {
+      fprintf(stderr, "%lu\n", next );
+   }
+   
+   return 0;
+}
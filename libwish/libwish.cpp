@@ -306,6 +306,70 @@ int wish_read_conf( char const* path, struct wish_conf* conf ) {
       else if( strcmp( key, DEBUG_KEY ) == 0 ) {
          _DEBUG = strtol(values[0], NULL, 10);
       }
+      else if( strcmp( key, ZYGOTE_WORKERS_KEY ) == 0 ) {
+         conf->zygote_workers = strtol( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, CACHE_SIZE_KEY ) == 0 ) {
+         conf->cache_size = strtoull( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, FETCH_HOST_CONNECTIONS_KEY ) == 0 ) {
+         conf->fetch_host_connections = strtol( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, CGROUP_ROOT_KEY ) == 0 ) {
+         conf->cgroup_root = strdup( values[0] );
+      }
+      else if( strcmp( key, OUTPUT_LOOPS_KEY ) == 0 ) {
+         conf->output_loops = strtol( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, SCHED_SLOTS_KEY ) == 0 ) {
+         conf->sched_slots = strtol( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, SCHED_MAX_LOAD_KEY ) == 0 ) {
+         conf->sched_max_load = strtod( values[0], NULL );
+      }
+      else if( strcmp( key, SCHED_STEAL_DEPTH_KEY ) == 0 ) {
+         conf->sched_steal_depth = strtol( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, OUTLOG_SEGMENTS_KEY ) == 0 ) {
+         conf->outlog_segments = strtol( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, PIN_CPUS_KEY ) == 0 ) {
+         conf->pin_cpus = strdup( values[0] );
+      }
+      else if( strcmp( key, SINK_THREADS_KEY ) == 0 ) {
+         conf->sink_threads = strtol( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, SINK_FSYNC_KEY ) == 0 ) {
+         conf->sink_fsync = strtol( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, RESULTS_MAX_KEY ) == 0 ) {
+         conf->results_max = strtol( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, RESULTS_TTL_KEY ) == 0 ) {
+         conf->results_ttl = strtol( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, PROBE_HELPERS_KEY ) == 0 ) {
+         conf->probe_helpers = strtol( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, PEER_CONNECTIONS_KEY ) == 0 ) {
+         conf->peer_connections = strtol( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, LABELS_KEY ) == 0 ) {
+         // labels may be separated by spaces or commas; keep them comma-separated
+         string labels;
+         for( int i = 0; i < num_values; i++ ) {
+            if( labels.size() > 0 )
+               labels += ",";
+            labels += values[i];
+         }
+         conf->labels = strdup( labels.c_str() );
+      }
+      else if( strcmp( key, SAMPLE_INTERVAL_KEY ) == 0 ) {
+         conf->sample_interval = strtoll( values[0], NULL, 10 );
+      }
+      else if( strcmp( key, HEARTBEAT_TIMESTAMPS_KEY ) == 0 ) {
+         conf->heartbeat_timestamps = (strtol( values[0], NULL, 10 ) != 0);
+      }
       
       /***********************************************************************/
       else {
@@ -477,6 +541,7 @@ int wish_init( struct wish_state* state ) {
    state->nid = wish_host_nid( looked_up );
    state->fs_invisible = new vector<char*>();
    state->client_cons = new vector<struct wish_connection*>();
+   pthread_mutex_init( &state->client_cons_lock, NULL );
    
    // initialize the wish state lock
    pthread_rwlock_init( &state->lock, NULL );
@@ -501,6 +566,15 @@ int wish_shutdown( struct wish_state* state ) {
    if( state->conf.files_root )
       free( state->conf.files_root );
    
+   if( state->conf.cgroup_root )
+      free( state->conf.cgroup_root );
+   
+   if( state->conf.pin_cpus )
+      free( state->conf.pin_cpus );
+   
+   if( state->conf.labels )
+      free( state->conf.labels );
+   
    for( vector<char*>::size_type i = 0; i < state->fs_invisible->size(); i++ ) {
       if( state->fs_invisible->at(i) )
          free( state->fs_invisible->at(i) );
@@ -508,10 +582,14 @@ int wish_shutdown( struct wish_state* state ) {
    delete state->fs_invisible;
    
    for( vector<struct wish_connection*>::iterator itr = state->client_cons->begin(); itr != state->client_cons->end(); itr++ ) {
+      if( *itr == NULL )
+         continue;
+      
       wish_disconnect( state, (*itr) );
       free( *itr );
    }
    delete state->client_cons;
+   pthread_mutex_destroy( &state->client_cons_lock );
    
    wish_state_unlock( state );
    
@@ -660,6 +738,50 @@ int wish_init_packet_nocopy( struct wish_packet* wp, struct wish_packet_header*
 }
 
 
+// connect a socket, giving up after timeout_ms milliseconds (0 to wait as long as the kernel does).
+// return 0 on success; negative on error
+static int wish_connect_deadline( int soc, struct sockaddr* addr, socklen_t addrlen, int timeout_ms ) {
+   if( timeout_ms <= 0 ) {
+      return connect( soc, addr, addrlen ) == 0 ? 0 : -errno;
+   }
+   
+   int flags = fcntl( soc, F_GETFL );
+   fcntl( soc, F_SETFL, flags | O_NONBLOCK );
+   
+   int rc = connect( soc, addr, addrlen );
+   if( rc < 0 && errno == EINPROGRESS ) {
+      struct pollfd pfd;
+      pfd.fd = soc;
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+      
+      do {
+         rc = poll( &pfd, 1, timeout_ms );
+      } while( rc < 0 && errno == EINTR );
+      
+      if( rc == 0 ) {
+         rc = -ETIMEDOUT;
+      }
+      else if( rc > 0 ) {
+         // find out how the connect went
+         int err = 0;
+         socklen_t len = sizeof(err);
+         getsockopt( soc, SOL_SOCKET, SO_ERROR, &err, &len );
+         rc = -err;
+      }
+      else {
+         rc = -errno;
+      }
+   }
+   else if( rc < 0 ) {
+      rc = -errno;
+   }
+   
+   fcntl( soc, F_SETFL, flags );
+   return rc;
+}
+
+
 // connect to another daemon, returning 0 on success, or a negative errno
 int wish_connect( struct wish_state* state, struct wish_connection* con, char const* hostname, int portnum ) {
    
@@ -682,6 +804,16 @@ int wish_connect( struct wish_state* state, struct wish_connection* con, char co
       return -ENETDOWN;
    }
    
+   // how long to wait to connect, and to wait for data
+   int connect_timeout = 5000;
+   if( state ) {
+      wish_state_rlock( state );
+      
+      connect_timeout = state->conf.connect_timeout;
+      
+      wish_state_unlock( state );
+   }
+   
    // attempt to connect on each of the possible addresses
    int socket_fd = 0;
    struct addrinfo* rp = NULL;
@@ -693,7 +825,7 @@ int wish_connect( struct wish_state* state, struct wish_connection* con, char co
          continue;
       }
       
-      int rc = connect( socket_fd, rp->ai_addr, rp->ai_addrlen );
+      int rc = wish_connect_deadline( socket_fd, rp->ai_addr, rp->ai_addrlen, connect_timeout );
       if( rc < 0 ) {
          // failed to connect
          close(socket_fd);
@@ -713,15 +845,6 @@ int wish_connect( struct wish_state* state, struct wish_connection* con, char co
    }
    
    // set a socket timeout
-   int connect_timeout = 5000;
-   if( state ) {
-      wish_state_rlock( state );
-      
-      connect_timeout = state->conf.connect_timeout;
-      
-      wish_state_unlock( state );
-   }
-   
    struct timeval tv;
    tv.tv_sec = connect_timeout / 1000;                          // seconds
    tv.tv_usec = (connect_timeout % 1000) * 1000;                // microseconds
@@ -1091,6 +1214,27 @@ int wish_write_packet( struct wish_state* state, struct wish_connection* con, st
 }
 
 
+// serialize a (default) packet into a buffer, so it can be sent without blocking
+// return 0 on success, -errno on failure
+int wish_serialize_packet( struct wish_packet* wp, uint8_t** buf, size_t* len ) {
+   struct wish_packet_header tmp_hdr;
+   memcpy( &tmp_hdr, &wp->hdr, sizeof(tmp_hdr) );
+   
+   wish_packet_header_hton( &tmp_hdr );
+   
+   *len = sizeof(tmp_hdr) + wp->hdr.payload_len;
+   *buf = (uint8_t*)calloc( *len, 1 );
+   if( *buf == NULL )
+      return -ENOMEM;
+   
+   memcpy( *buf, &tmp_hdr, sizeof(tmp_hdr) );
+   if( wp->hdr.payload_len > 0 )
+      memcpy( *buf + sizeof(tmp_hdr), wp->payload, wp->hdr.payload_len );
+   
+   return 0;
+}
+
+
 // free a packet's memory
 int wish_free_packet( struct wish_packet* wp ) {
    if( wp->payload )
@@ -36,6 +36,7 @@
 #include <vector>
 #include <curl/curl.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include "packets.h"
 
@@ -63,6 +64,7 @@ extern int _DEBUG;
 #define WISH_HTTP_SETENV   "SETENV"
 #define WISH_HTTP_FILE     "FILE"
 #define WISH_HTTP_TASET    "TASET"
+#define WISH_HTTP_STATS    "STATS"
 
 // environment variables
 #define WISH_ORIGIN_ENV "WISH_ORIGIN"
@@ -71,6 +73,7 @@ extern int _DEBUG;
 #define WISH_GPID_ENV   "WISH_GPID"
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
 
 #define WISH_MAX_ENVAR_SIZE 65536
 
@@ -119,6 +122,25 @@ struct wish_conf {
    char* http_secrets;           // path to HTTP secrets file
    bool use_https;               // whether or not to use HTTPS
    time_t job_timeout;           // default process timeout
+   int zygote_workers;           // number of pre-forked workers to keep for launching jobs (0 to fork each job from the daemon)
+   uint64_t cache_size;          // maximum number of bytes of downloaded job files to cache (0 to disable)
+   int fetch_host_connections;   // maximum number of concurrent job file downloads from any one host
+   char* cgroup_root;            // cgroup v2 directory delegated to us, to account for each job in its own cgroup (NULL to only use rusage)
+   int output_loops;             // number of threads streaming job output, on each of the origin and executor sides (0 for one per CPU)
+   int sched_slots;              // most queued jobs the scheduler runs on any one host at a time (0 for the default)
+   double sched_max_load;        // 1-minute load average at which the scheduler stops placing jobs on a host (0 for no limit)
+   int sched_steal_depth;        // queue length at which an idle daemon takes jobs from a peer's scheduler queue (0 to never take any)
+   int outlog_segments;          // most segments of each job's output log the origin keeps for replay (0 for the default)
+   char* pin_cpus;               // cores that jobs asking for cores of their own may be pinned to, as a cpuset list (NULL for all of ours)
+   int sink_threads;             // number of threads writing job output files on the origin (0 for the default)
+   int sink_fsync;               // when to sync job output files to disk (0: never; 1: when the job ends; 2: after every write)
+   int results_max;              // most finished jobs' outcomes the origin keeps for late joiners (0 for the default)
+   int results_ttl;              // how long the origin keeps each finished job's outcome, in seconds (0 for the default)
+   int probe_helpers;            // hosts asked to probe a host that didn't answer our heartbeat, before suspecting it (0 for the default)
+   int peer_connections;         // most connections to other hosts kept open for heartbeats (0 for the default)
+   char* labels;                 // comma-separated labels of this host, for placement queries to match (NULL for none)
+   int64_t sample_interval;      // how often do we read this host's load, memory, disk, and network (in milliseconds; 0 for the default)
+   bool heartbeat_timestamps;    // whether or not to time heartbeats by when the kernel received them (SO_TIMESTAMPING)
    
    struct wish_hostent** initial_peers;         // initial peers
 };
@@ -135,6 +157,7 @@ struct wish_state {
    uint64_t nid;                // our nid
    char* hostname;              // our looked-up hostname
    vector<struct wish_connection*>* client_cons;    // connection to our clients
+   pthread_mutex_t client_cons_lock;                 // protects client_cons and writes to them (not the state lock, so slow clients don't hold up readers of the state)
    
    // read/write lock to access this structure
    pthread_rwlock_t lock;
@@ -188,6 +211,25 @@ struct wish_HTTP_buf {
 #define JOB_TIMEOUT_KEY          "JOB_TIMEOUT"
 #define USE_HTTPS_KEY            "USE_HTTPS"
 #define DEBUG_KEY                "DEBUG"
+#define ZYGOTE_WORKERS_KEY       "ZYGOTE_WORKERS"
+#define CACHE_SIZE_KEY           "CACHE_SIZE"
+#define FETCH_HOST_CONNECTIONS_KEY "FETCH_HOST_CONNECTIONS"
+#define CGROUP_ROOT_KEY          "CGROUP_ROOT"
+#define OUTPUT_LOOPS_KEY         "OUTPUT_LOOPS"
+#define SCHED_SLOTS_KEY          "SCHED_SLOTS"
+#define SCHED_MAX_LOAD_KEY       "SCHED_MAX_LOAD"
+#define SCHED_STEAL_DEPTH_KEY    "SCHED_STEAL_DEPTH"
+#define OUTLOG_SEGMENTS_KEY      "OUTLOG_SEGMENTS"
+#define PIN_CPUS_KEY             "PIN_CPUS"
+#define SINK_THREADS_KEY         "SINK_THREADS"
+#define SINK_FSYNC_KEY           "SINK_FSYNC"
+#define RESULTS_MAX_KEY          "RESULTS_MAX"
+#define RESULTS_TTL_KEY          "RESULTS_TTL"
+#define PROBE_HELPERS_KEY        "PROBE_HELPERS"
+#define PEER_CONNECTIONS_KEY     "PEER_CONNECTIONS"
+#define LABELS_KEY               "LABELS"
+#define SAMPLE_INTERVAL_KEY      "SAMPLE_INTERVAL"
+#define HEARTBEAT_TIMESTAMPS_KEY "HEARTBEAT_TIMESTAMPS"
 
 // parse configuration file
 // return 0 on success, -errno on failure
@@ -253,6 +295,10 @@ int wish_clear_connection( struct wish_state* state, struct wish_connection* con
 // return 0 on success, -errno on failure
 int wish_write_packet( struct wish_state* state, struct wish_connection* con, struct wish_packet* wp );
 
+// serialize a (default) packet into a newly-allocated buffer, exactly as wish_write_packet would send it.
+// return 0 on success, -errno on failure
+int wish_serialize_packet( struct wish_packet* wp, uint8_t** buf, size_t* len );
+
 // clone a connection, which the caller can close/free safely
 int wish_connection_clone( struct wish_state* state, struct wish_connection* old, struct wish_connection* next );
 
@@ -9,6 +9,12 @@
 #include "packets/process_packet.h"
 #include "packets/barrier_packet.h"
 #include "packets/access_packet.h"
+#include "packets/usage_packet.h"
+#include "packets/job_array_packet.h"
+#include "packets/bcast_packet.h"
+#include "packets/sched_packet.h"
+#include "packets/dag_packet.h"
+#include "packets/output_packet.h"
 
 // ADD YOUR PACKET CODE'S HEADER FILE HERE!
 
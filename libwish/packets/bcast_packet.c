@@ -0,0 +1,126 @@
+#include "bcast_packet.h"
+
+// make a broadcast packet
+void wish_init_bcast_packet( struct wish_state* state, struct wish_bcast_packet* pkt, uint32_t fanout, char** targets, uint32_t num_targets ) {
+   memset( pkt, 0, sizeof(struct wish_bcast_packet) );
+   
+   pkt->fanout = fanout;
+   
+   pkt->num_targets = num_targets;
+   if( num_targets > 0 ) {
+      pkt->targets = (char**)calloc( sizeof(char*) * num_targets, 1 );
+      for( uint32_t i = 0; i < num_targets; i++ ) {
+         pkt->targets[i] = strdup( targets[i] );
+      }
+   }
+}
+
+
+// add a host's result
+void wish_add_bcast_result( struct wish_bcast_packet* pkt, char const* hostname, uint32_t type, int32_t data ) {
+   pkt->results = (struct wish_bcast_result*)realloc( pkt->results, sizeof(struct wish_bcast_result) * (pkt->num_results + 1) );
+   
+   struct wish_bcast_result* res = &pkt->results[ pkt->num_results ];
+   res->hostname = strdup( hostname );
+   res->type = type;
+   res->data = data;
+   
+   pkt->num_results++;
+}
+
+
+// pack a broadcast packet
+int wish_pack_bcast_packet( struct wish_state* state, struct wish_packet* wp, struct wish_bcast_packet* pkt ) {
+   wish_init_header( state, &wp->hdr, PACKET_TYPE_BCAST );
+   
+   size_t len = sizeof(pkt->fanout) + sizeof(pkt->num_targets) + sizeof(pkt->num_results);
+   
+   for( uint32_t i = 0; i < pkt->num_targets; i++ ) {
+      len += strlen( pkt->targets[i] ) + 1;
+   }
+   for( uint32_t i = 0; i < pkt->num_results; i++ ) {
+      len += strlen( pkt->results[i].hostname ) + 1 + sizeof(pkt->results[i].type) + sizeof(pkt->results[i].data);
+   }
+   
+   uint8_t* buf = (uint8_t*)calloc( len, 1 );
+   
+   off_t offset = 0;
+   wish_pack_uint( buf, &offset, pkt->fanout );
+   
+   wish_pack_uint( buf, &offset, pkt->num_targets );
+   for( uint32_t i = 0; i < pkt->num_targets; i++ ) {
+      wish_pack_string( buf, &offset, pkt->targets[i] );
+   }
+   
+   wish_pack_uint( buf, &offset, pkt->num_results );
+   for( uint32_t i = 0; i < pkt->num_results; i++ ) {
+      wish_pack_string( buf, &offset, pkt->results[i].hostname );
+      wish_pack_uint( buf, &offset, pkt->results[i].type );
+      wish_pack_int( buf, &offset, pkt->results[i].data );
+   }
+   
+   wish_init_packet_nocopy( wp, &wp->hdr, buf, len );
+   
+   return 0;
+}
+
+
+// unpack a broadcast packet
+int wish_unpack_bcast_packet( struct wish_state* state, struct wish_packet* wp, struct wish_bcast_packet* pkt ) {
+   memset( pkt, 0, sizeof(struct wish_bcast_packet) );
+   
+   off_t offset = 0;
+   pkt->fanout = wish_unpack_uint( wp->payload, &offset );
+   
+   pkt->num_targets = wish_unpack_uint( wp->payload, &offset );
+   if( pkt->num_targets > BCAST_MAX_TARGETS ) {
+      pkt->num_targets = 0;
+      return -EINVAL;
+   }
+   
+   if( pkt->num_targets > 0 ) {
+      pkt->targets = (char**)calloc( sizeof(char*) * pkt->num_targets, 1 );
+      for( uint32_t i = 0; i < pkt->num_targets; i++ ) {
+         pkt->targets[i] = wish_unpack_string( wp->payload, &offset );
+      }
+   }
+   
+   uint32_t num_results = wish_unpack_uint( wp->payload, &offset );
+   if( num_results > BCAST_MAX_TARGETS ) {
+      return -EINVAL;
+   }
+   
+   if( num_results > 0 ) {
+      pkt->results = (struct wish_bcast_result*)calloc( sizeof(struct wish_bcast_result) * num_results, 1 );
+      for( uint32_t i = 0; i < num_results; i++ ) {
+         pkt->results[i].hostname = wish_unpack_string( wp->payload, &offset );
+         pkt->results[i].type = wish_unpack_uint( wp->payload, &offset );
+         pkt->results[i].data = wish_unpack_int( wp->payload, &offset );
+      }
+      pkt->num_results = num_results;
+   }
+   
+   return 0;
+}
+
+
+// free a broadcast packet
+int wish_free_bcast_packet( struct wish_bcast_packet* pkt ) {
+   if( pkt->targets ) {
+      for( uint32_t i = 0; i < pkt->num_targets; i++ ) {
+         free( pkt->targets[i] );
+      }
+      free( pkt->targets );
+      pkt->targets = NULL;
+   }
+   if( pkt->results ) {
+      for( uint32_t i = 0; i < pkt->num_results; i++ ) {
+         free( pkt->results[i].hostname );
+      }
+      free( pkt->results );
+      pkt->results = NULL;
+   }
+   pkt->num_targets = 0;
+   pkt->num_results = 0;
+   return 0;
+}
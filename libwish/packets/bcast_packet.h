@@ -0,0 +1,49 @@
+// packet for broadcast launches.  It follows a JOB_BROADCAST job packet down the launch tree, carrying the
+// hosts in the receiver's subtree, and comes back up carrying the exit status of each host in that subtree.
+
+#ifndef _BCAST_PACKET_H_
+#define _BCAST_PACKET_H_
+
+#include "libwish.h"
+
+#define PACKET_TYPE_BCAST 125
+
+#define BCAST_DEFAULT_FANOUT  8
+#define BCAST_MAX_FANOUT      64
+#define BCAST_MAX_TARGETS     65536
+
+// how the job ended on one host
+struct wish_bcast_result {
+   char* hostname;
+   uint32_t type;             // PROCESS_TYPE_EXIT, PROCESS_TYPE_TIMEOUT, or PROCESS_TYPE_ERROR
+   int32_t data;              // exit code for PROCESS_TYPE_EXIT; -errno for PROCESS_TYPE_ERROR
+};
+
+struct wish_bcast_packet {
+   uint32_t fanout;           // how many children each node forwards the job to
+   
+   // going down
+   uint32_t num_targets;
+   char** targets;            // hosts to run the job on (the receiver among them)
+   
+   // coming back up
+   uint32_t num_results;
+   struct wish_bcast_result* results;
+};
+
+// make a broadcast packet.  The targets are duplicated.
+void wish_init_bcast_packet( struct wish_state* state, struct wish_bcast_packet* pkt, uint32_t fanout, char** targets, uint32_t num_targets );
+
+// add a host's result to a broadcast packet.  hostname is duplicated.
+void wish_add_bcast_result( struct wish_bcast_packet* pkt, char const* hostname, uint32_t type, int32_t data );
+
+// pack a broadcast packet
+int wish_pack_bcast_packet( struct wish_state* state, struct wish_packet* wp, struct wish_bcast_packet* pkt );
+
+// unpack a broadcast packet
+int wish_unpack_bcast_packet( struct wish_state* state, struct wish_packet* wp, struct wish_bcast_packet* pkt );
+
+// free a broadcast packet
+int wish_free_bcast_packet( struct wish_bcast_packet* pkt );
+
+#endif
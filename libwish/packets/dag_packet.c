@@ -0,0 +1,269 @@
+#include "dag_packet.h"
+
+// make an empty DAG packet
+void wish_init_dag_packet( struct wish_state* state, struct wish_dag_packet* pkt, uint64_t dag_id, uid_t owner, gid_t group, int umask ) {
+   memset( pkt, 0, sizeof(struct wish_dag_packet) );
+   
+   pkt->dag_id = dag_id;
+   pkt->owner = owner;
+   pkt->group = group;
+   pkt->umask = umask;
+}
+
+
+// add a node
+uint32_t wish_add_dag_node( struct wish_dag_packet* pkt, char const* name, char const* hostname, char const* cmd, time_t timeout ) {
+   pkt->nodes = (struct wish_dag_node*)realloc( pkt->nodes, sizeof(struct wish_dag_node) * (pkt->num_nodes + 1) );
+   
+   struct wish_dag_node* node = &pkt->nodes[ pkt->num_nodes ];
+   memset( node, 0, sizeof(struct wish_dag_node) );
+   
+   node->name = strdup( name );
+   node->hostname = strdup( hostname );
+   node->cmd_text = strdup( cmd );
+   node->timeout = timeout;
+   
+   return pkt->num_nodes++;
+}
+
+
+// add a dependency
+void wish_add_dag_dep( struct wish_dag_packet* pkt, uint32_t node, uint32_t dep, uint32_t kind ) {
+   struct wish_dag_node* n = &pkt->nodes[ node ];
+   
+   n->deps = (struct wish_dag_dep*)realloc( n->deps, sizeof(struct wish_dag_dep) * (n->num_deps + 1) );
+   n->deps[ n->num_deps ].node = dep;
+   n->deps[ n->num_deps ].kind = kind;
+   n->num_deps++;
+}
+
+
+// check a DAG's dependencies
+int wish_check_dag_packet( struct wish_dag_packet* pkt ) {
+   if( pkt->num_nodes == 0 || pkt->num_nodes > DAG_MAX_NODES )
+      return -EINVAL;
+   
+   // how many unresolved dependencies each node has
+   uint32_t* waiting = (uint32_t*)calloc( sizeof(uint32_t) * pkt->num_nodes, 1 );
+   
+   for( uint32_t i = 0; i < pkt->num_nodes; i++ ) {
+      if( pkt->nodes[i].name == NULL || pkt->nodes[i].hostname == NULL || pkt->nodes[i].cmd_text == NULL ) {
+         free( waiting );
+         return -EINVAL;
+      }
+      
+      for( uint32_t j = 0; j < pkt->nodes[i].num_deps; j++ ) {
+         struct wish_dag_dep* dep = &pkt->nodes[i].deps[j];
+         if( dep->node >= pkt->num_nodes || dep->node == i || (dep->kind != DAG_AFTER_OK && dep->kind != DAG_AFTER_ANY) ) {
+            free( waiting );
+            return -EINVAL;
+         }
+      }
+      waiting[i] = pkt->nodes[i].num_deps;
+   }
+   
+   // take away nodes with nothing left to wait on until none are left.  If some never get there, there's a cycle.
+   uint32_t* ready = (uint32_t*)calloc( sizeof(uint32_t) * pkt->num_nodes, 1 );
+   uint32_t num_ready = 0;
+   uint32_t resolved = 0;
+   
+   for( uint32_t i = 0; i < pkt->num_nodes; i++ ) {
+      if( waiting[i] == 0 )
+         ready[ num_ready++ ] = i;
+   }
+   
+   while( num_ready > 0 ) {
+      uint32_t done = ready[ --num_ready ];
+      resolved++;
+      
+      for( uint32_t i = 0; i < pkt->num_nodes; i++ ) {
+         for( uint32_t j = 0; j < pkt->nodes[i].num_deps; j++ ) {
+            if( pkt->nodes[i].deps[j].node == done ) {
+               waiting[i]--;
+               if( waiting[i] == 0 )
+                  ready[ num_ready++ ] = i;
+            }
+         }
+      }
+   }
+   
+   free( ready );
+   free( waiting );
+   
+   return (resolved == pkt->num_nodes ? 0 : -ELOOP);
+}
+
+
+// pack a DAG packet
+int wish_pack_dag_packet( struct wish_state* state, struct wish_packet* wp, struct wish_dag_packet* pkt ) {
+   wish_init_header( state, &wp->hdr, PACKET_TYPE_DAG );
+   
+   size_t len = sizeof(pkt->dag_id) + sizeof(pkt->owner) + sizeof(pkt->group) + sizeof(pkt->umask) + sizeof(pkt->num_nodes) +
+                sizeof(pkt->num_gpids) + sizeof(uint64_t) * pkt->num_gpids;
+   
+   for( uint32_t i = 0; i < pkt->num_nodes; i++ ) {
+      struct wish_dag_node* node = &pkt->nodes[i];
+      len += strlen( node->name ) + 1 + strlen( node->hostname ) + 1 + strlen( node->cmd_text ) + 1 + sizeof(int64_t) +
+             sizeof(node->num_deps) + (sizeof(uint32_t) * 2) * node->num_deps;
+   }
+   
+   uint8_t* buf = (uint8_t*)calloc( len, 1 );
+   
+   off_t offset = 0;
+   wish_pack_ulong( buf, &offset, pkt->dag_id );
+   wish_pack_uint( buf, &offset, pkt->owner );
+   wish_pack_uint( buf, &offset, pkt->group );
+   wish_pack_uint( buf, &offset, pkt->umask );
+   
+   wish_pack_uint( buf, &offset, pkt->num_nodes );
+   for( uint32_t i = 0; i < pkt->num_nodes; i++ ) {
+      struct wish_dag_node* node = &pkt->nodes[i];
+      
+      wish_pack_string( buf, &offset, node->name );
+      wish_pack_string( buf, &offset, node->hostname );
+      wish_pack_string( buf, &offset, node->cmd_text );
+      wish_pack_long( buf, &offset, node->timeout );
+      
+      wish_pack_uint( buf, &offset, node->num_deps );
+      for( uint32_t j = 0; j < node->num_deps; j++ ) {
+         wish_pack_uint( buf, &offset, node->deps[j].node );
+         wish_pack_uint( buf, &offset, node->deps[j].kind );
+      }
+   }
+   
+   wish_pack_uint( buf, &offset, pkt->num_gpids );
+   for( uint32_t i = 0; i < pkt->num_gpids; i++ ) {
+      wish_pack_ulong( buf, &offset, pkt->gpids[i] );
+   }
+   
+   wish_init_packet_nocopy( wp, &wp->hdr, buf, len );
+   
+   return 0;
+}
+
+
+// are there len more bytes in a packet's payload?
+static bool wish_dag_packet_has( struct wish_packet* wp, off_t offset, size_t len ) {
+   return offset >= 0 && (size_t)offset <= wp->hdr.payload_len && len <= wp->hdr.payload_len - (size_t)offset;
+}
+
+// is there a whole string (with its terminator) in a packet's payload?
+static bool wish_dag_packet_has_string( struct wish_packet* wp, off_t offset ) {
+   return wish_dag_packet_has( wp, offset, 1 ) && memchr( wp->payload + offset, 0, wp->hdr.payload_len - offset ) != NULL;
+}
+
+// unpack a DAG node
+static int wish_unpack_dag_node( struct wish_packet* wp, off_t* offset, struct wish_dag_node* node ) {
+   if( !wish_dag_packet_has_string( wp, *offset ) )
+      return -EINVAL;
+   node->name = wish_unpack_string( wp->payload, offset );
+   
+   if( !wish_dag_packet_has_string( wp, *offset ) )
+      return -EINVAL;
+   node->hostname = wish_unpack_string( wp->payload, offset );
+   
+   if( !wish_dag_packet_has_string( wp, *offset ) )
+      return -EINVAL;
+   node->cmd_text = wish_unpack_string( wp->payload, offset );
+   
+   if( !wish_dag_packet_has( wp, *offset, sizeof(int64_t) + sizeof(uint32_t) ) )
+      return -EINVAL;
+   node->timeout = wish_unpack_long( wp->payload, offset );
+   
+   uint32_t num_deps = wish_unpack_uint( wp->payload, offset );
+   if( num_deps > DAG_MAX_NODES || !wish_dag_packet_has( wp, *offset, (sizeof(uint32_t) * 2) * num_deps ) )
+      return -EINVAL;
+   
+   if( num_deps > 0 ) {
+      node->deps = (struct wish_dag_dep*)calloc( sizeof(struct wish_dag_dep) * num_deps, 1 );
+      node->num_deps = num_deps;
+      
+      for( uint32_t j = 0; j < num_deps; j++ ) {
+         node->deps[j].node = wish_unpack_uint( wp->payload, offset );
+         node->deps[j].kind = wish_unpack_uint( wp->payload, offset );
+      }
+   }
+   
+   return 0;
+}
+
+
+// unpack a DAG packet.  On error, nothing is left allocated.
+int wish_unpack_dag_packet( struct wish_state* state, struct wish_packet* wp, struct wish_dag_packet* pkt ) {
+   memset( pkt, 0, sizeof(struct wish_dag_packet) );
+   
+   off_t offset = 0;
+   if( !wish_dag_packet_has( wp, offset, sizeof(uint64_t) + sizeof(uint32_t) * 4 ) )
+      return -EINVAL;
+   
+   pkt->dag_id = wish_unpack_ulong( wp->payload, &offset );
+   pkt->owner = wish_unpack_uint( wp->payload, &offset );
+   pkt->group = wish_unpack_uint( wp->payload, &offset );
+   pkt->umask = wish_unpack_uint( wp->payload, &offset );
+   
+   uint32_t num_nodes = wish_unpack_uint( wp->payload, &offset );
+   if( num_nodes > DAG_MAX_NODES ) {
+      return -EINVAL;
+   }
+   
+   if( num_nodes > 0 ) {
+      pkt->nodes = (struct wish_dag_node*)calloc( sizeof(struct wish_dag_node) * num_nodes, 1 );
+      pkt->num_nodes = num_nodes;
+      
+      for( uint32_t i = 0; i < num_nodes; i++ ) {
+         if( wish_unpack_dag_node( wp, &offset, &pkt->nodes[i] ) != 0 ) {
+            wish_free_dag_packet( pkt );
+            return -EINVAL;
+         }
+      }
+   }
+   
+   if( !wish_dag_packet_has( wp, offset, sizeof(uint32_t) ) ) {
+      wish_free_dag_packet( pkt );
+      return -EINVAL;
+   }
+   
+   uint32_t num_gpids = wish_unpack_uint( wp->payload, &offset );
+   if( num_gpids > DAG_MAX_NODES || !wish_dag_packet_has( wp, offset, sizeof(uint64_t) * num_gpids ) ) {
+      wish_free_dag_packet( pkt );
+      return -EINVAL;
+   }
+   
+   if( num_gpids > 0 ) {
+      pkt->gpids = (uint64_t*)calloc( sizeof(uint64_t) * num_gpids, 1 );
+      pkt->num_gpids = num_gpids;
+      
+      for( uint32_t i = 0; i < num_gpids; i++ ) {
+         pkt->gpids[i] = wish_unpack_ulong( wp->payload, &offset );
+      }
+   }
+   
+   return 0;
+}
+
+
+// free a DAG packet
+int wish_free_dag_packet( struct wish_dag_packet* pkt ) {
+   if( pkt->nodes ) {
+      for( uint32_t i = 0; i < pkt->num_nodes; i++ ) {
+         struct wish_dag_node* node = &pkt->nodes[i];
+         if( node->name )
+            free( node->name );
+         if( node->hostname )
+            free( node->hostname );
+         if( node->cmd_text )
+            free( node->cmd_text );
+         if( node->deps )
+            free( node->deps );
+      }
+      free( pkt->nodes );
+      pkt->nodes = NULL;
+   }
+   if( pkt->gpids ) {
+      free( pkt->gpids );
+      pkt->gpids = NULL;
+   }
+   pkt->num_nodes = 0;
+   pkt->num_gpids = 0;
+   return 0;
+}
@@ -0,0 +1,71 @@
+// packet describing a DAG of jobs: each node is a job, and runs once the nodes it depends on have ended.
+// the origin runs the whole DAG itself, and replies with the same packet type carrying the DAG's id and the gpid
+// of each node.  Joining on the DAG's id gets back how every node ended, in node order.
+
+#ifndef _DAG_PACKET_H_
+#define _DAG_PACKET_H_
+
+#include "libwish.h"
+
+#define PACKET_TYPE_DAG 127
+
+#define DAG_MAX_NODES   4096
+
+#define DAG_ANY_HOST    "*"      // node hostname that lets the origin pick the least loaded host when the node is ready
+
+// kinds of dependency
+#define DAG_AFTER_OK    0x1      // run only if the dependency exited with status 0
+#define DAG_AFTER_ANY   0x2      // run once the dependency has ended, however it ended
+
+struct wish_dag_dep {
+   uint32_t node;             // index of the node depended on
+   uint32_t kind;             // DAG_AFTER_*
+};
+
+struct wish_dag_node {
+   char* name;                // name to report the node by
+   char* hostname;            // host to run on (or DAG_ANY_HOST)
+   char* cmd_text;            // shell command
+   time_t timeout;            // maximum amount of time the node is allowed to run, in seconds (-1 for infinite)
+   uint32_t num_deps;
+   struct wish_dag_dep* deps;
+};
+
+struct wish_dag_packet {
+   uint64_t dag_id;           // id of the DAG as a whole, which pjoin can wait on (0 to have the origin pick one)
+   uint32_t owner;
+   uint32_t group;
+   uint32_t umask;
+   
+   uint32_t num_nodes;
+   struct wish_dag_node* nodes;
+   
+   // filled in by the origin's reply
+   uint32_t num_gpids;        // number of entries in gpids
+   uint64_t* gpids;           // gpid of each node, by index
+};
+
+// make an empty DAG packet
+void wish_init_dag_packet( struct wish_state* state, struct wish_dag_packet* pkt, uint64_t dag_id, uid_t owner, gid_t group, int umask );
+
+// add a node to a DAG packet.  Everything is duplicated.
+// return the node's index
+uint32_t wish_add_dag_node( struct wish_dag_packet* pkt, char const* name, char const* hostname, char const* cmd, time_t timeout );
+
+// make node depend on dep
+void wish_add_dag_dep( struct wish_dag_packet* pkt, uint32_t node, uint32_t dep, uint32_t kind );
+
+// check that a DAG's dependencies refer to its own nodes and have no cycles.
+// return 0 if so; -ELOOP if there is a cycle; -EINVAL if a dependency is invalid
+int wish_check_dag_packet( struct wish_dag_packet* pkt );
+
+// pack a DAG packet
+int wish_pack_dag_packet( struct wish_state* state, struct wish_packet* wp, struct wish_dag_packet* pkt );
+
+// unpack a DAG packet
+int wish_unpack_dag_packet( struct wish_state* state, struct wish_packet* wp, struct wish_dag_packet* pkt );
+
+// free a DAG packet
+int wish_free_dag_packet( struct wish_dag_packet* pkt );
+
+#endif
@@ -22,11 +22,6 @@ static int wish_init_heartbeat_packet_impl( struct wish_state* state, struct wis
       return -errno;
    }
    
-   rc = gettimeofday( &h->sendtime, NULL );
-   if( rc < 0 ) {
-      return -errno;
-   }
-   
    h->loads[0] = sys.loads[0];
    h->loads[1] = sys.loads[1];
    h->loads[2] = sys.loads[2];
@@ -64,17 +59,86 @@ int wish_init_heartbeat_packet_ack( struct wish_state* state, struct wish_heartb
 }
 
 // initialize a wish nget packet
-int wish_init_nget_packet( struct wish_state* state, struct wish_nget_packet* npkt, uint64_t rank, uint32_t props ) {
+int wish_init_nget_packet( struct wish_state* state, struct wish_nget_packet* npkt, uint64_t rank, uint32_t props, uint32_t count ) {
+   memset( npkt, 0, sizeof(struct wish_nget_packet) );
    npkt->rank = rank;
    npkt->props = props;
+   npkt->count = count;
    return 0;
 }
 
+// pack a membership update
+static void wish_pack_member_update( uint8_t* buf, off_t* offset, struct wish_member_update* u ) {
+   wish_pack_uint( buf, offset, u->state );
+   wish_pack_ulong( buf, offset, u->nid );
+   wish_pack_uint( buf, offset, u->incarnation );
+   wish_pack_string( buf, offset, u->hostname );
+   wish_pack_uint( buf, offset, u->portnum );
+   wish_pack_uint( buf, offset, u->seq );
+   wish_pack_ulong( buf, offset, u->load );
+   wish_pack_ulong( buf, offset, u->ram_free );
+   wish_pack_ulong( buf, offset, u->disk_free );
+   wish_pack_uint( buf, offset, u->queue_depth );
+   wish_pack_uint( buf, offset, u->running );
+   wish_pack_uint( buf, offset, u->cpus_free );
+   wish_pack_uint( buf, offset, u->nodes_free );
+}
+
+// the fields of a metrics block, in the order they go out
+static void wish_host_metrics_fields( struct wish_host_metrics* m, uint32_t** fields ) {
+   fields[0] = &m->ncpus;
+   fields[1] = &m->util;
+   fields[2] = &m->cpu_busy;
+   fields[3] = &m->psi_cpu;
+   fields[4] = &m->psi_mem;
+   fields[5] = &m->psi_io;
+   fields[6] = &m->net_rx;
+   fields[7] = &m->net_tx;
+}
+
+// pack a metrics block
+static void wish_pack_host_metrics( uint8_t* buf, off_t* offset, struct wish_host_metrics* m ) {
+   uint32_t* fields[HEARTBEAT_METRICS_FIELDS];
+   wish_host_metrics_fields( m, fields );
+   
+   wish_pack_uint( buf, offset, m->version );
+   wish_pack_uint( buf, offset, HEARTBEAT_METRICS_FIELDS );
+   for( int i = 0; i < HEARTBEAT_METRICS_FIELDS; i++ ) {
+      wish_pack_uint( buf, offset, *fields[i] );
+   }
+}
+
+// unpack a metrics block, skipping fields we don't know of
+static void wish_unpack_host_metrics( struct wish_packet* wp, off_t* offset, struct wish_host_metrics* m ) {
+   uint32_t* fields[HEARTBEAT_METRICS_FIELDS];
+   wish_host_metrics_fields( m, fields );
+   
+   memset( m, 0, sizeof(struct wish_host_metrics) );
+   if( (uint32_t)*offset + 2 * sizeof(uint32_t) > wp->hdr.payload_len )
+      return;
+   
+   m->version = wish_unpack_uint( wp->payload, offset );
+   uint32_t num_fields = wish_unpack_uint( wp->payload, offset );
+   
+   uint32_t room = (wp->hdr.payload_len - *offset) / sizeof(uint32_t);
+   if( num_fields > room )
+      num_fields = room;
+   
+   for( uint32_t i = 0; i < num_fields; i++ ) {
+      uint32_t value = wish_unpack_uint( wp->payload, offset );
+      if( i < HEARTBEAT_METRICS_FIELDS )
+         *fields[i] = value;
+   }
+}
+
 // pack a heartbeat packet
 int wish_pack_heartbeat_packet( struct wish_state* state, struct wish_packet* wp, struct wish_heartbeat_packet* h ) {
    wish_init_header( state, &wp->hdr, PACKET_TYPE_HEARTBEAT );
    
-   uint8_t* packet_buf = (uint8_t*)calloc( sizeof(struct wish_heartbeat_packet), 1 );
+   uint32_t num_updates = (h->updates != NULL ? h->num_updates : 0);
+   
+   size_t len = sizeof(struct wish_heartbeat_packet) + num_updates * sizeof(struct wish_member_update);
+   uint8_t* packet_buf = (uint8_t*)calloc( len, 1 );
    
    off_t offset = 0;
    
@@ -86,8 +150,43 @@ int wish_pack_heartbeat_packet( struct wish_state* state, struct wish_packet* wp
    wish_pack_ulong( packet_buf, &offset, h->ram_free );
    wish_pack_ulong( packet_buf, &offset, h->disk_total );
    wish_pack_ulong( packet_buf, &offset, h->disk_free );
+   wish_pack_uint( packet_buf, &offset, h->queue_depth );
+   wish_pack_uint( packet_buf, &offset, h->running );
+   wish_pack_uint( packet_buf, &offset, h->cpus_free );
+   wish_pack_uint( packet_buf, &offset, h->nodes_free );
+   
+   wish_pack_uint( packet_buf, &offset, h->kind );
+   wish_pack_ulong( packet_buf, &offset, h->target );
+   wish_pack_ulong( packet_buf, &offset, h->nid );
+   wish_pack_uint( packet_buf, &offset, h->incarnation );
+   wish_pack_uint( packet_buf, &offset, h->seq );
+   wish_pack_uint( packet_buf, &offset, h->portnum );
+   wish_pack_string( packet_buf, &offset, h->hostname );
+   wish_pack_uint( packet_buf, &offset, num_updates );
+   
+   for( uint32_t i = 0; i < num_updates; i++ ) {
+      wish_pack_member_update( packet_buf, &offset, &h->updates[i] );
+   }
+   
+   // labels go last, so hosts that don't know of them stop reading before them
+   wish_pack_string( packet_buf, &offset, h->labels );
+   for( uint32_t i = 0; i < num_updates; i++ ) {
+      wish_pack_string( packet_buf, &offset, h->updates[i].labels );
+   }
    
-   wish_init_packet_nocopy( wp, &wp->hdr, packet_buf, sizeof(struct wish_heartbeat_packet) );
+   // and metrics blocks after them
+   wish_pack_host_metrics( packet_buf, &offset, &h->metrics );
+   for( uint32_t i = 0; i < num_updates; i++ ) {
+      wish_pack_host_metrics( packet_buf, &offset, &h->updates[i].metrics );
+   }
+   
+   // then timing
+   wish_pack_ulong( packet_buf, &offset, h->send_mono );
+   wish_pack_ulong( packet_buf, &offset, h->echo_mono );
+   wish_pack_uint( packet_buf, &offset, h->hold );
+   
+   // only send what we packed
+   wish_init_packet_nocopy( wp, &wp->hdr, packet_buf, offset );
    
    return 0;
 }
@@ -102,11 +201,34 @@ int wish_pack_nget_packet( struct wish_state* state, struct wish_packet* wp, str
    
    wish_pack_ulong( packet_buf, &offset, pkt->rank );
    wish_pack_uint( packet_buf, &offset, pkt->props );
+   wish_pack_uint( packet_buf, &offset, pkt->count );
    
-   wish_init_packet_nocopy( wp, &wp->hdr, packet_buf, sizeof(struct wish_nget_packet) );
+   for( int i = 0; i < 4; i++ ) {
+      wish_pack_int( packet_buf, &offset, pkt->weights[i] );
+   }
+   wish_pack_ulong( packet_buf, &offset, pkt->max_latency );
+   wish_pack_ulong( packet_buf, &offset, pkt->max_load );
+   wish_pack_ulong( packet_buf, &offset, pkt->min_ram );
+   wish_pack_ulong( packet_buf, &offset, pkt->min_disk );
+   wish_pack_string( packet_buf, &offset, pkt->labels );
+   
+   wish_init_packet_nocopy( wp, &wp->hdr, packet_buf, offset );
    return 0;
 }
 
+// unpack a string into a fixed-size buffer of len+1 bytes
+static void wish_unpack_fixed_string( uint8_t* buf, off_t* offset, char* str, size_t len ) {
+   char* tmp = wish_unpack_string( buf, offset );
+   strncpy( str, tmp, len );
+   str[len] = 0;
+   free( tmp );
+}
+
+// unpack a hostname into a fixed-size buffer
+static void wish_unpack_hostname( uint8_t* buf, off_t* offset, char* hostname ) {
+   wish_unpack_fixed_string( buf, offset, hostname, HOST_NAME_MAX );
+}
+
 // unpack a heartbeat packet
 int wish_unpack_heartbeat_packet( struct wish_state* state, struct wish_packet* wp, struct wish_heartbeat_packet* h ) {
    off_t offset = 0;
@@ -119,6 +241,90 @@ int wish_unpack_heartbeat_packet( struct wish_state* state, struct wish_packet*
    h->ram_free = wish_unpack_ulong( wp->payload, &offset );
    h->disk_total = wish_unpack_ulong( wp->payload, &offset );
    h->disk_free = wish_unpack_ulong( wp->payload, &offset );
+   h->queue_depth = wish_unpack_uint( wp->payload, &offset );
+   h->running = wish_unpack_uint( wp->payload, &offset );
+   h->cpus_free = wish_unpack_uint( wp->payload, &offset );
+   h->nodes_free = wish_unpack_uint( wp->payload, &offset );
+   
+   h->num_updates = 0;
+   h->updates = NULL;
+   
+   // hosts running older versions don't send the membership fields
+   if( (uint32_t)offset >= wp->hdr.payload_len ) {
+      h->kind = HEARTBEAT_PING;
+      h->target = 0;
+      h->nid = 0;
+      h->incarnation = 0;
+      h->seq = 0;
+      h->portnum = 0;
+      h->hostname[0] = 0;
+      h->labels[0] = 0;
+      memset( &h->metrics, 0, sizeof(struct wish_host_metrics) );
+      h->send_mono = 0;
+      h->echo_mono = 0;
+      h->hold = 0;
+      return 0;
+   }
+   
+   h->kind = wish_unpack_uint( wp->payload, &offset );
+   h->target = wish_unpack_ulong( wp->payload, &offset );
+   h->nid = wish_unpack_ulong( wp->payload, &offset );
+   h->incarnation = wish_unpack_uint( wp->payload, &offset );
+   h->seq = wish_unpack_uint( wp->payload, &offset );
+   h->portnum = wish_unpack_uint( wp->payload, &offset );
+   wish_unpack_hostname( wp->payload, &offset, h->hostname );
+   
+   uint32_t num_updates = wish_unpack_uint( wp->payload, &offset );
+   if( num_updates > HEARTBEAT_MAX_UPDATES )
+      num_updates = HEARTBEAT_MAX_UPDATES;
+   
+   if( num_updates > 0 ) {
+      h->updates = (struct wish_member_update*)calloc( sizeof(struct wish_member_update) * num_updates, 1 );
+      h->num_updates = num_updates;
+   
+      for( uint32_t i = 0; i < num_updates; i++ ) {
+         struct wish_member_update* u = &h->updates[i];
+   
+         u->state = wish_unpack_uint( wp->payload, &offset );
+         u->nid = wish_unpack_ulong( wp->payload, &offset );
+         u->incarnation = wish_unpack_uint( wp->payload, &offset );
+         wish_unpack_hostname( wp->payload, &offset, u->hostname );
+         u->portnum = wish_unpack_uint( wp->payload, &offset );
+         u->seq = wish_unpack_uint( wp->payload, &offset );
+         u->load = wish_unpack_ulong( wp->payload, &offset );
+         u->ram_free = wish_unpack_ulong( wp->payload, &offset );
+         u->disk_free = wish_unpack_ulong( wp->payload, &offset );
+         u->queue_depth = wish_unpack_uint( wp->payload, &offset );
+         u->running = wish_unpack_uint( wp->payload, &offset );
+         u->cpus_free = wish_unpack_uint( wp->payload, &offset );
+         u->nodes_free = wish_unpack_uint( wp->payload, &offset );
+      }
+   }
+   
+   // hosts that don't have labels don't send them
+   h->labels[0] = 0;
+   if( (uint32_t)offset < wp->hdr.payload_len ) {
+      wish_unpack_fixed_string( wp->payload, &offset, h->labels, HEARTBEAT_LABELS_MAX );
+      for( uint32_t i = 0; i < h->num_updates; i++ ) {
+         wish_unpack_fixed_string( wp->payload, &offset, h->updates[i].labels, HEARTBEAT_LABELS_MAX );
+      }
+   }
+   
+   // as are metrics blocks
+   wish_unpack_host_metrics( wp, &offset, &h->metrics );
+   for( uint32_t i = 0; i < h->num_updates; i++ ) {
+      wish_unpack_host_metrics( wp, &offset, &h->updates[i].metrics );
+   }
+   
+   // and timing
+   h->send_mono = 0;
+   h->echo_mono = 0;
+   h->hold = 0;
+   if( (uint32_t)offset + 2 * sizeof(uint64_t) + sizeof(uint32_t) <= wp->hdr.payload_len ) {
+      h->send_mono = wish_unpack_ulong( wp->payload, &offset );
+      h->echo_mono = wish_unpack_ulong( wp->payload, &offset );
+      h->hold = wish_unpack_uint( wp->payload, &offset );
+   }
    
    return 0;
 }
@@ -130,5 +336,38 @@ int wish_unpack_nget_packet( struct wish_state* state, struct wish_packet* wp, s
    pkt->rank = wish_unpack_ulong( wp->payload, &offset );
    pkt->props = wish_unpack_uint( wp->payload, &offset );
    
+   // older clients don't ask for a count, or send a query
+   pkt->count = 0;
+   if( (uint32_t)offset + sizeof(uint32_t) <= wp->hdr.payload_len )
+      pkt->count = wish_unpack_uint( wp->payload, &offset );
+   
+   memset( pkt->weights, 0, sizeof(pkt->weights) );
+   pkt->max_latency = 0;
+   pkt->max_load = 0;
+   pkt->min_ram = 0;
+   pkt->min_disk = 0;
+   pkt->labels[0] = 0;
+   
+   if( (uint32_t)offset < wp->hdr.payload_len ) {
+      for( int i = 0; i < 4; i++ ) {
+         pkt->weights[i] = wish_unpack_int( wp->payload, &offset );
+      }
+      pkt->max_latency = wish_unpack_ulong( wp->payload, &offset );
+      pkt->max_load = wish_unpack_ulong( wp->payload, &offset );
+      pkt->min_ram = wish_unpack_ulong( wp->payload, &offset );
+      pkt->min_disk = wish_unpack_ulong( wp->payload, &offset );
+      wish_unpack_fixed_string( wp->payload, &offset, pkt->labels, HEARTBEAT_LABELS_MAX );
+   }
+   
+   return 0;
+}
+
+// free a heartbeat packet's updates
+int wish_free_heartbeat_packet( struct wish_heartbeat_packet* h ) {
+   if( h->updates ) {
+      free( h->updates );
+      h->updates = NULL;
+   }
+   h->num_updates = 0;
    return 0;
 }
@@ -12,7 +12,65 @@
 #define HEARTBEAT_PROP_RAM     0x3
 #define HEARTBEAT_PROP_DISK    0x4
 #define HEARTBEAT_PROP_COUNT   0x5
+#define HEARTBEAT_PROP_QUERY   0x6     // rank hosts that pass a query's filters by its weighted score
 
+// kinds of heartbeat, in the membership protocol
+#define HEARTBEAT_PING         0     // a probe; the receiver acks it
+#define HEARTBEAT_ACK          1     // the answer to a probe (relayed on behalf of target, if target is set)
+#define HEARTBEAT_PING_REQ     2     // asks the receiver to probe target for the sender
+
+// most membership updates carried on one heartbeat
+#define HEARTBEAT_MAX_UPDATES  8
+
+// longest list of labels a host can announce
+#define HEARTBEAT_LABELS_MAX   127
+
+// what a host is, to the rest of the instance
+#define MEMBER_ALIVE           0
+#define MEMBER_SUSPECT         1     // missed a probe; dead unless it refutes it in time
+#define MEMBER_DEAD            2
+#define MEMBER_LEFT            3     // shut down on purpose
+
+// the metrics block hosts announce.  Each version only adds fields at the end: it goes out as a version, a count of
+// fields, and that many 32-bit fields, so hosts skip fields newer than they know of and take ones older hosts don't
+// send as 0.
+#define HEARTBEAT_METRICS_VERSION  1
+#define HEARTBEAT_METRICS_FIELDS   8
+
+// how busy a host is, beyond its load average, as its sampler last found it
+struct wish_host_metrics {
+   uint32_t version;             // 0 if the host sent none
+   uint32_t ncpus;               // online cores
+   uint32_t util;                // utilization, in thousandths of every core: the greater of cpu_busy and load per core
+   uint32_t cpu_busy;            // share of all cores' time spent busy over the last sample interval, in thousandths
+   uint32_t psi_cpu;             // share of the last 10s some task stalled on CPU, memory, or I/O (/proc/pressure), in thousandths
+   uint32_t psi_mem;
+   uint32_t psi_io;
+   uint32_t net_rx;              // received and sent over every interface but loopback, in KiB/s
+   uint32_t net_tx;
+};
+
+// news about one host, passed along on heartbeats
+struct wish_member_update {
+   uint32_t state;               // MEMBER_*
+   uint64_t nid;
+   uint32_t incarnation;         // only the host itself raises it, to refute news that it's suspect
+   char hostname[HOST_NAME_MAX+1];
+   uint32_t portnum;
+   
+   // the host's condition, as of its own counter seq (0 if not carried)
+   uint32_t seq;
+   uint64_t load;
+   uint64_t ram_free;
+   uint64_t disk_free;
+   uint32_t queue_depth;
+   uint32_t running;
+   uint32_t cpus_free;
+   uint32_t nodes_free;
+   
+   char labels[HEARTBEAT_LABELS_MAX+1];   // comma-separated labels from the host's config file ("" if not carried)
+   struct wish_host_metrics metrics;
+};
 
 struct wish_heartbeat_packet {
    uint32_t id;
@@ -21,28 +79,63 @@ struct wish_heartbeat_packet {
    uint64_t ram_free;
    uint64_t disk_total;
    uint64_t disk_free;
+   uint32_t queue_depth;         // jobs waiting in the sender's scheduler queue
+   uint32_t running;             // jobs running on the sender
+   uint32_t cpus_free;           // cores on the sender not held by a pinned job
+   uint32_t nodes_free;          // NUMA nodes on the sender with no pinned job on them
+   
+   // membership protocol
+   uint32_t kind;                // HEARTBEAT_*
+   uint64_t target;              // host a PING_REQ (or relayed ACK) is about
+   uint64_t nid;                 // sender
+   uint32_t incarnation;         // sender's incarnation
+   uint32_t seq;                 // sender's counter for the condition above
+   uint32_t portnum;             // sender's listening port
+   char hostname[HOST_NAME_MAX+1];  // sender's hostname
+   uint32_t num_updates;
+   struct wish_member_update* updates;    // piggybacked membership news (malloc'ed)
+   char labels[HEARTBEAT_LABELS_MAX+1];   // sender's labels
+   struct wish_host_metrics metrics;      // sender's metrics block
+   
+   // timing, by the sender's monotonic clock, so an ack carries what's needed to time it (0 from older hosts)
+   uint64_t send_mono;           // when it was sent, in microseconds
+   uint64_t echo_mono;           // on an ACK: the send_mono of the PING it answers
+   uint32_t hold;                // on an ACK: microseconds between that PING arriving and the ACK going out
    
    // not sent; used internally
-   int64_t latency;              // latency, in microseconds
-   struct timeval sendtime;      // send time
+   uint64_t recv_mono;           // when it arrived, in microseconds of our monotonic clock
 };
 
 struct wish_nget_packet {
    uint64_t rank;
    uint32_t props;
+   uint32_t count;               // ranks wanted, starting at rank (0 from older clients, meaning 1)
+   
+   // HEARTBEAT_PROP_QUERY: of the hosts that pass every filter and have every label, rank lowest first by
+   //   w_latency * latency (ms) + w_load * utilization - w_ram * free RAM (GB) - w_disk * free disk (GB)
+   // where utilization is 1 when every core is busy (see wish_host_metrics.util)
+   int32_t weights[4];           // w_latency, w_load, w_ram, w_disk, in thousandths
+   uint64_t max_latency;         // in microseconds (0 for no limit)
+   uint64_t max_load;            // utilization, in thousandths (0 for no limit)
+   uint64_t min_ram;             // free RAM, in bytes (0 for no limit)
+   uint64_t min_disk;            // free disk, in bytes (0 for no limit)
+   char labels[HEARTBEAT_LABELS_MAX+1];   // comma-separated labels a host must all have ("" for any)
 };
 
 // make a heartbeat packet, by reading the state of the system
 int wish_init_heartbeat_packet( struct wish_state* state, struct wish_heartbeat_packet* h );
 int wish_init_heartbeat_packet_ack( struct wish_state* state, struct wish_heartbeat_packet* ack, struct wish_heartbeat_packet* original );
-int wish_init_nget_packet( struct wish_state* state, struct wish_nget_packet* npkt, uint64_t rank, uint32_t props );
+int wish_init_nget_packet( struct wish_state* state, struct wish_nget_packet* npkt, uint64_t rank, uint32_t props, uint32_t count );
 
 // pack a heartbeat packet
 int wish_pack_heartbeat_packet( struct wish_state* state, struct wish_packet* wp, struct wish_heartbeat_packet* h );
 int wish_pack_nget_packet( struct wish_state* state, struct wish_packet* wp, struct wish_nget_packet* npkt );
 
-// unpack a heartbeat packet
+// unpack a heartbeat packet (free it with wish_free_heartbeat_packet)
 int wish_unpack_heartbeat_packet( struct wish_state* state, struct wish_packet* wp, struct wish_heartbeat_packet* h );
 int wish_unpack_nget_packet( struct wish_state* state, struct wish_packet* wp, struct wish_nget_packet* npkt );
 
+// free a heartbeat packet's updates
+int wish_free_heartbeat_packet( struct wish_heartbeat_packet* h );
+
 #endif
\ No newline at end of file
@@ -0,0 +1,228 @@
+#include "job_array_packet.h"
+
+// duplicate a string, or return NULL
+static char* wish_job_array_strdup( char const* str ) {
+   return str ? strdup( str ) : NULL;
+}
+
+// unpack a string, turning "" into NULL
+static char* wish_job_array_unpack_path( uint8_t* buf, off_t* offset ) {
+   char* str = wish_unpack_string( buf, offset );
+   if( strlen(str) == 0 ) {
+      free( str );
+      return NULL;
+   }
+   return str;
+}
+
+// make a job array packet
+void wish_init_job_array_packet( struct wish_state* state, struct wish_job_array_packet* pkt, uint64_t array_id, uint32_t count, char** hosts, uint32_t num_hosts, uint32_t select,
+                                 char* cmd, char* stdin_path, char* stdout_path, char* stderr_path, uid_t owner, gid_t group, int umask, uint32_t flags, time_t timeout ) {
+   memset( pkt, 0, sizeof(struct wish_job_array_packet) );
+
+   pkt->array_id = array_id;
+   pkt->count = count;
+   pkt->select = select;
+   pkt->flags = flags;
+   pkt->timeout = timeout;
+
+   pkt->num_hosts = num_hosts;
+   if( num_hosts > 0 ) {
+      pkt->hosts = (char**)calloc( sizeof(char*) * num_hosts, 1 );
+      for( uint32_t i = 0; i < num_hosts; i++ ) {
+         pkt->hosts[i] = strdup( hosts[i] );
+      }
+   }
+
+   pkt->cmd_text = strdup( cmd );
+   pkt->stdin_path = wish_job_array_strdup( stdin_path );
+   pkt->stdout_path = wish_job_array_strdup( stdout_path );
+   pkt->stderr_path = wish_job_array_strdup( stderr_path );
+
+   pkt->umask = umask;
+   pkt->owner = owner;
+   pkt->group = group;
+}
+
+
+// pack a job array packet
+int wish_pack_job_array_packet( struct wish_state* state, struct wish_packet* wp, struct wish_job_array_packet* pkt ) {
+   wish_init_header( state, &wp->hdr, PACKET_TYPE_JOB_ARRAY );
+
+   char* empty = (char*)"";
+   char* stdin_path = pkt->stdin_path ? pkt->stdin_path : empty;
+   char* stdout_path = pkt->stdout_path ? pkt->stdout_path : empty;
+   char* stderr_path = pkt->stderr_path ? pkt->stderr_path : empty;
+
+   size_t len = sizeof(pkt->array_id) + sizeof(pkt->count) + sizeof(pkt->num_hosts) + sizeof(pkt->select) + sizeof(pkt->flags) + sizeof(int64_t) +
+                strlen( pkt->cmd_text ) + 1 + strlen( stdin_path ) + 1 + strlen( stdout_path ) + 1 + strlen( stderr_path ) + 1 +
+                sizeof(pkt->umask) + sizeof(pkt->owner) + sizeof(pkt->group) +
+                sizeof(pkt->num_gpids) + sizeof(uint64_t) * pkt->num_gpids;
+
+   for( uint32_t i = 0; i < pkt->num_hosts; i++ ) {
+      len += strlen( pkt->hosts[i] ) + 1;
+   }
+
+   uint8_t* buf = (uint8_t*)calloc( len, 1 );
+
+   off_t offset = 0;
+   wish_pack_ulong( buf, &offset, pkt->array_id );
+   wish_pack_uint( buf, &offset, pkt->count );
+   wish_pack_uint( buf, &offset, pkt->num_hosts );
+   wish_pack_uint( buf, &offset, pkt->select );
+   wish_pack_uint( buf, &offset, pkt->flags );
+   wish_pack_long( buf, &offset, pkt->timeout );
+   wish_pack_string( buf, &offset, pkt->cmd_text );
+   wish_pack_string( buf, &offset, stdin_path );
+   wish_pack_string( buf, &offset, stdout_path );
+   wish_pack_string( buf, &offset, stderr_path );
+   wish_pack_uint( buf, &offset, pkt->umask );
+   wish_pack_uint( buf, &offset, pkt->owner );
+   wish_pack_uint( buf, &offset, pkt->group );
+
+   for( uint32_t i = 0; i < pkt->num_hosts; i++ ) {
+      wish_pack_string( buf, &offset, pkt->hosts[i] );
+   }
+
+   wish_pack_uint( buf, &offset, pkt->num_gpids );
+   for( uint32_t i = 0; i < pkt->num_gpids; i++ ) {
+      wish_pack_ulong( buf, &offset, pkt->gpids[i] );
+   }
+
+   wish_init_packet_nocopy( wp, &wp->hdr, buf, len );
+
+   return 0;
+}
+
+
+// unpack a job array packet
+int wish_unpack_job_array_packet( struct wish_state* state, struct wish_packet* wp, struct wish_job_array_packet* pkt ) {
+   memset( pkt, 0, sizeof(struct wish_job_array_packet) );
+
+   off_t offset = 0;
+   pkt->array_id = wish_unpack_ulong( wp->payload, &offset );
+   pkt->count = wish_unpack_uint( wp->payload, &offset );
+   pkt->num_hosts = wish_unpack_uint( wp->payload, &offset );
+   pkt->select = wish_unpack_uint( wp->payload, &offset );
+   pkt->flags = wish_unpack_uint( wp->payload, &offset );
+   pkt->timeout = wish_unpack_long( wp->payload, &offset );
+   pkt->cmd_text = wish_unpack_string( wp->payload, &offset );
+   pkt->stdin_path = wish_job_array_unpack_path( wp->payload, &offset );
+   pkt->stdout_path = wish_job_array_unpack_path( wp->payload, &offset );
+   pkt->stderr_path = wish_job_array_unpack_path( wp->payload, &offset );
+   pkt->umask = wish_unpack_uint( wp->payload, &offset );
+   pkt->owner = wish_unpack_uint( wp->payload, &offset );
+   pkt->group = wish_unpack_uint( wp->payload, &offset );
+
+   if( pkt->num_hosts > JOB_ARRAY_MAX_INSTANCES ) {
+      pkt->num_hosts = 0;
+      return -EINVAL;
+   }
+
+   if( pkt->num_hosts > 0 ) {
+      pkt->hosts = (char**)calloc( sizeof(char*) * pkt->num_hosts, 1 );
+      for( uint32_t i = 0; i < pkt->num_hosts; i++ ) {
+         pkt->hosts[i] = wish_unpack_string( wp->payload, &offset );
+      }
+   }
+
+   pkt->num_gpids = wish_unpack_uint( wp->payload, &offset );
+   if( pkt->num_gpids > JOB_ARRAY_MAX_INSTANCES ) {
+      pkt->num_gpids = 0;
+      return -EINVAL;
+   }
+
+   if( pkt->num_gpids > 0 ) {
+      pkt->gpids = (uint64_t*)calloc( sizeof(uint64_t) * pkt->num_gpids, 1 );
+      for( uint32_t i = 0; i < pkt->num_gpids; i++ ) {
+         pkt->gpids[i] = wish_unpack_ulong( wp->payload, &offset );
+      }
+   }
+
+   if( offset > (off_t)wp->hdr.payload_len )
+      return -EINVAL;
+
+   return 0;
+}
+
+
+// free a job array packet
+int wish_free_job_array_packet( struct wish_job_array_packet* pkt ) {
+   if( pkt->hosts ) {
+      for( uint32_t i = 0; i < pkt->num_hosts; i++ ) {
+         free( pkt->hosts[i] );
+      }
+      free( pkt->hosts );
+      pkt->hosts = NULL;
+   }
+   if( pkt->cmd_text ) {
+      free( pkt->cmd_text );
+      pkt->cmd_text = NULL;
+   }
+   if( pkt->stdin_path ) {
+      free( pkt->stdin_path );
+      pkt->stdin_path = NULL;
+   }
+   if( pkt->stdout_path ) {
+      free( pkt->stdout_path );
+      pkt->stdout_path = NULL;
+   }
+   if( pkt->stderr_path ) {
+      free( pkt->stderr_path );
+      pkt->stderr_path = NULL;
+   }
+   if( pkt->gpids ) {
+      free( pkt->gpids );
+      pkt->gpids = NULL;
+   }
+   return 0;
+}
+
+
+// fill in an instance's copy of a template
+char* wish_job_array_expand( char const* tmpl, uint32_t index, char const* host ) {
+   if( tmpl == NULL )
+      return NULL;
+
+   char index_txt[20];
+   sprintf( index_txt, "%u", index );
+
+   size_t index_pattern_len = strlen( JOB_ARRAY_INDEX_PATTERN );
+   size_t host_pattern_len = strlen( JOB_ARRAY_HOST_PATTERN );
+
+   // work out how big the result will be
+   size_t len = 0;
+   for( char const* p = tmpl; *p != 0; ) {
+      if( strncmp( p, JOB_ARRAY_INDEX_PATTERN, index_pattern_len ) == 0 ) {
+         len += strlen( index_txt );
+         p += index_pattern_len;
+      }
+      else if( strncmp( p, JOB_ARRAY_HOST_PATTERN, host_pattern_len ) == 0 ) {
+         len += strlen( host );
+         p += host_pattern_len;
+      }
+      else {
+         len++;
+         p++;
+      }
+   }
+
+   char* ret = (char*)calloc( len + 1, 1 );
+   char* out = ret;
+
+   for( char const* p = tmpl; *p != 0; ) {
+      if( strncmp( p, JOB_ARRAY_INDEX_PATTERN, index_pattern_len ) == 0 ) {
+         out = stpcpy( out, index_txt );
+         p += index_pattern_len;
+      }
+      else if( strncmp( p, JOB_ARRAY_HOST_PATTERN, host_pattern_len ) == 0 ) {
+         out = stpcpy( out, host );
+         p += host_pattern_len;
+      }
+      else {
+         *out++ = *p++;
+      }
+   }
+
+   return ret;
+}
@@ -0,0 +1,57 @@
+// packet describing an array of jobs: one command template, run as many instances, either on a list of hosts
+// or on hosts the origin picks.  The origin expands and dispatches every instance, and replies with the same
+// packet type carrying the gpid of each instance.
+
+#ifndef _JOB_ARRAY_PACKET_H_
+#define _JOB_ARRAY_PACKET_H_
+
+#include "libwish.h"
+
+#define PACKET_TYPE_JOB_ARRAY 124
+
+// placeholders in the command, stdin, stdout, and stderr templates
+#define JOB_ARRAY_INDEX_PATTERN "{#}"        // replaced with the instance's index (starting from 0)
+#define JOB_ARRAY_HOST_PATTERN  "{host}"     // replaced with the name of the host the instance runs on
+
+#define JOB_ARRAY_MAX_INSTANCES 65536
+
+struct wish_job_array_packet {
+   uint64_t array_id;         // gpid of the array as a whole, which pjoin can wait on (0 to have the origin pick one)
+   uint32_t count;            // number of instances
+   uint32_t num_hosts;        // number of hosts in hosts.  If 0, the origin picks hosts itself, ranked by select.
+   char** hosts;              // hosts to run on; instance i runs on hosts[i % num_hosts]
+   uint32_t select;           // HEARTBEAT_PROP_* to rank hosts by if no hosts are given (HEARTBEAT_PROP_NONE for configuration order)
+   uint32_t flags;            // job options (JOB_*)
+   time_t timeout;            // maximum amount of time each instance is allowed to run, in seconds (-1 for infinite)
+
+   char* cmd_text;            // shell command (or file, with JOB_USE_FILE) template
+   char* stdin_path;          // stdin template (NULL for none)
+   char* stdout_path;         // stdout template (NULL to send output to the client)
+   char* stderr_path;         // stderr template (NULL to send output to the client)
+   uint32_t umask;
+   uint32_t owner;
+   uint32_t group;
+
+   // filled in by the origin's reply
+   uint32_t num_gpids;        // number of entries in gpids
+   uint64_t* gpids;           // gpid of each instance, by index (0 if it could not be dispatched)
+};
+
+// make a job array packet.  Everything is duplicated.
+void wish_init_job_array_packet( struct wish_state* state, struct wish_job_array_packet* pkt, uint64_t array_id, uint32_t count, char** hosts, uint32_t num_hosts, uint32_t select,
+                                 char* cmd, char* stdin_path, char* stdout_path, char* stderr_path, uid_t owner, gid_t group, int umask, uint32_t flags, time_t timeout );
+
+// pack a job array packet
+int wish_pack_job_array_packet( struct wish_state* state, struct wish_packet* wp, struct wish_job_array_packet* pkt );
+
+// unpack a job array packet
+int wish_unpack_job_array_packet( struct wish_state* state, struct wish_packet* wp, struct wish_job_array_packet* pkt );
+
+// free a job array packet
+int wish_free_job_array_packet( struct wish_job_array_packet* pkt );
+
+// fill in an instance's copy of a template.
+// the caller must free the returned string.  Returns NULL if tmpl is NULL.
+char* wish_job_array_expand( char const* tmpl, uint32_t index, char const* host );
+
+#endif
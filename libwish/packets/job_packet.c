@@ -81,6 +81,12 @@ int wish_pack_job_packet( struct wish_state* state, struct wish_packet* wp, stru
                 sizeof(struct sockaddr_storage) * pkt->visited_len + 
                 sizeof(char) * (cmd_len + 1) +
                 sizeof(char) * (stdin_url_len + 1);
+   
+   // if this is a daemon-created packet, then add the content hashes of the files to download
+   if( pkt->flags & JOB_WISH_ORIGIN ) {
+      len += (pkt->cmd_hash ? strlen( pkt->cmd_hash ) : 0) + 1;
+      len += (pkt->stdin_hash ? strlen( pkt->stdin_hash ) : 0) + 1;
+   }
                 
    // if this is a client-created packet, then add the additional information such as stdout, stderr, and metadata
    if( !(pkt->flags & JOB_WISH_ORIGIN) ) {
@@ -107,6 +113,7 @@ int wish_pack_job_packet( struct wish_state* state, struct wish_packet* wp, stru
    wish_pack_long( packet_buf, &offset, pkt->timeout );
    wish_pack_int( packet_buf, &offset, pkt->origin_http_portnum );
    wish_pack_ulong( packet_buf, &offset, pkt->gpid );
+   wish_pack_uint( packet_buf, &offset, pkt->cpus );
    wish_pack_string( packet_buf, &offset, pkt->cmd_text );
    wish_pack_string( packet_buf, &offset, pkt->stdin_url );
    
@@ -114,6 +121,11 @@ int wish_pack_job_packet( struct wish_state* state, struct wish_packet* wp, stru
       wish_pack_sockaddr( packet_buf, &offset, &pkt->visited[i] );
    }
    
+   if( pkt->flags & JOB_WISH_ORIGIN ) {
+      wish_pack_string( packet_buf, &offset, pkt->cmd_hash ? pkt->cmd_hash : (char*)"" );
+      wish_pack_string( packet_buf, &offset, pkt->stdin_hash ? pkt->stdin_hash : (char*)"" );
+   }
+   
    if( !(pkt->flags & JOB_WISH_ORIGIN) ) {
       if( pkt->stdout_path ) {
          wish_pack_string( packet_buf, &offset, pkt->stdout_path );
@@ -154,6 +166,7 @@ int wish_unpack_job_packet( struct wish_state* state, struct wish_packet* wp, st
    pkt->timeout = wish_unpack_long( wp->payload, &offset );
    pkt->origin_http_portnum = wish_unpack_int( wp->payload, &offset );
    pkt->gpid = wish_unpack_ulong( wp->payload, &offset );
+   pkt->cpus = wish_unpack_uint( wp->payload, &offset );
    pkt->cmd_text = wish_unpack_string( wp->payload, &offset );
    pkt->stdin_url = wish_unpack_string( wp->payload, &offset );
    
@@ -169,6 +182,20 @@ int wish_unpack_job_packet( struct wish_state* state, struct wish_packet* wp, st
       free( v );
    }
    
+   if( pkt->flags & JOB_WISH_ORIGIN ) {
+      pkt->cmd_hash = wish_unpack_string( wp->payload, &offset );
+      if( strlen(pkt->cmd_hash) == 0 ) {
+         free( pkt->cmd_hash );
+         pkt->cmd_hash = NULL;
+      }
+      
+      pkt->stdin_hash = wish_unpack_string( wp->payload, &offset );
+      if( strlen(pkt->stdin_hash) == 0 ) {
+         free( pkt->stdin_hash );
+         pkt->stdin_hash = NULL;
+      }
+   }
+   
    if( !(pkt->flags & JOB_WISH_ORIGIN) ) {
       char* str = wish_unpack_string( wp->payload, &offset );
       if( strlen(str) > 0 ) {
@@ -209,6 +236,14 @@ int wish_free_job_packet( struct wish_job_packet* pkt ) {
       free( pkt->stdin_url );
       pkt->stdin_url = NULL;
    }
+   if( pkt->cmd_hash ) {
+      free( pkt->cmd_hash );
+      pkt->cmd_hash = NULL;
+   }
+   if( pkt->stdin_hash ) {
+      free( pkt->stdin_hash );
+      pkt->stdin_hash = NULL;
+   }
    return 0;
 }
 
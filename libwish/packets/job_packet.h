@@ -9,6 +9,15 @@
 
 #define JOB_DETACHED    0x1      // don't need to join with process
 #define JOB_USE_FILE    0x4      // the command text refers to a file on the origin to be downloaded and executed
+#define JOB_STREAM_STDIN 0x8     // feed stdin to the job as it downloads, instead of downloading it to disk first
+#define JOB_BROADCAST   0x10     // run the job on many hosts through a launch tree.  A bcast packet with the hosts follows
+                                 // the job packet.  ttl is how many more levels the tree may go down, and visited is the
+                                 // path from the origin (which stays first) to the sender.
+#define JOB_SCHEDULE    0x20     // queue the job on the origin, which picks the host to run it on.  A sched packet with the
+                                 // placement policy follows the job packet.
+#define JOB_NUMA_NODE   0x40     // run the job alone on a whole NUMA node of its executor (instead of on cpus cores)
+#define JOB_CREDIT      0x80     // the origin grants output credit as it consumes output (see PROCESS_TYPE_CREDIT).  Executors
+                                 // send output to origins that don't set this as fast as they'll take it.
 
 #define JOB_WISH_ORIGIN 0x2      // job came from a WISH daemon, not a client. 
                                  // if this is NOT set (i.e. the wish_job_packet came
@@ -25,11 +34,14 @@ struct wish_job_packet {
    uint32_t flags;            // job options
    uint64_t gpid;             // the global PID of the process
    time_t timeout;            // maximum amount of time this process is allowed to run, in seconds (-1 for infinite)
+   uint32_t cpus;             // number of cores of its own the job runs on (0 to run wherever the executor's kernel puts it)
    
    char* cmd_text;            // shell command text
    char* stdin_url;           // stdin url on the origin host
    struct sockaddr_storage* visited;  // list of sockaddrs of nodes this packet has passed through
    int origin_http_portnum;   // port number of origin's HTTP server
+   char* cmd_hash;            // SHA-256 of the file at cmd_text, if JOB_USE_FILE is set (NULL if unknown)
+   char* stdin_hash;          // SHA-256 of the file at stdin_url (NULL if unknown)
    
    // used locally for routing stdout
    uint32_t umask;
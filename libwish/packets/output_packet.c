@@ -0,0 +1,65 @@
+#include "output_packet.h"
+
+// make an output packet
+void wish_init_output_packet( struct wish_state* state, struct wish_output_packet* pkt, uint32_t type, uint64_t gpid, uint64_t offset, uint32_t flags, uint32_t stream, char const* data ) {
+   memset( pkt, 0, sizeof(struct wish_output_packet) );
+   
+   pkt->type = type;
+   pkt->gpid = gpid;
+   pkt->offset = offset;
+   pkt->flags = flags;
+   pkt->stream = stream;
+   
+   if( data )
+      pkt->data = strdup( data );
+}
+
+
+// pack an output packet
+int wish_pack_output_packet( struct wish_state* state, struct wish_packet* wp, struct wish_output_packet* pkt ) {
+   wish_init_header( state, &wp->hdr, PACKET_TYPE_OUTPUT );
+   
+   char* data = (pkt->data ? pkt->data : (char*)"");
+   
+   size_t len = sizeof(pkt->type) + sizeof(pkt->gpid) + sizeof(pkt->offset) + sizeof(pkt->flags) + sizeof(pkt->stream) + strlen(data) + 1;
+   
+   uint8_t* buf = (uint8_t*)calloc( len, 1 );
+   
+   off_t offset = 0;
+   wish_pack_uint( buf, &offset, pkt->type );
+   wish_pack_ulong( buf, &offset, pkt->gpid );
+   wish_pack_ulong( buf, &offset, pkt->offset );
+   wish_pack_uint( buf, &offset, pkt->flags );
+   wish_pack_uint( buf, &offset, pkt->stream );
+   wish_pack_string( buf, &offset, data );
+   
+   wish_init_packet_nocopy( wp, &wp->hdr, buf, len );
+   
+   return 0;
+}
+
+
+// unpack an output packet
+int wish_unpack_output_packet( struct wish_state* state, struct wish_packet* wp, struct wish_output_packet* pkt ) {
+   memset( pkt, 0, sizeof(struct wish_output_packet) );
+   
+   off_t offset = 0;
+   pkt->type = wish_unpack_uint( wp->payload, &offset );
+   pkt->gpid = wish_unpack_ulong( wp->payload, &offset );
+   pkt->offset = wish_unpack_ulong( wp->payload, &offset );
+   pkt->flags = wish_unpack_uint( wp->payload, &offset );
+   pkt->stream = wish_unpack_uint( wp->payload, &offset );
+   pkt->data = wish_unpack_string( wp->payload, &offset );
+   
+   return 0;
+}
+
+
+// free an output packet
+int wish_free_output_packet( struct wish_output_packet* pkt ) {
+   if( pkt->data ) {
+      free( pkt->data );
+      pkt->data = NULL;
+   }
+   return 0;
+}
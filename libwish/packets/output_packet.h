@@ -0,0 +1,45 @@
+// packet for attaching to a job's output on its origin, and for replaying it.
+// a client sends an OUTPUT_ATTACH with the log offset to start from.  The origin replies with OUTPUT_DATA packets
+// for the output it still has from that offset on (each carrying its stream and its offset in the job's log), then
+// an OUTPUT_END.  A client that asks to follow gets OUTPUT_DATA as new output comes in, until the job ends.
+
+#ifndef _OUTPUT_PACKET_H_
+#define _OUTPUT_PACKET_H_
+
+#include "libwish.h"
+
+#define PACKET_TYPE_OUTPUT 128
+
+// what an output packet is
+#define OUTPUT_ATTACH      0x1      // request to replay (and maybe follow) a job's output
+#define OUTPUT_DATA        0x2      // some of the job's output
+#define OUTPUT_END         0x3      // no more output will be sent on this connection
+
+// attach options (in wish_output_packet.flags of an OUTPUT_ATTACH)
+#define OUTPUT_FOLLOW      0x1      // after replaying, keep sending output as it comes in, until the job ends
+
+// end status (in wish_output_packet.flags of an OUTPUT_END)
+#define OUTPUT_CLOSED      0x1      // the job has ended, so its log is complete
+
+struct wish_output_packet {
+   uint32_t type;             // OUTPUT_*
+   uint64_t gpid;             // job whose output this is
+   uint64_t offset;           // ATTACH: log offset to replay from.  DATA: log offset of data.  END: log offset to resume from.
+   uint32_t flags;            // ATTACH: OUTPUT_FOLLOW.  END: OUTPUT_CLOSED.
+   uint32_t stream;           // DATA: STRING_STDOUT or STRING_STDERR
+   char* data;                // DATA: the output (NULL otherwise)
+};
+
+// make an output packet.  data is duplicated if not NULL.
+void wish_init_output_packet( struct wish_state* state, struct wish_output_packet* pkt, uint32_t type, uint64_t gpid, uint64_t offset, uint32_t flags, uint32_t stream, char const* data );
+
+// pack an output packet
+int wish_pack_output_packet( struct wish_state* state, struct wish_packet* wp, struct wish_output_packet* pkt );
+
+// unpack an output packet
+int wish_unpack_output_packet( struct wish_state* state, struct wish_packet* wp, struct wish_output_packet* pkt );
+
+// free an output packet
+int wish_free_output_packet( struct wish_output_packet* pkt );
+
+#endif
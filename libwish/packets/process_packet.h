@@ -19,6 +19,13 @@
 #define PROCESS_TYPE_PSIGALL  0x9
 #define PROCESS_TYPE_ACK      0xA
 #define PROCESS_TYPE_GET_GPID 0xB      // wish_process_packet.data is the local pid to look up
+#define PROCESS_TYPE_CREDIT   0xC      // wish_process_packet.data is the number of additional output bytes the origin will accept
+#define PROCESS_TYPE_ARRAY    0xD      // reply to a pjoin on a job array: wish_process_packet.data is the number of per-instance replies that follow
+#define PROCESS_TYPE_STEAL    0xE      // an idle daemon asks for up to wish_process_packet.data queued jobs; wish_process_packet.gpid is its nid.
+                                       // the reply's data is how many it will be sent, as ordinary jobs.
+
+// pjoin options (in wish_process_packet.signal)
+#define PROCESS_JOIN_USAGE    0x1      // after the exit status, also send back the job's wish_usage_packet
 
 // it is IMPERATIVE that this fits into a single TCP segment!
 struct wish_process_packet {
@@ -0,0 +1,89 @@
+#include "sched_packet.h"
+
+// make a sched packet
+void wish_init_sched_packet( struct wish_state* state, struct wish_sched_packet* pkt, uint32_t policy, uint64_t min_ram, uint64_t min_disk, uint32_t max_load, char** hosts, uint32_t num_hosts ) {
+   memset( pkt, 0, sizeof(struct wish_sched_packet) );
+   
+   pkt->policy = policy;
+   pkt->min_ram = min_ram;
+   pkt->min_disk = min_disk;
+   pkt->max_load = max_load;
+   
+   pkt->num_hosts = num_hosts;
+   if( num_hosts > 0 ) {
+      pkt->hosts = (char**)calloc( sizeof(char*) * num_hosts, 1 );
+      for( uint32_t i = 0; i < num_hosts; i++ ) {
+         pkt->hosts[i] = strdup( hosts[i] );
+      }
+   }
+}
+
+
+// pack a sched packet
+int wish_pack_sched_packet( struct wish_state* state, struct wish_packet* wp, struct wish_sched_packet* pkt ) {
+   wish_init_header( state, &wp->hdr, PACKET_TYPE_SCHED );
+   
+   size_t len = sizeof(pkt->policy) + sizeof(pkt->min_ram) + sizeof(pkt->min_disk) + sizeof(pkt->max_load) + sizeof(pkt->num_hosts);
+   
+   for( uint32_t i = 0; i < pkt->num_hosts; i++ ) {
+      len += strlen( pkt->hosts[i] ) + 1;
+   }
+   
+   uint8_t* buf = (uint8_t*)calloc( len, 1 );
+   
+   off_t offset = 0;
+   wish_pack_uint( buf, &offset, pkt->policy );
+   wish_pack_ulong( buf, &offset, pkt->min_ram );
+   wish_pack_ulong( buf, &offset, pkt->min_disk );
+   wish_pack_uint( buf, &offset, pkt->max_load );
+   
+   wish_pack_uint( buf, &offset, pkt->num_hosts );
+   for( uint32_t i = 0; i < pkt->num_hosts; i++ ) {
+      wish_pack_string( buf, &offset, pkt->hosts[i] );
+   }
+   
+   wish_init_packet_nocopy( wp, &wp->hdr, buf, len );
+   
+   return 0;
+}
+
+
+// unpack a sched packet
+int wish_unpack_sched_packet( struct wish_state* state, struct wish_packet* wp, struct wish_sched_packet* pkt ) {
+   memset( pkt, 0, sizeof(struct wish_sched_packet) );
+   
+   off_t offset = 0;
+   pkt->policy = wish_unpack_uint( wp->payload, &offset );
+   pkt->min_ram = wish_unpack_ulong( wp->payload, &offset );
+   pkt->min_disk = wish_unpack_ulong( wp->payload, &offset );
+   pkt->max_load = wish_unpack_uint( wp->payload, &offset );
+   
+   uint32_t num_hosts = wish_unpack_uint( wp->payload, &offset );
+   if( num_hosts > SCHED_MAX_HOSTS ) {
+      return -EINVAL;
+   }
+   
+   if( num_hosts > 0 ) {
+      pkt->hosts = (char**)calloc( sizeof(char*) * num_hosts, 1 );
+      for( uint32_t i = 0; i < num_hosts; i++ ) {
+         pkt->hosts[i] = wish_unpack_string( wp->payload, &offset );
+      }
+      pkt->num_hosts = num_hosts;
+   }
+   
+   return 0;
+}
+
+
+// free a sched packet
+int wish_free_sched_packet( struct wish_sched_packet* pkt ) {
+   if( pkt->hosts ) {
+      for( uint32_t i = 0; i < pkt->num_hosts; i++ ) {
+         free( pkt->hosts[i] );
+      }
+      free( pkt->hosts );
+      pkt->hosts = NULL;
+   }
+   pkt->num_hosts = 0;
+   return 0;
+}
@@ -0,0 +1,44 @@
+// packet for queued jobs.  It follows a JOB_SCHEDULE job packet from a client, and tells the origin how to pick
+// the host to run the job on, and which hosts it may not use.
+
+#ifndef _SCHED_PACKET_H_
+#define _SCHED_PACKET_H_
+
+#include "libwish.h"
+
+#define PACKET_TYPE_SCHED 126
+
+// placement policies
+#define SCHED_POLICY_CPU      1     // the host with the lowest load average
+#define SCHED_POLICY_RAM      2     // the host with the most free RAM
+#define SCHED_POLICY_LATENCY  3     // the host with the lowest heartbeat latency
+#define SCHED_POLICY_SPREAD   4     // the host running the fewest of the origin's queued jobs
+#define SCHED_POLICY_PACK     5     // the host running the most of the origin's queued jobs, while it has a free slot
+
+#define SCHED_MAX_HOSTS       65536
+
+struct wish_sched_packet {
+   uint32_t policy;           // SCHED_POLICY_*
+   
+   // constraints (0 for none)
+   uint64_t min_ram;          // free RAM a host must have, in bytes
+   uint64_t min_disk;         // free disk a host must have, in bytes
+   uint32_t max_load;         // 1-minute load average, in hundredths, at or above which a host is not used
+   
+   uint32_t num_hosts;
+   char** hosts;              // hosts the job may run on (none for any)
+};
+
+// make a sched packet.  The hosts are duplicated.
+void wish_init_sched_packet( struct wish_state* state, struct wish_sched_packet* pkt, uint32_t policy, uint64_t min_ram, uint64_t min_disk, uint32_t max_load, char** hosts, uint32_t num_hosts );
+
+// pack a sched packet
+int wish_pack_sched_packet( struct wish_state* state, struct wish_packet* wp, struct wish_sched_packet* pkt );
+
+// unpack a sched packet
+int wish_unpack_sched_packet( struct wish_state* state, struct wish_packet* wp, struct wish_sched_packet* pkt );
+
+// free a sched packet
+int wish_free_sched_packet( struct wish_sched_packet* pkt );
+
+#endif
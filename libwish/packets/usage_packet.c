@@ -0,0 +1,66 @@
+#include "usage_packet.h"
+
+// initialize a usage packet
+void wish_init_usage_packet( struct wish_state* state, struct wish_usage_packet* p, uint64_t gpid ) {
+   memset( p, 0, sizeof(struct wish_usage_packet) );
+   p->gpid = gpid;
+   p->source = USAGE_SOURCE_NONE;
+}
+
+// fill in a usage packet's CPU, memory, and I/O numbers from a struct rusage
+void wish_usage_packet_rusage( struct wish_usage_packet* p, struct rusage* ru ) {
+   p->utime = (uint64_t)ru->ru_utime.tv_sec * 1000000 + ru->ru_utime.tv_usec;
+   p->stime = (uint64_t)ru->ru_stime.tv_sec * 1000000 + ru->ru_stime.tv_usec;
+   p->maxrss = ru->ru_maxrss;
+   
+   // block counts are in 512-byte units
+   p->read_bytes = (uint64_t)ru->ru_inblock * 512;
+   p->write_bytes = (uint64_t)ru->ru_oublock * 512;
+   
+   p->source = USAGE_SOURCE_RUSAGE;
+}
+
+// pack a usage packet
+int wish_pack_usage_packet( struct wish_state* state, struct wish_packet* wp, struct wish_usage_packet* p ) {
+   wish_init_header( state, &wp->hdr, PACKET_TYPE_USAGE );
+   
+   size_t len = sizeof(p->gpid) + sizeof(p->owner) + sizeof(p->source) + sizeof(p->utime) + sizeof(p->stime) + sizeof(p->maxrss) +
+                sizeof(p->read_bytes) + sizeof(p->write_bytes) + sizeof(p->wall_time) + sizeof(p->queue_delay) + sizeof(p->launch_delay);
+   
+   uint8_t* buf = (uint8_t*)calloc( len, 1 );
+   
+   off_t offset = 0;
+   wish_pack_ulong( buf, &offset, p->gpid );
+   wish_pack_uint( buf, &offset, p->owner );
+   wish_pack_uint( buf, &offset, p->source );
+   wish_pack_ulong( buf, &offset, p->utime );
+   wish_pack_ulong( buf, &offset, p->stime );
+   wish_pack_ulong( buf, &offset, p->maxrss );
+   wish_pack_ulong( buf, &offset, p->read_bytes );
+   wish_pack_ulong( buf, &offset, p->write_bytes );
+   wish_pack_ulong( buf, &offset, p->wall_time );
+   wish_pack_ulong( buf, &offset, p->queue_delay );
+   wish_pack_ulong( buf, &offset, p->launch_delay );
+   
+   wish_init_packet_nocopy( wp, &wp->hdr, buf, len );
+   
+   return 0;
+}
+
+// unpack a usage packet
+int wish_unpack_usage_packet( struct wish_state* state, struct wish_packet* wp, struct wish_usage_packet* p ) {
+   off_t offset = 0;
+   p->gpid = wish_unpack_ulong( wp->payload, &offset );
+   p->owner = wish_unpack_uint( wp->payload, &offset );
+   p->source = wish_unpack_uint( wp->payload, &offset );
+   p->utime = wish_unpack_ulong( wp->payload, &offset );
+   p->stime = wish_unpack_ulong( wp->payload, &offset );
+   p->maxrss = wish_unpack_ulong( wp->payload, &offset );
+   p->read_bytes = wish_unpack_ulong( wp->payload, &offset );
+   p->write_bytes = wish_unpack_ulong( wp->payload, &offset );
+   p->wall_time = wish_unpack_ulong( wp->payload, &offset );
+   p->queue_delay = wish_unpack_ulong( wp->payload, &offset );
+   p->launch_delay = wish_unpack_ulong( wp->payload, &offset );
+   
+   return 0;
+}
@@ -0,0 +1,44 @@
+// packet for reporting the resources a job used.
+// an executor sends one to the origin just before the job's exit status, and the origin passes it on to
+// joining clients that ask for it.
+
+#ifndef _USAGE_PACKET_H_
+#define _USAGE_PACKET_H_
+
+#include "libwish.h"
+#include <sys/resource.h>
+
+#define PACKET_TYPE_USAGE 4567
+
+// where the CPU, memory, and I/O numbers came from
+#define USAGE_SOURCE_NONE     0x0      // not measured
+#define USAGE_SOURCE_RUSAGE   0x1      // wait4() on the job's shell (covers the descendants it waited for)
+#define USAGE_SOURCE_CGROUP   0x2      // the job's cgroup (covers everything the job started)
+
+struct wish_usage_packet {
+   uint64_t gpid;             // (global) PID
+   uint32_t owner;            // uid of the user that spawned the job (filled in by the origin)
+   uint32_t source;           // USAGE_SOURCE_*
+   uint64_t utime;            // user CPU time, in microseconds
+   uint64_t stime;            // system CPU time, in microseconds
+   uint64_t maxrss;           // peak resident set size, in kilobytes
+   uint64_t read_bytes;       // bytes read from block devices
+   uint64_t write_bytes;      // bytes written to block devices
+   uint64_t wall_time;        // time from the job's start until it exited, in microseconds
+   uint64_t queue_delay;      // time from receiving the job until launching it (getting its inputs), in microseconds
+   uint64_t launch_delay;     // time from launching the job until its shell was running, in microseconds
+};
+
+// initialize a usage packet
+void wish_init_usage_packet( struct wish_state* state, struct wish_usage_packet* p, uint64_t gpid );
+
+// fill in a usage packet's CPU, memory, and I/O numbers from a struct rusage
+void wish_usage_packet_rusage( struct wish_usage_packet* p, struct rusage* ru );
+
+// pack a usage packet
+int wish_pack_usage_packet( struct wish_state* state, struct wish_packet* wp, struct wish_usage_packet* p );
+
+// unpack a usage packet
+int wish_unpack_usage_packet( struct wish_state* state, struct wish_packet* wp, struct wish_usage_packet* p );
+
+#endif
@@ -3,9 +3,14 @@
 // read/write lock to the barrier list
 static pthread_rwlock_t barrier_rwlock;
 
-// set of barriers in operation
-typedef vector<struct wish_barrier_status*> BarrierList;
-static BarrierList barriers;
+// set of barriers in operation, by ID
+typedef map<uint64_t, struct wish_barrier_status*> BarrierTable;
+static BarrierTable barriers;
+
+// next barrier ID
+static uint64_t next_barrier_id = 1;
+
+static void barrier_expire( struct wish_state* state, uint64_t id );
 
 // read-lock the barriers
 static int barriers_rlock() { return pthread_rwlock_rdlock( &barrier_rwlock ); }
@@ -18,14 +23,19 @@ static int barriers_unlock() { return pthread_rwlock_unlock( &barrier_rwlock );
 
 // initialize a barrier status structure
 static int barrier_init_status( struct wish_state* state, struct wish_barrier_status* status, struct barrier_packet* bpkt ) {
+   status->id = next_barrier_id++;
    status->b_info = bpkt;
    status->proc_cons = new RendezvousList();
-   status->expire = wish_time_millis() + bpkt->timeout;
+   
+   timer_setup( &status->expire_timer, barrier_expire, status->id );
+   timer_arm( &status->expire_timer, bpkt->timeout );
    return 0;
 }
 
 // free a barrier status structure's memory
 static int barrier_free_status( struct wish_state* state, struct wish_barrier_status* status ) {
+   timer_cancel( &status->expire_timer );
+   
    if( status->b_info ) {
       wish_free_barrier_packet( status->b_info );
       free( status->b_info );
@@ -60,11 +70,12 @@ int barrier_init( struct wish_state* state ) {
 int barrier_shutdown( struct wish_state* state ) {
    barriers_wlock();
    
-   for( BarrierList::size_type i = 0; i < barriers.size(); i++ ) {
-      barrier_free_status( state, barriers[i] );
-      free( barriers[i] );
-      barriers[i] = NULL;
+   for( BarrierTable::iterator itr = barriers.begin(); itr != barriers.end(); itr++ ) {
+      barrier_free_status( state, itr->second );
+      free( itr->second );
+      itr->second = NULL;
    }
+   barriers.clear();
    
    barriers_unlock();
    
@@ -82,7 +93,7 @@ int barrier_add( struct wish_state* state, struct wish_connection* con, struct b
    status->proc_cons->push_back( Rendezvous(bpkt->gpid_self, con) );
    
    //barriers_wlock();
-   barriers.push_back( status );
+   barriers[ status->id ] = status;
    //barriers_unlock();
    
    return 0;
@@ -125,13 +136,10 @@ int barrier_process( struct wish_state* state, struct wish_connection* con, stru
    bool processed = false;
    
    barriers_wlock();
-   int dead = -1;
-   
-   // before we begin, remove stale barriers
-   barrier_purge_old( state );
+   uint64_t dead = 0;
    
-   for( unsigned int i = 0; i < barriers.size(); i++ ) {
-      struct wish_barrier_status* status = barriers[i];
+   for( BarrierTable::iterator itr = barriers.begin(); itr != barriers.end(); itr++ ) {
+      struct wish_barrier_status* status = itr->second;
       
       if( wish_barrier_equal( status->b_info, bpkt ) ) {
          // This incoming barrier packet may be an acknowledgement for an existing barrier.
@@ -163,7 +171,7 @@ int barrier_process( struct wish_state* state, struct wish_connection* con, stru
                   errorf("barrier_process: failed to fully release barrier of %lu\n", status->b_info->gpid_self );
                   barrier_free_status( state, status );
                }
-               dead = i;
+               dead = status->id;
             }
             
             processed = true;
@@ -196,8 +204,9 @@ int barrier_process( struct wish_state* state, struct wish_connection* con, stru
       }
    }
    
-   if( dead != -1 ) {
-      barriers.erase( barriers.begin() + dead );
+   if( dead != 0 ) {
+      free( barriers[dead] );
+      barriers.erase( dead );
    }
    
    barriers_unlock();
@@ -205,19 +214,17 @@ int barrier_process( struct wish_state* state, struct wish_connection* con, stru
 }
 
 
-// remove stale barriers
-int barrier_purge_old( struct wish_state* state ) {
-   uint64_t now = wish_time_millis();
+// a barrier has expired (called from the timer thread)--remove it
+static void barrier_expire( struct wish_state* state, uint64_t id ) {
+   barriers_wlock();
    
-   if( barriers.size() > 0 ) {
-      for( BarrierList::iterator itr = barriers.begin() + (barriers.size() - 1); itr != barriers.begin(); itr-- ) {
-         if( (*itr)->expire < now ) {
-            // it's expired
-            barrier_free_status( state, *itr );
-            barriers.erase( itr );
-         }
-      }
+   BarrierTable::iterator itr = barriers.find( id );
+   if( itr != barriers.end() ) {
+      dbprintf("barrier_expire: barrier of %lu expired\n", itr->second->b_info->gpid_self );
+      barrier_free_status( state, itr->second );
+      free( itr->second );
+      barriers.erase( itr );
    }
-   return 0;
+   
+   barriers_unlock();
 }
-
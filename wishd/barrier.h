@@ -2,6 +2,8 @@
 #define _BARRIER_H_
 
 #include "libwish.h"
+#include "timer.h"
+#include <map>
 
 using namespace std;
 
@@ -10,8 +12,9 @@ typedef vector< Rendezvous > RendezvousList;
 
 
 struct wish_barrier_status {
+   uint64_t id;                                 // unique ID of this barrier (identifies it to its expiry timer)
    struct barrier_packet* b_info;               // number and list of gpids of processes in this barrier
-   uint64_t expire;                             // when does this barrier expire
+   struct timer expire_timer;                   // fires when this barrier expires
    RendezvousList* proc_cons;                   // connections to running processes that have responded
 };
 
@@ -28,6 +31,5 @@ int barrier_release( struct wish_state* state, struct wish_barrier_status* statu
 
 int barrier_process( struct wish_state* state, struct wish_connection* con, struct barrier_packet* bpkt );
 
-int barrier_purge_old( struct wish_state* state );
 
 #endif
\ No newline at end of file
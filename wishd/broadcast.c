@@ -0,0 +1,423 @@
+#include "broadcast.h"
+
+// nearest first
+static bool broadcast_nearer( const pair<double, char*>& a, const pair<double, char*>& b ) {
+   return a.first < b.first;
+}
+
+
+// how many levels below its root a tree with the given fanout needs to reach num_hosts hosts
+static uint32_t broadcast_depth( uint64_t num_hosts, uint32_t fanout ) {
+   uint32_t depth = 0;
+   uint64_t level = 1;
+   uint64_t reached = 0;
+   
+   while( reached < num_hosts ) {
+      level *= fanout;
+      reached += level;
+      depth++;
+   }
+   return depth;
+}
+
+
+// send a broadcast job and the hosts in the receiver's subtree
+static int broadcast_send( struct wish_state* state, struct wish_connection* con, struct wish_packet* job_pkt, uint32_t fanout, char** targets, uint32_t num_targets ) {
+   int rc = wish_write_packet( state, con, job_pkt );
+   if( rc != 0 )
+      return rc;
+   
+   struct wish_bcast_packet bcast;
+   wish_init_bcast_packet( state, &bcast, fanout, targets, num_targets );
+   
+   struct wish_packet pkt;
+   wish_pack_bcast_packet( state, &pkt, &bcast );
+   rc = wish_write_packet( state, con, &pkt );
+   
+   wish_free_packet( &pkt );
+   wish_free_bcast_packet( &bcast );
+   return rc;
+}
+
+
+// hand the job to a child, and wait for the statuses of its subtree (child thread)
+static void* broadcast_child_pthread( void* arg ) {
+   struct broadcast_child* child = (struct broadcast_child*)arg;
+   struct wish_state* state = child->state;
+   struct wish_connection con;
+   int rc = 0;
+   
+   // if the child can't be reached, the next host in its subtree takes its place
+   vector<char*>::size_type root = 0;
+   for( ; root < child->targets.size(); root++ ) {
+      uint64_t nid = 0;
+      memset( &con, 0, sizeof(con) );
+   
+      rc = heartbeat_get_hostname( state, child->targets[root], &con, &nid );
+      if( rc == 0 ) {
+         rc = broadcast_send( state, &con, child->job_pkt, child->fanout, &child->targets[root], child->targets.size() - root );
+         if( rc == 0 )
+            break;
+   
+         wish_disconnect( state, &con );
+      }
+   
+      errorf("broadcast_child_pthread: could not hand off to %s, rc = %d\n", child->targets[root], rc );
+      wish_add_bcast_result( &child->results, child->targets[root], PROCESS_TYPE_ERROR, rc );
+   }
+   
+   if( root == child->targets.size() )
+      return NULL;
+   
+   // the subtree replies once the job has ended everywhere in it
+   struct wish_packet pkt;
+   rc = wish_read_packet( state, &con, &pkt );
+   if( rc == 0 ) {
+      if( pkt.hdr.type == PACKET_TYPE_BCAST ) {
+         struct wish_bcast_packet reply;
+         rc = wish_unpack_bcast_packet( state, &pkt, &reply );
+   
+         for( uint32_t i = 0; rc == 0 && i < reply.num_results; i++ ) {
+            wish_add_bcast_result( &child->results, reply.results[i].hostname, reply.results[i].type, reply.results[i].data );
+         }
+         wish_free_bcast_packet( &reply );
+      }
+      else {
+         rc = -EBADMSG;
+      }
+      wish_free_packet( &pkt );
+   }
+   
+   if( rc != 0 ) {
+      // we don't know how it went for any of them
+      errorf("broadcast_child_pthread: no statuses from %s, rc = %d\n", child->targets[root], rc );
+      for( ; root < child->targets.size(); root++ ) {
+         wish_add_bcast_result( &child->results, child->targets[root], PROCESS_TYPE_ERROR, rc );
+      }
+   }
+   
+   wish_disconnect( state, &con );
+   return NULL;
+}
+
+
+// run the job here, and wait for it to end.  Its output is thrown away.
+// we talk to the executor over a socket pair, just as an origin would over the network.
+static void broadcast_run_local( struct wish_state* state, struct wish_packet* job_pkt, uint32_t* type, int32_t* data ) {
+   *type = PROCESS_TYPE_ERROR;
+   
+   int fds[2];
+   if( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) != 0 ) {
+      *data = -errno;
+      errorf("broadcast_run_local: socketpair rc = %d\n", *data );
+      return;
+   }
+   
+   struct wish_connection* exec_con = (struct wish_connection*)calloc( sizeof(struct wish_connection), 1 );
+   exec_con->soc = fds[0];
+   
+   struct wish_connection con;
+   memset( &con, 0, sizeof(con) );
+   con.soc = fds[1];
+   
+   struct wish_job_packet* job = (struct wish_job_packet*)calloc( sizeof(struct wish_job_packet), 1 );
+   wish_unpack_job_packet( state, job_pkt, job );
+   uint64_t gpid = job->gpid;
+   
+   int rc = process_start( state, exec_con, job );
+   if( rc != 0 ) {
+      errorf("broadcast_run_local: process_start rc = %d\n", rc );
+      *data = rc;
+   
+      wish_free_job_packet( job );
+      free( job );
+      wish_disconnect( state, exec_con );
+      free( exec_con );
+      wish_disconnect( state, &con );
+      return;
+   }
+   
+   *data = -ECONNABORTED;
+   
+   bool done = false;
+   while( !done ) {
+      struct wish_packet pkt;
+      rc = wish_read_packet( state, &con, &pkt );
+      if( rc != 0 )
+         break;
+   
+      if( pkt.hdr.type == PACKET_TYPE_STRINGS ) {
+         // nobody wants the output, but the executor only sends as much as we give it credit for
+         struct wish_strings_packet wssp;
+         wish_unpack_strings_packet( state, &pkt, &wssp );
+   
+         uint32_t consumed = 0;
+         for( int i = 0; i < wssp.count; i++ ) {
+            consumed += strlen( wssp.packets[i].str );
+         }
+         wish_free_strings_packet( &wssp );
+   
+         if( consumed > 0 )
+            wish_process_reply( state, &con, PROCESS_TYPE_CREDIT, gpid, consumed );
+      }
+      else if( pkt.hdr.type == PACKET_TYPE_PROCESS ) {
+         struct wish_process_packet wpp;
+         wish_unpack_process_packet( state, &pkt, &wpp );
+   
+         if( wpp.type == PROCESS_TYPE_EXIT || wpp.type == PROCESS_TYPE_TIMEOUT ) {
+            *type = wpp.type;
+            *data = wpp.data;
+            done = true;
+         }
+         else if( wpp.type == PROCESS_TYPE_FAILURE ) {
+            *data = -ENOEXEC;
+            done = true;
+         }
+         else if( wpp.type == PROCESS_TYPE_ERROR ) {
+            *data = wpp.data;
+            done = true;
+         }
+      }
+   
+      wish_free_packet( &pkt );
+   }
+   
+   wish_disconnect( state, &con );
+}
+
+
+// run a broadcast job here and in our subtree, and send back the statuses
+static int broadcast_run( struct wish_state* state, struct wish_connection* con, struct wish_job_packet* job, struct wish_bcast_packet* bcast ) {
+   int rc = 0;
+   bool origin = !(job->flags & JOB_WISH_ORIGIN);
+   
+   struct wish_bcast_packet reply;
+   wish_init_bcast_packet( state, &reply, bcast->fanout, NULL, 0 );
+   
+   uint32_t fanout = bcast->fanout;
+   if( fanout == 0 )
+      fanout = BCAST_DEFAULT_FANOUT;
+   if( fanout > BCAST_MAX_FANOUT )
+      fanout = BCAST_MAX_FANOUT;
+   
+   if( origin ) {
+      // make the job's files available to every host
+      rc = process_publish_job( state, job );
+      if( rc != 0 ) {
+         errorf("broadcast_run: process_publish_job rc = %d\n", rc );
+         for( uint32_t i = 0; i < bcast->num_targets; i++ ) {
+            wish_add_bcast_result( &reply, bcast->targets[i], PROCESS_TYPE_ERROR, rc );
+         }
+      }
+   }
+   
+   // find ourselves among the targets, and order the rest nearest first
+   char* here = NULL;
+   vector< pair<double, char*> > others;
+   set<uint64_t> seen;
+   
+   for( uint32_t i = 0; rc == 0 && i < bcast->num_targets; i++ ) {
+      uint64_t nid = wish_host_nid( bcast->targets[i] );
+      if( process_is_localhost( state, nid ) ) {
+         if( here == NULL )
+            here = bcast->targets[i];
+         continue;
+      }
+   
+      if( seen.count( nid ) )
+         continue;
+   
+      seen.insert( nid );
+      others.push_back( pair<double, char*>( heartbeat_nid_latency( state, nid ), bcast->targets[i] ) );
+   }
+   
+   stable_sort( others.begin(), others.end(), broadcast_nearer );
+   
+   // the job we hand down comes from the origin, by way of us.
+   // the origin sizes the tree; each level below gets one less level to go
+   struct sockaddr_storage me;
+   memset( &me, 0, sizeof(me) );
+   int http_portnum = job->origin_http_portnum;
+   
+   wish_state_rlock( state );
+   memcpy( &me, state->addr->ai_addr, state->addr->ai_addrlen );
+   if( origin )
+      http_portnum = state->conf.http_portnum;
+   wish_state_unlock( state );
+   
+   vector<struct sockaddr_storage> path;
+   uint32_t ttl = 0;
+   bool can_forward = true;
+   
+   if( origin ) {
+      path.push_back( me );
+      ttl = broadcast_depth( others.size(), fanout );
+   }
+   else {
+      path.insert( path.end(), job->visited, job->visited + job->visited_len );
+      path.push_back( me );
+      can_forward = (job->ttl > 0);
+      ttl = (job->ttl > 0 ? job->ttl - 1 : 0);
+   }
+   
+   struct wish_packet job_pkt;
+   memset( &job_pkt, 0, sizeof(job_pkt) );
+   
+   if( rc == 0 ) {
+      struct wish_job_packet fwd;
+      wish_init_job_packet( state, &fwd, 0, ttl, &path[0], path.size(), job->cmd_text, job->stdin_url, job->flags | JOB_WISH_ORIGIN | JOB_BROADCAST | JOB_CREDIT, job->timeout, http_portnum );
+      fwd.gpid = job->gpid;
+      fwd.cpus = job->cpus;
+   
+      if( !origin )
+         fwd.nid_src = job->nid_src;
+      if( job->cmd_hash )
+         fwd.cmd_hash = strdup( job->cmd_hash );
+      if( job->stdin_hash )
+         fwd.stdin_hash = strdup( job->stdin_hash );
+   
+      wish_pack_job_packet( state, &job_pkt, &fwd );
+      wish_free_job_packet( &fwd );
+   }
+   
+   if( rc == 0 && !can_forward && others.size() > 0 ) {
+      // the tree is deeper than the origin planned
+      errorf("broadcast_run: out of levels for %lu with %zu hosts left\n", job->gpid, others.size() );
+      for( unsigned int i = 0; i < others.size(); i++ ) {
+         wish_add_bcast_result( &reply, others[i].second, PROCESS_TYPE_ERROR, -ELOOP );
+      }
+      others.clear();
+   }
+   
+   // the nearest hosts are our children, and the rest are dealt out between them
+   vector<struct broadcast_child*> children;
+   unsigned int num_children = MIN( (unsigned int)others.size(), fanout );
+   
+   for( unsigned int i = 0; rc == 0 && i < num_children; i++ ) {
+      struct broadcast_child* child = new broadcast_child;
+      child->state = state;
+      child->job_pkt = &job_pkt;
+      child->fanout = fanout;
+      wish_init_bcast_packet( state, &child->results, fanout, NULL, 0 );
+      children.push_back( child );
+   }
+   
+   for( unsigned int i = 0; i < others.size() && num_children > 0; i++ ) {
+      children[ i % num_children ]->targets.push_back( others[i].second );
+   }
+   
+   vector<bool> started( children.size(), false );
+   for( unsigned int i = 0; i < children.size(); i++ ) {
+      if( pthread_create( &children[i]->thread, NULL, broadcast_child_pthread, children[i] ) == 0 ) {
+         started[i] = true;
+      }
+      else {
+         // do it ourselves
+         broadcast_child_pthread( children[i] );
+      }
+   }
+   
+   if( rc == 0 && here != NULL ) {
+      uint32_t type = PROCESS_TYPE_ERROR;
+      int32_t data = 0;
+      broadcast_run_local( state, &job_pkt, &type, &data );
+      wish_add_bcast_result( &reply, here, type, data );
+   }
+   
+   for( unsigned int i = 0; i < children.size(); i++ ) {
+      if( started[i] )
+         pthread_join( children[i]->thread, NULL );
+   
+      for( uint32_t j = 0; j < children[i]->results.num_results; j++ ) {
+         struct wish_bcast_result* res = &children[i]->results.results[j];
+         wish_add_bcast_result( &reply, res->hostname, res->type, res->data );
+      }
+   
+      wish_free_bcast_packet( &children[i]->results );
+      delete children[i];
+   }
+   
+   if( job_pkt.payload )
+      wish_free_packet( &job_pkt );
+   
+   // send the whole subtree's statuses back in one go
+   struct wish_packet pkt;
+   wish_pack_bcast_packet( state, &pkt, &reply );
+   int write_rc = wish_write_packet( state, con, &pkt );
+   if( write_rc != 0 ) {
+      errorf("broadcast_run: could not send statuses of %lu, rc = %d\n", job->gpid, write_rc );
+   }
+   
+   wish_free_packet( &pkt );
+   wish_free_bcast_packet( &reply );
+   
+   return rc;
+}
+
+
+// pthread bootstrapper for broadcast_run
+static void* broadcast_run_pthread( void* arg ) {
+   struct broadcast_args* args = (struct broadcast_args*)arg;
+   
+   // the hosts to run it on come next
+   struct wish_packet bcast_packet;
+   int rc = wish_read_packet( args->state, args->con, &bcast_packet );
+   if( rc == 0 ) {
+      if( bcast_packet.hdr.type == PACKET_TYPE_BCAST )
+         rc = wish_unpack_bcast_packet( args->state, &bcast_packet, args->bcast );
+      else
+         rc = -EBADMSG;
+   
+      wish_free_packet( &bcast_packet );
+   }
+   
+   if( rc == 0 ) {
+      rc = broadcast_run( args->state, args->con, args->job, args->bcast );
+      dbprintf("broadcast_run returned %d\n", rc );
+   }
+   else {
+      errorf("broadcast_run_pthread: hosts for %lu rc = %d\n", args->job->gpid, rc );
+      wish_process_reply( args->state, args->con, PROCESS_TYPE_ERROR, args->job->gpid, rc );
+   }
+   
+   wish_disconnect( args->state, args->con );
+   free( args->con );
+   
+   if( args->job->stdout_path )
+      free( args->job->stdout_path );
+   if( args->job->stderr_path )
+      free( args->job->stderr_path );
+   wish_free_job_packet( args->job );
+   free( args->job );
+   
+   wish_free_bcast_packet( args->bcast );
+   free( args->bcast );
+   free( args );
+   
+   return NULL;
+}
+
+
+// handle a broadcast job in the background
+int broadcast_start( struct wish_state* state, struct wish_connection* con, struct wish_job_packet* job ) {
+   struct broadcast_args* args = (struct broadcast_args*)calloc( sizeof(struct broadcast_args), 1 );
+   args->state = state;
+   args->con = con;
+   args->job = job;
+   args->bcast = (struct wish_bcast_packet*)calloc( sizeof(struct wish_bcast_packet), 1 );
+   
+   pthread_attr_t attrs;
+   pthread_attr_init( &attrs );
+   pthread_attr_setdetachstate( &attrs, PTHREAD_CREATE_DETACHED );
+   
+   pthread_t thread;
+   int rc = pthread_create( &thread, &attrs, broadcast_run_pthread, args );
+   pthread_attr_destroy( &attrs );
+   
+   if( rc != 0 ) {
+      free( args->bcast );
+      free( args );
+      return -rc;
+   }
+   return 0;
+}
@@ -0,0 +1,43 @@
+// broadcast launches: run one job on many hosts through a tree of daemons.
+// each daemon in the tree runs the job itself (if it is one of the targets), forwards it to up to fanout children
+// (nearest first, by heartbeat latency) with the rest of its targets divided between them, and sends back one
+// batch of exit statuses for its whole subtree.  Launch time grows with the depth of the tree, not the number of hosts.
+#ifndef _BROADCAST_H_
+#define _BROADCAST_H_
+
+#include "libwish.h"
+#include "heartbeat.h"
+#include "process.h"
+#include <vector>
+#include <set>
+#include <algorithm>
+
+using namespace std;
+
+// a child in the launch tree, and the hosts it's responsible for
+struct broadcast_child {
+   struct wish_state* state;
+   struct wish_packet* job_pkt;        // job to forward (shared with the other children)
+   uint32_t fanout;
+   vector<char*> targets;              // hosts in the child's subtree, the child first
+   struct wish_bcast_packet results;   // how the job ended on each of them
+   pthread_t thread;
+};
+
+// arguments to a broadcast thread
+struct broadcast_args {
+   struct wish_state* state;
+   struct wish_connection* con;
+   struct wish_job_packet* job;
+   struct wish_bcast_packet* bcast;
+};
+
+// handle a broadcast job from a client or a parent daemon on con, in the background.  The hosts to run it on (a
+// PACKET_TYPE_BCAST packet) follow the job on con, and are read in the background too, so a slow sender holds up
+// only its own broadcast.
+// takes ownership of con and job (both allocated with malloc).  Exit statuses (or an error) are sent back on con
+// once the job has ended everywhere in this node's subtree.
+// return 0 on success; negative on error (in which case the caller keeps ownership)
+int broadcast_start( struct wish_state* state, struct wish_connection* con, struct wish_job_packet* job );
+
+#endif
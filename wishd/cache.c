@@ -0,0 +1,459 @@
+#include "cache.h"
+
+// cached files, by hash
+static CacheTable cache;
+static pthread_rwlock_t cache_lock;
+
+// hashes of local files we've spawned
+static FileHashTable file_hashes;
+static pthread_rwlock_t file_hashes_lock;
+
+// path to the cache directory
+static char* cache_dir = NULL;
+
+// cached files, least recently used first (protected by cache_lock)
+static CacheLRU cache_lru;
+
+// statistics (protected by cache_lock)
+static struct cache_stats stats;
+
+static int cache_rlock(void) {
+   return pthread_rwlock_rdlock( &cache_lock );
+}
+
+static int cache_wlock(void) {
+   return pthread_rwlock_wrlock( &cache_lock );
+}
+
+static int cache_unlock(void) {
+   return pthread_rwlock_unlock( &cache_lock );
+}
+
+
+// is this a well-formed hash?
+static bool cache_valid_hash( char const* hash ) {
+   if( hash == NULL || strlen(hash) != CACHE_HASH_LEN )
+      return false;
+
+   for( int i = 0; i < CACHE_HASH_LEN; i++ ) {
+      if( !isxdigit( hash[i] ) )
+         return false;
+   }
+   return true;
+}
+
+
+// path to a cached file
+static char* cache_path( char const* hash ) {
+   return fullpath( cache_dir, hash, NULL );
+}
+
+
+// add an entry, as the most recently used.
+// cache must be write-locked
+static void cache_add( string const& hash, off_t size ) {
+   struct cache_entry ent;
+   ent.size = size;
+   ent.lru = cache_lru.insert( cache_lru.end(), hash );
+
+   cache[ hash ] = ent;
+   stats.size += size;
+}
+
+
+// drop an entry (but not its file).
+// cache must be write-locked
+static void cache_remove( CacheTable::iterator itr ) {
+   stats.size -= itr->second.size;
+   cache_lru.erase( itr->second.lru );
+   cache.erase( itr );
+}
+
+
+// evict least-recently-used entries until the cache fits in max_size.
+// cache must be write-locked
+static void cache_evict( uint64_t max_size ) {
+   while( stats.size > max_size && cache.size() > 0 ) {
+      CacheTable::iterator victim = cache.find( cache_lru.front() );
+
+      char* path = cache_path( victim->first.c_str() );
+      int rc = unlink( path );
+      if( rc != 0 ) {
+         errorf("cache_evict: unlink %s errno = %d\n", path, -errno );
+      }
+      free( path );
+
+      stats.evictions++;
+      cache_remove( victim );
+   }
+   stats.num_entries = cache.size();
+}
+
+
+// initialize the cache
+int cache_init( struct wish_state* state ) {
+   pthread_rwlock_init( &cache_lock, NULL );
+   pthread_rwlock_init( &file_hashes_lock, NULL );
+
+   memset( &stats, 0, sizeof(stats) );
+
+   wish_state_rlock( state );
+   stats.max_size = state->conf.cache_size;
+   cache_dir = fullpath( state->conf.tmp_dir, CACHE_DIR, NULL );
+   wish_state_unlock( state );
+
+   if( stats.max_size == 0 ) {
+      return 0;
+   }
+
+   int rc = mkdirs( cache_dir );
+   if( rc != 0 ) {
+      errorf("cache_init: could not create %s, rc = %d\n", cache_dir, rc );
+      stats.max_size = 0;
+      return rc;
+   }
+
+   // index what's left over from the last run.
+   // anything that isn't a finished cache entry gets removed.
+   DIR* dir = opendir( cache_dir );
+   if( dir == NULL ) {
+      rc = -errno;
+      errorf("cache_init: opendir %s errno = %d\n", cache_dir, rc );
+      stats.max_size = 0;
+      return rc;
+   }
+
+   struct dirent* dent = NULL;
+   while( (dent = readdir( dir )) != NULL ) {
+      if( strcmp( dent->d_name, "." ) == 0 || strcmp( dent->d_name, ".." ) == 0 )
+         continue;
+
+      char* path = cache_path( dent->d_name );
+      struct stat sb;
+
+      if( cache_valid_hash( dent->d_name ) && stat( path, &sb ) == 0 && S_ISREG( sb.st_mode ) ) {
+         cache_add( string(dent->d_name), sb.st_size );
+      }
+      else {
+         unlink( path );
+      }
+      free( path );
+   }
+   closedir( dir );
+
+   cache_evict( stats.max_size );
+
+   dbprintf("cache_init: %lu entries (%lu bytes) in %s\n", stats.num_entries, stats.size, cache_dir );
+   return 0;
+}
+
+
+// shut down the cache
+int cache_shutdown( struct wish_state* state ) {
+   cache_wlock();
+   cache.clear();
+   cache_lru.clear();
+   cache_unlock();
+
+   pthread_rwlock_wrlock( &file_hashes_lock );
+   for( FileHashTable::iterator itr = file_hashes.begin(); itr != file_hashes.end(); itr++ ) {
+      free( itr->second.hash );
+   }
+   file_hashes.clear();
+   pthread_rwlock_unlock( &file_hashes_lock );
+
+   pthread_rwlock_destroy( &cache_lock );
+   pthread_rwlock_destroy( &file_hashes_lock );
+
+   free( cache_dir );
+   cache_dir = NULL;
+   return 0;
+}
+
+
+// is the cache enabled?
+bool cache_enabled(void) {
+   return stats.max_size > 0;
+}
+
+
+// hex-encode a digest
+static char* cache_hex( unsigned char* digest, unsigned int len ) {
+   char* ret = (char*)calloc( len * 2 + 1, 1 );
+   for( unsigned int i = 0; i < len; i++ ) {
+      sprintf( ret + 2*i, "%02x", digest[i] );
+   }
+   return ret;
+}
+
+
+// hash the contents of fd (starting from offset 0), and optionally copy them to copy_fd.
+// return the hex-encoded hash, or NULL on error.
+static char* cache_hash_fd( int fd, int copy_fd ) {
+   EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+   if( ctx == NULL )
+      return NULL;
+
+   EVP_DigestInit_ex( ctx, EVP_sha256(), NULL );
+
+   char buf[65536];
+   off_t offset = 0;
+   bool failed = false;
+
+   while( true ) {
+      ssize_t nr = pread( fd, buf, sizeof(buf), offset );
+      if( nr < 0 ) {
+         errorf("cache_hash_fd: read errno = %d\n", -errno );
+         failed = true;
+         break;
+      }
+      if( nr == 0 )
+         break;
+
+      EVP_DigestUpdate( ctx, buf, nr );
+      offset += nr;
+
+      if( copy_fd >= 0 ) {
+         ssize_t nw = 0;
+         while( nw < nr ) {
+            ssize_t w = write( copy_fd, buf + nw, nr - nw );
+            if( w < 0 ) {
+               errorf("cache_hash_fd: write errno = %d\n", -errno );
+               failed = true;
+               break;
+            }
+            nw += w;
+         }
+         if( failed )
+            break;
+      }
+   }
+
+   unsigned char digest[EVP_MAX_MD_SIZE];
+   unsigned int digest_len = 0;
+   EVP_DigestFinal_ex( ctx, digest, &digest_len );
+   EVP_MD_CTX_free( ctx );
+
+   if( failed )
+      return NULL;
+
+   return cache_hex( digest, digest_len );
+}
+
+
+// get the hex-encoded SHA-256 of a local file
+char* cache_hash_file( char const* path ) {
+   int fd = open( path, O_RDONLY );
+   if( fd < 0 ) {
+      errorf("cache_hash_file: open %s errno = %d\n", path, -errno );
+      return NULL;
+   }
+
+   struct stat sb;
+   if( fstat( fd, &sb ) != 0 ) {
+      close( fd );
+      return NULL;
+   }
+
+   string spath = path;
+   char* ret = NULL;
+
+   // already hashed this version of the file?
+   pthread_rwlock_rdlock( &file_hashes_lock );
+   FileHashTable::iterator itr = file_hashes.find( spath );
+   if( itr != file_hashes.end() && itr->second.dev == sb.st_dev && itr->second.ino == sb.st_ino && itr->second.size == sb.st_size && itr->second.mtime == sb.st_mtime ) {
+      ret = strdup( itr->second.hash );
+   }
+   pthread_rwlock_unlock( &file_hashes_lock );
+
+   if( ret ) {
+      close( fd );
+      return ret;
+   }
+
+   ret = cache_hash_fd( fd, -1 );
+   close( fd );
+
+   if( ret == NULL )
+      return NULL;
+
+   struct cache_file_hash fh;
+   fh.dev = sb.st_dev;
+   fh.ino = sb.st_ino;
+   fh.size = sb.st_size;
+   fh.mtime = sb.st_mtime;
+   fh.hash = strdup( ret );
+
+   pthread_rwlock_wrlock( &file_hashes_lock );
+   itr = file_hashes.find( spath );
+   if( itr != file_hashes.end() ) {
+      free( itr->second.hash );
+   }
+   file_hashes[ spath ] = fh;
+   pthread_rwlock_unlock( &file_hashes_lock );
+
+   return ret;
+}
+
+
+// copy a cached file into fd
+int cache_get( struct wish_state* state, char const* hash, int fd ) {
+   if( !cache_enabled() || !cache_valid_hash( hash ) )
+      return -ENOENT;
+
+   // open the entry while locked, so it can't get evicted out from under us
+   cache_wlock();
+   CacheTable::iterator itr = cache.find( string(hash) );
+   if( itr == cache.end() ) {
+      stats.misses++;
+      cache_unlock();
+      return -ENOENT;
+   }
+
+   char* path = cache_path( hash );
+   int cached_fd = open( path, O_RDONLY );
+   if( cached_fd < 0 ) {
+      // someone removed it
+      errorf("cache_get: open %s errno = %d\n", path, -errno );
+      cache_remove( itr );
+      stats.num_entries = cache.size();
+      stats.misses++;
+
+      cache_unlock();
+      free( path );
+      return -ENOENT;
+   }
+
+   // now the most recently used
+   cache_lru.splice( cache_lru.end(), cache_lru, itr->second.lru );
+   off_t size = itr->second.size;
+   cache_unlock();
+
+   free( path );
+
+   // copy it into place
+   char buf[65536];
+   int rc = 0;
+   while( true ) {
+      ssize_t nr = read( cached_fd, buf, sizeof(buf) );
+      if( nr < 0 ) {
+         rc = -errno;
+         break;
+      }
+      if( nr == 0 )
+         break;
+
+      ssize_t nw = 0;
+      while( nw < nr ) {
+         ssize_t w = write( fd, buf + nw, nr - nw );
+         if( w < 0 ) {
+            rc = -errno;
+            break;
+         }
+         nw += w;
+      }
+      if( rc != 0 )
+         break;
+   }
+   close( cached_fd );
+
+   if( rc != 0 ) {
+      errorf("cache_get: failed to copy %s, rc = %d\n", hash, rc );
+
+      // the caller will download it instead
+      ftruncate( fd, 0 );
+      lseek( fd, 0, SEEK_SET );
+
+      cache_wlock();
+      stats.misses++;
+      cache_unlock();
+      return rc;
+   }
+
+   cache_wlock();
+   stats.hits++;
+   stats.bytes_saved += size;
+   cache_unlock();
+
+   return 0;
+}
+
+
+// add the contents of fd to the cache
+int cache_put( struct wish_state* state, char const* hash, int fd ) {
+   if( !cache_enabled() || !cache_valid_hash( hash ) )
+      return -EINVAL;
+
+   struct stat sb;
+   if( fstat( fd, &sb ) != 0 )
+      return -errno;
+
+   if( (uint64_t)sb.st_size > stats.max_size ) {
+      // will never fit
+      return -EFBIG;
+   }
+
+   // already have it?
+   cache_rlock();
+   bool exists = (cache.find( string(hash) ) != cache.end());
+   cache_unlock();
+
+   if( exists )
+      return 0;
+
+   // copy to a temporary file in the cache directory, and check that it's what the origin said it was
+   char* tmp_path = (char*)calloc( strlen(cache_dir) + strlen(".tmp-XXXXXX") + 2, 1 );
+   sprintf( tmp_path, "%s/.tmp-XXXXXX", cache_dir );
+
+   int tmp_fd = mkstemp( tmp_path );
+   if( tmp_fd < 0 ) {
+      int rc = -errno;
+      errorf("cache_put: mkstemp %s errno = %d\n", tmp_path, rc );
+      free( tmp_path );
+      return rc;
+   }
+
+   char* actual_hash = cache_hash_fd( fd, tmp_fd );
+   close( tmp_fd );
+
+   if( actual_hash == NULL || strcmp( actual_hash, hash ) != 0 ) {
+      // file changed on the origin since it was hashed, or we failed to copy it
+      errorf("cache_put: expected %s, got %s\n", hash, actual_hash );
+      unlink( tmp_path );
+      free( tmp_path );
+      free( actual_hash );
+      return -EINVAL;
+   }
+   free( actual_hash );
+
+   char* path = cache_path( hash );
+   int rc = 0;
+
+   cache_wlock();
+   if( cache.find( string(hash) ) != cache.end() ) {
+      // someone beat us to it
+      unlink( tmp_path );
+   }
+   else if( rename( tmp_path, path ) != 0 ) {
+      rc = -errno;
+      errorf("cache_put: rename %s to %s errno = %d\n", tmp_path, path, rc );
+      unlink( tmp_path );
+   }
+   else {
+      cache_add( string(hash), sb.st_size );
+      cache_evict( stats.max_size );
+   }
+   cache_unlock();
+
+   free( tmp_path );
+   free( path );
+   return rc;
+}
+
+
+// get a snapshot of the cache statistics
+void cache_get_stats( struct cache_stats* ret ) {
+   cache_rlock();
+   memcpy( ret, &stats, sizeof(struct cache_stats) );
+   cache_unlock();
+}
@@ -0,0 +1,75 @@
+// content-addressed cache of downloaded job files (binaries and stdin)
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include "libwish.h"
+#include <openssl/evp.h>
+#include <dirent.h>
+#include <map>
+#include <list>
+#include <string>
+
+using namespace std;
+
+#define CACHE_DIR "cache/"                // cache directory, relative to the temporary directory
+#define CACHE_HASH_LEN (SHA256_DIGEST_LENGTH * 2)   // length of a hex-encoded hash
+
+// hashes of cached files, least recently used first
+typedef list<string> CacheLRU;
+
+// cached file
+struct cache_entry {
+   off_t size;                   // size of the file
+   CacheLRU::iterator lru;       // where it is in the LRU list
+};
+
+typedef map<string, struct cache_entry> CacheTable;
+
+// hash of a local file, remembered so the origin doesn't rehash it on every spawn
+struct cache_file_hash {
+   dev_t dev;
+   ino_t ino;
+   off_t size;
+   time_t mtime;
+   char* hash;
+};
+
+typedef map<string, struct cache_file_hash> FileHashTable;
+
+// cache statistics
+struct cache_stats {
+   uint64_t hits;                // number of lookups that were served from the cache
+   uint64_t misses;              // number of lookups that had to download
+   uint64_t bytes_saved;         // bytes we didn't have to download
+   uint64_t evictions;           // number of entries evicted
+   uint64_t num_entries;         // number of entries in the cache
+   uint64_t size;                // total size of the cached files
+   uint64_t max_size;            // maximum size of the cache
+};
+
+// initialize the cache, and index whatever is already in it
+int cache_init( struct wish_state* state );
+
+// shut down the cache (cached files are kept on disk)
+int cache_shutdown( struct wish_state* state );
+
+// is the cache enabled?
+bool cache_enabled(void);
+
+// get the hex-encoded SHA-256 of a local file.
+// the caller must free the returned string.  Returns NULL on error.
+char* cache_hash_file( char const* path );
+
+// copy a cached file with the given hash into fd.
+// return 0 on a hit, -ENOENT on a miss, or negative on error
+int cache_get( struct wish_state* state, char const* hash, int fd );
+
+// add the contents of fd to the cache, if they have the given hash.
+// fd's offset is not changed.
+// return 0 on success; negative on error
+int cache_put( struct wish_state* state, char const* hash, int fd );
+
+// get a snapshot of the cache statistics
+void cache_get_stats( struct cache_stats* stats );
+
+#endif
@@ -0,0 +1,414 @@
+#include "dag.h"
+#include "process.h"
+
+// running and finished-but-unjoined DAGs, by id
+static DagTable dags;
+static pthread_rwlock_t dags_lock;
+
+static volatile bool dags_running = false;
+
+// free a DAG that is done and out of the table
+static void dag_free( struct dag_run* run ) {
+   wish_free_dag_packet( run->dag );
+   free( run->dag );
+   delete[] run->nodes;
+   pthread_mutex_destroy( &run->lock );
+   pthread_cond_destroy( &run->cond );
+   delete run;
+}
+
+
+// record a node's outcome, and pass it on to the nodes that depend on it.
+// dependents with nothing left to wait on become ready, or are skipped if a dependency they needed to succeed didn't.
+// called with run->lock held.
+static void dag_resolve( struct dag_run* run, uint32_t node, int type, int data, struct wish_usage_packet* usage ) {
+   struct dag_node* n = &run->nodes[node];
+   
+   n->status = DAG_NODE_DONE;
+   n->type = type;
+   n->data = data;
+   if( usage ) {
+      memcpy( &n->usage, usage, sizeof(struct wish_usage_packet) );
+      n->have_usage = true;
+   }
+   
+   run->remaining--;
+   
+   bool succeeded = (type == PROCESS_TYPE_EXIT && data == 0);
+   
+   for( vector<uint32_t>::size_type i = 0; i < n->dependents.size(); i++ ) {
+      uint32_t d = n->dependents[i];
+      struct wish_dag_node* dn = &run->dag->nodes[d];
+   
+      // a node may depend on this one more than once
+      for( uint32_t j = 0; j < dn->num_deps; j++ ) {
+         if( dn->deps[j].node != node )
+            continue;
+   
+         if( dn->deps[j].kind == DAG_AFTER_OK && !succeeded )
+            run->nodes[d].doomed = true;
+   
+         run->nodes[d].waiting--;
+      }
+   
+      if( run->nodes[d].waiting == 0 && run->nodes[d].status == DAG_NODE_WAITING ) {
+         if( run->nodes[d].doomed ) {
+            dag_resolve( run, d, PROCESS_TYPE_ERROR, -ECANCELED, NULL );
+         }
+         else {
+            run->nodes[d].status = DAG_NODE_RUNNING;
+            run->ready.push_back( d );
+         }
+      }
+   }
+}
+
+
+// can a node run on any host?
+static bool dag_any_host( struct dag_run* run, uint32_t node ) {
+   return strcmp( run->dag->nodes[node].hostname, DAG_ANY_HOST ) == 0;
+}
+
+
+// launch a ready node on the host with the given nid
+static int dag_launch( struct dag_run* run, uint32_t node, uint64_t nid ) {
+   struct wish_state* state = run->state;
+   struct wish_dag_packet* dag = run->dag;
+   struct wish_dag_node* n = &dag->nodes[node];
+   
+   struct wish_job_packet job;
+   wish_init_job_packet_client( state, &job, run->nodes[node].gpid, nid, 1, n->cmd_text, NULL, NULL, NULL, dag->owner, dag->group, dag->umask, 0, n->timeout );
+   
+   // no stdin is "" in a client's job packet
+   if( job.stdin_url && strlen(job.stdin_url) == 0 ) {
+      free( job.stdin_url );
+      job.stdin_url = NULL;
+   }
+   
+   int rc = process_spawn_dag( state, &job, nid, run, node );
+   if( rc != 0 ) {
+      errorf("dag_launch: node %s of %lu on %s: process_spawn_dag rc = %d\n", n->name, dag->dag_id, n->hostname, rc );
+   }
+   
+   wish_free_job_packet( &job );
+   return rc;
+}
+
+
+// send every node's outcome to a client
+static void dag_reply( struct wish_state* state, struct dag_run* run, struct wish_connection* con, bool want_usage ) {
+   int rc = wish_process_reply( state, con, PROCESS_TYPE_ARRAY, run->dag->dag_id, run->dag->num_nodes );
+   
+   for( uint32_t i = 0; i < run->dag->num_nodes && rc == 0; i++ ) {
+      struct dag_node* n = &run->nodes[i];
+   
+      rc = wish_process_reply( state, con, n->type, n->gpid, n->data );
+      if( rc == 0 && want_usage && (n->type == PROCESS_TYPE_EXIT || n->type == PROCESS_TYPE_TIMEOUT) ) {
+         // the client reads usage after every exit or timeout
+         if( !n->have_usage )
+            wish_init_usage_packet( state, &n->usage, n->gpid );
+   
+         struct wish_packet pkt;
+         wish_pack_usage_packet( state, &pkt, &n->usage );
+         rc = wish_write_packet( state, con, &pkt );
+         wish_free_packet( &pkt );
+      }
+   }
+   
+   if( rc != 0 ) {
+      errorf("dag_reply: could not reply outcome of %lu to client, rc = %d\n", run->dag->dag_id, rc );
+   }
+}
+
+
+// every outcome of a DAG is known.  If someone's already waiting, they get it now; otherwise it keeps until someone joins.
+// done is set and the join claimed together, under dags_lock, so a join can't free the run in between.
+static void dag_finish( struct dag_run* run ) {
+   pthread_rwlock_wrlock( &dags_lock );
+   pthread_mutex_lock( &run->lock );
+   
+   run->done = true;
+   
+   struct wish_connection* con = run->join;
+   bool want_usage = run->join_usage;
+   if( con )
+      dags.erase( run->dag->dag_id );
+   
+   pthread_mutex_unlock( &run->lock );
+   pthread_rwlock_unlock( &dags_lock );
+   
+   if( con ) {
+      dag_reply( run->state, run, con, want_usage );
+      wish_disconnect( run->state, con );
+      free( con );
+      dag_free( run );
+   }
+}
+
+
+// launch a DAG's nodes as they become ready, until every outcome is known
+static void* dag_run_pthread( void* arg ) {
+   struct dag_run* run = (struct dag_run*)arg;
+   struct wish_state* state = run->state;
+   
+   pthread_mutex_lock( &run->lock );
+   
+   while( run->remaining > 0 ) {
+      if( run->ready.size() == 0 ) {
+         pthread_cond_wait( &run->cond, &run->lock );
+         continue;
+      }
+   
+      vector<uint32_t> launch;
+      launch.swap( run->ready );
+   
+      pthread_mutex_unlock( &run->lock );
+   
+      // spread the ones that may run anywhere over the hosts with the most CPU to spare, one rank each
+      uint32_t num_any = 0;
+      for( vector<uint32_t>::size_type i = 0; i < launch.size(); i++ ) {
+         if( dag_any_host( run, launch[i] ) )
+            num_any++;
+      }
+   
+      vector<uint64_t> best;
+      if( num_any > 0 )
+         heartbeat_best_range( state, HEARTBEAT_PROP_CPU, 0, num_any, &best );
+   
+      uint32_t rank = 0;
+   
+      for( vector<uint32_t>::size_type i = 0; i < launch.size(); i++ ) {
+         uint64_t nid = 0;
+         if( !dag_any_host( run, launch[i] ) )
+            nid = wish_host_nid( run->dag->nodes[ launch[i] ].hostname );
+         else if( best.size() > 0 )
+            nid = best[ rank++ % best.size() ];
+   
+         int rc = -ECANCELED;
+         if( dags_running )
+            rc = dag_launch( run, launch[i], nid );
+   
+         if( rc != 0 ) {
+            pthread_mutex_lock( &run->lock );
+            dag_resolve( run, launch[i], PROCESS_TYPE_ERROR, rc, NULL );
+            pthread_mutex_unlock( &run->lock );
+         }
+      }
+   
+      pthread_mutex_lock( &run->lock );
+   }
+   
+   pthread_mutex_unlock( &run->lock );
+   
+   dbprintf("dag_run_pthread: DAG %lu is done\n", run->dag->dag_id );
+   
+   dag_finish( run );
+   return NULL;
+}
+
+
+// set up DAG tracking
+int dag_init( struct wish_state* state ) {
+   pthread_rwlock_init( &dags_lock, NULL );
+   dags_running = true;
+   return 0;
+}
+
+
+// stop launching nodes
+int dag_shutdown( struct wish_state* state ) {
+   dags_running = false;
+   
+   // wake up the launchers, so the nodes they were about to launch get cancelled.
+   // nodes that are running end when the process table shuts down.
+   pthread_rwlock_rdlock( &dags_lock );
+   for( DagTable::iterator itr = dags.begin(); itr != dags.end(); itr++ ) {
+      pthread_mutex_lock( &itr->second->lock );
+      pthread_cond_signal( &itr->second->cond );
+      pthread_mutex_unlock( &itr->second->lock );
+   }
+   pthread_rwlock_unlock( &dags_lock );
+   
+   return 0;
+}
+
+
+// start running a DAG
+int dag_start( struct wish_state* state, struct wish_dag_packet* dag, struct wish_connection* con ) {
+   int rc = wish_check_dag_packet( dag );
+   if( rc != 0 )
+      return rc;
+   
+   if( !dags_running )
+      return -ESHUTDOWN;
+   
+   if( dag->dag_id == 0 )
+      dag->dag_id = process_random_id();
+   
+   struct dag_run* run = new dag_run();
+   run->state = state;
+   run->dag = dag;
+   run->nodes = new dag_node[ dag->num_nodes ];
+   run->remaining = dag->num_nodes;
+   run->done = false;
+   run->join = NULL;
+   run->join_usage = false;
+   pthread_mutex_init( &run->lock, NULL );
+   pthread_cond_init( &run->cond, NULL );
+   
+   for( uint32_t i = 0; i < dag->num_nodes; i++ ) {
+      struct dag_node* n = &run->nodes[i];
+      n->status = DAG_NODE_WAITING;
+      n->gpid = process_random_id();
+      n->waiting = dag->nodes[i].num_deps;
+      n->doomed = false;
+      n->type = PROCESS_TYPE_ERROR;
+      n->data = 0;
+      n->have_usage = false;
+      memset( &n->usage, 0, sizeof(struct wish_usage_packet) );
+   
+      for( uint32_t j = 0; j < dag->nodes[i].num_deps; j++ ) {
+         vector<uint32_t>* dependents = &run->nodes[ dag->nodes[i].deps[j].node ].dependents;
+         if( find( dependents->begin(), dependents->end(), i ) == dependents->end() )
+            dependents->push_back( i );
+      }
+   
+      // nothing to wait on
+      if( n->waiting == 0 ) {
+         n->status = DAG_NODE_RUNNING;
+         run->ready.push_back( i );
+      }
+   }
+   
+   pthread_rwlock_wrlock( &dags_lock );
+   if( dags.find( dag->dag_id ) != dags.end() ) {
+      pthread_rwlock_unlock( &dags_lock );
+   
+      // the caller keeps the DAG
+      run->dag = NULL;
+      delete[] run->nodes;
+      pthread_mutex_destroy( &run->lock );
+      pthread_cond_destroy( &run->cond );
+      delete run;
+      return -EEXIST;
+   }
+   dags[ dag->dag_id ] = run;
+   pthread_rwlock_unlock( &dags_lock );
+   
+   // tell the client the DAG's id, and its nodes' gpids
+   struct wish_dag_packet reply;
+   wish_init_dag_packet( state, &reply, dag->dag_id, dag->owner, dag->group, dag->umask );
+   reply.num_gpids = dag->num_nodes;
+   reply.gpids = (uint64_t*)calloc( sizeof(uint64_t) * dag->num_nodes, 1 );
+   for( uint32_t i = 0; i < dag->num_nodes; i++ ) {
+      reply.gpids[i] = run->nodes[i].gpid;
+   }
+   
+   struct wish_packet pkt;
+   wish_pack_dag_packet( state, &pkt, &reply );
+   wish_free_dag_packet( &reply );
+   
+   rc = wish_write_packet( state, con, &pkt );
+   wish_free_packet( &pkt );
+   
+   if( rc != 0 ) {
+      // it runs anyway, and can be joined by id
+      errorf("dag_start: could not reply gpids of %lu to client, rc = %d\n", dag->dag_id, rc );
+   }
+   
+   pthread_attr_t attrs;
+   pthread_attr_init( &attrs );
+   pthread_attr_setdetachstate( &attrs, PTHREAD_CREATE_DETACHED );
+   
+   pthread_t thread;
+   rc = pthread_create( &thread, &attrs, dag_run_pthread, run );
+   pthread_attr_destroy( &attrs );
+   
+   if( rc != 0 ) {
+      errorf("dag_start: pthread_create rc = %d\n", rc );
+   
+      // nothing will run; every node fails
+      pthread_mutex_lock( &run->lock );
+      for( uint32_t i = 0; i < dag->num_nodes; i++ ) {
+         if( run->nodes[i].status != DAG_NODE_DONE )
+            dag_resolve( run, i, PROCESS_TYPE_ERROR, -rc, NULL );
+      }
+      run->ready.clear();
+      pthread_mutex_unlock( &run->lock );
+   
+      dag_finish( run );
+   }
+   
+   return 0;
+}
+
+
+// a node has ended
+void dag_node_ended( struct wish_state* state, struct dag_run* run, uint32_t node, int type, int data, struct wish_usage_packet* usage ) {
+   pthread_mutex_lock( &run->lock );
+   
+   if( run->nodes[node].status != DAG_NODE_DONE ) {
+      dag_resolve( run, node, type, data, usage );
+      pthread_cond_signal( &run->cond );
+   }
+   
+   pthread_mutex_unlock( &run->lock );
+}
+
+
+// join on a DAG
+int dag_join( struct wish_state* state, struct wish_connection* con, uint64_t dag_id, bool block, bool want_usage ) {
+   pthread_rwlock_wrlock( &dags_lock );
+   
+   DagTable::iterator itr = dags.find( dag_id );
+   if( itr == dags.end() ) {
+      pthread_rwlock_unlock( &dags_lock );
+      return -ENOENT;
+   }
+   
+   struct dag_run* run = itr->second;
+   int rc = 0;
+   
+   pthread_mutex_lock( &run->lock );
+   
+   if( run->done ) {
+      // already finished--reply everything now
+      dags.erase( itr );
+      pthread_mutex_unlock( &run->lock );
+      pthread_rwlock_unlock( &dags_lock );
+   
+      dag_reply( state, run, con, want_usage );
+      wish_disconnect( state, con );
+      free( con );
+      dag_free( run );
+      return 0;
+   }
+   
+   if( !block ) {
+      // reply that it's still working
+      pthread_mutex_unlock( &run->lock );
+      pthread_rwlock_unlock( &dags_lock );
+   
+      rc = wish_process_reply( state, con, PROCESS_TYPE_ERROR, dag_id, -EAGAIN );
+      if( rc != 0 )
+         return rc;
+   
+      wish_disconnect( state, con );
+      free( con );
+      return 0;
+   }
+   
+   if( run->join != NULL ) {
+      // someone else is already waiting on it
+      rc = -EBUSY;
+   }
+   else {
+      run->join = con;
+      run->join_usage = want_usage;
+   }
+   
+   pthread_mutex_unlock( &run->lock );
+   pthread_rwlock_unlock( &dags_lock );
+   
+   return rc;
+}
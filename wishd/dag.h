@@ -0,0 +1,73 @@
+// job DAGs, run by the origin.
+// a client sends the whole DAG at once.  The origin launches each node as soon as the nodes it depends on have
+// ended (skipping it if an after-success dependency didn't succeed), and keeps every node's outcome until the
+// DAG is joined, so a workflow costs one round trip to submit and one to join no matter how many stages it has.
+#ifndef _DAG_H_
+#define _DAG_H_
+
+#include "libwish.h"
+#include "heartbeat.h"
+#include <map>
+#include <vector>
+
+using namespace std;
+
+// where a node is
+#define DAG_NODE_WAITING   0     // waiting on dependencies
+#define DAG_NODE_RUNNING   1     // launched
+#define DAG_NODE_DONE      2     // ended (or never ran); outcome is known
+
+// one node of a running DAG
+struct dag_node {
+   int status;                   // DAG_NODE_*
+   uint64_t gpid;
+   uint32_t waiting;             // dependencies that haven't ended yet
+   bool doomed;                  // did an after-success dependency fail?  Then it's skipped.
+   vector<uint32_t> dependents;  // nodes that depend on this one
+
+   // outcome
+   int type;                     // PROCESS_TYPE_EXIT, PROCESS_TYPE_TIMEOUT, or PROCESS_TYPE_ERROR
+   int data;                     // exit status, or -errno
+   struct wish_usage_packet usage;
+   bool have_usage;
+};
+
+// a running DAG
+struct dag_run {
+   struct wish_state* state;
+   struct wish_dag_packet* dag;
+   struct dag_node* nodes;
+
+   vector<uint32_t> ready;       // nodes to launch
+   uint32_t remaining;           // nodes whose outcome isn't known yet
+   bool done;                    // is every outcome known?
+
+   struct wish_connection* join; // client waiting on the whole DAG (NULL if none yet)
+   bool join_usage;              // does it want each node's resource usage too?
+
+   pthread_mutex_t lock;
+   pthread_cond_t cond;          // signaled when nodes become ready or outcomes come in
+};
+
+typedef map<uint64_t, struct dag_run*> DagTable;
+
+// set up DAG tracking
+int dag_init( struct wish_state* state );
+
+// stop launching nodes of DAGs that are still running
+int dag_shutdown( struct wish_state* state );
+
+// start running a DAG from a client, and reply its id and its nodes' gpids on con.
+// takes ownership of dag (allocated with malloc) on success.
+// return 0 on success; negative on error (in which case the caller keeps ownership)
+int dag_start( struct wish_state* state, struct wish_dag_packet* dag, struct wish_connection* con );
+
+// a node of a DAG has ended (called by the process subsystem, from the node's join)
+void dag_node_ended( struct wish_state* state, struct dag_run* run, uint32_t node, int type, int data, struct wish_usage_packet* usage );
+
+// join on a DAG: reply PROCESS_TYPE_ARRAY with the number of nodes, then each node's outcome in order, once all are known.
+// takes ownership of con on success.
+// return 0 on success; -ENOENT if there is no such DAG; other negative on error
+int dag_join( struct wish_state* state, struct wish_connection* con, uint64_t dag_id, bool block, bool want_usage );
+
+#endif
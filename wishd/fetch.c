@@ -0,0 +1,274 @@
+#include "fetch.h"
+
+// downloads waiting to start
+static FetchQueue pending;
+static pthread_rwlock_t pending_lock;
+
+// multi handle driving all downloads
+static CURLM* fetch_multi = NULL;
+
+// downloads in progress, and how many there are per host (only touched by the fetch thread)
+static FetchQueue active;
+static FetchHostCounts host_active;
+
+// configuration
+static int host_connections = FETCH_DEFAULT_HOST_CONNECTIONS;
+static long connect_timeout = 0;
+
+static pthread_t fetch_thread;
+static volatile bool fetch_running = false;
+
+
+// write downloaded data to the request's file
+static size_t fetch_write( void* data, size_t size, size_t count, void* user_data ) {
+   struct fetch_request* req = (struct fetch_request*)user_data;
+
+   size_t len = size * count;
+   size_t written = 0;
+   while( written < len ) {
+      ssize_t rc = write( req->fd, (char*)data + written, len - written );
+      if( rc < 0 ) {
+         if( errno == EINTR )
+            continue;
+
+         // curl will stop the transfer
+         errorf("fetch_write: write to %d errno = %d\n", req->fd, -errno );
+         break;
+      }
+      written += rc;
+   }
+
+   return written;
+}
+
+
+// get the host:port part of a URL
+static char* fetch_url_host( char const* url ) {
+   char const* start = strstr( url, "://" );
+   if( start == NULL )
+      start = url;
+   else
+      start += 3;
+
+   size_t len = strcspn( start, "/" );
+
+   char* ret = (char*)calloc( len + 1, 1 );
+   strncpy( ret, start, len );
+   return ret;
+}
+
+
+// start a download on the multi handle
+static int fetch_begin( struct fetch_request* req ) {
+   CURL* curl_h = curl_easy_init();
+   if( curl_h == NULL )
+      return -ENOMEM;
+
+   curl_easy_setopt( curl_h, CURLOPT_NOPROGRESS, 1L );
+   curl_easy_setopt( curl_h, CURLOPT_USERAGENT, "wish/1.0");
+   curl_easy_setopt( curl_h, CURLOPT_URL, req->url );
+   curl_easy_setopt( curl_h, CURLOPT_FOLLOWLOCATION, 1L );
+   curl_easy_setopt( curl_h, CURLOPT_NOSIGNAL, 1L );
+   curl_easy_setopt( curl_h, CURLOPT_WRITEFUNCTION, fetch_write );
+   curl_easy_setopt( curl_h, CURLOPT_WRITEDATA, req );
+   curl_easy_setopt( curl_h, CURLOPT_PRIVATE, req );
+
+   if( connect_timeout > 0 )
+      curl_easy_setopt( curl_h, CURLOPT_CONNECTTIMEOUT_MS, connect_timeout );
+
+   CURLMcode mrc = curl_multi_add_handle( fetch_multi, curl_h );
+   if( mrc != CURLM_OK ) {
+      errorf("fetch_begin: curl_multi_add_handle rc = %d\n", mrc );
+      curl_easy_cleanup( curl_h );
+      return -EIO;
+   }
+
+   req->curl_h = curl_h;
+   active.push_back( req );
+   host_active[ string(req->host) ]++;
+   return 0;
+}
+
+
+// finish a download, and tell whoever is waiting on it
+static void fetch_end( struct fetch_request* req, int rc ) {
+   if( req->curl_h ) {
+      curl_easy_getinfo( req->curl_h, CURLINFO_RESPONSE_CODE, &req->status );
+
+      curl_multi_remove_handle( fetch_multi, req->curl_h );
+      curl_easy_cleanup( req->curl_h );
+      req->curl_h = NULL;
+
+      host_active[ string(req->host) ]--;
+
+      for( FetchQueue::iterator itr = active.begin(); itr != active.end(); itr++ ) {
+         if( *itr == req ) {
+            active.erase( itr );
+            break;
+         }
+      }
+
+      if( rc == 0 && req->status >= 400 ) {
+         rc = -req->status;
+      }
+   }
+
+   req->rc = -abs(rc);
+   sem_post( req->done );
+}
+
+
+// start as many pending downloads as the per-host caps allow
+static void fetch_admit(void) {
+   pthread_rwlock_wrlock( &pending_lock );
+
+   for( FetchQueue::iterator itr = pending.begin(); itr != pending.end(); ) {
+      struct fetch_request* req = *itr;
+
+      if( host_active[ string(req->host) ] >= host_connections ) {
+         itr++;
+         continue;
+      }
+
+      itr = pending.erase( itr );
+
+      int rc = fetch_begin( req );
+      if( rc != 0 ) {
+         fetch_end( req, rc );
+      }
+   }
+
+   pthread_rwlock_unlock( &pending_lock );
+}
+
+
+// fetch thread: drive all downloads
+static void* fetch_thread_func( void* arg ) {
+   while( fetch_running ) {
+      fetch_admit();
+
+      int still_running = 0;
+      curl_multi_perform( fetch_multi, &still_running );
+
+      // reap finished downloads
+      CURLMsg* msg = NULL;
+      int msgs_left = 0;
+      while( (msg = curl_multi_info_read( fetch_multi, &msgs_left )) != NULL ) {
+         if( msg->msg != CURLMSG_DONE )
+            continue;
+
+         struct fetch_request* req = NULL;
+         curl_easy_getinfo( msg->easy_handle, CURLINFO_PRIVATE, (char**)&req );
+
+         if( msg->data.result != CURLE_OK ) {
+            errorf("fetch_thread_func: download of %s failed: %s\n", req->url, curl_easy_strerror( msg->data.result ) );
+         }
+
+         fetch_end( req, msg->data.result );
+      }
+
+      // wait for something to happen, or for a new download to be queued
+      curl_multi_poll( fetch_multi, NULL, 0, 1000, NULL );
+   }
+
+   return NULL;
+}
+
+
+// start the fetch thread
+int fetch_init( struct wish_state* state ) {
+   wish_state_rlock( state );
+   if( state->conf.fetch_host_connections > 0 )
+      host_connections = state->conf.fetch_host_connections;
+   connect_timeout = state->conf.connect_timeout;
+   wish_state_unlock( state );
+
+   curl_global_init( CURL_GLOBAL_ALL );
+
+   fetch_multi = curl_multi_init();
+   if( fetch_multi == NULL ) {
+      errorf("%s", "fetch_init: curl_multi_init failed\n");
+      return -ENOMEM;
+   }
+
+   pthread_rwlock_init( &pending_lock, NULL );
+
+   fetch_running = true;
+   int rc = pthread_create( &fetch_thread, NULL, fetch_thread_func, NULL );
+   if( rc != 0 ) {
+      errorf("fetch_init: pthread_create rc = %d\n", rc );
+      fetch_running = false;
+      curl_multi_cleanup( fetch_multi );
+      fetch_multi = NULL;
+      pthread_rwlock_destroy( &pending_lock );
+      return -rc;
+   }
+
+   return 0;
+}
+
+
+// stop the fetch thread
+int fetch_shutdown( struct wish_state* state ) {
+   if( !fetch_running )
+      return 0;
+
+   fetch_running = false;
+   curl_multi_wakeup( fetch_multi );
+   pthread_join( fetch_thread, NULL );
+
+   // fail everything that didn't finish
+   pthread_rwlock_wrlock( &pending_lock );
+   for( FetchQueue::size_type i = 0; i < pending.size(); i++ ) {
+      fetch_end( pending[i], -ECANCELED );
+   }
+   pending.clear();
+   pthread_rwlock_unlock( &pending_lock );
+
+   while( active.size() > 0 ) {
+      fetch_end( active[0], -ECANCELED );
+   }
+
+   curl_multi_cleanup( fetch_multi );
+   fetch_multi = NULL;
+
+   pthread_rwlock_destroy( &pending_lock );
+   return 0;
+}
+
+
+// set up a download of url into fd
+void fetch_request_init( struct fetch_request* req, char const* url, int fd, sem_t* done ) {
+   memset( req, 0, sizeof(struct fetch_request) );
+   req->url = strdup( url );
+   req->host = fetch_url_host( url );
+   req->fd = fd;
+   req->done = done;
+}
+
+
+// free a download's memory
+void fetch_request_free( struct fetch_request* req ) {
+   if( req->url ) {
+      free( req->url );
+      req->url = NULL;
+   }
+   if( req->host ) {
+      free( req->host );
+      req->host = NULL;
+   }
+}
+
+
+// queue a download
+int fetch_start( struct fetch_request* req ) {
+   if( !fetch_running )
+      return -ENOTCONN;
+
+   pthread_rwlock_wrlock( &pending_lock );
+   pending.push_back( req );
+   pthread_rwlock_unlock( &pending_lock );
+
+   curl_multi_wakeup( fetch_multi );
+   return 0;
+}
@@ -0,0 +1,48 @@
+// shared download thread for job inputs.
+// all downloads run concurrently on one curl multi handle, with a cap on how many go to any one host at once.
+#ifndef _FETCH_H_
+#define _FETCH_H_
+
+#include "libwish.h"
+#include <semaphore.h>
+#include <map>
+#include <string>
+
+using namespace std;
+
+#define FETCH_DEFAULT_HOST_CONNECTIONS 4        // default maximum concurrent downloads from a single host
+
+// a download
+struct fetch_request {
+   char* url;                    // URL to download
+   char* host;                   // host (and port) it comes from
+   int fd;                       // where to write the data
+   sem_t* done;                  // posted once the download finishes (successfully or not)
+
+   // filled in when the download finishes
+   int rc;                       // 0 on success; negative on error
+   long status;                  // HTTP status
+
+   CURL* curl_h;                 // used by the fetch thread
+};
+
+typedef vector<struct fetch_request*> FetchQueue;
+typedef map<string, int> FetchHostCounts;
+
+// start the fetch thread
+int fetch_init( struct wish_state* state );
+
+// stop the fetch thread.  Unfinished downloads fail with -ECANCELED.
+int fetch_shutdown( struct wish_state* state );
+
+// set up a download of url into fd
+void fetch_request_init( struct fetch_request* req, char const* url, int fd, sem_t* done );
+
+// free a download's memory
+void fetch_request_free( struct fetch_request* req );
+
+// queue a download.  req->done will be posted once it finishes.
+// return 0 on success; negative on error
+int fetch_start( struct fetch_request* req );
+
+#endif
@@ -0,0 +1,178 @@
+#include "gpidtable.h"
+
+// which shard a gpid lives in (gpids aren't evenly spread in their low bits, so mix them first)
+static struct gpid_shard* gpid_table_shard( struct gpid_table* table, uint64_t gpid ) {
+   return &table->shards[ (gpid * 0x9E3779B97F4A7C15ULL) >> (64 - GPID_TABLE_SHARD_BITS) ];
+}
+
+
+// free an entry that nothing refers to anymore
+static void gpid_table_free( struct gpid_table* table, struct gpid_entry* ent ) {
+   pthread_mutex_destroy( &ent->lock );
+   (*table->free_entry)( table->state, ent );
+}
+
+
+// set up a table
+void gpid_table_init( struct gpid_table* table, struct wish_state* state, gpid_entry_free_func free_entry ) {
+   for( int i = 0; i < GPID_TABLE_SHARDS; i++ ) {
+      pthread_mutex_init( &table->shards[i].lock, NULL );
+      table->shards[i].entries.clear();
+   }
+
+   table->state = state;
+   table->free_entry = free_entry;
+}
+
+
+// remove and free everything in a table
+void gpid_table_shutdown( struct gpid_table* table ) {
+   for( int i = 0; i < GPID_TABLE_SHARDS; i++ ) {
+      struct gpid_shard* shard = &table->shards[i];
+
+      for( GpidShardMap::iterator itr = shard->entries.begin(); itr != shard->entries.end(); itr++ ) {
+         struct gpid_entry* ent = itr->second;
+         ent->removed = true;
+         ent->refs--;
+
+         if( ent->refs == 0 )
+            gpid_table_free( table, ent );
+      }
+
+      shard->entries.clear();
+      pthread_mutex_destroy( &shard->lock );
+   }
+}
+
+
+// add an entry under gpid.  The table and the caller each get a reference.
+int gpid_table_insert( struct gpid_table* table, struct gpid_entry* ent, uint64_t gpid ) {
+   struct gpid_shard* shard = gpid_table_shard( table, gpid );
+
+   ent->gpid = gpid;
+   ent->refs = 2;
+   ent->removed = false;
+
+   pthread_mutex_lock( &shard->lock );
+
+   if( shard->entries.find( gpid ) != shard->entries.end() ) {
+      pthread_mutex_unlock( &shard->lock );
+      return -EEXIST;
+   }
+
+   pthread_mutex_init( &ent->lock, NULL );
+   shard->entries[ gpid ] = ent;
+
+   pthread_mutex_unlock( &shard->lock );
+   return 0;
+}
+
+
+// look up an entry, and take a reference to it
+struct gpid_entry* gpid_table_get( struct gpid_table* table, uint64_t gpid ) {
+   struct gpid_shard* shard = gpid_table_shard( table, gpid );
+   struct gpid_entry* ent = NULL;
+
+   pthread_mutex_lock( &shard->lock );
+
+   GpidShardMap::iterator itr = shard->entries.find( gpid );
+   if( itr != shard->entries.end() ) {
+      ent = itr->second;
+      ent->refs++;
+   }
+
+   pthread_mutex_unlock( &shard->lock );
+   return ent;
+}
+
+
+// drop a reference to an entry
+void gpid_table_put( struct gpid_table* table, struct gpid_entry* ent ) {
+   struct gpid_shard* shard = gpid_table_shard( table, ent->gpid );
+
+   pthread_mutex_lock( &shard->lock );
+   ent->refs--;
+   bool last = (ent->refs == 0);
+   pthread_mutex_unlock( &shard->lock );
+
+   if( last )
+      gpid_table_free( table, ent );
+}
+
+
+// take an entry out of the table.  The caller holds a reference, so this never frees it.
+int gpid_table_remove( struct gpid_table* table, struct gpid_entry* ent ) {
+   struct gpid_shard* shard = gpid_table_shard( table, ent->gpid );
+   int rc = 0;
+
+   pthread_mutex_lock( &shard->lock );
+
+   if( ent->removed ) {
+      rc = -ENOENT;
+   }
+   else {
+      shard->entries.erase( ent->gpid );
+      ent->removed = true;
+      ent->refs--;
+   }
+
+   pthread_mutex_unlock( &shard->lock );
+   return rc;
+}
+
+
+// take a reference to every entry in the table, one shard at a time
+void gpid_table_snapshot( struct gpid_table* table, GpidEntryList* ents ) {
+   gpid_table_snapshot_part( table, 0, 1, ents );
+}
+
+
+// take a reference to every entry in every num_parts'th shard, starting with shard part
+void gpid_table_snapshot_part( struct gpid_table* table, int part, int num_parts, GpidEntryList* ents ) {
+   for( int i = part; i < GPID_TABLE_SHARDS; i += num_parts ) {
+      struct gpid_shard* shard = &table->shards[i];
+
+      pthread_mutex_lock( &shard->lock );
+
+      for( GpidShardMap::iterator itr = shard->entries.begin(); itr != shard->entries.end(); itr++ ) {
+         itr->second->refs++;
+         ents->push_back( itr->second );
+      }
+
+      pthread_mutex_unlock( &shard->lock );
+   }
+}
+
+
+// drop the references taken by gpid_table_snapshot
+void gpid_table_put_all( struct gpid_table* table, GpidEntryList* ents ) {
+   for( GpidEntryList::size_type i = 0; i < ents->size(); i++ ) {
+      gpid_table_put( table, ents->at(i) );
+   }
+   ents->clear();
+}
+
+
+// how many entries are in the table
+size_t gpid_table_count( struct gpid_table* table ) {
+   size_t count = 0;
+
+   for( int i = 0; i < GPID_TABLE_SHARDS; i++ ) {
+      pthread_mutex_lock( &table->shards[i].lock );
+      count += table->shards[i].entries.size();
+      pthread_mutex_unlock( &table->shards[i].lock );
+   }
+
+   return count;
+}
+
+
+// lock an entry
+int gpid_entry_lock( struct gpid_entry* ent ) {
+   return pthread_mutex_lock( &ent->lock );
+}
+
+// unlock an entry
+int gpid_entry_unlock( struct gpid_entry* ent ) {
+   return pthread_mutex_unlock( &ent->lock );
+}
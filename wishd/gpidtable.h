@@ -0,0 +1,81 @@
+// table of reference-counted entries keyed by gpid, split into independently-locked shards.
+// shard locks are only held long enough to find, add, or remove an entry.  Each entry has its own lock
+// for everything else, so slow work (like network I/O) on one entry never holds up lookups of the others.
+#ifndef _GPIDTABLE_H_
+#define _GPIDTABLE_H_
+
+#include "libwish.h"
+#include <map>
+#include <vector>
+
+using namespace std;
+
+#define GPID_TABLE_SHARD_BITS 6
+#define GPID_TABLE_SHARDS     (1 << GPID_TABLE_SHARD_BITS)
+
+// table entry header.  Must be the first member of the structure it heads.
+struct gpid_entry {
+   uint64_t gpid;
+   int refs;                     // references held on this entry (the table holds one while the entry is in it)
+   bool removed;                 // has this entry been taken out of its table?  Only changes with lock held.
+   pthread_mutex_t lock;         // protects the structure this heads
+};
+
+// frees an entry once it has been removed and its last reference dropped
+typedef void (*gpid_entry_free_func)( struct wish_state* state, struct gpid_entry* ent );
+
+typedef map<uint64_t, struct gpid_entry*> GpidShardMap;
+typedef vector<struct gpid_entry*> GpidEntryList;
+
+struct gpid_shard {
+   pthread_mutex_t lock;
+   GpidShardMap entries;
+};
+
+struct gpid_table {
+   struct gpid_shard shards[GPID_TABLE_SHARDS];
+   struct wish_state* state;
+   gpid_entry_free_func free_entry;
+};
+
+// set up a table
+void gpid_table_init( struct gpid_table* table, struct wish_state* state, gpid_entry_free_func free_entry );
+
+// remove and free everything in a table.  Nothing else may be using it.
+void gpid_table_shutdown( struct gpid_table* table );
+
+// add an entry under gpid.  On success, both the table and the caller hold a reference to it.
+// return 0 on success, or -EEXIST if the table already has an entry for gpid
+int gpid_table_insert( struct gpid_table* table, struct gpid_entry* ent, uint64_t gpid );
+
+// look up an entry, and take a reference to it.
+// return NULL if there is no entry for gpid
+struct gpid_entry* gpid_table_get( struct gpid_table* table, uint64_t gpid );
+
+// drop a reference to an entry, freeing it if it was the last one.  The entry must not be locked by the caller.
+void gpid_table_put( struct gpid_table* table, struct gpid_entry* ent );
+
+// take an entry out of the table, and drop the table's reference to it.
+// the caller must hold a reference and the entry's lock.
+// return 0 on success, or -ENOENT if it was already removed
+int gpid_table_remove( struct gpid_table* table, struct gpid_entry* ent );
+
+// take a reference to every entry in the table.  Release them with gpid_table_put_all.
+void gpid_table_snapshot( struct gpid_table* table, GpidEntryList* ents );
+
+// take a reference to every entry in one part of the table, when it is split into num_parts parts by gpid.
+// each entry is in exactly one part, so threads can divide the table's entries between them.
+// release them with gpid_table_put_all
+void gpid_table_snapshot_part( struct gpid_table* table, int part, int num_parts, GpidEntryList* ents );
+
+// drop the references taken by gpid_table_snapshot
+void gpid_table_put_all( struct gpid_table* table, GpidEntryList* ents );
+
+// how many entries are in the table (a snapshot; it may change as soon as this returns)
+size_t gpid_table_count( struct gpid_table* table );
+
+// lock and unlock an entry
+int gpid_entry_lock( struct gpid_entry* ent );
+int gpid_entry_unlock( struct gpid_entry* ent );
+
+#endif
@@ -1,22 +1,87 @@
 #include "heartbeat.h"
+#include "scheduler.h"
+#include "process.h"
 
 typedef map<long, struct wish_host_status*> HostHeartbeats;
 
 static HostHeartbeats host_heartbeats;
+static struct rank_list host_ranks[HEARTBEAT_RANKINGS];     // by HEARTBEAT_PROP_* - HEARTBEAT_PROP_LATENCY
 static int _STATUS_MEMORY = 0;
 
-// lock on host_heartbeats
+// lock on host_heartbeats (and membership).  Only writers take it; readers use the published snapshot.
 static pthread_rwlock_t host_heartbeats_lock;
 
+// lock on host_ranks alone.  Writers hold it only to refile a host, under host_heartbeats_lock and never across
+// I/O, so readers of the rankings wait at most an O(log n) insert and remove.
+static pthread_rwlock_t host_ranks_lock;
+
+// published snapshots are packed with their readers: user space addresses fit in the low 48 bits (x86-64 and
+// aarch64), which leaves the top 16 to count readers
+#define SNAPSHOT_MASK      ((1ULL << 48) - 1)
+#define SNAPSHOT_READER    (1ULL << 48)
+
 // heartbeat processing thread
 static pthread_t host_heartbeat_thread;
 
-void* heartbeat_thread(void* arg);
+// fires every heartbeat interval to probe a host, and half way through to get help with a probe that went unanswered
+static struct timer heartbeat_timer;
+static struct timer probe_timer;
+static uint64_t heartbeat_interval = 0;
 
-// rlock host_heartbeats
-static int host_heartbeats_rlock(void) {
-   return pthread_rwlock_rdlock( &host_heartbeats_lock );
-}
+// who's in the instance
+static struct swim membership;
+
+// most connections to other hosts to keep open
+static unsigned int max_connections = HEARTBEAT_DEFAULT_CONNECTIONS;
+
+// time heartbeats by when the kernel received them?
+static bool use_timestamps = false;
+
+// what readers see (see struct heartbeat_snapshot), packed with how many readers hold it (see
+// heartbeat_snapshot_get).  Only swapped under the write lock.
+static struct heartbeat_snapshot empty_snapshot = { 1, 0, NULL, host_ranks };
+static uint64_t published = (uint64_t)&empty_snapshot;
+static bool snapshot_dirty = false;           // has anything readers see changed since it was published?
+
+// a heartbeat queued for the sender thread
+struct heartbeat_outbound {
+   uint64_t nid;                 // who it's for
+   struct wish_heartbeat_packet h;    // stamped just before it goes out
+};
+
+// a connect the sender thread is waiting on, and what's waiting to go out on it
+struct heartbeat_connecting {
+   int soc;
+   int flags;                    // the socket's flags, before we made it non-blocking
+   struct addrinfo* addr;
+   char* hostname;
+   int portnum;
+   uint64_t deadline;            // when to give up, by our monotonic clock (microseconds)
+   vector<struct heartbeat_outbound> waiting;
+};
+
+typedef map<uint64_t, struct heartbeat_connecting> HeartbeatConnecting;
+
+// sends heartbeats, so that no one waits on the network while holding the lock on host_heartbeats
+static pthread_t send_thread;
+static pthread_mutex_t send_lock;
+static vector<struct heartbeat_outbound> send_queue;     // protected by send_lock
+static bool send_running = false;                        // protected by send_lock
+static int send_wake[2] = { -1, -1 };                    // written to when something's queued
+
+// how long to wait to connect to a host, in milliseconds
+static int connect_timeout = 5000;
+
+static void heartbeat_send( struct wish_state* state, uint64_t arg );
+static void heartbeat_wake_sender(void);
+static void* heartbeat_send_pthread( void* arg );
+static int heartbeat_receive( struct wish_state* state, long from, struct wish_packet* wp, uint64_t arrival );
+static void heartbeat_probe_timeout( struct wish_state* state, uint64_t arg );
+static void heartbeat_publish(void);
+static void heartbeat_snapshot_swap( struct heartbeat_snapshot* snap );
+static void heartbeat_peer_put( struct heartbeat_peer* peer );
+
+void* heartbeat_thread(void* arg);
 
 // wlock host_heartbeats
 static int host_heartbeats_wlock(void) {
@@ -29,302 +94,1327 @@ static int host_heartbeats_unlock(void) {
 }
 
 
+// current time, in milliseconds
+static uint64_t heartbeat_now(void) {
+   struct timeval tv;
+   gettimeofday( &tv, NULL );
+   return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+// current time by the monotonic clock, in microseconds.  Heartbeats are timed by it, so NTP can't step their RTTs.
+static uint64_t heartbeat_mono_now(void) {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+// set up a heartbeat connection to time heartbeats well: send each one as soon as it's written (rather than hold
+// its payload until the header is acked, which costs a delayed ack), and have the kernel stamp what arrives if
+// we're timing by it
+static void heartbeat_socket_setup( struct wish_connection* con ) {
+   if( con->soc < 0 )
+      return;
+   
+   int one = 1;
+   if( setsockopt( con->soc, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) ) != 0 ) {
+      errorf("heartbeat_socket_setup: setsockopt(TCP_NODELAY) on socket %d errno = %d\n", con->soc, -errno );
+   }
+   
+   if( !use_timestamps )
+      return;
+   
+   int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+   int rc = setsockopt( con->soc, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags) );
+   if( rc != 0 ) {
+      errorf("heartbeat_socket_setup: setsockopt(SO_TIMESTAMPING) on socket %d errno = %d\n", con->soc, -errno );
+   }
+}
+
+
+// when the heartbeat waiting on a connection arrived, by our monotonic clock: when the kernel got it if it stamped
+// it, or else now (so time spent waiting for us to poll the connection counts against the host)
+static uint64_t heartbeat_arrival( struct wish_connection* con ) {
+   uint64_t now = heartbeat_mono_now();
+   if( !use_timestamps )
+      return now;
+   
+   // peek at the first byte, for its stamp
+   char byte;
+   char control[CMSG_SPACE(sizeof(struct scm_timestamping))];
+   struct iovec iov;
+   iov.iov_base = &byte;
+   iov.iov_len = 1;
+   
+   struct msghdr msg;
+   memset( &msg, 0, sizeof(msg) );
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+   
+   if( recvmsg( con->soc, &msg, MSG_PEEK | MSG_DONTWAIT ) <= 0 )
+      return now;
+   
+   for( struct cmsghdr* cm = CMSG_FIRSTHDR( &msg ); cm != NULL; cm = CMSG_NXTHDR( &msg, cm ) ) {
+      if( cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SO_TIMESTAMPING )
+         continue;
+   
+      // the stamp is by the wall clock; take its age off our monotonic now
+      struct scm_timestamping* stamp = (struct scm_timestamping*)CMSG_DATA( cm );
+      if( stamp->ts[0].tv_sec == 0 )
+         break;
+   
+      struct timespec real;
+      clock_gettime( CLOCK_REALTIME, &real );
+      int64_t age = (int64_t)(real.tv_sec - stamp->ts[0].tv_sec) * 1000000 + (real.tv_nsec - stamp->ts[0].tv_nsec) / 1000;
+      if( age > 0 && (uint64_t)age < now )
+         return now - age;
+   
+      break;
+   }
+   
+   return now;
+}
+
+
+// set up a host status's history rings
+static void wish_host_status_init_history( struct wish_host_status* status ) {
+   status->samples_size = (_STATUS_MEMORY > 0 ? _STATUS_MEMORY : 1);
+   status->samples = (struct heartbeat_sample*)calloc( sizeof(struct heartbeat_sample) * status->samples_size, 1 );
+   status->samples_next = 0;
+   status->num_samples = 0;
+   
+   status->probe_id = 0;
+   status->probe_mono = 0;
+   status->probes = 0;
+   status->probes_lost = 0;
+   status->loss = 0;
+   status->jitter = 0;
+   status->last_latency = -1;
+   
+   memset( &status->latency, 0, sizeof(struct heartbeat_stat) );
+   memset( &status->load, 0, sizeof(struct heartbeat_stat) );
+   memset( &status->ram_free, 0, sizeof(struct heartbeat_stat) );
+   memset( &status->disk_free, 0, sizeof(struct heartbeat_stat) );
+   memset( &status->util, 0, sizeof(struct heartbeat_stat) );
+   status->util.zeros = true;     // an idle host's is 0
+}
+
+
 // initialize a host status
 static int wish_host_status_init( struct wish_state* state, struct wish_host_status* status, struct wish_connection* con ) {
    
    if( con ) {
       char hostname[HOST_NAME_MAX+1];
       char portnum_buf[10];
-      
+   
       int rc = getnameinfo( con->addr->ai_addr, con->addr->ai_addrlen, hostname, HOST_NAME_MAX, portnum_buf, 10, NI_NUMERICHOST | NI_NUMERICSERV );
       if( rc != 0 )
          return rc;
-      
+   
       status->portnum = strtol( portnum_buf, NULL, 10 );
       status->hostname = strdup( hostname );
       status->nid = wish_host_nid( hostname );
-      
+   
       status->con = *con;
       wish_recv_timeout( state, &status->con, 0 );    // don't time out
+      heartbeat_socket_setup( &status->con );
    }
    else {
       status->con.soc = -1;
       status->con.addr = NULL;
-   } 
+   }
    
-   status->pending = new vector<struct wish_heartbeat_packet*>();
-   status->heartbeats = new vector<struct wish_heartbeat_packet*>();
+   status->state = MEMBER_ALIVE;
+   status->last_used = heartbeat_now();
+   
+   wish_host_status_init_history( status );
    
    return 0;
 }
 
 
 // initialize a host status
-static int wish_host_status_init2( struct wish_state* state, struct wish_host_status* status, char* hostname, int portnum ) {
+static int wish_host_status_init2( struct wish_state* state, struct wish_host_status* status, char const* hostname, int portnum ) {
    
    status->portnum = portnum;
    status->hostname = strdup( hostname );
    status->nid = wish_host_nid( hostname );
+   status->state = MEMBER_ALIVE;
+   status->last_used = 0;
    
    memset( &status->con, 0, sizeof(struct wish_connection) );
    status->con.soc = -1;
    
-   status->pending = new vector<struct wish_heartbeat_packet*>();
-   status->heartbeats = new vector<struct wish_heartbeat_packet*>();
+   wish_host_status_init_history( status );
+   
+   return 0;
+}
+
+
+// free a host status
+static void wish_host_status_free( struct wish_state* state, struct wish_host_status* hs ) {
+   if( hs->peer != NULL )
+      heartbeat_peer_put( hs->peer );
+   
+   free( hs->samples );
+   
+   wish_disconnect( state, &hs->con );
+   free( hs->hostname );
+   free( hs );
+}
+
+
+// something readers see of a host changed; remake its peer when we next publish.
+// need to write-lock host heartbeats first
+static void heartbeat_touch( struct wish_host_status* hs ) {
+   hs->changed = true;
+   snapshot_dirty = true;
+}
+
+
+// does a sample carry a metric?
+static bool heartbeat_stat_carried( struct heartbeat_stat* st, double value ) {
+   return value > 0 || (value == 0 && st->zeros);
+}
+
+
+// count a sample of a metric in the window
+static void heartbeat_stat_count( struct heartbeat_stat* st, double value ) {
+   if( !heartbeat_stat_carried( st, value ) )
+      return;
+   
+   st->count++;
+   st->sum += value;
+   st->sum_sq += value * value;
+}
+
+
+// a sample of a metric came in
+static void heartbeat_stat_add( struct heartbeat_stat* st, double value ) {
+   if( !heartbeat_stat_carried( st, value ) )
+      return;
+   
+   heartbeat_stat_count( st, value );
+   
+   if( st->seen++ == 0 )
+      st->ewma = value;
+   else
+      st->ewma += HEARTBEAT_EWMA_WEIGHT * (value - st->ewma);
+}
+
+
+// a sample of a metric left the window (the moving average keeps it)
+static void heartbeat_stat_remove( struct heartbeat_stat* st, double value ) {
+   if( !heartbeat_stat_carried( st, value ) )
+      return;
+   
+   st->count--;
+   st->sum -= value;
+   st->sum_sq -= value * value;
+}
+
+
+// mean of a metric over the window (0 if no sample carries it)
+static double heartbeat_stat_mean( struct heartbeat_stat* st ) {
+   if( st->count == 0 )
+      return 0;
+   
+   return st->sum / st->count;
+}
+
+
+// standard deviation of a metric over the window
+static double heartbeat_stat_stddev( struct heartbeat_stat* st ) {
+   if( st->count < 2 )
+      return 0;
+   
+   double mean = st->sum / st->count;
+   double var = st->sum_sq / st->count - mean * mean;
+   if( var < 0 )
+      var = 0;
+   
+   return sqrt( var );
+}
+
+
+// recount a host's window from its samples
+static void heartbeat_stats_rebuild( struct wish_host_status* hs ) {
+   struct heartbeat_stat* stats[] = { &hs->latency, &hs->load, &hs->ram_free, &hs->disk_free, &hs->util };
+   for( unsigned int i = 0; i < sizeof(stats) / sizeof(stats[0]); i++ ) {
+      stats[i]->count = 0;
+      stats[i]->sum = 0;
+      stats[i]->sum_sq = 0;
+   }
+   
+   for( uint32_t i = 0; i < hs->num_samples; i++ ) {
+      struct heartbeat_sample* sample = &hs->samples[i];
+      heartbeat_stat_count( &hs->latency, sample->latency );
+      heartbeat_stat_count( &hs->load, sample->load );
+      heartbeat_stat_count( &hs->ram_free, sample->ram_free );
+      heartbeat_stat_count( &hs->disk_free, sample->disk_free );
+      heartbeat_stat_count( &hs->util, sample->util );
+   }
+}
+
+
+// a host's key in a ranking: the lower, the better
+static double heartbeat_rank_key( struct wish_host_status* hs, int i ) {
+   switch( i + HEARTBEAT_PROP_LATENCY ) {
+      case HEARTBEAT_PROP_LATENCY:
+         return (hs->latency.count > 0 ? heartbeat_stat_mean( &hs->latency ) : INFINITY);
+   
+      case HEARTBEAT_PROP_CPU:
+         return heartbeat_stat_mean( &hs->util );
+   
+      case HEARTBEAT_PROP_RAM:
+         return -heartbeat_stat_mean( &hs->ram_free );
+   
+      default:
+         return -heartbeat_stat_mean( &hs->disk_free );
+   }
+}
+
+
+// file a host in every ranking.
+// need to write-lock host heartbeats first
+static void heartbeat_rank_add( struct wish_host_status* hs ) {
+   pthread_rwlock_wrlock( &host_ranks_lock );
+   for( int i = 0; i < HEARTBEAT_RANKINGS; i++ ) {
+      hs->rank_keys[i] = heartbeat_rank_key( hs, i );
+      int rc = rank_insert( &host_ranks[i], hs->rank_keys[i], hs->nid );
+      if( rc != 0 ) {
+         errorf("heartbeat_rank_add: rank_insert rc = %d\n", rc );
+      }
+   }
+   pthread_rwlock_unlock( &host_ranks_lock );
+   hs->ranked = true;
+   
+   // readers only see hosts that are filed
+   heartbeat_touch( hs );
+}
+
+
+// take a host out of the rankings.
+// need to write-lock host heartbeats first
+static void heartbeat_rank_del( struct wish_host_status* hs ) {
+   if( !hs->ranked )
+      return;
+   
+   pthread_rwlock_wrlock( &host_ranks_lock );
+   for( int i = 0; i < HEARTBEAT_RANKINGS; i++ ) {
+      rank_remove( &host_ranks[i], hs->rank_keys[i], hs->nid );
+   }
+   pthread_rwlock_unlock( &host_ranks_lock );
+   hs->ranked = false;
+   snapshot_dirty = true;
+}
+
+
+// refile a host whose metrics changed.
+// need to write-lock host heartbeats first
+static void heartbeat_rank_update( struct wish_host_status* hs ) {
+   if( !hs->ranked )
+      return;
+   
+   for( int i = 0; i < HEARTBEAT_RANKINGS; i++ ) {
+      double key = heartbeat_rank_key( hs, i );
+      if( key == hs->rank_keys[i] )
+         continue;
+   
+      pthread_rwlock_wrlock( &host_ranks_lock );
+      rank_remove( &host_ranks[i], hs->rank_keys[i], hs->nid );
+      hs->rank_keys[i] = key;
+      rank_insert( &host_ranks[i], key, hs->nid );
+      pthread_rwlock_unlock( &host_ranks_lock );
+   }
+}
+
+
+// remember what a heartbeat from a host told us, forgetting the oldest sample if we have enough.
+// need to write-lock host heartbeats first
+static void heartbeat_remember( struct wish_host_status* hs, struct heartbeat_sample* sample ) {
+   struct heartbeat_sample* slot = &hs->samples[ hs->samples_next ];
+   
+   if( hs->num_samples == hs->samples_size ) {
+      heartbeat_stat_remove( &hs->latency, slot->latency );
+      heartbeat_stat_remove( &hs->load, slot->load );
+      heartbeat_stat_remove( &hs->ram_free, slot->ram_free );
+      heartbeat_stat_remove( &hs->disk_free, slot->disk_free );
+      heartbeat_stat_remove( &hs->util, slot->util );
+   }
+   else {
+      hs->num_samples++;
+   }
+   
+   *slot = *sample;
+   
+   heartbeat_stat_add( &hs->latency, slot->latency );
+   heartbeat_stat_add( &hs->load, slot->load );
+   heartbeat_stat_add( &hs->ram_free, slot->ram_free );
+   heartbeat_stat_add( &hs->disk_free, slot->disk_free );
+   heartbeat_stat_add( &hs->util, slot->util );
+   
+   hs->samples_next = (hs->samples_next + 1) % hs->samples_size;
+   
+   // rounding creeps into the running sums; start them afresh each time around the ring
+   if( hs->samples_next == 0 )
+      heartbeat_stats_rebuild( hs );
+   
+   heartbeat_rank_update( hs );
+   heartbeat_touch( hs );
+}
+
+
+// a host's most recent sample (NULL if we have none)
+static struct heartbeat_sample* heartbeat_last_sample( struct wish_host_status* hs ) {
+   if( hs->num_samples == 0 )
+      return NULL;
+   
+   return &hs->samples[ (hs->samples_next + hs->samples_size - 1) % hs->samples_size ];
+}
+
+
+// note a probe we sent a host.  If the last one is still unanswered, it's counted lost.
+// need to write-lock host heartbeats first
+static void heartbeat_probe_sent( struct wish_host_status* hs, uint32_t id, uint64_t send_mono ) {
+   if( hs->probe_mono != 0 ) {
+      hs->probes_lost++;
+      hs->loss += HEARTBEAT_EWMA_WEIGHT * (1 - hs->loss);
+   }
+   
+   hs->probes++;
+   hs->probe_id = id;
+   hs->probe_mono = send_mono;
+   heartbeat_touch( hs );
+}
+
+
+// time an ack from a host: from when the probe it echoes went out to when the ack arrived, less the time the host held
+// the probe.  Hosts too old to echo are timed against our last probe, if the ack carries its id.
+// return the latency to the host (half the round trip) in microseconds, or -1 if it doesn't answer one of ours
+// need to write-lock host heartbeats first
+static int64_t heartbeat_probe_acked( struct wish_host_status* hs, struct wish_heartbeat_packet* h ) {
+   int64_t rtt = -1;
+   
+   if( h->echo_mono != 0 ) {
+      // not a time of ours
+      if( h->echo_mono > h->recv_mono )
+         return -1;
+   
+      rtt = h->recv_mono - h->echo_mono;
+      if( h->hold < rtt )
+         rtt -= h->hold;
+   }
+   else if( h->id != 0 && h->id == hs->probe_id && hs->probe_mono != 0 && hs->probe_mono <= h->recv_mono ) {
+      rtt = h->recv_mono - hs->probe_mono;
+      h->echo_mono = hs->probe_mono;
+   }
+   else {
+      return -1;
+   }
+   
+   // our latest probe was answered (late answers to older ones are still timed, but they were lost)
+   if( hs->probe_mono != 0 && h->echo_mono == hs->probe_mono ) {
+      hs->probe_mono = 0;
+      hs->loss -= HEARTBEAT_EWMA_WEIGHT * hs->loss;
+   }
+   
+   int64_t latency = rtt / 2;
+   
+   if( hs->last_latency >= 0 ) {
+      double d = fabs( (double)(latency - hs->last_latency) );
+      hs->jitter += (d - hs->jitter) / 16;
+   }
+   hs->last_latency = latency;
+   
+   return latency;
+}
+
+
+// queue a membership heartbeat for the sender thread to send a host.  It's built here, as the sampler last read
+// our condition; the sender stamps it and connects to the host if need be.
+// need to write-lock host heartbeats first
+static int heartbeat_swim_send( struct swim* s, uint64_t nid, struct wish_heartbeat_packet* h ) {
+   if( host_heartbeats.count( (long)nid ) == 0 )
+      return -ENOENT;
+   
+   // our condition rides along with the membership protocol's fields
+   struct heartbeat_outbound out;
+   out.nid = nid;
+   memset( &out.h, 0, sizeof(out.h) );
+   sampler_fill_heartbeat( &out.h );
+   
+   out.h.id = h->id;
+   out.h.kind = h->kind;
+   out.h.target = h->target;
+   out.h.nid = h->nid;
+   out.h.incarnation = h->incarnation;
+   out.h.seq = h->seq;
+   out.h.portnum = h->portnum;
+   strcpy( out.h.hostname, h->hostname );
+   strcpy( out.h.labels, h->labels );
+   out.h.echo_mono = h->echo_mono;
+   out.h.recv_mono = h->recv_mono;
+   
+   // h's updates are freed once we return
+   if( h->num_updates > 0 ) {
+      out.h.updates = (struct wish_member_update*)malloc( sizeof(struct wish_member_update) * h->num_updates );
+      if( out.h.updates == NULL )
+         return -ENOMEM;
+   
+      memcpy( out.h.updates, h->updates, sizeof(struct wish_member_update) * h->num_updates );
+      out.h.num_updates = h->num_updates;
+   }
    
+   pthread_mutex_lock( &send_lock );
+   send_queue.push_back( out );
+   pthread_mutex_unlock( &send_lock );
+   
+   heartbeat_wake_sender();
    return 0;
 }
 
 
+// wake the sender thread
+static void heartbeat_wake_sender(void) {
+   char c = 0;
+   if( write( send_wake[1], &c, 1 ) < 0 && errno != EAGAIN ) {
+      errorf("heartbeat_wake_sender: write errno = %d\n", -errno );
+   }
+}
+
+
+// stamp a queued heartbeat and send it on our connection to its host, without waiting on the network.
+// Only the stamping is done under the lock.
+// return 0 on success, -ENOTCONN if we have no connection to the host, or negative on error
+static int heartbeat_deliver( struct wish_state* state, struct heartbeat_outbound* out ) {
+   struct wish_heartbeat_packet* h = &out->h;
+   
+   host_heartbeats_wlock();
+   
+   HostHeartbeats::iterator itr = host_heartbeats.find( (long)out->nid );
+   if( itr == host_heartbeats.end() ) {
+      host_heartbeats_unlock();
+      return -ENOENT;
+   }
+   
+   struct wish_host_status* hs = itr->second;
+   if( hs->con.soc < 0 ) {
+      host_heartbeats_unlock();
+      return -ENOTCONN;
+   }
+   
+   // stamp it as late as we can, and say how long we held the probe it answers
+   h->send_mono = heartbeat_mono_now();
+   if( h->echo_mono != 0 && h->recv_mono != 0 && h->send_mono > h->recv_mono )
+      h->hold = (uint32_t)min( h->send_mono - h->recv_mono, (uint64_t)UINT32_MAX );
+   
+   struct wish_packet wp;
+   wish_pack_heartbeat_packet( state, &wp, h );
+   
+   uint8_t* buf = NULL;
+   size_t len = 0;
+   int rc = wish_serialize_packet( &wp, &buf, &len );
+   wish_free_packet( &wp );
+   
+   // our own handle on the socket, in case the connection is replaced while we send
+   int soc = -1;
+   int con_soc = hs->con.soc;
+   if( rc == 0 ) {
+      soc = dup( con_soc );
+      if( soc < 0 )
+         rc = -errno;
+   }
+   
+   if( rc == 0 ) {
+      hs->last_used = heartbeat_now();
+   
+      if( h->kind == HEARTBEAT_PING ) {
+         // record that we have sent a packet to this peer that we expect an ack for (before it can be answered)
+         heartbeat_probe_sent( hs, h->id, h->send_mono );
+         heartbeat_publish();
+      }
+   }
+   
+   host_heartbeats_unlock();
+   
+   if( rc != 0 ) {
+      free( buf );
+      return rc;
+   }
+   
+   ssize_t sent = send( soc, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL );
+   if( sent < 0 )
+      rc = -errno;
+   else if( (size_t)sent < len )
+      rc = -EIO;         // the rest would run into the next packet
+   
+   close( soc );
+   free( buf );
+   
+   if( rc == -EAGAIN || rc == -EWOULDBLOCK ) {
+      // the host isn't keeping up; this heartbeat is lost, like any other that doesn't make it
+      return rc;
+   }
+   
+   if( rc != 0 ) {
+      // hang up, unless the connection's been replaced since
+      host_heartbeats_wlock();
+      itr = host_heartbeats.find( (long)out->nid );
+      if( itr != host_heartbeats.end() && itr->second->con.soc == con_soc )
+         wish_disconnect( state, &itr->second->con );
+      host_heartbeats_unlock();
+   }
+   
+   return rc;
+}
+
+
+// start connecting to a host, without waiting for it to answer.  Only the host's address is read under the lock.
+// return 0 if the connect is under way, or negative on error
+static int heartbeat_start_connect( struct wish_state* state, uint64_t nid, struct heartbeat_connecting* c ) {
+   host_heartbeats_wlock();
+   
+   HostHeartbeats::iterator itr = host_heartbeats.find( (long)nid );
+   if( itr == host_heartbeats.end() ) {
+      host_heartbeats_unlock();
+      return -ENOENT;
+   }
+   
+   char* hostname = strdup( itr->second->hostname );
+   int portnum = itr->second->portnum;
+   
+   host_heartbeats_unlock();
+   
+   struct addrinfo hints;
+   memset( &hints, 0, sizeof(hints) );
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   hints.ai_flags = AI_NUMERICSERV;
+   
+   char portnum_str[10];
+   sprintf( portnum_str, "%d", portnum );
+   
+   struct addrinfo* result = NULL;
+   int rc = getaddrinfo( hostname, portnum_str, &hints, &result );
+   if( rc != 0 ) {
+      errorf("heartbeat_start_connect: getaddrinfo(%s): %s\n", hostname, gai_strerror( rc ) );
+      free( hostname );
+      return -ENETDOWN;
+   }
+   
+   // take the first address that will start connecting
+   c->soc = -1;
+   for( struct addrinfo* rp = result; rp != NULL; rp = rp->ai_next ) {
+      int soc = socket( rp->ai_family, rp->ai_socktype, rp->ai_protocol );
+      if( soc < 0 )
+         continue;
+   
+      c->flags = fcntl( soc, F_GETFL );
+      fcntl( soc, F_SETFL, c->flags | O_NONBLOCK );
+   
+      if( connect( soc, rp->ai_addr, rp->ai_addrlen ) != 0 && errno != EINPROGRESS ) {
+         close( soc );
+         continue;
+      }
+   
+      // keep the address, for the connection
+      c->addr = (struct addrinfo*)calloc( sizeof(struct addrinfo), 1 );
+      memcpy( c->addr, rp, sizeof(struct addrinfo) );
+      c->addr->ai_next = NULL;
+      c->addr->ai_canonname = NULL;
+      c->addr->ai_addr = (struct sockaddr*)calloc( sizeof(struct sockaddr_storage), 1 );
+      memcpy( c->addr->ai_addr, rp->ai_addr, rp->ai_addrlen );
+   
+      c->soc = soc;
+      break;
+   }
+   
+   freeaddrinfo( result );
+   
+   if( c->soc < 0 ) {
+      errorf("heartbeat_start_connect: can't connect to %s:%d\n", hostname, portnum );
+      free( hostname );
+      return -EHOSTDOWN;
+   }
+   
+   c->hostname = hostname;
+   c->portnum = portnum;
+   c->deadline = heartbeat_mono_now() + (uint64_t)connect_timeout * 1000;
+   return 0;
+}
+
+
+// give up on a connect, and on what was waiting for it
+static void heartbeat_connecting_free( struct heartbeat_connecting* c ) {
+   if( c->soc >= 0 )
+      close( c->soc );
+   
+   if( c->addr ) {
+      free( c->addr->ai_addr );
+      free( c->addr );
+   }
+   
+   for( vector<struct heartbeat_outbound>::size_type i = 0; i < c->waiting.size(); i++ ) {
+      wish_free_heartbeat_packet( &c->waiting[i].h );
+   }
+   
+   free( c->hostname );
+}
+
+
+// a connect went through: make it the host's connection (unless it got one some other way meanwhile), and send
+// what was waiting for it
+static void heartbeat_connected( struct wish_state* state, uint64_t nid, struct heartbeat_connecting* c ) {
+   fcntl( c->soc, F_SETFL, c->flags );
+   
+   host_heartbeats_wlock();
+   
+   HostHeartbeats::iterator itr = host_heartbeats.find( (long)nid );
+   if( itr != host_heartbeats.end() && itr->second->con.soc < 0 ) {
+      struct wish_host_status* hs = itr->second;
+   
+      wish_disconnect( state, &hs->con );
+      hs->con.soc = c->soc;
+      hs->con.addr = c->addr;
+      c->soc = -1;
+      c->addr = NULL;
+   
+      dbprintf("heartbeat_connected: connected to %s on socket %d\n", hs->hostname, hs->con.soc );
+      wish_recv_timeout( state, &hs->con, 0 );    // don't time out
+      heartbeat_socket_setup( &hs->con );
+   }
+   
+   host_heartbeats_unlock();
+   
+   for( vector<struct heartbeat_outbound>::size_type i = 0; i < c->waiting.size(); i++ ) {
+      int rc = heartbeat_deliver( state, &c->waiting[i] );
+      if( rc != 0 && rc != -ENOENT ) {
+         errorf("heartbeat_connected: failed to send to %s, rc = %d\n", c->hostname, rc );
+      }
+   }
+}
+
+
+// wait for more heartbeats to send, or for connects to go through (or run out of time)
+static void heartbeat_send_wait( struct wish_state* state, HeartbeatConnecting* connecting ) {
+   vector<struct pollfd> fds;
+   vector<uint64_t> nids;
+   
+   struct pollfd pfd;
+   pfd.fd = send_wake[0];
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+   fds.push_back( pfd );
+   
+   uint64_t now = heartbeat_mono_now();
+   uint64_t deadline = 0;
+   for( HeartbeatConnecting::iterator itr = connecting->begin(); itr != connecting->end(); itr++ ) {
+      pfd.fd = itr->second.soc;
+      pfd.events = POLLOUT;
+      fds.push_back( pfd );
+      nids.push_back( itr->first );
+   
+      if( deadline == 0 || itr->second.deadline < deadline )
+         deadline = itr->second.deadline;
+   }
+   
+   int timeout = -1;
+   if( deadline != 0 )
+      timeout = (deadline > now ? (int)((deadline - now) / 1000) + 1 : 0);
+   
+   int rc = poll( &fds[0], fds.size(), timeout );
+   if( rc < 0 && errno != EINTR ) {
+      errorf("heartbeat_send_wait: errno = %d on poll\n", -errno );
+   }
+   
+   if( fds[0].revents & POLLIN ) {
+      char buf[256];
+      while( read( send_wake[0], buf, sizeof(buf) ) > 0 );
+   }
+   
+   now = heartbeat_mono_now();
+   for( vector<uint64_t>::size_type i = 0; i < nids.size(); i++ ) {
+      HeartbeatConnecting::iterator itr = connecting->find( nids[i] );
+      struct heartbeat_connecting* c = &itr->second;
+   
+      if( fds[i+1].revents != 0 ) {
+         // find out how the connect went
+         int err = 0;
+         socklen_t len = sizeof(err);
+         getsockopt( c->soc, SOL_SOCKET, SO_ERROR, &err, &len );
+   
+         if( err == 0 )
+            heartbeat_connected( state, nids[i], c );
+         else
+            errorf("heartbeat: connect to %s:%d errno = %d\n", c->hostname, c->portnum, -err );
+      }
+      else if( c->deadline <= now ) {
+         errorf("heartbeat: connect to %s:%d timed out\n", c->hostname, c->portnum );
+      }
+      else {
+         continue;
+      }
+   
+      heartbeat_connecting_free( c );
+      connecting->erase( itr );
+   }
+}
+
+
+// thread to send heartbeats: connects to hosts without blocking, and sends without holding the lock on
+// host_heartbeats, so a host that's slow to answer holds up no one
+static void* heartbeat_send_pthread( void* arg ) {
+   struct wish_state* state = (struct wish_state*)arg;
+   
+   HeartbeatConnecting connecting;
+   
+   while( true ) {
+      vector<struct heartbeat_outbound> out;
+   
+      pthread_mutex_lock( &send_lock );
+      out.swap( send_queue );
+      bool running = send_running;
+      pthread_mutex_unlock( &send_lock );
+   
+      for( vector<struct heartbeat_outbound>::size_type i = 0; i < out.size(); i++ ) {
+   
+         // still connecting to it?
+         HeartbeatConnecting::iterator itr = connecting.find( out[i].nid );
+         if( itr != connecting.end() ) {
+            itr->second.waiting.push_back( out[i] );
+            continue;
+         }
+   
+         int rc = heartbeat_deliver( state, &out[i] );
+         if( rc == -ENOTCONN && running ) {
+            struct heartbeat_connecting c;
+            c.addr = NULL;
+            c.hostname = NULL;
+   
+            rc = heartbeat_start_connect( state, out[i].nid, &c );
+            if( rc == 0 ) {
+               connecting[ out[i].nid ] = c;
+               connecting[ out[i].nid ].waiting.push_back( out[i] );
+               continue;
+            }
+         }
+         else if( rc != 0 && rc != -ENOENT ) {
+            errorf("heartbeat_send_pthread: failed to send to %lu, rc = %d\n", out[i].nid, rc );
+         }
+   
+         wish_free_heartbeat_packet( &out[i].h );
+      }
+   
+      // the last of what was queued (e.g. our goodbyes) went out on the connections we have
+      if( !running )
+         break;
+   
+      heartbeat_send_wait( state, &connecting );
+   }
+   
+   for( HeartbeatConnecting::iterator itr = connecting.begin(); itr != connecting.end(); itr++ ) {
+      heartbeat_connecting_free( &itr->second );
+   }
+   
+   return NULL;
+}
+
+
+// note the labels a host announced, if it announced any
+static void heartbeat_learn_labels( struct wish_host_status* hs, char const* labels ) {
+   if( labels[0] != 0 )
+      strcpy( hs->labels, labels );
+}
+
+
+// note the metrics block a host sent, if it sent one
+static void heartbeat_learn_metrics( struct wish_host_status* hs, struct wish_host_metrics* m ) {
+   if( m->version != 0 )
+      hs->metrics = *m;
+}
+
+
+// a host's utilization in thousandths, from what it sent
+static uint32_t heartbeat_util( uint64_t load, struct wish_host_metrics* m ) {
+   if( m->version != 0 )
+      return m->util;
+   
+   return (uint32_t)(sampler_util( load, m ) * 1000);
+}
+
+
+// a host joined, or changed state.
+// need to write-lock host heartbeats first
+static void heartbeat_swim_changed( struct swim* s, struct wish_member_update* m ) {
+   struct wish_state* state = (struct wish_state*)s->cls;
+   
+   HostHeartbeats::iterator itr = host_heartbeats.find( (long)m->nid );
+   
+   if( m->state == MEMBER_DEAD || m->state == MEMBER_LEFT ) {
+      if( itr != host_heartbeats.end() ) {
+         errorf("heartbeat: %s:%d %s\n", itr->second->hostname, itr->second->portnum, (m->state == MEMBER_LEFT ? "left" : "is down") );
+   
+         heartbeat_rank_del( itr->second );
+         wish_host_status_free( state, itr->second );
+         host_heartbeats.erase( itr );
+      }
+      return;
+   }
+   
+   if( itr == host_heartbeats.end() ) {
+      struct wish_host_status* status = (struct wish_host_status*)calloc( sizeof(struct wish_host_status), 1 );
+      wish_host_status_init2( state, status, m->hostname, m->portnum );
+      status->nid = m->nid;
+      status->state = m->state;
+      heartbeat_learn_labels( status, m->labels );
+      heartbeat_learn_metrics( status, &m->metrics );
+   
+      host_heartbeats[ m->nid ] = status;
+      heartbeat_rank_add( status );
+   
+      dbprintf("heartbeat: %s:%d joined\n", m->hostname, m->portnum );
+      return;
+   }
+   
+   struct wish_host_status* status = itr->second;
+   
+   if( m->state == MEMBER_SUSPECT && status->state != MEMBER_SUSPECT ) {
+      errorf("heartbeat: %s:%d is not answering\n", status->hostname, status->portnum );
+   }
+   else if( m->state == MEMBER_ALIVE && status->state == MEMBER_SUSPECT ) {
+      errorf("heartbeat: %s:%d is back\n", status->hostname, status->portnum );
+   }
+   
+   status->state = m->state;
+   heartbeat_learn_labels( status, m->labels );
+   heartbeat_learn_metrics( status, &m->metrics );
+   
+   // hosts that reached us first are known by their address; learn the name and port they listen on
+   if( m->portnum != 0 && m->hostname[0] != 0 && (status->portnum != (int)m->portnum || strcmp( status->hostname, m->hostname ) != 0) ) {
+      free( status->hostname );
+      status->hostname = strdup( m->hostname );
+      status->portnum = m->portnum;
+   }
+   
+   heartbeat_touch( status );
+}
+
+
+// news of a host's condition came from another host.
+// need to write-lock host heartbeats first
+static void heartbeat_swim_metrics( struct swim* s, struct wish_member_update* m ) {
+   HostHeartbeats::iterator itr = host_heartbeats.find( (long)m->nid );
+   if( itr == host_heartbeats.end() )
+      return;
+   
+   struct heartbeat_sample sample;
+   sample.latency = -1;      // not measured
+   sample.load = m->load;
+   sample.util = heartbeat_util( m->load, &m->metrics );
+   sample.ram_free = m->ram_free;
+   sample.disk_free = m->disk_free;
+   sample.queue_depth = m->queue_depth;
+   sample.running = m->running;
+   sample.cpus_free = m->cpus_free;
+   sample.nodes_free = m->nodes_free;
+   
+   heartbeat_learn_labels( itr->second, m->labels );
+   heartbeat_learn_metrics( itr->second, &m->metrics );
+   heartbeat_remember( itr->second, &sample );
+}
+
+
 // initialize heartbeat monitoring
 int heartbeat_init( struct wish_state* state ) {
    pthread_rwlock_init( &host_heartbeats_lock, NULL );
+   pthread_rwlock_init( &host_ranks_lock, NULL );
    
    wish_state_rlock( state );
    _STATUS_MEMORY = state->conf.status_memory;
+   heartbeat_interval = state->conf.heartbeat_interval;
+   
+   if( state->conf.peer_connections > 0 )
+      max_connections = state->conf.peer_connections;
+   
+   use_timestamps = state->conf.heartbeat_timestamps;
+   
+   if( state->conf.connect_timeout > 0 )
+      connect_timeout = state->conf.connect_timeout;
    
-   // populate heartbeat table with initial peers
+   struct swim_ops ops;
+   ops.send = heartbeat_swim_send;
+   ops.changed = heartbeat_swim_changed;
+   ops.metrics = heartbeat_swim_metrics;
+   
+   uint64_t now = heartbeat_now();
+   
+   // a restarted daemon outranks whatever the instance remembers of it
    host_heartbeats_wlock();
+   for( int i = 0; i < HEARTBEAT_RANKINGS; i++ ) {
+      rank_init( &host_ranks[i] );
+   }
+   
+   swim_init( &membership, state->nid, state->hostname, state->conf.portnum, (uint32_t)time(NULL), heartbeat_interval, state->conf.probe_helpers, &ops, state );
+   if( state->conf.labels )
+      strncpy( membership.self.labels, state->conf.labels, HEARTBEAT_LABELS_MAX );
+   
+   // populate heartbeat table with initial peers.  We connect to each when we first probe it.
    for( int i = 0; state->conf.initial_peers[i] != NULL; i++ ) {
+      uint64_t nid = wish_host_nid( state->conf.initial_peers[i]->hostname );
+      if( nid == state->nid || host_heartbeats.count( nid ) > 0 )
+         continue;
+   
       struct wish_host_status* status = (struct wish_host_status*)calloc( sizeof(struct wish_host_status), 1 );
-      
+   
       wish_host_status_init2( state, status, state->conf.initial_peers[i]->hostname, state->conf.initial_peers[i]->portnum );
-      
-      // attempt to connect
-      int rc = wish_connect( state, &status->con, status->hostname, status->portnum );
-      if( rc == 0 ) {
-         dbprintf("heartbeat_init: connected to %s on socket %d\n", status->hostname, status->con.soc );
-         wish_recv_timeout( state, &status->con, 0 );    // don't time out
-      }
-      else {
-         errorf("heartbeat_init: wish_connect on %s:%d rc = %d\n", status->hostname, status->portnum, rc );
-      }
-      
-      host_heartbeats[ wish_host_nid(state->conf.initial_peers[i]->hostname) ] = status;
+   
+      host_heartbeats[ nid ] = status;
+      heartbeat_rank_add( status );
+      swim_add( &membership, nid, status->hostname, status->portnum, now );
    }
    
+   heartbeat_publish();
    host_heartbeats_unlock();
    
    wish_state_unlock( state );
    
-   int rc = pthread_create( &host_heartbeat_thread, NULL, heartbeat_thread, state );
+   // start the sender before anything can be queued for it
+   pthread_mutex_init( &send_lock, NULL );
+   if( pipe( send_wake ) != 0 ) {
+      errorf("heartbeat_init: pipe errno = %d\n", -errno );
+      return -errno;
+   }
+   fcntl( send_wake[0], F_SETFL, fcntl( send_wake[0], F_GETFL ) | O_NONBLOCK );
+   fcntl( send_wake[1], F_SETFL, fcntl( send_wake[1], F_GETFL ) | O_NONBLOCK );
+   
+   send_running = true;
+   int rc = pthread_create( &send_thread, NULL, heartbeat_send_pthread, state );
+   if( rc != 0 ) {
+      errorf("heartbeat_init: pthread_create(sender) rc = %d\n", rc );
+      send_running = false;
+      return -rc;
+   }
+   
+   rc = pthread_create( &host_heartbeat_thread, NULL, heartbeat_thread, state );
    if( rc < 0 ) {
       errorf("heartbeat_init: pthread_create(heartbeat) rc = %d\n", rc );
       return -errno;
    }
    
+   // send the first heartbeats right away
+   timer_setup( &heartbeat_timer, heartbeat_send, 0 );
+   timer_setup( &probe_timer, heartbeat_probe_timeout, 0 );
+   timer_arm( &heartbeat_timer, 0 );
+   
    return 0;
 }
 
 
 // shut down heartbeat monitoring
 int heartbeat_shutdown( struct wish_state* state ) {
+   timer_cancel( &heartbeat_timer );
+   timer_cancel( &probe_timer );
+   
+   // say goodbye, so the instance doesn't have to find out the slow way
+   host_heartbeats_wlock();
+   swim_leave( &membership );
+   host_heartbeats_unlock();
+   
+   // send the goodbyes, and stop sending
+   pthread_mutex_lock( &send_lock );
+   bool sending = send_running;
+   send_running = false;
+   pthread_mutex_unlock( &send_lock );
+   
+   if( sending ) {
+      heartbeat_wake_sender();
+      pthread_join( send_thread, NULL );
+   }
+   
    pthread_kill( host_heartbeat_thread, SIGKILL );
    pthread_join( host_heartbeat_thread, NULL );
    
    for( HostHeartbeats::iterator itr = host_heartbeats.begin(); itr != host_heartbeats.end(); itr++ ) {
-      struct wish_host_status* hs = itr->second;
-      
-      for( vector<struct wish_heartbeat_packet*>::iterator itr2 = hs->pending->begin(); itr2 != hs->pending->end(); itr2++ ) {
-         if( *itr2 ) {
-            free( *itr2 );
-            *itr2 = NULL;
-         }
-      }
-      
-      for( vector<struct wish_heartbeat_packet*>::iterator itr2 = hs->heartbeats->begin(); itr2 != hs->heartbeats->end(); itr2++ ) {
-         if( *itr2 ) {
-            free( *itr2 );
-            *itr2 = NULL;
-         }
-      }
-      
-      delete hs->pending;
-      delete hs->heartbeats;
-      
-      wish_disconnect( state, &hs->con );
-      free( hs->hostname );
-      free( hs );
+      wish_host_status_free( state, itr->second );
       itr->second = NULL;
    }
    host_heartbeats.clear();
+   swim_free( &membership );
+   
+   // readers see no one from now on (swapping takes over a reference, like any snapshot's first)
+   __atomic_add_fetch( &empty_snapshot.refs, 1, __ATOMIC_SEQ_CST );
+   heartbeat_snapshot_swap( &empty_snapshot );
+   snapshot_dirty = false;
+   
+   pthread_rwlock_wrlock( &host_ranks_lock );
+   for( int i = 0; i < HEARTBEAT_RANKINGS; i++ ) {
+      rank_free( &host_ranks[i] );
+   }
+   pthread_rwlock_unlock( &host_ranks_lock );
    
+   for( vector<struct heartbeat_outbound>::size_type i = 0; i < send_queue.size(); i++ ) {
+      wish_free_heartbeat_packet( &send_queue[i].h );
+   }
+   send_queue.clear();
+   
+   if( send_wake[0] >= 0 ) {
+      close( send_wake[0] );
+      close( send_wake[1] );
+      send_wake[0] = send_wake[1] = -1;
+   }
+   pthread_mutex_destroy( &send_lock );
+   
+   pthread_rwlock_destroy( &host_ranks_lock );
    pthread_rwlock_destroy( &host_heartbeats_lock );
    return 0;
 }
 
 
-// thread to send/receive heartbeats periodically
+// close the connections we've used least recently, if we have too many open.
+// need to write-lock host heartbeats first
+static void heartbeat_trim_connections( struct wish_state* state ) {
+   vector< pair<uint64_t, long> > open;      // <last used, nid>
+   for( HostHeartbeats::iterator itr = host_heartbeats.begin(); itr != host_heartbeats.end(); itr++ ) {
+      if( itr->second->con.soc >= 0 && (uint64_t)itr->first != membership.probe_target )
+         open.push_back( pair<uint64_t, long>( itr->second->last_used, itr->first ) );
+   }
+   
+   if( open.size() <= max_connections )
+      return;
+   
+   sort( open.begin(), open.end() );
+   
+   for( vector< pair<uint64_t, long> >::size_type i = 0; i < open.size() - max_connections; i++ ) {
+      wish_disconnect( state, &host_heartbeats[ open[i].second ]->con );
+   }
+}
+
+
+// probe a host (called from the timer thread every heartbeat interval)
+static void heartbeat_send( struct wish_state* state, uint64_t arg ) {
+   host_heartbeats_wlock();
+   
+   swim_tick( &membership, heartbeat_now() );
+   heartbeat_trim_connections( state );
+   
+   heartbeat_publish();
+   host_heartbeats_unlock();
+   
+   timer_arm( &probe_timer, heartbeat_interval / 2 );
+   timer_arm( &heartbeat_timer, heartbeat_interval );
+}
+
+
+// the host we probed hasn't answered yet (called from the timer thread half way through the heartbeat interval)
+static void heartbeat_probe_timeout( struct wish_state* state, uint64_t arg ) {
+   host_heartbeats_wlock();
+   swim_probe_timeout( &membership, heartbeat_now() );
+   heartbeat_publish();
+   host_heartbeats_unlock();
+}
+
+
+// a heartbeat read off a connection, waiting to be handled
+struct heartbeat_inbound {
+   long from;
+   uint64_t arrival;             // by our monotonic clock, in microseconds
+   struct wish_packet packet;
+};
+
+
+// a host's connection, as heartbeat_thread reads it: its own handle on the socket, so it can wait on it and read
+// from it without the lock on host_heartbeats.  Filed by the socket's inode, which stays the socket's while we
+// hold it open (unlike its descriptor, which a new connection can be given once the host's is closed).
+struct heartbeat_reader {
+   long nid;                     // whose it is
+   struct wish_connection con;   // con.soc is our handle; the rest is where we are in the packet being read
+};
+
+typedef map<ino_t, struct heartbeat_reader> HeartbeatReaders;
+
+
+// which socket a descriptor refers to (0 if none)
+static ino_t heartbeat_socket_ino( int soc ) {
+   struct stat sb;
+   if( soc < 0 || fstat( soc, &sb ) != 0 )
+      return 0;
+   
+   return sb.st_ino;
+}
+
+
+// bring heartbeat_thread's readers up to date with the hosts' connections: drop those of connections that were
+// closed or replaced, and get a handle on new ones
+static void heartbeat_readers_sync( struct wish_state* state, HeartbeatReaders* readers ) {
+   map<ino_t, long> current;
+   
+   pthread_rwlock_rdlock( &host_heartbeats_lock );
+   
+   for( HostHeartbeats::iterator itr = host_heartbeats.begin(); itr != host_heartbeats.end(); itr++ ) {
+      ino_t ino = heartbeat_socket_ino( itr->second->con.soc );
+      if( ino == 0 )
+         continue;
+   
+      current[ ino ] = itr->first;
+   
+      HeartbeatReaders::iterator r = readers->find( ino );
+      if( r != readers->end() ) {
+         r->second.nid = itr->first;        // the host may have been renamed
+         continue;
+      }
+   
+      int soc = dup( itr->second->con.soc );
+      if( soc < 0 ) {
+         errorf("heartbeat_readers_sync: dup(%d) errno = %d\n", itr->second->con.soc, -errno );
+         continue;
+      }
+   
+      struct heartbeat_reader reader;
+      memset( &reader.con, 0, sizeof(reader.con) );
+      reader.nid = itr->first;
+      reader.con.soc = soc;
+      (*readers)[ ino ] = reader;
+   }
+   
+   pthread_rwlock_unlock( &host_heartbeats_lock );
+   
+   for( HeartbeatReaders::iterator itr = readers->begin(); itr != readers->end(); ) {
+      if( current.count( itr->first ) == 0 ) {
+         wish_disconnect( state, &itr->second.con );
+         readers->erase( itr++ );
+      }
+      else {
+         itr++;
+      }
+   }
+}
+
+
+// thread to receive heartbeats.  It waits on and reads from the hosts' connections without the lock on
+// host_heartbeats, and takes it only to handle what it read.
 void* heartbeat_thread( void* arg ) {
    struct wish_state* state = (struct wish_state*)arg;
    
-   wish_state_rlock( state );
-   uint64_t interval = state->conf.heartbeat_interval;
-   wish_state_unlock( state );
+   HeartbeatReaders readers;
    
    int rc = 0;
-   uint64_t last_write = -1;
    while( 1 ) {
-      // first, attempt to repair any broken connections
-      host_heartbeats_wlock();
-      
-      for( HostHeartbeats::iterator itr = host_heartbeats.begin(); itr != host_heartbeats.end(); itr++ ) {
-         // verify that this connection is good
-         struct timeval tv;
-         socklen_t sz = sizeof(tv);
-         rc = getsockopt( itr->second->con.soc, SOL_SOCKET, SO_RCVTIMEO, &tv, &sz );
-         if( rc == -1 && errno == -EBADF ) {
-            wish_disconnect( state, &itr->second->con );
-         }         
-      }
-      
+      heartbeat_readers_sync( state, &readers );
+   
       fd_set rfds;
       FD_ZERO( &rfds );
-      
+   
       // add each connection to our rfd set
       int max_fd = -1;
-      for( HostHeartbeats::iterator itr = host_heartbeats.begin(); itr != host_heartbeats.end(); itr++ ) {
-         if( itr->second->con.soc > 0 ) {
-            FD_SET( itr->second->con.soc, &rfds );
-            if( itr->second->con.soc > max_fd )
-               max_fd = itr->second->con.soc;
+      for( HeartbeatReaders::iterator itr = readers.begin(); itr != readers.end(); itr++ ) {
+         if( itr->second.con.soc < FD_SETSIZE ) {
+            FD_SET( itr->second.con.soc, &rfds );
+            if( itr->second.con.soc > max_fd )
+               max_fd = itr->second.con.soc;
          }
       }
-      
+   
       struct timeval tv;
       tv.tv_sec = 0;
       tv.tv_usec = 5000;
-      
+   
       if( max_fd > 0 ) {
          int num_ready = select( max_fd + 1, &rfds, NULL, NULL, &tv );
          if( num_ready < 0 ) {
             // problem
             errorf("heartbeat_thread: errno = %d on select\n", -errno);
          }
-         else {
-            
-            typedef pair<struct wish_connection*, struct wish_heartbeat_packet*> AckHandle;
-            typedef vector<AckHandle> AckBuf;
-            
-            AckBuf to_ack;
-            
-            for( HostHeartbeats::iterator itr = host_heartbeats.begin(); itr != host_heartbeats.end(); itr++ ) {
-               if( itr->second->con.soc < 0 )
+         else if( num_ready > 0 ) {
+   
+            // read everything first; handling a packet can add and remove hosts
+            vector<struct heartbeat_inbound> inbound;
+            vector<ino_t> broken;
+   
+            for( HeartbeatReaders::iterator itr = readers.begin(); itr != readers.end(); itr++ ) {
+               struct wish_connection* con = &itr->second.con;
+               if( con->soc < 0 || con->soc >= FD_SETSIZE || !FD_ISSET( con->soc, &rfds ) )
                   continue;
-               
-               if( FD_ISSET( itr->second->con.soc, &rfds ) ) {
-                  
-                  // get the packet
-                  struct wish_packet packet;
-                  rc = wish_read_packet_noblock( state, &itr->second->con, &packet );
-                  if( rc != 0 ) {
-                     if( rc != -EAGAIN && rc != -EWOULDBLOCK ) {
-                        errorf("heartbeat_thread: wish_read_packet rc = %d\n", rc );
-                        wish_disconnect( state, &itr->second->con );
-                     }
-                     continue;
-                  }
-                  
-                  // process the packet
-                  rc = heartbeat_process( state, &itr->second->con, &packet );
-                  if( rc < 0 ) {
-                     errorf("heartbeat_thread: heartbeat_process rc = %d\n", rc );
-                     wish_free_packet( &packet );
-                     continue;
-                  }
-                  
-                  // do we need to ack it?
-                  else if( rc > 0 ) {
-                     struct wish_heartbeat_packet* whp = (struct wish_heartbeat_packet*)calloc( sizeof(struct wish_heartbeat_packet), 1 );
-                     wish_unpack_heartbeat_packet( state, &packet, whp );
-                     
-                     to_ack.push_back( AckHandle( &itr->second->con, whp ) );
-                     
-                     wish_free_packet( &packet );
-                  }
-                  else {
-                     wish_free_packet( &packet );
-                  }
-               }
-            }
-            
-            // send ack heartbeats to wish daemon instances that sent us a heartbeat we could use
-            if( to_ack.size() > 0 ) {
-               struct wish_heartbeat_packet* ack = (struct wish_heartbeat_packet*)calloc( sizeof(struct wish_heartbeat_packet), 1 );
-               
-               for( AckBuf::iterator itr = to_ack.begin(); itr != to_ack.end(); itr++ ) {
-                  rc = wish_init_heartbeat_packet_ack( state, ack, itr->second );
-                  if( rc != 0 ) {
-                     errorf("heartbeat_thread: failed to create heartbeat, rc = %d\n", rc );
-                     free( itr->second );
-                     continue;
-                  }
-                  
-                  struct wish_packet wp;
-                  wish_pack_heartbeat_packet( state, &wp, ack );
-                  
-                  rc = wish_write_packet( state, itr->first, &wp );
-                  if( rc != 0 ) {
-                     errorf("heartbeat_thread: failed to send ACK, rc = %d\n", rc );
+   
+               // get the packet, and when it came
+               struct heartbeat_inbound in;
+               in.from = itr->second.nid;
+               in.arrival = heartbeat_arrival( con );
+               rc = wish_read_packet_noblock( state, con, &in.packet );
+               if( rc != 0 ) {
+                  if( rc != -EAGAIN && rc != -EWOULDBLOCK ) {
+                     errorf("heartbeat_thread: wish_read_packet rc = %d\n", rc );
+                     wish_disconnect( state, con );
+                     broken.push_back( itr->first );
                   }
-                  
-                  wish_free_packet( &wp );
-                  free( itr->second );
+                  continue;
                }
-               
-               free( ack );
+   
+               inbound.push_back( in );
             }
-            
-            // send normal heartbeats to wish daemon instances we know about, but didn't receive a packet from
-            uint64_t now = wish_time_millis();
-            if( last_write + interval < now ) {
-               last_write = now;
-               
-               struct wish_heartbeat_packet whp;
-               rc = wish_init_heartbeat_packet( state, &whp );
-               if( rc != 0 ) {
-                  errorf("heartbeat_thread: failed to create a hearbeat packet, rc = %d\n", rc );
+   
+            if( inbound.size() > 0 || broken.size() > 0 ) {
+               host_heartbeats_wlock();
+   
+               // hang up on hosts whose connections broke (unless they've been replaced since)
+               for( HostHeartbeats::iterator itr = host_heartbeats.begin(); broken.size() > 0 && itr != host_heartbeats.end(); itr++ ) {
+                  if( find( broken.begin(), broken.end(), heartbeat_socket_ino( itr->second->con.soc ) ) != broken.end() )
+                     wish_disconnect( state, &itr->second->con );
                }
-               else {
-                  struct wish_packet wp;
-                  wish_pack_heartbeat_packet( state, &wp, &whp );
-                  
-                  for( HostHeartbeats::iterator itr = host_heartbeats.begin(); itr != host_heartbeats.end(); itr++ ) {
-                     if( itr->second->con.soc < 0 )
-                        continue;
-                     
-                     rc = wish_write_packet( state, &itr->second->con, &wp );
-                     if( rc != 0 ) {
-                        errorf("heartbeat_thread: failed to send, rc = %d\n", rc );
-                     }
-                     else {
-                        // record that we have sent a packet to this peer that we expect an ack for
-                        struct wish_heartbeat_packet* whp_dup = (struct wish_heartbeat_packet*)calloc( sizeof(struct wish_heartbeat_packet), 1 );
-                        memcpy( whp_dup, &whp, sizeof(whp) );
-                        
-                        itr->second->pending->push_back( whp_dup );
-                        
-                        if( itr->second->pending->size() > (unsigned)(_STATUS_MEMORY * 2) ) {
-                           // don't keep more than 2x the status memory
-                           free( itr->second->pending->front() );
-                           itr->second->pending->erase( itr->second->pending->begin() );
-                        }
-                     }
+   
+               // process the packets (acks are queued for the sender as we go)
+               for( vector<struct heartbeat_inbound>::size_type i = 0; i < inbound.size(); i++ ) {
+                  rc = heartbeat_receive( state, inbound[i].from, &inbound[i].packet, inbound[i].arrival );
+                  if( rc < 0 ) {
+                     errorf("heartbeat_thread: heartbeat_receive rc = %d\n", rc );
                   }
-                  
-                  wish_free_packet( &wp );
+               }
+   
+               heartbeat_publish();
+               host_heartbeats_unlock();
+   
+               for( vector<struct heartbeat_inbound>::size_type i = 0; i < inbound.size(); i++ ) {
+                  wish_free_packet( &inbound[i].packet );
                }
             }
          }
       }
-      host_heartbeats_unlock();
-      usleep( 5000 );
+      else {
+         usleep( 5000 );
+      }
    }
    
    return NULL;
 }
 
 
+// keep a heartbeat a host sent us, working out the latency to it if it acks one of ours.
+// need to write-lock host heartbeats first
+static void heartbeat_record( struct wish_host_status* host_status, struct wish_heartbeat_packet* h ) {
+   struct heartbeat_sample sample;
+   sample.latency = -1;      // unknown
+   sample.load = h->loads[0];
+   sample.util = heartbeat_util( h->loads[0], &h->metrics );
+   sample.ram_free = h->ram_free;
+   sample.disk_free = h->disk_free;
+   sample.queue_depth = h->queue_depth;
+   sample.running = h->running;
+   sample.cpus_free = h->cpus_free;
+   sample.nodes_free = h->nodes_free;
+   
+   // is this an acknowledgement of a packet we sent?  (hosts running older versions don't say)
+   if( (h->kind == HEARTBEAT_ACK && h->target == 0) || h->nid == 0 )
+      sample.latency = heartbeat_probe_acked( host_status, h );
+   
+   heartbeat_learn_labels( host_status, h->labels );
+   heartbeat_learn_metrics( host_status, &h->metrics );
+   heartbeat_remember( host_status, &sample );
+}
+
+
 // monitor heartbeats for a given connection
 int heartbeat_add( struct wish_state* state, struct wish_connection* con, struct wish_packet* wp ) {
    
@@ -332,6 +1422,9 @@ int heartbeat_add( struct wish_state* state, struct wish_connection* con, struct
       return -EINVAL;
    }
    
+   // when it arrived (for RTT, and for how long we hold it before acking)
+   uint64_t arrival = heartbeat_mono_now();
+   
    // first, get the name of this host
    char hostname_c[HOST_NAME_MAX+1];
    char portnum_buf[10];
@@ -343,130 +1436,368 @@ int heartbeat_add( struct wish_state* state, struct wish_connection* con, struct
       return -rc;
    }
    
-   uint64_t nid = wish_host_nid( hostname_c );
+   struct wish_heartbeat_packet h;
+   memset( &h, 0, sizeof(h) );
+   wish_unpack_heartbeat_packet( state, wp, &h );
+   h.recv_mono = arrival;
+   
+   // hosts say who they are; older ones are known by where they connect from
+   uint64_t nid = (h.nid != 0 ? h.nid : wish_host_nid( hostname_c ));
+   
+   wish_state_rlock( state );
+   bool me = (nid == state->nid);
+   wish_state_unlock( state );
+   
+   if( me ) {
+      // we probed ourselves under another name
+      wish_free_heartbeat_packet( &h );
+      wish_disconnect( state, con );
+      return -EINVAL;
+   }
    
    host_heartbeats_wlock();
    
    HostHeartbeats::iterator itr = host_heartbeats.find( nid );
    if( itr == host_heartbeats.end() ) {
-      
+   
       struct wish_host_status* host_status = (struct wish_host_status*)calloc( sizeof(struct wish_host_status), 1 );
-      
+   
       wish_host_status_init( state, host_status, con );
-                             
-      // extract the heartbeat information
-      struct wish_heartbeat_packet *h = (struct wish_heartbeat_packet*)calloc( sizeof(struct wish_heartbeat_packet), 1 );
-      wish_unpack_heartbeat_packet( state, wp, h );
-       
-      host_status->heartbeats->push_back( h );
-      
+      host_status->nid = nid;
+   
+      if( h.hostname[0] != 0 && h.portnum != 0 ) {
+         // so we can reconnect to it
+         free( host_status->hostname );
+         host_status->hostname = strdup( h.hostname );
+         host_status->portnum = h.portnum;
+      }
+   
       host_heartbeats[ nid ] = host_status;
-      
+      heartbeat_rank_add( host_status );
+   
       dbprintf("heartbeat_add: will monitor %s (socket %d)\n", hostname_c, host_status->con.soc );
    }
    else {
       // update the connection to this host
       wish_disconnect( state, &itr->second->con );
       itr->second->con = *con;
+      wish_recv_timeout( state, &itr->second->con, 0 );    // don't time out
+      heartbeat_socket_setup( &itr->second->con );
       dbprintf("heartbeat_add: updated connection for %s (socket %d)\n", hostname_c, itr->second->con.soc );
    }
    
+   // it's a member (if it wasn't already), and gets its ack
+   swim_recv( &membership, &h, heartbeat_now() );
+   
+   itr = host_heartbeats.find( nid );
+   if( itr != host_heartbeats.end() )
+      heartbeat_record( itr->second, &h );
+   
+   heartbeat_publish();
    host_heartbeats_unlock();
+   
+   wish_free_heartbeat_packet( &h );
    return 0;
 }
 
 
-// process a received heartbeat packet.
+// a host answered on our connection to from, under another nid (e.g. its name in our config file isn't the one
+// it goes by).  Know it by the nid it gives.
 // need to write-lock host heartbeats first
-// return negative on error, 0 on latency process, 1 if it needs to be acked
-int heartbeat_process( struct wish_state* state, struct wish_connection* con, struct wish_packet* wp ) {
+static void heartbeat_rename( struct wish_state* state, long from, uint64_t nid ) {
+   HostHeartbeats::iterator itr = host_heartbeats.find( from );
+   if( itr == host_heartbeats.end() )
+      return;
+   
+   struct wish_host_status* hs = itr->second;
+   heartbeat_rank_del( hs );
+   host_heartbeats.erase( itr );
+   swim_forget( &membership, from );
+   
+   dbprintf("heartbeat_rename: %s:%d is %lu\n", hs->hostname, hs->portnum, nid );
+   
+   itr = host_heartbeats.find( nid );
+   if( itr == host_heartbeats.end() ) {
+      hs->nid = nid;
+      host_heartbeats[ nid ] = hs;
+      heartbeat_rank_add( hs );
+      return;
+   }
+   
+   // already know it; keep whichever connection works
+   if( itr->second->con.soc < 0 && hs->con.soc >= 0 ) {
+      itr->second->con = hs->con;
+      hs->con.soc = -1;
+      hs->con.addr = NULL;
+      hs->con.last_packet_recved = NULL;
+   }
+   
+   wish_host_status_free( state, hs );
+}
+
+
+// process a received heartbeat packet that came in on our connection to from (0 if we don't know).
+// need to write-lock host heartbeats first
+// return negative on error, 0 on success
+static int heartbeat_receive( struct wish_state* state, long from, struct wish_packet* wp, uint64_t arrival ) {
    if( wp->hdr.type != PACKET_TYPE_HEARTBEAT )
       return -EINVAL;
    
-   // what's the current time (for RTT)?
-   struct timeval now;
-   memset(&now, 0, sizeof(now) );
-   gettimeofday( &now, NULL );
-      
-   // first, get the name of this host
-   char* hostname_c = (char*)calloc( HOST_NAME_MAX + 1, 1 );
-   char portnum_buf[10];
+   struct wish_heartbeat_packet h;
+   memset( &h, 0, sizeof(h) );
+   wish_unpack_heartbeat_packet( state, wp, &h );
+   h.recv_mono = arrival;
    
-   // get the hostname
-   int rc = getnameinfo( (struct sockaddr*)&wp->hdr.origin, sizeof(struct sockaddr_storage), hostname_c, HOST_NAME_MAX, portnum_buf, 10, NI_NUMERICSERV );
-   if( rc != 0 ) {
-      errorf("heartbeat_process: rc = %d, error: '%s', errno = %d\n", rc, gai_strerror( rc ), -errno );
-      free( hostname_c );
-      return -ENETDOWN;
+   uint64_t nid = h.nid;
+   int rc = 0;
+   
+   if( nid == 0 ) {
+      // an older host; it's known by where it sends from
+      char hostname_c[HOST_NAME_MAX+1];
+      char portnum_buf[10];
+   
+      rc = getnameinfo( (struct sockaddr*)&wp->hdr.origin, sizeof(struct sockaddr_storage), hostname_c, HOST_NAME_MAX, portnum_buf, 10, NI_NUMERICSERV );
+      if( rc != 0 ) {
+         errorf("heartbeat_receive: rc = %d, error: '%s', errno = %d\n", rc, gai_strerror( rc ), -errno );
+         return -ENETDOWN;
+      }
+   
+      nid = wish_host_nid( hostname_c );
+   }
+   else if( from != 0 && (uint64_t)from != nid ) {
+      heartbeat_rename( state, from, nid );
    }
    
+   // membership news, and an ack if it's a probe
+   swim_recv( &membership, &h, heartbeat_now() );
+   
+   // are we monitoring this host?
+   HostHeartbeats::iterator itr = host_heartbeats.find( nid );
+   if( itr != host_heartbeats.end() ) {
+      heartbeat_record( itr->second, &h );
+   }
+   else if( h.nid == 0 ) {
+      // unknown host
+      errorf("heartbeat_receive: unknown host %lu\n", nid );
+   }
+   
+   wish_free_heartbeat_packet( &h );
+   return rc;
+}
+
+
+// process a received heartbeat packet.
+// need to write-lock host heartbeats first
+// return negative on error, 0 on success
+int heartbeat_process( struct wish_state* state, struct wish_connection* con, struct wish_packet* wp ) {
+   return heartbeat_receive( state, 0, wp, heartbeat_mono_now() );
+}
+
+// fill in what a metrics block says
+static void heartbeat_metrics_block( struct heartbeat_metrics* m, struct wish_host_metrics* b ) {
+   m->ncpus = b->ncpus;
+   m->cpu_busy = b->cpu_busy / 1000.0;
+   m->psi_cpu = b->psi_cpu / 1000.0;
+   m->psi_mem = b->psi_mem / 1000.0;
+   m->psi_io = b->psi_io / 1000.0;
+   m->net_rx = (double)b->net_rx * 1024;
+   m->net_tx = (double)b->net_tx * 1024;
+}
+
+
+// a host's condition, as its heartbeats tell it.
+// need to lock host heartbeats first
+static void heartbeat_host_metrics( struct wish_host_status* hs, struct heartbeat_metrics* m ) {
+   memset( m, 0, sizeof(struct heartbeat_metrics) );
+   
+   m->latency = (hs->latency.count > 0 ? heartbeat_stat_mean( &hs->latency ) : INFINITY);
+   m->load = heartbeat_stat_mean( &hs->load ) / (1 << SI_LOAD_SHIFT);
+   m->ram_free = heartbeat_stat_mean( &hs->ram_free );
+   m->disk_free = heartbeat_stat_mean( &hs->disk_free );
    
-   // convert to nid
-   uint64_t nid = wish_host_nid( hostname_c );
+   m->latency_ewma = (hs->latency.ewma > 0 ? hs->latency.ewma : INFINITY);
+   m->latency_stddev = heartbeat_stat_stddev( &hs->latency );
+   m->latency_jitter = hs->jitter;
+   m->loss = hs->loss;
+   m->probes = hs->probes;
+   m->probes_lost = hs->probes_lost;
+   m->load_ewma = hs->load.ewma / (1 << SI_LOAD_SHIFT);
+   m->util = heartbeat_stat_mean( &hs->util ) / 1000;
    
-   struct wish_host_status* host_status = NULL;
+   heartbeat_metrics_block( m, &hs->metrics );
    
-   // are we monitoring this host already?
-   if( host_heartbeats.find( nid ) != host_heartbeats.end() ) {
-      host_status = host_heartbeats[ nid ];
-      
-      struct wish_heartbeat_packet* ack = (struct wish_heartbeat_packet*)calloc( sizeof(struct wish_heartbeat_packet), 1 );
-      wish_unpack_heartbeat_packet( state, wp, ack );
-      
-      // extract the heartbeat information.
-      ack->latency = -1;      // unknown
-      
-      // is this an acknowledgement of a packet we sent?
-      for( vector<struct wish_heartbeat_packet*>::iterator itr = host_status->pending->begin(); itr != host_status->pending->end(); itr++ ) {
-         if( *itr == NULL )
-            continue;
-         
-         if( (*itr)->id == ack->id ) {
-            // calculate the RTT
-            // (now_sec * 1000000L + now_usec - send_sec * 1000000L - send_usec)
-            // = (now_sec - send_sec) * 1000000L + (now_usec - send_usec)
-            uint64_t d_seconds = now.tv_sec - (*itr)->sendtime.tv_sec;
-            uint64_t d_micros = now.tv_usec - (*itr)->sendtime.tv_usec;
-            uint64_t rtt = d_seconds * 1000000L + d_micros;
-            ack->latency = rtt / 2;
-            // remove this pending packet, since it has been acknowledged
-            free( *itr );
-            host_status->pending->erase( itr );
+   struct heartbeat_sample* last = heartbeat_last_sample( hs );
+   if( last != NULL ) {
+      m->queue_depth = last->queue_depth;
+      m->running = last->running;
+      m->cpus_free = last->cpus_free;
+      m->nodes_free = last->nodes_free;
+   }
+}
+
+
+// make a peer of a host, as it is now.
+// need to lock host heartbeats first
+static struct heartbeat_peer* heartbeat_peer_new( struct wish_host_status* hs ) {
+   struct heartbeat_peer* peer = (struct heartbeat_peer*)calloc( sizeof(struct heartbeat_peer), 1 );
+   if( peer == NULL )
+      return NULL;
+   
+   peer->refs = 1;
+   peer->nid = hs->nid;
+   strncpy( peer->hostname, hs->hostname, HOST_NAME_MAX );
+   peer->portnum = hs->portnum;
+   peer->state = hs->state;
+   strcpy( peer->labels, hs->labels );
+   memcpy( peer->rank_keys, hs->rank_keys, sizeof(peer->rank_keys) );
+   heartbeat_host_metrics( hs, &peer->m );
+   return peer;
+}
+
+
+// drop a reference to a peer, freeing it if it was the last
+static void heartbeat_peer_put( struct heartbeat_peer* peer ) {
+   if( __atomic_sub_fetch( &peer->refs, 1, __ATOMIC_SEQ_CST ) == 0 )
+      free( peer );
+}
+
+
+// drop references to a snapshot, freeing it (and dropping its peers) if they were the last
+static void heartbeat_snapshot_drop( struct heartbeat_snapshot* snap, int refs ) {
+   if( __atomic_sub_fetch( &snap->refs, refs, __ATOMIC_SEQ_CST ) > 0 || snap == &empty_snapshot )
+      return;
+   
+   for( uint32_t i = 0; i < snap->num_peers; i++ ) {
+      heartbeat_peer_put( snap->peers[i] );
+   }
+   
+   free( snap->peers );
+   free( snap );
+}
+
+
+// take a reference to the published snapshot.  Never blocks.
+// the reference is counted in the top bits of published itself, so loading the snapshot and taking it are one
+// atomic add, and the publisher can't free it in between.
+static struct heartbeat_snapshot* heartbeat_snapshot_get(void) {
+   uint64_t word = __atomic_add_fetch( &published, SNAPSHOT_READER, __ATOMIC_SEQ_CST );
+   return (struct heartbeat_snapshot*)(word & SNAPSHOT_MASK);
+}
+
+
+// give back a reference from heartbeat_snapshot_get.  Never blocks.
+static void heartbeat_snapshot_put( struct heartbeat_snapshot* snap ) {
+   // still published?  Then our reference is still counted in published.
+   // (it can't have been freed and its address reused while we hold it)
+   uint64_t word = __atomic_load_n( &published, __ATOMIC_SEQ_CST );
+   while( (word & SNAPSHOT_MASK) == (uint64_t)snap ) {
+      if( __atomic_compare_exchange_n( &published, &word, word - SNAPSHOT_READER, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) )
+         return;
+   }
+   
+   // swapped out; the publisher moved our reference onto snap->refs
+   heartbeat_snapshot_drop( snap, 1 );
+}
+
+
+// publish a snapshot in place of the last one, taking over the caller's reference to it.
+// readers still holding the old one have their references moved onto it, and the last of them frees it.
+// need to write-lock host heartbeats first
+static void heartbeat_snapshot_swap( struct heartbeat_snapshot* snap ) {
+   uint64_t word = __atomic_exchange_n( &published, (uint64_t)snap, __ATOMIC_SEQ_CST );
+   
+   struct heartbeat_snapshot* old = (struct heartbeat_snapshot*)(word & SNAPSHOT_MASK);
+   int readers = (int)(word / SNAPSHOT_READER);
+   
+   // (the reference published held goes with it)
+   heartbeat_snapshot_drop( old, 1 - readers );
+}
+
+
+// publish what we know now, if anything readers see has changed since we last did.
+// hosts that haven't changed keep their peers.
+// need to write-lock host heartbeats first
+static void heartbeat_publish(void) {
+   if( !snapshot_dirty )
+      return;
+   
+   struct heartbeat_snapshot* snap = (struct heartbeat_snapshot*)calloc( sizeof(struct heartbeat_snapshot), 1 );
+   
+   bool ok = (snap != NULL);
+   if( ok ) {
+      snap->refs = 1;
+      snap->ranks = host_ranks;
+      snap->peers = (struct heartbeat_peer**)calloc( sizeof(struct heartbeat_peer*) * (host_heartbeats.size() + 1), 1 );
+      ok = (snap->peers != NULL);
+   }
+   
+   // host_heartbeats is ordered by nid as a long, so the peers come out sorted for heartbeat_snapshot_find
+   for( HostHeartbeats::iterator itr = host_heartbeats.begin(); ok && itr != host_heartbeats.end(); itr++ ) {
+      struct wish_host_status* hs = itr->second;
+      if( hs->peer == NULL || hs->changed ) {
+         struct heartbeat_peer* peer = heartbeat_peer_new( hs );
+         if( peer == NULL ) {
+            ok = false;
             break;
          }
+   
+         if( hs->peer != NULL )
+            heartbeat_peer_put( hs->peer );
+   
+         hs->peer = peer;
+         hs->changed = false;
       }
-      
-      if( ack->latency >= 0 ) {
-         // success!
-         // free the last packet
-         if( host_status->heartbeats->size() > (unsigned)_STATUS_MEMORY ) {
-            struct wish_heartbeat_packet* old = host_status->heartbeats->front();
-            if( old ) {
-               free( old );
-            }
-            host_status->heartbeats->erase( host_status->heartbeats->begin() );
-         }
-         
-         host_status->heartbeats->push_back( ack );
-         
-         //dbprintf("heartbeat_process: got heartbeat from %s, latency = %ld\n", hostname_c, ack->latency );
-      }
-      else {
-         // not an ack packet
-         free( ack );
-         rc = 1;
-      }
+   
+      __atomic_add_fetch( &hs->peer->refs, 1, __ATOMIC_SEQ_CST );
+      snap->peers[ snap->num_peers ] = hs->peer;
+      snap->num_peers++;
    }
-   else {
-      // unknown host
-      errorf("heartbeat_process: unknown host %s\n", hostname_c );
+   
+   if( !ok ) {
+      // readers keep the last snapshot; try again on the next update
+      errorf("heartbeat_publish: %s\n", strerror( ENOMEM ) );
+      if( snap != NULL ) {
+         snap->refs = 1;
+         heartbeat_snapshot_drop( snap, 1 );
+      }
+      return;
    }
    
-   free( hostname_c );
+   heartbeat_snapshot_swap( snap );
+   snapshot_dirty = false;
+}
+
+
+// find a host in a snapshot (NULL if it isn't in it)
+static struct heartbeat_peer* heartbeat_snapshot_find( struct heartbeat_snapshot* snap, uint64_t nid ) {
+   uint32_t lo = 0, hi = snap->num_peers;
+   while( lo < hi ) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      long mid_nid = (long)snap->peers[mid]->nid;
+   
+      if( mid_nid == (long)nid )
+         return snap->peers[mid];
    
-   return rc;
+      if( mid_nid < (long)nid )
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return NULL;
+}
+
+
+// read-lock the rankings
+static void heartbeat_ranks_rlock(void) {
+   pthread_rwlock_rdlock( &host_ranks_lock );
 }
 
+// unlock the rankings
+static void heartbeat_ranks_unlock(void) {
+   pthread_rwlock_unlock( &host_ranks_lock );
+}
+
+
 // get a connection and NID for a host.
 int heartbeat_get_hostname( struct wish_state* state, char const* hostname, struct wish_connection* con, uint64_t* nid ) {
    uint64_t hnid = wish_host_nid( hostname );
@@ -491,15 +1822,15 @@ int heartbeat_get_nid( struct wish_state* state, uint64_t nid, struct wish_conne
       rc = wish_connect( state, con, "localhost", myport );
    }
    else {
-      host_heartbeats_rlock();
-      HostHeartbeats::iterator itr = host_heartbeats.find( (long)nid );
-      if( itr != host_heartbeats.end() ) {
-         rc = wish_connect( state, con, itr->second->hostname, itr->second->portnum );
+      struct heartbeat_snapshot* snap = heartbeat_snapshot_get();
+      struct heartbeat_peer* peer = heartbeat_snapshot_find( snap, nid );
+      if( peer != NULL ) {
+         rc = wish_connect( state, con, peer->hostname, peer->portnum );
       }
       else {
          rc = -ENOENT;
       }
-      host_heartbeats_unlock();
+      heartbeat_snapshot_put( snap );
    }
    
    if( rc == 0 ) {
@@ -517,17 +1848,17 @@ char* heartbeat_nid_to_hostname( struct wish_state* state, uint64_t nid ) {
    wish_state_rlock( state );
    if( state->nid == nid )
       ret = strdup( state->hostname );
-   wish_state_rlock( state );
+   wish_state_unlock( state );
    
    if( ret )
       return ret;
    
-   host_heartbeats_rlock();
-   HostHeartbeats::iterator itr = host_heartbeats.find( (long)nid );
-   if( itr != host_heartbeats.end() ) {
-      ret = strdup( itr->second->hostname );
+   struct heartbeat_snapshot* snap = heartbeat_snapshot_get();
+   struct heartbeat_peer* peer = heartbeat_snapshot_find( snap, nid );
+   if( peer != NULL ) {
+      ret = strdup( peer->hostname );
    }
-   host_heartbeats_unlock();
+   heartbeat_snapshot_put( snap );
    
    return ret;
 }
@@ -536,12 +1867,12 @@ char* heartbeat_nid_to_hostname( struct wish_state* state, uint64_t nid ) {
 int heartbeat_nid_to_portnum( struct wish_state* state, uint64_t nid ) {
    int ret = -1;
    
-   host_heartbeats_rlock();
-   HostHeartbeats::iterator itr = host_heartbeats.find( (long)nid );
-   if( itr != host_heartbeats.end() ) {
-      ret = itr->second->portnum;
+   struct heartbeat_snapshot* snap = heartbeat_snapshot_get();
+   struct heartbeat_peer* peer = heartbeat_snapshot_find( snap, nid );
+   if( peer != NULL ) {
+      ret = peer->portnum;
    }
-   host_heartbeats_unlock();
+   heartbeat_snapshot_put( snap );
    
    return ret;
 }
@@ -549,147 +1880,203 @@ int heartbeat_nid_to_portnum( struct wish_state* state, uint64_t nid ) {
 
 // how many nodes do we know about?
 uint64_t heartbeat_count_hosts( struct wish_state* state ) {
-   host_heartbeats_rlock();
-   uint64_t ret = host_heartbeats.size();
-   host_heartbeats_unlock();
+   struct heartbeat_snapshot* snap = heartbeat_snapshot_get();
+   uint64_t ret = snap->num_peers;
+   heartbeat_snapshot_put( snap );
    return ret;
 }
 
 
-static bool sort_ith_pair( const pair<double, long>& a, const pair<double, long>& b ) {
-   return a.first < b.first;
+// average latency to a host
+double heartbeat_nid_latency( struct wish_state* state, uint64_t nid ) {
+   wish_state_rlock( state );
+   bool me = (state->nid == nid);
+   wish_state_unlock( state );
+   
+   if( me )
+      return 0;
+   
+   double ret = INFINITY;
+   
+   struct heartbeat_snapshot* snap = heartbeat_snapshot_get();
+   struct heartbeat_peer* peer = heartbeat_snapshot_find( snap, nid );
+   if( peer != NULL ) {
+      ret = peer->m.latency;
+   }
+   heartbeat_snapshot_put( snap );
+   
+   return ret;
 }
 
 
-static double host_latency( struct wish_host_status* status ) {
-   double latency_avg = 0;
-   int cnt = 0;
-   for( unsigned int i = 0; i < status->heartbeats->size(); i++ ) {
-      if( status->heartbeats->at(i)->latency > 0 ) {
-         latency_avg += status->heartbeats->at(i)->latency;
-         cnt++;
-      }
-   }
-   dbprintf("host_latency: latency of %s is %lf\n", status->hostname, latency_avg / cnt);
-   if( cnt == 0 ) {
-      return INFINITY;
+// is a host suspected of being down?
+bool heartbeat_nid_suspect( struct wish_state* state, uint64_t nid ) {
+   bool ret = false;
+   
+   struct heartbeat_snapshot* snap = heartbeat_snapshot_get();
+   struct heartbeat_peer* peer = heartbeat_snapshot_find( snap, nid );
+   if( peer != NULL ) {
+      ret = (peer->state == MEMBER_SUSPECT);
    }
-   return latency_avg / cnt;
+   heartbeat_snapshot_put( snap );
+   
+   return ret;
 }
 
 
-static double host_ram( struct wish_host_status* status ) {
-   double ram_avg = 0;
-   int cnt = 0;
-   for( unsigned int i = 0; i < status->heartbeats->size(); i++ ) {
-      if( status->heartbeats->at(i)->ram_free > 0 ) {
-         ram_avg += status->heartbeats->at(i)->ram_free;
-         cnt++;
-      }
+// a host's condition
+int heartbeat_nid_metrics( struct wish_state* state, uint64_t nid, struct heartbeat_metrics* m ) {
+   memset( m, 0, sizeof(struct heartbeat_metrics) );
+   
+   wish_state_rlock( state );
+   bool me = (state->nid == nid);
+   wish_state_unlock( state );
+   
+   if( me ) {
+      struct sampler_reading r;
+      sampler_read( &r );
+   
+      m->latency = 0;
+      m->load = (double)r.loads[0] / (1 << SI_LOAD_SHIFT);
+      m->load_ewma = m->load;
+      m->ram_free = r.ram_free;
+      m->disk_free = r.disk_free;
+      m->util = r.metrics.util / 1000.0;
+      heartbeat_metrics_block( m, &r.metrics );
+   
+      // our own jobs are counted as they change, so don't wait for the sampler
+      m->queue_depth = scheduler_queue_depth( state );
+      m->running = process_num_running( state );
+      m->cpus_free = pin_free_cpus( state );
+      m->nodes_free = pin_free_nodes( state );
+   
+      return 0;
+   }
+   
+   int rc = 0;
+   
+   struct heartbeat_snapshot* snap = heartbeat_snapshot_get();
+   struct heartbeat_peer* peer = heartbeat_snapshot_find( snap, nid );
+   if( peer != NULL ) {
+      *m = peer->m;
    }
-   if( cnt == 0 ) {
-      cnt = 1;
+   else {
+      rc = -ENOENT;
    }
-   dbprintf("host_ram: RAM of %s is %lf\n", status->hostname, ram_avg / cnt);
-   return ram_avg / cnt;
+   heartbeat_snapshot_put( snap );
+   
+   return rc;
 }
 
 
-static double host_disk( struct wish_host_status* status ) {
-   double disk_avg = 0;
-   int cnt = 0;
-   for( unsigned int i = 0; i < status->heartbeats->size(); i++ ) {
-      if( status->heartbeats->at(i)->disk_free > 0 ) {
-         disk_avg += status->heartbeats->at(i)->disk_free;
-         cnt++;
-      }
-   }
-   if( cnt == 0 ) {
-      cnt = 1;
+// every host we know of
+void heartbeat_nids( struct wish_state* state, vector<uint64_t>* nids ) {
+   wish_state_rlock( state );
+   nids->push_back( state->nid );
+   wish_state_unlock( state );
+   
+   struct heartbeat_snapshot* snap = heartbeat_snapshot_get();
+   for( uint32_t i = 0; i < snap->num_peers; i++ ) {
+      if( snap->peers[i]->state == MEMBER_SUSPECT )
+         continue;
+   
+      nids->push_back( snap->peers[i]->nid );
    }
-   dbprintf("host_disk: disk of %s is %lf\n", status->hostname, disk_avg / cnt );
-   return disk_avg / cnt;
+   heartbeat_snapshot_put( snap );
 }
 
 
-static double host_cpu( struct wish_host_status* status ) {
-   double cpu_avg = 0;
-   int cnt = 0;
-   for( unsigned int i = 0; i < status->heartbeats->size(); i++ ) {
-      if( status->heartbeats->at(i)->loads[0] > 0 ) {
-         cpu_avg += status->heartbeats->at(i)->loads[0];
-         cnt++;
-      }
-   }
-   if( cnt == 0 )
-      cnt = 1;
+// this host's key in a ranking (see heartbeat_rank_key), as of now
+static double host_local_key( struct wish_state* state, uint32_t props ) {
+   struct sampler_reading r;
+   sampler_read( &r );
+   
+   switch( props ) {
+      case HEARTBEAT_PROP_LATENCY:
+         return 0;
+   
+      case HEARTBEAT_PROP_CPU:
+         return r.metrics.util;
    
-   dbprintf("host_cpu: cpu of %s is %lf\n", status->hostname, cpu_avg / cnt );
-   return cpu_avg / cnt;
+      case HEARTBEAT_PROP_RAM:
+         return -(double)r.ram_free;
+   
+      default:
+         return -(double)r.disk_free;
+   }
 }
 
 
-static uint64_t host_best( struct wish_state* state, unsigned int best, double (*attr_calc)(struct wish_host_status*), double local, bool reverse ) {
-   
-   // which host has the ith best attr?
-   host_heartbeats_rlock();
-   vector< pair<double, long> > buf;      // list of <nid, avg latency>
-   for( HostHeartbeats::iterator itr = host_heartbeats.begin(); itr != host_heartbeats.end(); itr++ ) {
-      double val = (*attr_calc)( itr->second );
-      buf.push_back( pair<double, long>( val, wish_host_nid( itr->second->hostname ) ) );
-   }
+// which hosts are ranked first, first+1, ... by a metric?  This host is ranked among the others.
+static void host_best( struct wish_state* state, uint32_t props, unsigned int first, unsigned int count, vector<uint64_t>* nids ) {
+   double local = host_local_key( state, props );
    
    wish_state_rlock( state );
-   buf.push_back( pair<double, long>( local, state->nid ) );
+   uint64_t self = state->nid;
    wish_state_unlock( state );
    
-   sort( buf.begin(), buf.end(), sort_ith_pair );
-   host_heartbeats_unlock();
+   struct heartbeat_snapshot* snap = heartbeat_snapshot_get();
+   heartbeat_ranks_rlock();
    
-   unsigned int ind = 0;
-   if( reverse )
-      ind = best;
-   else
-      ind = buf.size()-1-best;
+   struct rank_list* r = &snap->ranks[ props - HEARTBEAT_PROP_LATENCY ];
+   unsigned int total = r->size + 1;
+   
+   if( first < total ) {
+      if( count > total - first )
+         count = total - first;
+   
+      // where this host falls among the others
+      unsigned int mine = rank_count_below( r, local, self );
+   
+      // the others we need, from the one of rank first (or the one before, if this host comes ahead of it)
+      uint64_t* others = (uint64_t*)calloc( sizeof(uint64_t) * count, 1 );
+      uint32_t num_others = rank_range( r, (first > mine ? first - 1 : first), count, others );
+   
+      uint32_t j = 0;
+      for( unsigned int rank = first; rank < first + count; rank++ ) {
+         if( rank == mine )
+            nids->push_back( self );
+         else if( j < num_others )
+            nids->push_back( others[j++] );
+      }
    
-   return buf[ind].second;
+      free( others );
+   }
+   
+   heartbeat_ranks_unlock();
+   heartbeat_snapshot_put( snap );
+}
+
+
+// which host is ranked best by a metric?
+static uint64_t host_best_one( struct wish_state* state, uint32_t props, unsigned int best ) {
+   vector<uint64_t> nids;
+   host_best( state, props, best, 1, &nids );
+   
+   if( nids.size() == 0 )
+      return 0;
+   
+   return nids[0];
 }
 
 // which host has the ith best latency?
 uint64_t heartbeat_best_latency( struct wish_state* state, unsigned int best ) {
-   return host_best( state, best, host_latency, 0, true );
+   return host_best_one( state, HEARTBEAT_PROP_LATENCY, best );
 }
 
 // which host has the ith best cpu?
 uint64_t heartbeat_best_cpu( struct wish_state* state, unsigned int best ) {
-   struct sysinfo sys;
-   sysinfo( &sys );
-   
-   return host_best( state, best, host_cpu, sys.loads[0], true );
+   return host_best_one( state, HEARTBEAT_PROP_CPU, best );
 }
 
 // which host has the ith most free ram?
 uint64_t heartbeat_best_ram( struct wish_state* state, unsigned int best ) {
-   struct sysinfo sys;
-   sysinfo( &sys );
-   
-   return host_best( state, best, host_ram, sys.freeram + sys.bufferram, false );
+   return host_best_one( state, HEARTBEAT_PROP_RAM, best );
 }
 
 // which host has the ith most free disk?
 uint64_t heartbeat_best_disk( struct wish_state* state, unsigned int best ) {
-   wish_state_rlock( state );
-   struct statfs fs;
-   int rc = statfs( state->conf.files_root, &fs );
-   wish_state_unlock( state );
-   
-   double val;
-   if( rc < 0 )
-      val = 0;
-   else
-      val = fs.f_bavail * fs.f_bsize;
-   
-   return host_best( state, best, host_disk, val, false );
+   return host_best_one( state, HEARTBEAT_PROP_DISK, best );
 }
 
 uint64_t heartbeat_index( struct wish_state* state, unsigned int best ) {
@@ -703,3 +2090,179 @@ uint64_t heartbeat_index( struct wish_state* state, unsigned int best ) {
    wish_state_unlock( state );
    return nid;
 }
+
+
+// what a unit of each ranking's key is worth in a query's weights (latency in ms, utilization, free RAM and disk in GB)
+static double const heartbeat_query_scale[HEARTBEAT_RANKINGS] = {
+   1.0 / 1000,
+   1.0 / 1000,
+   1.0 / (1024 * 1024 * 1024),
+   1.0 / (1024 * 1024 * 1024)
+};
+
+
+// is a label in a comma-separated list of them?
+static bool heartbeat_has_label( char const* labels, char const* label, size_t len ) {
+   while( *labels != 0 ) {
+      size_t n = strcspn( labels, "," );
+      if( n == len && strncmp( labels, label, len ) == 0 )
+         return true;
+   
+      labels += n;
+      if( *labels == ',' )
+         labels++;
+   }
+   return false;
+}
+
+
+// does a host have every label in want?
+static bool heartbeat_has_labels( char const* have, char const* want ) {
+   while( *want != 0 ) {
+      size_t len = strcspn( want, "," );
+      if( len > 0 && !heartbeat_has_label( have, want, len ) )
+         return false;
+   
+      want += len;
+      if( *want == ',' )
+         want++;
+   }
+   return true;
+}
+
+
+// score a host with the given ranking keys and labels.
+// return false if it fails a filter
+static bool heartbeat_query_score( double* keys, double* bounds, double* weights, char const* labels, char const* want, double* score ) {
+   for( int i = 0; i < HEARTBEAT_RANKINGS; i++ ) {
+      if( keys[i] > bounds[i] )
+         return false;
+   }
+   
+   if( !heartbeat_has_labels( labels, want ) )
+      return false;
+   
+   *score = 0;
+   for( int i = 0; i < HEARTBEAT_RANKINGS; i++ ) {
+      // (an unknown latency only counts if it's weighed)
+      if( weights[i] != 0 )
+         *score += weights[i] * keys[i] * heartbeat_query_scale[i];
+   }
+   return true;
+}
+
+
+static bool heartbeat_match_cmp( const struct heartbeat_match& a, const struct heartbeat_match& b ) {
+   return a.score < b.score || (a.score == b.score && a.nid < b.nid);
+}
+
+
+// run a placement query
+void heartbeat_query( struct wish_state* state, struct wish_nget_packet* query, unsigned int first, unsigned int count, vector<struct heartbeat_match>* matches ) {
+   double weights[HEARTBEAT_RANKINGS];
+   double bounds[HEARTBEAT_RANKINGS];
+   
+   for( int i = 0; i < HEARTBEAT_RANKINGS; i++ ) {
+      weights[i] = query->weights[i] / 1000.0;
+      bounds[i] = INFINITY;
+   }
+   
+   // every filter is an upper bound on a ranking's key
+   if( query->max_latency > 0 )
+      bounds[0] = query->max_latency;
+   if( query->max_load > 0 )
+      bounds[1] = query->max_load;
+   if( query->min_ram > 0 )
+      bounds[2] = -(double)query->min_ram;
+   if( query->min_disk > 0 )
+      bounds[3] = -(double)query->min_disk;
+   
+   vector<struct heartbeat_match> found;
+   struct heartbeat_match match;
+   
+   // this host, as it is now
+   double keys[HEARTBEAT_RANKINGS];
+   for( int i = 0; i < HEARTBEAT_RANKINGS; i++ ) {
+      keys[i] = host_local_key( state, i + HEARTBEAT_PROP_LATENCY );
+   }
+   
+   wish_state_rlock( state );
+   match.nid = state->nid;
+   bool ok = heartbeat_query_score( keys, bounds, weights, (state->conf.labels ? state->conf.labels : ""), query->labels, &match.score );
+   wish_state_unlock( state );
+   
+   if( ok )
+      found.push_back( match );
+   
+   struct heartbeat_snapshot* snap = heartbeat_snapshot_get();
+   heartbeat_ranks_rlock();
+   
+   // the rankings can count how many hosts pass each filter; only look at those that pass the narrowest one
+   int narrowest = 0;
+   uint32_t candidates = snap->ranks[0].size;
+   for( int i = 0; i < HEARTBEAT_RANKINGS; i++ ) {
+      if( bounds[i] == INFINITY )
+         continue;
+   
+      uint32_t passing = rank_count_below( &snap->ranks[i], bounds[i], UINT64_MAX );
+      if( passing < candidates ) {
+         candidates = passing;
+         narrowest = i;
+      }
+   }
+   
+   uint64_t* nids = (uint64_t*)calloc( sizeof(uint64_t) * (candidates + 1), 1 );
+   uint32_t num = rank_range( &snap->ranks[narrowest], 0, candidates, nids );
+   
+   heartbeat_ranks_unlock();
+   
+   // the rankings may be newer than the snapshot; hosts it doesn't have yet are left out
+   for( uint32_t i = 0; i < num; i++ ) {
+      struct heartbeat_peer* peer = heartbeat_snapshot_find( snap, nids[i] );
+      if( peer == NULL || peer->state == MEMBER_SUSPECT )
+         continue;
+   
+      match.nid = peer->nid;
+      if( heartbeat_query_score( peer->rank_keys, bounds, weights, peer->labels, query->labels, &match.score ) )
+         found.push_back( match );
+   }
+   
+   free( nids );
+   heartbeat_snapshot_put( snap );
+   
+   if( first >= found.size() )
+      return;
+   
+   // only the ranks asked for need to be in order
+   size_t last = (size_t)first + count;
+   if( last > found.size() )
+      last = found.size();
+   
+   partial_sort( found.begin(), found.begin() + last, found.end(), heartbeat_match_cmp );
+   matches->insert( matches->end(), found.begin() + first, found.begin() + last );
+}
+
+
+// get the nids of the hosts ranked first, first+1, ... by a metric (or configuration order), best first
+void heartbeat_best_range( struct wish_state* state, uint32_t props, unsigned int first, unsigned int count, vector<uint64_t>* nids ) {
+   if( props >= HEARTBEAT_PROP_LATENCY && props <= HEARTBEAT_PROP_DISK ) {
+      host_best( state, props, first, count, nids );
+      return;
+   }
+   
+   // configuration order: this host, then its initial peers
+   wish_state_rlock( state );
+   for( unsigned int rank = 0; rank < first + count; rank++ ) {
+      uint64_t nid = 0;
+      if( rank == 0 )
+         nid = state->nid;
+      else if( state->conf.initial_peers[rank-1] != NULL )
+         nid = wish_host_nid( state->conf.initial_peers[rank-1]->hostname );
+      else
+         break;
+   
+      if( rank >= first )
+         nids->push_back( nid );
+   }
+   wish_state_unlock( state );
+}
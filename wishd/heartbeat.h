@@ -1,26 +1,144 @@
-// code that maintains connections to other hosts in a WISH instance
+// code that maintains connections to other hosts in a WISH instance.
+// which hosts are in the instance, and how loaded each is, is kept by gossip (see swim.h): each heartbeat
+// interval we probe one host, not all of them, and connections to hosts are opened as they're needed.
 
 #ifndef _HEARTBEAT_H_
 #define _HEARTBEAT_H_
 
 #include "libwish.h"
+#include "timer.h"
+#include "swim.h"
+#include "rank.h"
+#include "sampler.h"
 #include <map>
 #include <string>
 #include <locale>
 #include <math.h>
 #include <algorithm>
+#include <netinet/tcp.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <sched.h>
 
 using namespace std;
 
+#define HEARTBEAT_DEFAULT_CONNECTIONS  64    // most connections to other hosts we keep open at once
+#define HEARTBEAT_EWMA_WEIGHT          0.25  // weight of the newest sample in a metric's moving average
+#define HEARTBEAT_RANKINGS             4     // hosts are ranked by each of HEARTBEAT_PROP_LATENCY through HEARTBEAT_PROP_DISK
+
+// what we know of a host's condition
+struct heartbeat_metrics {
+   double latency;               // average heartbeat latency (0 for this host; INFINITY if unknown)
+   double load;                  // 1-minute load average
+   double util;                  // utilization: the busier of its cores' busy share and its load per core (1 when every core is busy)
+   double ram_free;              // free RAM, in bytes
+   double disk_free;             // free disk space under the host's files root, in bytes
+   uint32_t queue_depth;         // jobs waiting in the host's scheduler queue (as of its last heartbeat)
+   uint32_t running;             // jobs running on the host (as of its last heartbeat)
+   uint32_t cpus_free;           // cores on the host free to pin jobs to (as of its last heartbeat)
+   uint32_t nodes_free;          // NUMA nodes on the host free to pin a job to (as of its last heartbeat)
+   
+   double latency_ewma;          // moving averages over every heartbeat, not just the recent ones
+   double load_ewma;
+   double latency_stddev;        // how much the latency of recent heartbeats varies
+   double latency_jitter;        // smoothed change from one latency sample to the next (RFC 3550), in microseconds
+   double loss;                  // moving average of the share of our probes it didn't answer
+   uint64_t probes;              // probes we've sent it
+   uint64_t probes_lost;         // ... that went unanswered
+   
+   uint32_t ncpus;               // from the host's last metrics block (0 if it sends none)
+   double cpu_busy;              // share of the last sample interval its cores were busy
+   double psi_cpu;               // share of the last 10 seconds some task stalled on CPU, memory, and I/O
+   double psi_mem;
+   double psi_io;
+   double net_rx;                // network throughput, in bytes per second
+   double net_tx;
+};
+
+// what one heartbeat told us of a host
+struct heartbeat_sample {
+   int64_t latency;              // half the round trip less the time the host held our probe, in microseconds (-1 if it wasn't an ack of ours)
+   uint64_t load;                // 1-minute load average, as sysinfo() gives it
+   uint32_t util;                // utilization, in thousandths (see sampler_util)
+   uint64_t ram_free;
+   uint64_t disk_free;
+   uint32_t queue_depth;
+   uint32_t running;
+   uint32_t cpus_free;
+   uint32_t nodes_free;
+};
+
+// running statistics of one metric over a host's recent heartbeats.  Samples that don't carry it (are 0) are left out,
+// unless zero is a reading of it (as an idle host's utilization is).
+struct heartbeat_stat {
+   uint32_t count;               // samples in the window that carry it
+   double sum;                   // their sum and sum of squares, for the mean and variance
+   double sum_sq;
+   double ewma;                  // moving average over every sample seen (0 if none yet)
+   uint64_t seen;                // samples seen that carry it
+   bool zeros;                   // do samples of 0 carry it?
+};
+
+// what readers see of a host: a copy made when it changes, shared by every snapshot it's unchanged in
+struct heartbeat_peer {
+   int refs;                                      // snapshots holding it, plus one while it's its host's latest
+   uint64_t nid;
+   char hostname[HOST_NAME_MAX+1];
+   int portnum;
+   uint32_t state;                                // MEMBER_ALIVE or MEMBER_SUSPECT
+   char labels[HEARTBEAT_LABELS_MAX+1];
+   double rank_keys[HEARTBEAT_RANKINGS];
+   struct heartbeat_metrics m;
+};
+
+// every other host, as of the last change, and the rankings.  Published whole for readers to use without taking
+// host_heartbeats_lock, so they never wait on the heartbeat thread's network I/O.
+struct heartbeat_snapshot {
+   int refs;                                      // readers still using it once it's swapped out, plus one while
+                                                  // it's the published one
+   uint32_t num_peers;
+   struct heartbeat_peer** peers;                 // sorted by nid (as a long, like host_heartbeats)
+   struct rank_list* ranks;                       // the live rankings, shared by every snapshot rather than copied
+                                                  // into each (read-lock them with heartbeat_ranks_rlock)
+};
+
 struct wish_host_status {
-   vector<struct wish_heartbeat_packet*>* pending;     // list of packets sent to this host that have not been acknowledged
-   vector<struct wish_heartbeat_packet*>* heartbeats;  // list of the last heartbeat packets we've received from this host
+   // our probes of it.  Acks echo the probe's send time, so only the latest is kept, to time acks from older hosts
+   // (which only echo its id) and to tell when one went unanswered.
+   uint32_t probe_id;
+   uint64_t probe_mono;                           // when it went out (0 once answered)
+   uint64_t probes;                               // how many we've sent
+   uint64_t probes_lost;                          // how many weren't answered before the next went out
+   double loss;                                   // moving average of the share lost
+   double jitter;                                 // smoothed change between successive latency samples (RFC 3550)
+   int64_t last_latency;                          // the previous latency sample (-1 if none)
+   
+   struct heartbeat_sample* samples;              // ring of what the host's last heartbeats told us
+   uint32_t samples_size;
+   uint32_t samples_next;
+   uint32_t num_samples;
+   
+   struct heartbeat_stat latency;                 // kept up to date as samples come and go
+   struct heartbeat_stat load;
+   struct heartbeat_stat ram_free;
+   struct heartbeat_stat disk_free;
+   struct heartbeat_stat util;
+   
+   double rank_keys[HEARTBEAT_RANKINGS];          // what it's filed under in each ranking (the lower, the better)
+   bool ranked;                                   // is it filed in the rankings?
+   
+   struct heartbeat_peer* peer;                   // what readers last saw of it (NULL if not published yet)
+   bool changed;                                  // does peer need remaking?
    
    struct wish_connection con;                    // connection to this host
    char* hostname;                                // hostname of this host
+   char labels[HEARTBEAT_LABELS_MAX+1];           // labels it announces ("" if none, or not heard yet)
+   struct wish_host_metrics metrics;              // the last metrics block it sent (version 0 if none)
    int portnum;                                   // portnum of this host (in case we need to repair the connection)
    
    uint64_t nid;                                  // node ID of this host
+   uint32_t state;                                // MEMBER_ALIVE or MEMBER_SUSPECT
+   uint64_t last_used;                            // when we last sent to it (ms), so idle connections can be closed
 };
 
 // initialize heartbeat monitoring
@@ -32,7 +150,7 @@ int heartbeat_shutdown( struct wish_state* state );
 // process an inbound heartbeat connection
 int heartbeat_add( struct wish_state* state, struct wish_connection* con, struct wish_packet* wp );
 
-// process an inbound heartbeat packet
+// process an inbound heartbeat packet (write-lock host heartbeats first)
 int heartbeat_process( struct wish_state* state, struct wish_connection* con, struct wish_packet* wp );
 
 // get a connection given a hostname.
@@ -54,10 +172,39 @@ int heartbeat_nid_to_portnum( struct wish_state* state, uint64_t nid );
 // how many hosts?
 uint64_t heartbeat_count_hosts( struct wish_state* state );
 
+// average latency to a host (0 for this host; INFINITY if unknown)
+double heartbeat_nid_latency( struct wish_state* state, uint64_t nid );
+
+// is a host suspected of being down (false for this host, and for hosts we don't know of)?
+bool heartbeat_nid_suspect( struct wish_state* state, uint64_t nid );
+
+// get a host's condition, averaged over its recent heartbeats (this host's is current).
+// return 0 on success, or -ENOENT if we don't know of the host
+int heartbeat_nid_metrics( struct wish_state* state, uint64_t nid, struct heartbeat_metrics* m );
+
+// list the nids of every host we know of that isn't suspected of being down, this one first
+void heartbeat_nids( struct wish_state* state, vector<uint64_t>* nids );
+
+// which host has the ith best latency/cpu/ram/disk (0 being the best; this host is ranked too)?
+// return its nid, or 0 if there aren't that many hosts
 uint64_t heartbeat_best_latency( struct wish_state* state, unsigned int best );
 uint64_t heartbeat_best_cpu( struct wish_state* state, unsigned int best );
 uint64_t heartbeat_best_ram( struct wish_state* state, unsigned int best );
 uint64_t heartbeat_best_disk( struct wish_state* state, unsigned int best );
 uint64_t heartbeat_index( struct wish_state* state, unsigned int best );
 
+// a host that matched a placement query
+struct heartbeat_match {
+   uint64_t nid;
+   double score;                 // the lower, the better
+};
+
+// run a placement query (see struct wish_nget_packet): get the hosts ranked first, first+1, ... among those that
+// match it, at most count of them, best first.  This host is considered too.
+void heartbeat_query( struct wish_state* state, struct wish_nget_packet* query, unsigned int first, unsigned int count, vector<struct heartbeat_match>* matches );
+
+// get the nids of the hosts ranked first, first+1, ... by a HEARTBEAT_PROP_* (HEARTBEAT_PROP_NONE for configuration
+// order), at most count of them, best first
+void heartbeat_best_range( struct wish_state* state, uint32_t props, unsigned int first, unsigned int count, vector<uint64_t>* nids );
+
 #endif
\ No newline at end of file
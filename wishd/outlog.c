@@ -0,0 +1,547 @@
+#include "outlog.h"
+
+// every job's log, by gpid
+static OutlogTable logs;
+static pthread_rwlock_t logs_lock;
+
+// most segments to keep per log
+static unsigned int max_segments = OUTLOG_DEFAULT_SEGMENTS;
+
+// most bytes a follower may have waiting
+static size_t max_backlog = OUTLOG_FOLLOWER_BACKLOG * OUTLOG_DEFAULT_SEGMENTS * OUTLOG_SEGMENT_SIZE;
+
+// sends what slow followers couldn't take at once
+static pthread_t flush_thread;
+static pthread_mutex_t flush_lock;
+static pthread_cond_t flush_cond;
+static bool flush_running = false;
+static bool flush_pending = false;      // has a follower been left with output waiting?  Protected by flush_lock.
+
+// free a follower, and hang up on it
+static void outlog_follower_free( struct wish_state* state, struct outlog_follower* f ) {
+   if( f->con ) {
+      wish_disconnect( state, f->con );
+      free( f->con );
+   }
+   if( f->outbuf )
+      free( f->outbuf );
+   delete f;
+}
+
+
+// append an output packet to a follower's outbound buffer.
+// return 0 on success; -ENOBUFS if the follower is too far behind; other negative on error
+static int outlog_queue( struct wish_state* state, struct outlog_follower* f, uint32_t type, uint64_t gpid, uint64_t offset, uint32_t flags, uint32_t stream, char const* data ) {
+   if( f->outbuf_len - f->outbuf_sent > max_backlog )
+      return -ENOBUFS;
+   
+   struct wish_output_packet opkt;
+   wish_init_output_packet( state, &opkt, type, gpid, offset, flags, stream, data );
+   
+   struct wish_packet pkt;
+   wish_pack_output_packet( state, &pkt, &opkt );
+   wish_free_output_packet( &opkt );
+   
+   uint8_t* buf = NULL;
+   size_t len = 0;
+   int rc = wish_serialize_packet( &pkt, &buf, &len );
+   wish_free_packet( &pkt );
+   if( rc != 0 )
+      return rc;
+   
+   if( f->outbuf == NULL ) {
+      // nothing waiting; the packet is the buffer
+      f->outbuf = buf;
+      f->outbuf_len = len;
+      f->outbuf_cap = len;
+      f->outbuf_sent = 0;
+      return 0;
+   }
+   
+   if( f->outbuf_len + len > f->outbuf_cap ) {
+      // out of room.  Compact away what has already been sent, if that's most of it...
+      if( f->outbuf_sent >= f->outbuf_len / 2 ) {
+         memmove( f->outbuf, f->outbuf + f->outbuf_sent, f->outbuf_len - f->outbuf_sent );
+         f->outbuf_len -= f->outbuf_sent;
+         f->outbuf_sent = 0;
+      }
+      
+      // ...and grow if that wasn't enough
+      if( f->outbuf_len + len > f->outbuf_cap ) {
+         size_t cap = MAX( f->outbuf_cap * 2, f->outbuf_len + len );
+         uint8_t* outbuf = (uint8_t*)realloc( f->outbuf, cap );
+         if( outbuf == NULL ) {
+            free( buf );
+            return -ENOMEM;
+         }
+         
+         f->outbuf = outbuf;
+         f->outbuf_cap = cap;
+      }
+   }
+   
+   memcpy( f->outbuf + f->outbuf_len, buf, len );
+   f->outbuf_len += len;
+   
+   free( buf );
+   return 0;
+}
+
+
+// send as much of a follower's outbound buffer as its connection will take without blocking.
+// return 0 if the buffer was drained, -EAGAIN if data remains, or -errno on error
+static int outlog_flush( struct wish_state* state, struct outlog_follower* f ) {
+   while( f->outbuf_sent < f->outbuf_len ) {
+      errno = 0;
+      ssize_t numw = send( f->con->soc, f->outbuf + f->outbuf_sent, f->outbuf_len - f->outbuf_sent, MSG_DONTWAIT | MSG_NOSIGNAL );
+      if( numw > 0 ) {
+         f->outbuf_sent += numw;
+      }
+      else if( numw < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+         // follower is slow; the flush thread sends the rest
+         return -EAGAIN;
+      }
+      else {
+         return errno != 0 ? -errno : -EPIPE;
+      }
+   }
+   
+   free( f->outbuf );
+   f->outbuf = NULL;
+   f->outbuf_len = 0;
+   f->outbuf_cap = 0;
+   f->outbuf_sent = 0;
+   return 0;
+}
+
+
+// have the flush thread look for followers with output waiting
+static void outlog_wake_flush(void) {
+   pthread_mutex_lock( &flush_lock );
+   flush_pending = true;
+   pthread_cond_signal( &flush_cond );
+   pthread_mutex_unlock( &flush_lock );
+}
+
+
+// send what a follower can take of its queued output, and drop it if it's done or gone.  Called with log->lock held.
+// return true if the follower is still in the log
+static bool outlog_push( struct wish_state* state, struct outlog* log, vector<struct outlog_follower*>::size_type i ) {
+   struct outlog_follower* f = log->followers[i];
+   
+   int rc = outlog_flush( state, f );
+   if( rc == -EAGAIN ) {
+      outlog_wake_flush();
+      return true;
+   }
+   
+   if( rc != 0 ) {
+      errorf("outlog_push: lost follower of %lu on %d, rc = %d\n", log->gpid, f->con->soc, rc );
+   }
+   else if( !f->ending ) {
+      return true;
+   }
+   
+   outlog_follower_free( state, f );
+   log->followers.erase( log->followers.begin() + i );
+   return false;
+}
+
+
+// send slow followers their queued output as they can take it
+static void* outlog_flush_pthread( void* arg ) {
+   struct wish_state* state = (struct wish_state*)arg;
+   
+   while( true ) {
+      pthread_mutex_lock( &flush_lock );
+      flush_pending = false;
+      bool running = flush_running;
+      pthread_mutex_unlock( &flush_lock );
+      
+      if( !running )
+         break;
+      
+      // which followers have output waiting?
+      vector<struct pollfd> fds;
+      vector<uint64_t> gpids;
+      
+      pthread_rwlock_rdlock( &logs_lock );
+      for( OutlogTable::iterator itr = logs.begin(); itr != logs.end(); itr++ ) {
+         struct outlog* log = itr->second;
+         pthread_mutex_lock( &log->lock );
+         
+         for( vector<struct outlog_follower*>::size_type i = 0; i < log->followers.size(); i++ ) {
+            if( log->followers[i]->outbuf == NULL )
+               continue;
+            
+            struct pollfd pfd;
+            pfd.fd = log->followers[i]->con->soc;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            fds.push_back( pfd );
+            gpids.push_back( log->gpid );
+         }
+         
+         pthread_mutex_unlock( &log->lock );
+      }
+      pthread_rwlock_unlock( &logs_lock );
+      
+      if( fds.size() == 0 ) {
+         // nothing to do until a follower falls behind
+         pthread_mutex_lock( &flush_lock );
+         while( flush_running && !flush_pending )
+            pthread_cond_wait( &flush_cond, &flush_lock );
+         pthread_mutex_unlock( &flush_lock );
+         continue;
+      }
+      
+      int rc = poll( &fds[0], fds.size(), OUTLOG_FLUSH_INTERVAL_MS );
+      if( rc <= 0 )
+         continue;
+      
+      for( vector<struct pollfd>::size_type j = 0; j < fds.size(); j++ ) {
+         if( fds[j].revents == 0 )
+            continue;
+         
+         pthread_rwlock_rdlock( &logs_lock );
+         
+         OutlogTable::iterator itr = logs.find( gpids[j] );
+         if( itr != logs.end() ) {
+            struct outlog* log = itr->second;
+            pthread_mutex_lock( &log->lock );
+            
+            // it may have been dropped since
+            for( vector<struct outlog_follower*>::size_type i = 0; i < log->followers.size(); i++ ) {
+               if( log->followers[i]->con->soc == fds[j].fd ) {
+                  outlog_push( state, log, i );
+                  break;
+               }
+            }
+            
+            pthread_mutex_unlock( &log->lock );
+         }
+         
+         pthread_rwlock_unlock( &logs_lock );
+      }
+   }
+   
+   return NULL;
+}
+
+
+// free a segment
+static void outlog_segment_free( struct outlog_segment* seg ) {
+   for( vector<struct outlog_record>::size_type i = 0; i < seg->records.size(); i++ ) {
+      free( seg->records[i].data );
+   }
+   delete seg;
+}
+
+
+// free a log that's out of the table
+static void outlog_free( struct wish_state* state, struct outlog* log ) {
+   timer_cancel( &log->expire_timer );
+   
+   for( vector<struct outlog_follower*>::size_type i = 0; i < log->followers.size(); i++ ) {
+      outlog_follower_free( state, log->followers[i] );
+   }
+   
+   for( list<struct outlog_segment*>::iterator itr = log->segments.begin(); itr != log->segments.end(); itr++ ) {
+      outlog_segment_free( *itr );
+   }
+   
+   pthread_mutex_destroy( &log->lock );
+   delete log;
+}
+
+
+// a finished job's log has lingered long enough (called from the timer thread)
+static void outlog_expire( struct wish_state* state, uint64_t gpid ) {
+   pthread_rwlock_wrlock( &logs_lock );
+   
+   OutlogTable::iterator itr = logs.find( gpid );
+   if( itr == logs.end() || !itr->second->closed ) {
+      // gone already, or reopened
+      pthread_rwlock_unlock( &logs_lock );
+      return;
+   }
+   
+   struct outlog* log = itr->second;
+   logs.erase( itr );
+   
+   pthread_rwlock_unlock( &logs_lock );
+   
+   dbprintf("outlog_expire: dropping output log of %lu\n", gpid );
+   outlog_free( state, log );
+}
+
+
+// set up output logs
+int outlog_init( struct wish_state* state ) {
+   pthread_rwlock_init( &logs_lock, NULL );
+   
+   wish_state_rlock( state );
+   if( state->conf.outlog_segments > 0 )
+      max_segments = state->conf.outlog_segments;
+   wish_state_unlock( state );
+   
+   max_backlog = (size_t)OUTLOG_FOLLOWER_BACKLOG * max_segments * OUTLOG_SEGMENT_SIZE;
+   
+   pthread_mutex_init( &flush_lock, NULL );
+   pthread_cond_init( &flush_cond, NULL );
+   
+   flush_running = true;
+   int rc = pthread_create( &flush_thread, NULL, outlog_flush_pthread, state );
+   if( rc != 0 ) {
+      errorf("outlog_init: pthread_create rc = %d\n", rc );
+      flush_running = false;
+      return -rc;
+   }
+   
+   return 0;
+}
+
+
+// drop every log
+int outlog_shutdown( struct wish_state* state ) {
+   if( flush_running ) {
+      pthread_mutex_lock( &flush_lock );
+      flush_running = false;
+      pthread_cond_signal( &flush_cond );
+      pthread_mutex_unlock( &flush_lock );
+      
+      pthread_join( flush_thread, NULL );
+   }
+   
+   pthread_rwlock_wrlock( &logs_lock );
+   
+   for( OutlogTable::iterator itr = logs.begin(); itr != logs.end(); itr++ ) {
+      outlog_free( state, itr->second );
+   }
+   logs.clear();
+   
+   pthread_rwlock_unlock( &logs_lock );
+   
+   pthread_rwlock_destroy( &logs_lock );
+   return 0;
+}
+
+
+// start a log for a job, or reopen an ended one
+int outlog_open( struct wish_state* state, uint64_t gpid ) {
+   struct outlog* log = new outlog();
+   log->gpid = gpid;
+   log->end = 0;
+   log->closed = false;
+   timer_setup( &log->expire_timer, outlog_expire, gpid );
+   pthread_mutex_init( &log->lock, NULL );
+   
+   pthread_rwlock_wrlock( &logs_lock );
+   
+   OutlogTable::iterator itr = logs.find( gpid );
+   if( itr != logs.end() ) {
+      int rc = -EEXIST;
+      
+      // a job that's run again (e.g. on another host, after it failed to start) keeps appending to its log
+      struct outlog* old = itr->second;
+      pthread_mutex_lock( &old->lock );
+      if( old->closed ) {
+         old->closed = false;
+         timer_cancel( &old->expire_timer );
+         rc = 0;
+      }
+      pthread_mutex_unlock( &old->lock );
+      
+      pthread_rwlock_unlock( &logs_lock );
+      pthread_mutex_destroy( &log->lock );
+      delete log;
+      return rc;
+   }
+   
+   logs[ gpid ] = log;
+   
+   pthread_rwlock_unlock( &logs_lock );
+   return 0;
+}
+
+
+// add some of a job's output to its log
+void outlog_append( struct wish_state* state, uint64_t gpid, uint32_t stream, char const* data ) {
+   size_t len = strlen( data );
+   if( len == 0 )
+      return;
+   
+   pthread_rwlock_rdlock( &logs_lock );
+   
+   OutlogTable::iterator itr = logs.find( gpid );
+   if( itr == logs.end() ) {
+      pthread_rwlock_unlock( &logs_lock );
+      return;
+   }
+   
+   struct outlog* log = itr->second;
+   pthread_mutex_lock( &log->lock );
+   
+   // start a new segment if this won't fit in the current one
+   if( log->segments.size() == 0 || (log->segments.back()->size > 0 && log->segments.back()->size + len > OUTLOG_SEGMENT_SIZE) ) {
+      struct outlog_segment* seg = new outlog_segment();
+      seg->start = log->end;
+      seg->size = 0;
+      log->segments.push_back( seg );
+   
+      // forget the oldest output
+      while( log->segments.size() > max_segments ) {
+         outlog_segment_free( log->segments.front() );
+         log->segments.pop_front();
+      }
+   }
+   
+   struct outlog_record rec;
+   rec.offset = log->end;
+   rec.stream = stream;
+   rec.data = strdup( data );
+   rec.len = len;
+   
+   struct outlog_segment* seg = log->segments.back();
+   seg->records.push_back( rec );
+   seg->size += len;
+   log->end += len;
+   
+   // pass it on to whoever's following, as fast as each can take it
+   for( vector<struct outlog_follower*>::size_type i = 0; i < log->followers.size(); ) {
+      struct outlog_follower* f = log->followers[i];
+      if( f->ending ) {
+         i++;
+         continue;
+      }
+   
+      int rc = outlog_queue( state, f, OUTPUT_DATA, gpid, rec.offset, 0, stream, data );
+      if( rc != 0 ) {
+         errorf("outlog_append: dropping follower of %lu on %d, rc = %d\n", gpid, f->con->soc, rc );
+         outlog_follower_free( state, f );
+         log->followers.erase( log->followers.begin() + i );
+         continue;
+      }
+   
+      if( outlog_push( state, log, i ) )
+         i++;
+   }
+   
+   pthread_mutex_unlock( &log->lock );
+   pthread_rwlock_unlock( &logs_lock );
+}
+
+
+// a job has ended
+void outlog_close( struct wish_state* state, uint64_t gpid ) {
+   pthread_rwlock_rdlock( &logs_lock );
+   
+   OutlogTable::iterator itr = logs.find( gpid );
+   if( itr == logs.end() ) {
+      pthread_rwlock_unlock( &logs_lock );
+      return;
+   }
+   
+   struct outlog* log = itr->second;
+   pthread_mutex_lock( &log->lock );
+   
+   if( !log->closed ) {
+      log->closed = true;
+   
+      // the followers have everything.  Slow ones are hung up on once they've been sent the rest.
+      for( vector<struct outlog_follower*>::size_type i = 0; i < log->followers.size(); ) {
+         struct outlog_follower* f = log->followers[i];
+         if( f->ending ) {
+            i++;
+            continue;
+         }
+   
+         f->ending = true;
+         int rc = outlog_queue( state, f, OUTPUT_END, gpid, log->end, OUTPUT_CLOSED, 0, NULL );
+         if( rc != 0 ) {
+            outlog_follower_free( state, f );
+            log->followers.erase( log->followers.begin() + i );
+            continue;
+         }
+   
+         if( outlog_push( state, log, i ) )
+            i++;
+      }
+   
+      timer_arm( &log->expire_timer, (uint64_t)OUTLOG_LINGER * 1000 );
+   }
+   
+   pthread_mutex_unlock( &log->lock );
+   pthread_rwlock_unlock( &logs_lock );
+}
+
+
+// replay a job's output, and maybe follow it
+int outlog_attach( struct wish_state* state, struct wish_connection* con, uint64_t gpid, uint64_t offset, bool follow ) {
+   pthread_rwlock_rdlock( &logs_lock );
+   
+   OutlogTable::iterator itr = logs.find( gpid );
+   if( itr == logs.end() ) {
+      pthread_rwlock_unlock( &logs_lock );
+      return -ENOENT;
+   }
+   
+   struct outlog* log = itr->second;
+   int rc = 0;
+   
+   struct outlog_follower* f = new outlog_follower();
+   f->con = con;
+   f->outbuf = NULL;
+   f->outbuf_len = 0;
+   f->outbuf_cap = 0;
+   f->outbuf_sent = 0;
+   f->ending = false;
+   
+   // queue the replay while holding the log, so nothing is appended between the replay and following.
+   // it's sent without blocking, along with whatever the job writes next.
+   pthread_mutex_lock( &log->lock );
+   
+   for( list<struct outlog_segment*>::iterator sitr = log->segments.begin(); sitr != log->segments.end() && rc == 0; sitr++ ) {
+      struct outlog_segment* seg = *sitr;
+   
+      // skip segments that end before offset
+      if( seg->start + seg->size <= offset )
+         continue;
+   
+      for( vector<struct outlog_record>::size_type i = 0; i < seg->records.size() && rc == 0; i++ ) {
+         struct outlog_record* rec = &seg->records[i];
+         if( rec->offset + rec->len <= offset )
+            continue;
+   
+         // send only the part from offset on, if offset is in the middle of it
+         size_t skip = 0;
+         if( rec->offset < offset )
+            skip = offset - rec->offset;
+   
+         rc = outlog_queue( state, f, OUTPUT_DATA, gpid, rec->offset + skip, 0, rec->stream, rec->data + skip );
+      }
+   }
+   
+   if( rc == 0 && !(follow && !log->closed) ) {
+      f->ending = true;
+      rc = outlog_queue( state, f, OUTPUT_END, gpid, log->end, (log->closed ? OUTPUT_CLOSED : 0), 0, NULL );
+   }
+   
+   if( rc == 0 ) {
+      log->followers.push_back( f );
+      outlog_push( state, log, log->followers.size() - 1 );
+   }
+   
+   pthread_mutex_unlock( &log->lock );
+   pthread_rwlock_unlock( &logs_lock );
+   
+   if( rc != 0 ) {
+      errorf("outlog_attach: could not replay output of %lu, rc = %d\n", gpid, rc );
+   
+      // nothing was sent; the caller keeps con
+      f->con = NULL;
+      outlog_follower_free( state, f );
+   }
+   
+   return rc;
+}
@@ -0,0 +1,92 @@
+// append-only logs of job output, kept by the origin.
+// everything a job writes to stdout and stderr is appended to its log as it arrives from the executor, tagged with
+// its stream and its offset in the log.  Clients can attach to a job at any time, replay its output from any offset
+// the log still holds, and then follow it as it grows, so late or extra readers never need the executor to send
+// anything again.  The log is kept in fixed-size segments; once a job has more than the configured number of
+// segments, its oldest one is dropped, which bounds how much memory each job's log takes.
+// output is queued for each follower and sent without blocking; a flush thread sends what a slow follower couldn't
+// take at once, and a follower that falls too far behind is dropped, so no follower holds up the job's output.
+#ifndef _OUTLOG_H_
+#define _OUTLOG_H_
+
+#include "libwish.h"
+#include "timer.h"
+#include <map>
+#include <list>
+#include <vector>
+#include <poll.h>
+
+using namespace std;
+
+#define OUTLOG_SEGMENT_SIZE      65536    // bytes of output per segment (a single larger write gets a segment to itself)
+#define OUTLOG_DEFAULT_SEGMENTS  16
+
+// how long a finished job's log is kept for late readers, in seconds
+#define OUTLOG_LINGER            300
+
+// most output a follower may have waiting to be sent, as a multiple of what a log holds, before it's dropped
+#define OUTLOG_FOLLOWER_BACKLOG  2
+
+// how long the flush thread waits on slow followers before looking for new ones, in milliseconds
+#define OUTLOG_FLUSH_INTERVAL_MS 100
+
+// one write of output
+struct outlog_record {
+   uint64_t offset;              // offset in the log
+   uint32_t stream;              // STRING_STDOUT or STRING_STDERR
+   char* data;
+   size_t len;
+};
+
+// a run of records
+struct outlog_segment {
+   uint64_t start;               // log offset of its first record
+   uint64_t size;                // bytes of output in it
+   vector<struct outlog_record> records;
+};
+
+// a client replaying or following a log
+struct outlog_follower {
+   struct wish_connection* con;
+   uint8_t* outbuf;              // serialized packets waiting to be sent
+   size_t outbuf_len;            // number of bytes in outbuf
+   size_t outbuf_cap;            // number of bytes outbuf has room for
+   size_t outbuf_sent;           // number of bytes of outbuf that have been sent
+   bool ending;                  // hang up once outbuf is sent (it has OUTPUT_END)
+};
+
+// a job's log
+struct outlog {
+   uint64_t gpid;
+   list<struct outlog_segment*> segments;    // oldest first
+   uint64_t end;                 // log offset the next record gets
+   bool closed;                  // has the job ended?
+   vector<struct outlog_follower*> followers;   // clients to send new output to, and ones still being sent OUTPUT_END
+   struct timer expire_timer;    // drops the log a while after the job ends
+   pthread_mutex_t lock;
+};
+
+typedef map<uint64_t, struct outlog*> OutlogTable;
+
+// set up output logs
+int outlog_init( struct wish_state* state );
+
+// drop every log, and hang up on every follower
+int outlog_shutdown( struct wish_state* state );
+
+// start a log for a job, or reopen the log of a job that ended and is being run again
+// return 0 on success; -EEXIST if it already has an open one
+int outlog_open( struct wish_state* state, uint64_t gpid );
+
+// add some of a job's output to its log, and send it to the log's followers
+void outlog_append( struct wish_state* state, uint64_t gpid, uint32_t stream, char const* data );
+
+// a job has ended.  Tell its followers, and keep its log for a while longer.
+void outlog_close( struct wish_state* state, uint64_t gpid );
+
+// replay a job's output from offset on con, then send OUTPUT_END--or, if follow is set, keep sending output until the job ends.
+// takes ownership of con on success.
+// return 0 on success; -ENOENT if there is no log for the job; other negative on error
+int outlog_attach( struct wish_state* state, struct wish_connection* con, uint64_t gpid, uint64_t offset, bool follow );
+
+#endif
@@ -0,0 +1,381 @@
+#include "pinning.h"
+
+// NUMA nodes, and the cores on each that jobs may be pinned to
+static vector<struct pin_node> nodes;
+
+// which job holds each core (0 if free)
+static map<int, uint64_t> owners;
+
+// the cores the daemon may run on, which unpinned jobs share
+static cpu_set_t daemon_cpus;
+
+static pthread_mutex_t pin_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// parse a cpuset list (e.g. "0-3,8,10-11") into a set of cores.
+// return 0 on success; -EINVAL if it can't be parsed
+static int pin_parse_list( char const* list, cpu_set_t* set ) {
+   CPU_ZERO( set );
+   
+   char const* p = list;
+   while( *p != 0 && *p != '\n' ) {
+      char* end = NULL;
+      long first = strtol( p, &end, 10 );
+      if( end == p || first < 0 )
+         return -EINVAL;
+   
+      long last = first;
+      p = end;
+      if( *p == '-' ) {
+         p++;
+         last = strtol( p, &end, 10 );
+         if( end == p || last < first )
+            return -EINVAL;
+         p = end;
+      }
+   
+      for( long i = first; i <= last && i < CPU_SETSIZE; i++ ) {
+         CPU_SET( i, set );
+      }
+   
+      if( *p == ',' )
+         p++;
+   }
+   
+   return 0;
+}
+
+
+// write a sorted list of ids as a cpuset list
+static char* pin_format_list( vector<int>* ids ) {
+   char* ret = (char*)calloc( ids->size() * 24 + 1, 1 );
+   size_t len = 0;
+   
+   for( vector<int>::size_type i = 0; i < ids->size(); ) {
+      // find the run starting here
+      vector<int>::size_type j = i;
+      while( j + 1 < ids->size() && ids->at(j+1) == ids->at(j) + 1 )
+         j++;
+   
+      if( j > i )
+         len += sprintf( ret + len, "%s%d-%d", (len > 0 ? "," : ""), ids->at(i), ids->at(j) );
+      else
+         len += sprintf( ret + len, "%s%d", (len > 0 ? "," : ""), ids->at(i) );
+   
+      i = j + 1;
+   }
+   
+   return ret;
+}
+
+
+// read the cores of each NUMA node, keeping only those in usable
+static void pin_read_nodes( cpu_set_t* usable ) {
+   DIR* dir = opendir( PIN_SYSFS_NODES );
+   if( dir != NULL ) {
+      struct dirent* dent = NULL;
+      while( (dent = readdir( dir )) != NULL ) {
+         int id = -1;
+         if( sscanf( dent->d_name, "node%d", &id ) != 1 )
+            continue;
+   
+         char path[PATH_MAX];
+         snprintf( path, PATH_MAX, "%s/%s/cpulist", PIN_SYSFS_NODES, dent->d_name );
+   
+         char buf[4096];
+         memset( buf, 0, sizeof(buf) );
+   
+         int fd = open( path, O_RDONLY );
+         if( fd < 0 )
+            continue;
+   
+         ssize_t nr = read( fd, buf, sizeof(buf) - 1 );
+         close( fd );
+   
+         cpu_set_t node_cpus;
+         if( nr <= 0 || pin_parse_list( buf, &node_cpus ) != 0 )
+            continue;
+   
+         struct pin_node node;
+         node.id = id;
+         for( int i = 0; i < CPU_SETSIZE; i++ ) {
+            if( CPU_ISSET( i, &node_cpus ) && CPU_ISSET( i, usable ) )
+               node.cpus.push_back( i );
+         }
+   
+         // memoryless or CPU-less nodes, or nodes we may not use, have nothing to give
+         if( node.cpus.size() > 0 )
+            nodes.push_back( node );
+      }
+      closedir( dir );
+   }
+   
+   if( nodes.size() == 0 ) {
+      // no NUMA information; treat the machine as one node
+      struct pin_node node;
+      node.id = 0;
+      for( int i = 0; i < CPU_SETSIZE; i++ ) {
+         if( CPU_ISSET( i, usable ) )
+            node.cpus.push_back( i );
+      }
+      nodes.push_back( node );
+   }
+}
+
+
+static bool pin_node_less( struct pin_node const& a, struct pin_node const& b ) {
+   return a.id < b.id;
+}
+
+
+// find the cores and NUMA nodes jobs may be pinned to
+int pin_init( struct wish_state* state ) {
+   // the cores we may run on ourselves...
+   cpu_set_t usable;
+   CPU_ZERO( &usable );
+   int rc = sched_getaffinity( 0, sizeof(cpu_set_t), &usable );
+   if( rc != 0 ) {
+      rc = -errno;
+      errorf("pin_init: sched_getaffinity errno = %d\n", rc );
+      return rc;
+   }
+   
+   memcpy( &daemon_cpus, &usable, sizeof(cpu_set_t) );
+   
+   // ...or just the ones we've been told to give to jobs
+   wish_state_rlock( state );
+   if( state->conf.pin_cpus ) {
+      cpu_set_t allowed;
+      rc = pin_parse_list( state->conf.pin_cpus, &allowed );
+      if( rc != 0 ) {
+         errorf("pin_init: could not parse %s \"%s\"\n", PIN_CPUS_KEY, state->conf.pin_cpus );
+      }
+      else {
+         CPU_AND( &usable, &usable, &allowed );
+      }
+   }
+   wish_state_unlock( state );
+   
+   if( rc != 0 )
+      return rc;
+   
+   pthread_mutex_lock( &pin_lock );
+   
+   pin_read_nodes( &usable );
+   sort( nodes.begin(), nodes.end(), pin_node_less );
+   
+   for( vector<struct pin_node>::size_type i = 0; i < nodes.size(); i++ ) {
+      for( vector<int>::size_type j = 0; j < nodes[i].cpus.size(); j++ ) {
+         owners[ nodes[i].cpus[j] ] = 0;
+      }
+      dbprintf("pin_init: NUMA node %d has %zu cores for jobs\n", nodes[i].id, nodes[i].cpus.size() );
+   }
+   
+   pthread_mutex_unlock( &pin_lock );
+   
+   return 0;
+}
+
+
+int pin_shutdown( struct wish_state* state ) {
+   pthread_mutex_lock( &pin_lock );
+   nodes.clear();
+   owners.clear();
+   pthread_mutex_unlock( &pin_lock );
+   return 0;
+}
+
+
+// free cores of a node.  Called with pin_lock held.
+static void pin_node_free_cpus( struct pin_node* node, vector<int>* free_cpus ) {
+   for( vector<int>::size_type i = 0; i < node->cpus.size(); i++ ) {
+      if( owners[ node->cpus[i] ] == 0 )
+         free_cpus->push_back( node->cpus[i] );
+   }
+}
+
+
+// give a job cores of its own
+int pin_reserve( struct wish_state* state, uint64_t gpid, uint32_t num_cpus, bool whole_node, struct pin_set* set ) {
+   vector<int> cpus;
+   vector<int> mems;
+   int rc = 0;
+   
+   pthread_mutex_lock( &pin_lock );
+   
+   if( whole_node ) {
+      // the first node nobody is using
+      bool any = false;
+      for( vector<struct pin_node>::size_type i = 0; i < nodes.size(); i++ ) {
+         vector<int> free_cpus;
+         pin_node_free_cpus( &nodes[i], &free_cpus );
+   
+         if( free_cpus.size() == nodes[i].cpus.size() ) {
+            cpus = free_cpus;
+            mems.push_back( nodes[i].id );
+            any = true;
+            break;
+         }
+      }
+   
+      if( !any )
+         rc = (nodes.size() > 0 ? -EBUSY : -EINVAL);
+   }
+   else if( num_cpus == 0 || num_cpus > owners.size() ) {
+      rc = -EINVAL;
+   }
+   else {
+      // the node with the fewest free cores that still fits the job, so bigger holes stay open for bigger jobs
+      int best = -1;
+      size_t best_free = 0;
+      size_t total_free = 0;
+   
+      for( vector<struct pin_node>::size_type i = 0; i < nodes.size(); i++ ) {
+         vector<int> free_cpus;
+         pin_node_free_cpus( &nodes[i], &free_cpus );
+         total_free += free_cpus.size();
+   
+         if( free_cpus.size() >= num_cpus && (best < 0 || free_cpus.size() < best_free) ) {
+            best = i;
+            best_free = free_cpus.size();
+         }
+      }
+   
+      if( best >= 0 ) {
+         vector<int> free_cpus;
+         pin_node_free_cpus( &nodes[best], &free_cpus );
+         cpus.assign( free_cpus.begin(), free_cpus.begin() + num_cpus );
+         mems.push_back( nodes[best].id );
+      }
+      else if( total_free >= num_cpus ) {
+         // no one node fits it; take from the emptiest nodes first, so it spans as few as possible
+         vector< pair<size_t, int> > by_free;
+         for( vector<struct pin_node>::size_type i = 0; i < nodes.size(); i++ ) {
+            vector<int> free_cpus;
+            pin_node_free_cpus( &nodes[i], &free_cpus );
+            by_free.push_back( pair<size_t, int>( free_cpus.size(), i ) );
+         }
+         sort( by_free.rbegin(), by_free.rend() );
+   
+         for( vector< pair<size_t, int> >::size_type i = 0; i < by_free.size() && cpus.size() < num_cpus; i++ ) {
+            struct pin_node* node = &nodes[ by_free[i].second ];
+   
+            vector<int> free_cpus;
+            pin_node_free_cpus( node, &free_cpus );
+            if( free_cpus.size() == 0 )
+               continue;
+   
+            for( vector<int>::size_type j = 0; j < free_cpus.size() && cpus.size() < num_cpus; j++ ) {
+               cpus.push_back( free_cpus[j] );
+            }
+            mems.push_back( node->id );
+         }
+      }
+      else {
+         rc = -EBUSY;
+      }
+   }
+   
+   if( rc == 0 ) {
+      for( vector<int>::size_type i = 0; i < cpus.size(); i++ ) {
+         owners[ cpus[i] ] = gpid;
+      }
+   }
+   
+   pthread_mutex_unlock( &pin_lock );
+   
+   if( rc != 0 )
+      return rc;
+   
+   sort( cpus.begin(), cpus.end() );
+   sort( mems.begin(), mems.end() );
+   
+   CPU_ZERO( &set->mask );
+   for( vector<int>::size_type i = 0; i < cpus.size(); i++ ) {
+      CPU_SET( cpus[i], &set->mask );
+   }
+   set->cpus = pin_format_list( &cpus );
+   set->mems = pin_format_list( &mems );
+   
+   dbprintf("pin_reserve: %lu gets cores %s on NUMA nodes %s\n", gpid, set->cpus, set->mems );
+   return 0;
+}
+
+
+// the cores no job holds
+int pin_unreserved( struct wish_state* state, struct pin_set* set ) {
+   memset( set, 0, sizeof(struct pin_set) );
+   
+   pthread_mutex_lock( &pin_lock );
+   
+   memcpy( &set->mask, &daemon_cpus, sizeof(cpu_set_t) );
+   for( map<int, uint64_t>::iterator itr = owners.begin(); itr != owners.end(); itr++ ) {
+      if( itr->second != 0 )
+         CPU_CLR( itr->first, &set->mask );
+   }
+   
+   pthread_mutex_unlock( &pin_lock );
+   
+   if( CPU_COUNT( &set->mask ) == 0 )
+      return -EBUSY;
+   
+   return 0;
+}
+
+
+// take back a job's cores
+void pin_release( struct wish_state* state, uint64_t gpid ) {
+   pthread_mutex_lock( &pin_lock );
+   
+   for( map<int, uint64_t>::iterator itr = owners.begin(); itr != owners.end(); itr++ ) {
+      if( itr->second == gpid )
+         itr->second = 0;
+   }
+   
+   pthread_mutex_unlock( &pin_lock );
+}
+
+
+// free a pin_set's lists
+void pin_set_free( struct pin_set* set ) {
+   if( set->cpus ) {
+      free( set->cpus );
+      set->cpus = NULL;
+   }
+   if( set->mems ) {
+      free( set->mems );
+      set->mems = NULL;
+   }
+}
+
+
+// how many cores are free
+uint32_t pin_free_cpus( struct wish_state* state ) {
+   uint32_t ret = 0;
+   
+   pthread_mutex_lock( &pin_lock );
+   for( map<int, uint64_t>::iterator itr = owners.begin(); itr != owners.end(); itr++ ) {
+      if( itr->second == 0 )
+         ret++;
+   }
+   pthread_mutex_unlock( &pin_lock );
+   
+   return ret;
+}
+
+
+// how many NUMA nodes are wholly free
+uint32_t pin_free_nodes( struct wish_state* state ) {
+   uint32_t ret = 0;
+   
+   pthread_mutex_lock( &pin_lock );
+   for( vector<struct pin_node>::size_type i = 0; i < nodes.size(); i++ ) {
+      vector<int> free_cpus;
+      pin_node_free_cpus( &nodes[i], &free_cpus );
+      if( free_cpus.size() == nodes[i].cpus.size() )
+         ret++;
+   }
+   pthread_mutex_unlock( &pin_lock );
+   
+   return ret;
+}
@@ -0,0 +1,59 @@
+// CPU and NUMA placement of jobs on this executor.
+// a job can ask for a number of cores, or for a whole NUMA node.  The executor gives it cores that no other pinned job
+// holds--from a single NUMA node whenever they fit in one, so the job's threads share caches and local memory--and
+// runs it on only those cores (with sched_setaffinity, and with its cgroup's cpuset too if it has a cgroup).  The cores
+// are taken back when the job exits.  Jobs that don't ask run on the cores no pinned job holds as they start (with
+// sched_setaffinity only), so they don't crowd the pinned jobs; if every core is held, they may run anywhere.
+// a pinned job that starts after an unpinned one may still share cores with it.
+// free cores and free NUMA nodes are advertised in heartbeats, so the origin's scheduler only sends pinned jobs where they fit.
+#ifndef _PINNING_H_
+#define _PINNING_H_
+
+#include "libwish.h"
+#include <sched.h>
+#include <dirent.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+#define PIN_SYSFS_NODES    "/sys/devices/system/node"
+
+// a NUMA node
+struct pin_node {
+   int id;
+   vector<int> cpus;             // its cores that jobs may be pinned to
+};
+
+// cores given to a job
+struct pin_set {
+   cpu_set_t mask;               // for sched_setaffinity
+   char* cpus;                   // the same, as a cpuset list (e.g. "0-3,8")
+   char* mems;                   // NUMA nodes the cores are on, as a cpuset list
+};
+
+// find the cores and NUMA nodes jobs may be pinned to
+int pin_init( struct wish_state* state );
+
+int pin_shutdown( struct wish_state* state );
+
+// give a job num_cpus cores of its own (or a whole NUMA node, if whole_node is set), and describe them in set.
+// return 0 on success; -EBUSY if there aren't enough free right now; -EINVAL if there could never be enough
+int pin_reserve( struct wish_state* state, uint64_t gpid, uint32_t num_cpus, bool whole_node, struct pin_set* set );
+
+// describe the cores no job holds in set (set->cpus and set->mems are left NULL), for jobs that aren't pinned.
+// return 0 on success; -EBUSY if every core is held
+int pin_unreserved( struct wish_state* state, struct pin_set* set );
+
+// take back a job's cores
+void pin_release( struct wish_state* state, uint64_t gpid );
+
+// free a pin_set's lists
+void pin_set_free( struct pin_set* set );
+
+// how many cores and whole NUMA nodes are free
+uint32_t pin_free_cpus( struct wish_state* state );
+uint32_t pin_free_nodes( struct wish_state* state );
+
+#endif
@@ -1,21 +1,20 @@
 #include "process.h"
 
-typedef map<uint64_t, struct wish_process*> ProcessTable;
-typedef map<uint64_t, struct wish_spawn*> SpawnTable;
-
 // table of processes we're executing
-static ProcessTable procs;
-static pthread_rwlock_t procs_lock;
+static struct gpid_table procs;
 
 // table of processes we've spawned
-static SpawnTable spawned;
-static pthread_rwlock_t spawned_lock;
+static struct gpid_table spawned;
+
+// how many output threads there are on each side
+static int num_output_loops = 1;
+static struct process_loop_args* output_loop_args = NULL;
 
-// thread that writes back stdout and stderr of locally-running processes to the originator
-static pthread_t process_writeback_thread;
+// threads that write back stdout and stderr of locally-running processes to the originator (one per part of procs)
+static pthread_t* process_writeback_threads = NULL;
 
-// thread that processes feedback from remotely-executing processes
-static pthread_t process_spawned_eventloop_thread;
+// threads that process feedback from remotely-executing processes (one per part of spawned)
+static pthread_t* process_spawned_eventloop_threads = NULL;
 
 // thread that processes feedback to locally executing procsses
 static pthread_t process_proc_eventloop_thread;
@@ -32,42 +31,115 @@ void* process_proc_eventloop_func( void* arg );
 // NIDs of possible localhost names
 static vector<uint64_t> localhost_nids;
 
+// recent job launch latencies, per launch method
+static struct process_latency launch_latency[2];
+
+// recent times to first output, per stdin mode
+static struct process_latency first_output_latency[2];
+
+// bytes of stdin spooled to disk right now, and at most
+static uint64_t stdin_spool_bytes = 0;
+static uint64_t stdin_spool_peak = 0;
+
+static pthread_rwlock_t stats_lock;
+
+// members of the job arrays we've spawned, by array id (until they're joined)
+typedef map<uint64_t, vector<uint64_t> > ArrayTable;
+static ArrayTable arrays;
+static pthread_rwlock_t arrays_lock;
+
+// source of random ids for job arrays
+static int process_urandom_fd = -1;
+
 static int wish_finish_process( struct wish_state* state, struct wish_process** proc );
 static int wish_spawned_destroy( struct wish_state* state, struct wish_spawn* spawned );
 
+static void process_expire( struct wish_state* state, uint64_t gpid );
+static void process_spawned_timeout( struct wish_state* state, uint64_t gpid );
+static void process_spawned_release_slot( struct wish_state* state, struct wish_spawn* spawned );
+static void process_spawned_close_log( struct wish_state* state, struct wish_spawn* spawned );
+static int process_do_join( struct wish_state* state, struct wish_spawn* spawn, int type, uint64_t gpid, int exit, struct process_join_replies* replies );
+static void process_join_reply( struct wish_state* state, struct process_join_replies* replies );
+
+static void process_free( struct wish_state* state, struct gpid_entry* ent );
+static void process_spawned_free( struct wish_state* state, struct gpid_entry* ent );
+
+static void process_array_join_reply( struct wish_state* state, struct process_array_join* aj, int type, uint64_t gpid, int data, struct wish_usage_packet* usage );
+
+// stop the first num_threads of a set of threads
+static void process_kill_threads( pthread_t* threads, int num_threads ) {
+   for( int i = 0; i < num_threads; i++ ) {
+      pthread_kill( threads[i], SIGKILL );
+   }
+   for( int i = 0; i < num_threads; i++ ) {
+      pthread_join( threads[i], NULL );
+   }
+}
+
 // initialize processes
 int process_init( struct wish_state* state ) {
    
-   pthread_rwlock_init( &procs_lock, NULL );
-   pthread_rwlock_init( &spawned_lock, NULL );
-   
-   int rc;
+   gpid_table_init( &procs, state, process_free );
+   gpid_table_init( &spawned, state, process_spawned_free );
+   pthread_rwlock_init( &stats_lock, NULL );
+   pthread_rwlock_init( &arrays_lock, NULL );
    
-   rc = pthread_create( &process_writeback_thread, NULL, process_writeback_func, state );
-   if( rc != 0 ) {
-      pthread_rwlock_destroy( &procs_lock );
-      pthread_rwlock_destroy( &spawned_lock );
+   process_urandom_fd = open( "/dev/urandom", O_RDONLY );
+   if( process_urandom_fd < 0 ) {
+      int rc = -errno;
+      errorf("process_init: could not open /dev/urandom, rc = %d\n", rc );
       return rc;
    }
    
-   rc = pthread_create( &process_spawned_eventloop_thread, NULL, process_spawned_eventloop_func, state );
-   if( rc != 0 ) {
-      pthread_kill( process_writeback_thread, SIGKILL );
-      pthread_rwlock_destroy( &procs_lock );
-      pthread_rwlock_destroy( &spawned_lock );
-      return rc;
+   // split output streaming across threads by gpid
+   wish_state_rlock( state );
+   num_output_loops = state->conf.output_loops;
+   wish_state_unlock( state );
+   
+   if( num_output_loops <= 0 )
+      num_output_loops = sysconf( _SC_NPROCESSORS_ONLN );
+   if( num_output_loops <= 0 )
+      num_output_loops = 1;
+   if( num_output_loops > PROCESS_MAX_OUTPUT_LOOPS )
+      num_output_loops = PROCESS_MAX_OUTPUT_LOOPS;
+   
+   output_loop_args = (struct process_loop_args*)calloc( sizeof(struct process_loop_args), num_output_loops );
+   process_writeback_threads = (pthread_t*)calloc( sizeof(pthread_t), num_output_loops );
+   process_spawned_eventloop_threads = (pthread_t*)calloc( sizeof(pthread_t), num_output_loops );
+   
+   int rc = 0;
+   
+   for( int i = 0; i < num_output_loops; i++ ) {
+      output_loop_args[i].state = state;
+      output_loop_args[i].part = i;
+   }
+   
+   for( int i = 0; i < num_output_loops; i++ ) {
+      rc = pthread_create( &process_writeback_threads[i], NULL, process_writeback_func, &output_loop_args[i] );
+      if( rc != 0 ) {
+         process_kill_threads( process_writeback_threads, i );
+         return rc;
+      }
+   }
+   
+   for( int i = 0; i < num_output_loops; i++ ) {
+      rc = pthread_create( &process_spawned_eventloop_threads[i], NULL, process_spawned_eventloop_func, &output_loop_args[i] );
+      if( rc != 0 ) {
+         process_kill_threads( process_writeback_threads, num_output_loops );
+         process_kill_threads( process_spawned_eventloop_threads, i );
+         return rc;
+      }
    }
    
    
    rc = pthread_create( &process_proc_eventloop_thread, NULL, process_proc_eventloop_func, state );
    if( rc != 0 ) {
-      pthread_kill( process_writeback_thread, SIGKILL );
-      pthread_kill( process_spawned_eventloop_thread, SIGKILL );
-      pthread_rwlock_destroy( &procs_lock );
-      pthread_rwlock_destroy( &spawned_lock );
+      process_kill_threads( process_writeback_threads, num_output_loops );
+      process_kill_threads( process_spawned_eventloop_threads, num_output_loops );
       return rc;
    }
    
+   dbprintf("process_init: %d output threads per side\n", num_output_loops );
    
    localhost_nids.push_back( wish_host_nid( "127.0.0.1" ) );
    localhost_nids.push_back( wish_host_nid( "127.0.1.1" ) );
@@ -81,71 +153,141 @@ int process_init( struct wish_state* state ) {
 // shut down processes
 int process_shutdown( struct wish_state* state ) {
    
-   pthread_kill( process_writeback_thread, SIGKILL );
-   pthread_kill( process_spawned_eventloop_thread, SIGKILL );
-   pthread_kill( process_proc_eventloop_thread, SIGKILL );
+   process_kill_threads( process_writeback_threads, num_output_loops );
+   process_kill_threads( process_spawned_eventloop_threads, num_output_loops );
+   process_kill_threads( &process_proc_eventloop_thread, 1 );
    
-   pthread_join( process_writeback_thread, NULL );
-   pthread_join( process_spawned_eventloop_thread, NULL );
-   pthread_join( process_proc_eventloop_thread, NULL );
+   gpid_table_shutdown( &procs );
+   gpid_table_shutdown( &spawned );
    
-   for( ProcessTable::iterator itr = procs.begin(); itr != procs.end(); itr++ ) {
-      wish_finish_process( state, &itr->second );
-   }
-   for( SpawnTable::iterator itr = spawned.begin(); itr != spawned.end(); itr++ ) {
-      wish_spawned_destroy( state, itr->second );
-      free( itr->second );
-      itr->second = NULL;
-   }
+   free( process_writeback_threads );
+   free( process_spawned_eventloop_threads );
+   free( output_loop_args );
+   
+   pthread_rwlock_destroy( &stats_lock );
+   
+   arrays.clear();
+   pthread_rwlock_destroy( &arrays_lock );
    
-   pthread_rwlock_destroy( &procs_lock );
-   pthread_rwlock_destroy( &spawned_lock );
+   close( process_urandom_fd );
+   process_urandom_fd = -1;
    
    return 0;
 }
 
-// read-lock the process table
-int procs_rlock(void) {
-   return pthread_rwlock_rdlock( &procs_lock );
+// look up a process we're executing, and take a reference to it
+static struct wish_process* procs_get( uint64_t gpid ) {
+   return (struct wish_process*)gpid_table_get( &procs, gpid );
+}
+
+// release a process we're executing
+static void procs_put( struct wish_process* proc ) {
+   gpid_table_put( &procs, &proc->ent );
+}
+
+// look up a process we've spawned, and take a reference to it
+static struct wish_spawn* spawned_get( uint64_t gpid ) {
+   return (struct wish_spawn*)gpid_table_get( &spawned, gpid );
+}
+
+// release a process we've spawned
+static void spawned_put( struct wish_spawn* spawn ) {
+   gpid_table_put( &spawned, &spawn->ent );
+}
+
+
+// microseconds from start to end
+static uint64_t process_usec_between( struct timeval* start, struct timeval* end ) {
+   return (end->tv_sec - start->tv_sec) * 1000000L + (end->tv_usec - start->tv_usec);
+}
+
+
+// add a latency sample, measured from start until now
+static void process_latency_add( struct process_latency* lat, struct timeval* start ) {
+   struct timeval now;
+   gettimeofday( &now, NULL );
+   
+   uint64_t usec = process_usec_between( start, &now );
+   
+   pthread_rwlock_wrlock( &stats_lock );
+   lat->samples[ lat->count % PROCESS_LATENCY_SAMPLES ] = usec;
+   lat->count++;
+   pthread_rwlock_unlock( &stats_lock );
 }
 
-// write-lock the process table
-int procs_wlock(void) {
-   return pthread_rwlock_wrlock( &procs_lock );
+
+// get the sample count, and the median and 99th percentile of the recent samples
+static void process_latency_get( struct process_latency* lat, uint64_t* count, uint64_t* p50, uint64_t* p99 ) {
+   pthread_rwlock_rdlock( &stats_lock );
+   *count = lat->count;
+   vector<uint64_t> samples( lat->samples, lat->samples + MIN( lat->count, (uint64_t)PROCESS_LATENCY_SAMPLES ) );
+   pthread_rwlock_unlock( &stats_lock );
+   
+   if( samples.size() == 0 ) {
+      *p50 = 0;
+      *p99 = 0;
+      return;
+   }
+   
+   sort( samples.begin(), samples.end() );
+   *p50 = samples[ (samples.size() - 1) / 2 ];
+   *p99 = samples[ ((samples.size() - 1) * 99) / 100 ];
 }
 
-// unlock the process table
-int procs_unlock(void) {
-   return pthread_rwlock_unlock( &procs_lock );
+
+// get launch latency statistics for a launch method
+int process_launch_stats( int method, uint64_t* count, uint64_t* p50, uint64_t* p99 ) {
+   if( method != PROCESS_LAUNCH_FORK && method != PROCESS_LAUNCH_ZYGOTE )
+      return -EINVAL;
+   
+   process_latency_get( &launch_latency[method], count, p50, p99 );
+   return 0;
 }
 
-// read-lock the process table
-int spawned_rlock(void) {
-   return pthread_rwlock_rdlock( &spawned_lock );
+
+// get time-to-first-output statistics for a stdin mode
+int process_first_output_stats( int stdin_mode, uint64_t* count, uint64_t* p50, uint64_t* p99 ) {
+   if( stdin_mode != PROCESS_STDIN_SPOOLED && stdin_mode != PROCESS_STDIN_STREAMED )
+      return -EINVAL;
+   
+   process_latency_get( &first_output_latency[stdin_mode], count, p50, p99 );
+   return 0;
 }
 
-// write-lock the process table
-int spawned_wlock(void) {
-   return pthread_rwlock_wrlock( &spawned_lock );
+
+// account for stdin being spooled to (or removed from) disk
+static void process_stdin_spool_add( int64_t bytes ) {
+   pthread_rwlock_wrlock( &stats_lock );
+   stdin_spool_bytes += bytes;
+   stdin_spool_peak = MAX( stdin_spool_peak, stdin_spool_bytes );
+   pthread_rwlock_unlock( &stats_lock );
 }
 
-// unlock the process table
-int spawned_unlock(void) {
-   return pthread_rwlock_unlock( &spawned_lock );
+
+// get stdin spooling statistics
+void process_stdin_spool_stats( uint64_t* current, uint64_t* peak ) {
+   pthread_rwlock_rdlock( &stats_lock );
+   *current = stdin_spool_bytes;
+   *peak = stdin_spool_peak;
+   pthread_rwlock_unlock( &stats_lock );
 }
 
 
 // make a process entry
-static int wish_process_init( struct wish_state* state, struct wish_process* proc, pid_t pid, uint64_t gpid, struct wish_connection* con, int stdout_fd, int stderr_fd, time_t timeout ) {
+static int wish_process_init( struct wish_state* state, struct wish_process* proc, pid_t pid, struct wish_job_packet* job, struct wish_connection* con, int stdout_fd, int stderr_fd ) {
+   uint64_t gpid = job->gpid;
+   
    proc->pid = pid;
    proc->gpid = gpid;
    proc->stdout_fd = stdout_fd;
    proc->stderr_fd = stderr_fd;
    proc->con = con;
    
-   if( timeout >= 0 ) {
-      proc->expire = time(NULL) + timeout;
-   }
+   // older origins never grant credit; don't wait on them for it
+   proc->credits = ((job->flags & JOB_CREDIT) ? PROCESS_OUTPUT_WINDOW : PROCESS_OUTPUT_UNMETERED);
+   
+   // armed once the process is in procs, if it has a timeout
+   timer_setup( &proc->expire_timer, process_expire, gpid );
    return 0;
 }
 
@@ -157,12 +299,20 @@ static int wish_spawned_init( struct wish_state* state, struct wish_spawn* spawn
    spawned->start_time = -1;
    spawned->status = PROCESS_STATUS_INIT;
    spawned->flags = job->flags;
+   spawned->owner = job->owner;
+   spawned->joins = new vector<struct process_joiner>();
+   pthread_mutex_init( &spawned->send_lock, NULL );
+   
+   // armed once the process starts, if it has a timeout
+   timer_setup( &spawned->timeout_timer, process_spawned_timeout, job->gpid );
    return 0;
 }
 
 
 // destroy a process entry
 static int wish_process_destroy( struct wish_state* state, struct wish_process* proc ) {
+   timer_cancel( &proc->expire_timer );
+   
    if( proc->con ) {
       wish_disconnect( state, proc->con );
       free( proc->con );
@@ -176,6 +326,8 @@ static int wish_process_destroy( struct wish_state* state, struct wish_process*
       free( proc->stdout_path );
    if( proc->stderr_path )
       free( proc->stderr_path );
+   if( proc->outbuf )
+      free( proc->outbuf );
    
    memset( proc, 0, sizeof(struct wish_process) );
    return 0;
@@ -185,39 +337,58 @@ static int wish_process_destroy( struct wish_state* state, struct wish_process*
 // destroy a spawned entry
 static int wish_spawned_destroy( struct wish_state* state, struct wish_spawn* spawned ) {
    dbprintf("wish_spawned_destroy: destroy %lu\n", spawned->gpid );
+   timer_cancel( &spawned->timeout_timer );
+   
    if( spawned->con ) {
       wish_disconnect( state, spawned->con );
       free( spawned->con );
       spawned->con = NULL;
    }
+   pthread_mutex_destroy( &spawned->send_lock );
    if( spawned->client ) {
       wish_disconnect( state, spawned->client );
       free( spawned->client );
       spawned->client = NULL;
    }
-   if( spawned->join ) {
-      wish_disconnect( state, spawned->join );
-      free( spawned->join );
+   if( spawned->joins ) {
+      for( vector<struct process_joiner>::size_type i = 0; i < spawned->joins->size(); i++ ) {
+         wish_disconnect( state, spawned->joins->at(i).con );
+         free( spawned->joins->at(i).con );
+      }
+      delete spawned->joins;
+      spawned->joins = NULL;
+   }
+   if( spawned->array_join ) {
+      // we'll never know how it ended
+      process_array_join_reply( state, spawned->array_join, PROCESS_TYPE_ERROR, spawned->gpid, -ECONNABORTED, NULL );
+      spawned->array_join = NULL;
    }
+   if( spawned->dag ) {
+      dag_node_ended( state, spawned->dag, spawned->dag_node, PROCESS_TYPE_ERROR, -ECONNABORTED, NULL );
+      spawned->dag = NULL;
+   }
+   process_spawned_release_slot( state, spawned );
+   process_spawned_close_log( state, spawned );
    if( spawned->stdout ) {
-      fclose( spawned->stdout );
+      sink_close( spawned->stdout );
       spawned->stdout = NULL;
    }
    if( spawned->stderr ) {
-      fclose( spawned->stderr );
+      sink_close( spawned->stderr );
       spawned->stderr = NULL;
    }
    return 0;
 }
 
-// read data into a string packet
-static int wish_process_read_output( struct wish_state* state, char which, int fd, struct wish_strings_packet* wssp ) {
+// read up to max bytes of data into a string packet.
+// return the number of bytes added on success, -ENODATA on EOF, or -errno on error
+static ssize_t wish_process_read_output( struct wish_state* state, char which, int fd, size_t max, struct wish_strings_packet* wssp ) {
    
    // get the pending data
    char buf[PROCESS_READ_SIZE+1];
    memset(buf, 0, PROCESS_READ_SIZE+1);
    
-   ssize_t count = read( fd, buf, PROCESS_READ_SIZE );
+   ssize_t count = read( fd, buf, MIN( max, PROCESS_READ_SIZE ) );
    if( count < 0 ) {
       return -errno;
    }
@@ -228,7 +399,9 @@ static int wish_process_read_output( struct wish_state* state, char which, int f
       dbprintf("wish_process_read_input: read %ld bytes\n", count);
       wish_add_string_packet( state, wssp, &pkt );
       wish_free_string_packet( &pkt );
-      return 0;
+      
+      // only what made it into the packet counts against the originator's credit
+      return strlen( buf );
    }
    else {
       return -ENODATA;
@@ -236,6 +409,98 @@ static int wish_process_read_output( struct wish_state* state, char which, int f
 }
 
 
+// append a packet to a process's outbound buffer.
+// it will be sent by the writeback thread as the connection permits.
+static int wish_process_queue_packet( struct wish_state* state, struct wish_process* proc, struct wish_packet* pkt ) {
+   uint8_t* buf = NULL;
+   size_t len = 0;
+   
+   int rc = wish_serialize_packet( pkt, &buf, &len );
+   if( rc != 0 )
+      return rc;
+   
+   if( proc->outbuf == NULL ) {
+      // nothing waiting; the packet is the buffer
+      proc->outbuf = buf;
+      proc->outbuf_len = len;
+      proc->outbuf_cap = len;
+      proc->outbuf_sent = 0;
+      return 0;
+   }
+   
+   if( proc->outbuf_len + len > proc->outbuf_cap ) {
+      // out of room.  Compact away what has already been sent, if that's most of it...
+      if( proc->outbuf_sent >= proc->outbuf_len / 2 ) {
+         memmove( proc->outbuf, proc->outbuf + proc->outbuf_sent, proc->outbuf_len - proc->outbuf_sent );
+         proc->outbuf_len -= proc->outbuf_sent;
+         proc->outbuf_sent = 0;
+      }
+      
+      // ...and grow if that wasn't enough
+      if( proc->outbuf_len + len > proc->outbuf_cap ) {
+         size_t cap = MAX( proc->outbuf_cap * 2, proc->outbuf_len + len );
+         uint8_t* outbuf = (uint8_t*)realloc( proc->outbuf, cap );
+         if( outbuf == NULL ) {
+            free( buf );
+            return -ENOMEM;
+         }
+         
+         proc->outbuf = outbuf;
+         proc->outbuf_cap = cap;
+      }
+   }
+   
+   memcpy( proc->outbuf + proc->outbuf_len, buf, len );
+   proc->outbuf_len += len;
+   
+   free( buf );
+   return 0;
+}
+
+
+// send as much of a process's outbound buffer as the connection will take without blocking.
+// return 0 if the buffer was drained, -EAGAIN if data remains, or -errno on error
+static int wish_process_flush( struct wish_state* state, struct wish_process* proc ) {
+   while( proc->outbuf_sent < proc->outbuf_len ) {
+      errno = 0;
+      ssize_t numw = send( proc->con->soc, proc->outbuf + proc->outbuf_sent, proc->outbuf_len - proc->outbuf_sent, MSG_DONTWAIT );
+      if( numw > 0 ) {
+         proc->outbuf_sent += numw;
+      }
+      else if( numw < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+         // originator is slow; try again later
+         return -EAGAIN;
+      }
+      else {
+         int errsv = -errno;
+         errorf("wish_process_flush: errno = %d when writing to %d\n", errsv, proc->con->soc );
+         return errsv != 0 ? errsv : -EPIPE;
+      }
+   }
+   
+   free( proc->outbuf );
+   proc->outbuf = NULL;
+   proc->outbuf_len = 0;
+   proc->outbuf_cap = 0;
+   proc->outbuf_sent = 0;
+   return 0;
+}
+
+
+// put a process packet into a process's outbound buffer
+static int wish_process_queue_reply( struct wish_state* state, struct wish_process* proc, int type, int data ) {
+   struct wish_process_packet ppkt;
+   struct wish_packet pkt;
+   
+   wish_init_process_packet( state, &ppkt, type, proc->gpid, 0, data );
+   wish_pack_process_packet( state, &pkt, &ppkt );
+   
+   int rc = wish_process_queue_packet( state, proc, &pkt );
+   wish_free_packet( &pkt );
+   return rc;
+}
+
+
 // kill a process
 static int wish_kill_process( struct wish_state* state, struct wish_process* proc ) {
    return kill( proc->pid, SIGKILL );
@@ -254,6 +519,50 @@ static int wish_finish_process( struct wish_state* state, struct wish_process**
    return 0;
 }
 
+
+// free a process table entry once nothing refers to it anymore
+static void process_free( struct wish_state* state, struct gpid_entry* ent ) {
+   struct wish_process* proc = (struct wish_process*)ent;
+   wish_finish_process( state, &proc );
+}
+
+
+// free a spawn table entry once nothing refers to it anymore
+static void process_spawned_free( struct wish_state* state, struct gpid_entry* ent ) {
+   struct wish_spawn* spawn = (struct wish_spawn*)ent;
+   wish_spawned_destroy( state, spawn );
+   free( spawn );
+}
+
+
+// a running process has timed out (called from the timer thread).
+// ask it to stop first, and kill it if it's still around after a grace period.
+// process_run will reap it, and the writeback thread will tell the originator once its output is sent.
+static void process_expire( struct wish_state* state, uint64_t gpid ) {
+   struct wish_process* proc = procs_get( gpid );
+   if( proc == NULL )
+      return;
+   
+   gpid_entry_lock( &proc->ent );
+   
+   if( !proc->ent.removed && !proc->finished ) {
+      if( !proc->timed_out ) {
+         errorf("process_expire: process %lu timed out\n", gpid );
+         kill( proc->pid, SIGTERM );
+         proc->timed_out = true;
+         
+         timer_arm( &proc->expire_timer, PROCESS_KILL_GRACE_MS );
+      }
+      else {
+         errorf("process_expire: process %lu ignored SIGTERM; killing it\n", gpid );
+         wish_kill_process( state, proc );
+      }
+   }
+   
+   gpid_entry_unlock( &proc->ent );
+   procs_put( proc );
+}
+
 // write back a process packet to a client
 int wish_process_reply( struct wish_state* state, struct wish_connection* con, int type, uint64_t gpid, int data ) {
    struct wish_process_packet ppkt;
@@ -274,13 +583,197 @@ int wish_process_reply( struct wish_state* state, struct wish_connection* con, i
 }
 
 
+// has a process ended, with all of its output read?
+// proc must be locked.
+static bool wish_process_drained( struct wish_process* proc ) {
+   if( !proc->finished )
+      return false;
+   
+   int fds[2] = { proc->stdout_fd, proc->stderr_fd };
+   for( int i = 0; i < 2; i++ ) {
+      if( fds[i] < 0 )
+         continue;
+      
+      struct stat sb;
+      if( fstat( fds[i], &sb ) != 0 || lseek( fds[i], 0, SEEK_CUR ) < sb.st_size )
+         return false;
+   }
+   return true;
+}
+
+
+// add the fds the writeback thread should wait on for a process.
+// proc must be locked.
+// return the largest fd added, or -1 if there were none
+static int wish_process_writeback_fds( struct wish_process* proc, fd_set* rfds, fd_set* wfds ) {
+   int max_fd = -1;
+   
+   if( proc->outbuf != NULL ) {
+      // waiting to send--wait for the originator to drain the connection
+      if( proc->con->soc >= 0 ) {
+         FD_SET( proc->con->soc, wfds );
+         max_fd = proc->con->soc;
+      }
+      return max_fd;
+   }
+   
+   if( proc->credits <= 0 && !wish_process_drained( proc ) ) {
+      // originator hasn't caught up yet; leave the output on disk.
+      // (the files are always readable, so waiting on them now would just spin)
+      return max_fd;
+   }
+   
+   if( proc->stdout_fd >= 0 ) 
+      FD_SET(proc->stdout_fd, rfds);
+   
+   if( proc->stderr_fd >= 0 )
+      FD_SET(proc->stderr_fd, rfds);
+   
+   return MAX(proc->stdout_fd, proc->stderr_fd);
+}
+
+
+// send back as much of a process's output (and then its exit status) as it has ready, without blocking.
+// proc must be locked.
+// return 0 if there is more to send later, 1 once the exit status has been sent, or negative on error
+static int wish_process_writeback( struct wish_state* state, struct wish_process* proc, fd_set* rfds, fd_set* wfds ) {
+   int rc = 0;
+   
+   // finish sending what we have, if we can
+   if( proc->outbuf != NULL ) {
+      if( proc->con->soc < 0 || !FD_ISSET( proc->con->soc, wfds ) )
+         return 0;
+      
+      rc = wish_process_flush( state, proc );
+      if( rc == -EAGAIN ) {
+         return 0;
+      }
+      else if( rc != 0 ) {
+         // something broke
+         errorf("process_writeback_func: send rc = %d\n", rc );
+         return rc;
+      }
+      
+      // was that the last packet?
+      return proc->exit_queued ? 1 : 0;
+   }
+   
+   // a finished process with nothing left to read can be wrapped up without credit
+   bool drained = (proc->credits <= 0 && wish_process_drained( proc ));
+   if( proc->credits <= 0 && !drained ) {
+      return 0;
+   }
+   
+   bool eof = true;
+   ssize_t num_read = 0;
+   
+   struct wish_strings_packet wssp;
+   wish_init_strings_packet( state, &wssp, 2 );
+   
+   if( proc->stdout_fd > 0 ) {
+      if( FD_ISSET( proc->stdout_fd, rfds ) && proc->credits > 0 ) {
+         ssize_t cnt = wish_process_read_output( state, STRING_STDOUT, proc->stdout_fd, proc->credits, &wssp );
+         if( cnt < 0 ) {
+            if( cnt != -ENODATA ) {
+               // not an EOF error
+               errorf("process_writeback_func: could not read from %s, rc = %ld\n", proc->stdout_path, cnt );
+            }
+         }
+         else {
+            num_read += cnt;
+            eof = false;
+         }
+      }
+      else if( !drained ) {
+         eof = false;
+      }
+   }
+   
+   if( proc->stderr_fd > 0 ) {
+      if( FD_ISSET( proc->stderr_fd, rfds ) && proc->credits - num_read > 0 ) {
+         ssize_t cnt = wish_process_read_output( state, STRING_STDERR, proc->stderr_fd, proc->credits - num_read, &wssp );
+         if( cnt < 0 ) {
+            if( cnt != -ENODATA ) {
+               // not an EOF error
+               errorf("process_writeback_func: could not read from %s, rc = %ld\n", proc->stderr_path, cnt );
+            }
+         }
+         else {
+            num_read += cnt;
+            eof = false;
+         }
+      }
+      else if( !drained ) {
+         eof = false;
+      }
+   }
+   
+   if( wssp.count > 0 ) {
+      if( !proc->have_output ) {
+         proc->have_output = true;
+         process_latency_add( &first_output_latency[ proc->stdin_mode ], &proc->job_start );
+      }
+      
+      // send off the data!
+      struct wish_packet pkt;
+      wish_pack_strings_packet( state, &pkt, &wssp );
+      
+      rc = wish_process_queue_packet( state, proc, &pkt );
+      wish_free_packet( &pkt );
+      
+      proc->credits -= num_read;
+   }
+   else if( eof && proc->finished ) {
+      // all output has been read, and the process is dead.  Tell the originator what it used, and how it ended.
+      if( proc->have_usage ) {
+         struct wish_packet pkt;
+         wish_pack_usage_packet( state, &pkt, &proc->usage );
+         
+         rc = wish_process_queue_packet( state, proc, &pkt );
+         wish_free_packet( &pkt );
+      }
+      
+      if( rc == 0 )
+         rc = wish_process_queue_reply( state, proc, proc->exit_type, proc->exit_data );
+      proc->exit_queued = true;
+   }
+   
+   wish_free_strings_packet( &wssp );
+   
+   if( rc == 0 && proc->outbuf != NULL ) {
+      rc = wish_process_flush( state, proc );
+      if( rc == -EAGAIN ) {
+         // will finish sending later
+         rc = 0;
+      }
+      else if( rc == 0 && proc->exit_queued ) {
+         // that was the last packet
+         return 1;
+      }
+   }
+   
+   if( rc != 0 ) {
+      // problem sending!
+      errorf("process_writeback_func: send rc = %d\n", rc );
+   }
+   
+   return rc;
+}
+
+
 // constantly write back stdout and stderr to an origin.
-// clear out any timed-out processes
+// Output is only read off of disk while the originator has granted us credit for it, and it
+// is only ever sent without blocking.  A slow originator therefore leaves its job's output
+// in the job's output files (instead of in RAM), and never holds up any other job.
+// The process table is only locked long enough to take references to its entries; each process is locked on its own while we work on it.
+// There is one of these threads per part of the process table, so busy jobs in one part don't hold up the others.
 void* process_writeback_func( void* arg ) {
    
-   struct wish_state* state = (struct wish_state*)arg;
+   struct process_loop_args* args = (struct process_loop_args*)arg;
+   struct wish_state* state = args->state;
    
    fd_set rfds;
+   fd_set wfds;
    struct timeval tv;
    
    while( 1 ) {
@@ -288,101 +781,41 @@ void* process_writeback_func( void* arg ) {
       tv.tv_usec = 1000;
    
       FD_ZERO( &rfds );
+      FD_ZERO( &wfds );
       int max_fd = -1;
       
-      vector<uint64_t> dead;
+      // our references keep every process's fds open until we're done with them
+      GpidEntryList ents;
+      gpid_table_snapshot_part( &procs, args->part, num_output_loops, &ents );
       
-      procs_wlock();
-      for( ProcessTable::iterator itr = procs.begin(); itr != procs.end(); itr++ ) {
-         if( itr->second == NULL ) {
-            dead.push_back( itr->first );
-            continue;
-         }
-         
-         if( itr->second->stdout_fd >= 0 ) 
-            FD_SET(itr->second->stdout_fd, &rfds);
-         
-         if( itr->second->stderr_fd >= 0 )
-            FD_SET(itr->second->stderr_fd, &rfds);
+      for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+         struct wish_process* proc = (struct wish_process*)ents[i];
          
-         max_fd = MAX( MAX(itr->second->stdout_fd, itr->second->stderr_fd), max_fd );
+         gpid_entry_lock( &proc->ent );
+         if( !proc->ent.removed ) {
+            max_fd = MAX( wish_process_writeback_fds( proc, &rfds, &wfds ), max_fd );
+         }
+         gpid_entry_unlock( &proc->ent );
       }
       
       if( max_fd > 0 ) {
          // do the select
-         // NOTE: some fds could disappear if we unlocked procs, so do that later
-         int fds_ready = select( max_fd + 1, &rfds, NULL, NULL, &tv );
+         int fds_ready = select( max_fd + 1, &rfds, &wfds, NULL, &tv );
          if( fds_ready > 0 ) {
-            // some fds are ready to be read from.
-            // build up a wish_strings_packet containing the information
             
-            for( ProcessTable::iterator itr = procs.begin(); itr != procs.end(); itr++ ) {
-               if( itr->second == NULL ) {
-                  continue;
-               }
-               
-               bool data = false;
-               
-               struct wish_strings_packet wssp;
-               wish_init_strings_packet( state, &wssp, fds_ready );
-               
-               if( itr->second->stdout_fd > 0 ) {
-                  if( FD_ISSET( itr->second->stdout_fd, &rfds ) ) {
-                     int rc = wish_process_read_output( state, STRING_STDOUT, itr->second->stdout_fd, &wssp );
-                     if( rc != 0 ) {
-                        if( rc != -ENODATA ) {
-                           // not an EOF error
-                           errorf("process_writeback_func: could not read from %s, rc = %d\n", itr->second->stdout_path, rc );
-                        }
-                     }
-                     else {
-                        data = true;
-                     }
-                  }
-               }
-               
-               if( itr->second->stderr_fd > 0 ) {
-                  if( FD_ISSET( itr->second->stderr_fd, &rfds ) ) {
-                     int rc = wish_process_read_output( state, STRING_STDERR, itr->second->stderr_fd, &wssp );
-                     if( rc != 0 ) {
-                        if( rc != -ENODATA ) {
-                           // not an EOF error
-                           errorf("process_writeback_func: could not read from %s, rc = %d\n", itr->second->stderr_path, rc );
-                        }
-                     }
-                     else {
-                        data = true;
-                     }
-                  }
-               }
-               if( !data ) {
-                  wish_free_strings_packet( &wssp );
-                  
-                  // nothing to read.  Is this process dead?
-                  if( itr->second->finished ) {
-                     wish_finish_process( state, &itr->second );
-                     dead.push_back( itr->first );
-                  }
-                  continue;
-               }
-               
-               // send off the data!
-               struct wish_packet pkt;
-               wish_pack_strings_packet( state, &pkt, &wssp );
+            for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+               struct wish_process* proc = (struct wish_process*)ents[i];
                
-               int rc = wish_write_packet( state, itr->second->con, &pkt );
-               wish_free_packet( &pkt );
-               wish_free_strings_packet( &wssp );
-               
-               if( rc != 0 ) {
-                  // problem sending!
-                  errorf("process_writeback_func: send rc = %d\n", rc );
-                  if( rc == -EBADF ) {
-                     // something broke
-                     wish_finish_process( state, &itr->second );
-                     dead.push_back( itr->first );
+               gpid_entry_lock( &proc->ent );
+               if( !proc->ent.removed ) {
+                  int rc = wish_process_writeback( state, proc, &rfds, &wfds );
+                  if( rc != 0 ) {
+                     // done with this process (or can't send to its originator anymore).
+                     // it gets cleaned up once process_run lets go of it.
+                     gpid_table_remove( &procs, &proc->ent );
                   }
                }
+               gpid_entry_unlock( &proc->ent );
             }
          }
          else if( fds_ready < 0 ) {
@@ -390,31 +823,28 @@ void* process_writeback_func( void* arg ) {
             errorf("process_writeback_func: select errno = %d\n", -errno);
             
             // find the offending process, and just erase it
-            for( ProcessTable::iterator itr = procs.begin(); itr != procs.end(); itr++ ) {
-               int rc = fcntl( itr->second->stdout_fd, F_GETFL );
+            for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+               struct wish_process* proc = (struct wish_process*)ents[i];
+               
+               gpid_entry_lock( &proc->ent );
+               int rc = fcntl( proc->stdout_fd, F_GETFL );
                if( rc == -1 && errno == -EBADF ) {
                   // it's bad
-                  wish_finish_process( state, &itr->second );
-                  dead.push_back( itr->first );
+                  gpid_table_remove( &procs, &proc->ent );
                }
                else {
-                  rc = fcntl( itr->second->stderr_fd, F_GETFL );
+                  rc = fcntl( proc->stderr_fd, F_GETFL );
                   if( rc == -1 && errno == -EBADF ) {
                      // it's bad
-                     wish_finish_process( state, &itr->second );
-                     dead.push_back( itr->first );
+                     gpid_table_remove( &procs, &proc->ent );
                   }
                }
+               gpid_entry_unlock( &proc->ent );
             }
          }
-         
-         // clear out erased entries
-         for(vector<uint64_t>::size_type i = 0; i < dead.size(); i++ ) {
-            procs.erase( dead[i] );
-         }
       }
       
-      procs_unlock();
+      gpid_table_put_all( &procs, &ents );
       usleep(10000);
    }
    
@@ -422,65 +852,226 @@ void* process_writeback_func( void* arg ) {
 }
 
 
-// eventloop--read and process packets from remotely-running processes
-void* process_spawned_eventloop_func( void* arg ) {
-   struct wish_state* state = (struct wish_state*)arg;
+// send a process packet to the daemon running a spawned process.
+// only the spawn's send lock is held while writing, so a slow executor doesn't hold up the others in its part of the spawn table.
+// the caller must hold a reference to spawn (which keeps spawn->con open), but not its entry lock.
+static int process_spawned_send( struct wish_state* state, struct wish_spawn* spawn, int type, int signal, int data ) {
+   struct wish_process_packet pkt;
+   wish_init_process_packet( state, &pkt, type, spawn->gpid, signal, data );
    
-   fd_set rfds;
-   struct timeval tv;
+   struct wish_packet wpkt;
+   wish_pack_process_packet( state, &wpkt, &pkt );
    
-   while( 1 ) {
-      tv.tv_sec = 0;
-      tv.tv_usec = 100;
+   pthread_mutex_lock( &spawn->send_lock );
+   int rc = wish_write_packet( state, spawn->con, &wpkt );
+   pthread_mutex_unlock( &spawn->send_lock );
    
-      FD_ZERO( &rfds );
-      int max_fd = -1;
-      
-      vector<uint64_t> dead;
-      
-      time_t current_time = time(NULL);
-      
-      // see if any of our spawned processes have input for us to process
-      spawned_wlock();
-      for( SpawnTable::iterator itr = spawned.begin(); itr != spawned.end(); itr++ ) {
-         if( itr->second == NULL ) {
-            dead.push_back( itr->first );
-            continue;
-         }
-         if( 0 < itr->second->timeout && itr->second->start_time + itr->second->timeout > current_time ) {
-            // process has timed out
-            wish_spawned_destroy( state, itr->second );
-            free( itr->second );
-            itr->second = NULL;
-            dead.push_back( itr->second->gpid );
-            continue;
-         }
-         
-         // otherwise, add to our fdset
-         if( itr->second->con->soc >= 0 ) {
-            FD_SET( itr->second->con->soc, &rfds );
-            max_fd = MAX( itr->second->con->soc, max_fd );
-         }
-      }
+   wish_free_packet( &wpkt );
+   return rc;
+}
+
+
+// have a spawned process's output files fallen too far behind?  spawn must be locked.
+static bool process_spawned_backlogged( struct wish_spawn* spawn ) {
+   return (spawn->stdout && sink_backlogged( spawn->stdout )) || (spawn->stderr && sink_backlogged( spawn->stderr ));
+}
+
+
+// has everything a spawned process wrote been written to its output files?  spawn must be locked.
+static bool process_spawned_written( struct wish_spawn* spawn ) {
+   return (spawn->stdout == NULL || sink_idle( spawn->stdout )) && (spawn->stderr == NULL || sink_idle( spawn->stderr ));
+}
+
+
+// once a spawned process's output files have caught up, give its executor the credit withheld from it,
+// and tell its joiners how it ended if it has
+static void process_spawned_catch_up( struct wish_state* state, struct wish_spawn* spawn ) {
+   uint32_t owed = 0;
+   
+   struct process_join_replies replies;
+   replies.ended = false;
+   
+   gpid_entry_lock( &spawn->ent );
+   
+   if( !spawn->ent.removed ) {
+      if( spawn->credit_owed > 0 && !process_spawned_backlogged( spawn ) ) {
+         owed = spawn->credit_owed;
+         spawn->credit_owed = 0;
+      }
+      
+      if( spawn->join_pending && process_spawned_written( spawn ) ) {
+         spawn->join_pending = false;
+         process_do_join( state, spawn, PROCESS_TYPE_EXIT, spawn->gpid, spawn->exit_code, &replies );
+         gpid_table_remove( &spawned, &spawn->ent );
+         owed = 0;
+      }
+   }
+   
+   gpid_entry_unlock( &spawn->ent );
+   
+   process_join_reply( state, &replies );
+   
+   if( owed > 0 ) {
+      int rc = process_spawned_send( state, spawn, PROCESS_TYPE_CREDIT, 0, owed );
+      if( rc != 0 ) {
+         errorf("process_spawned_catch_up: failed to grant %u bytes of credit to %lu, rc = %d\n", owed, spawn->gpid, rc );
+      }
+   }
+}
+
+
+// handle stdout/stderr data from a remotely-running process
+static int process_spawned_strings( struct wish_state* state, struct wish_spawn* spawn, struct wish_packet* pkt ) {
+   vector<struct wish_string_packet*> unwritten;
+   int rc = 0;
+   
+   // redirect the appropriate strings
+   struct wish_strings_packet wssp;
+   wish_unpack_strings_packet( state, pkt, &wssp );
+   
+   // how much output did we just consume?  We'll give it back to the executor as credit.
+   uint32_t consumed = 0;
+   for( int i = 0; i < wssp.count; i++ ) {
+      consumed += strlen( wssp.packets[i].str );
+   }
+   
+   // keep it for clients that attach later
+   for( int i = 0; i < wssp.count; i++ ) {
+      outlog_append( state, spawn->gpid, wssp.packets[i].which, wssp.packets[i].str );
+   }
+   
+   // the writers take the strings over, and write them out in the background
+   gpid_entry_lock( &spawn->ent );
+   for( int i = 0; i < wssp.count; i++ ) {
+      
+      if( wssp.packets[i].which == STRING_STDOUT && spawn->stdout != NULL ) {
+         sink_write( spawn->stdout, wssp.packets[i].str, strlen(wssp.packets[i].str) );
+         wssp.packets[i].str = NULL;
+      }
+      else if( wssp.packets[i].which == STRING_STDERR && spawn->stderr != NULL ) {
+         sink_write( spawn->stderr, wssp.packets[i].str, strlen(wssp.packets[i].str) );
+         wssp.packets[i].str = NULL;
+      }
+      else {
+         unwritten.push_back( &wssp.packets[i] );
+      }
+   }
+   
+   // if its files have fallen behind, the executor waits for them to catch up before sending more
+   if( process_spawned_backlogged( spawn ) ) {
+      spawn->credit_owed += consumed;
+      consumed = 0;
+   }
+   gpid_entry_unlock( &spawn->ent );
+   
+   struct wish_strings_packet to_client;
+   wish_init_strings_packet( state, &to_client, unwritten.size() );
+   for( unsigned int i = 0; i < unwritten.size(); i++ ) {
+      wish_add_string_packet( state, &to_client, unwritten[i] );
+   }
+   
+   struct wish_packet to_client_packet;
+   wish_pack_strings_packet( state, &to_client_packet, &to_client );
+   
+   // forward to the client.
+   // the other output threads might be forwarding to the same clients, so only one of us writes to them at a time.
+   // that takes the client connections' own lock, not the state lock, so nobody else waits on a slow client.
+   pthread_mutex_lock( &state->client_cons_lock );
+   vector<struct wish_connection*>* client_cons = state->client_cons;
+   
+   if( client_cons->size() > 0 ) {
+      for( uint64_t i = 0; i < client_cons->size(); i++ ) {
+         if( client_cons->at(i) == NULL )
+            continue;
+         
+         rc = wish_write_packet( state, client_cons->at(i), &to_client_packet );
+         if( rc != 0 ) {
+            errorf("process_spawned_eventloop_func: wish_write_packet to client on %d rc = %d\n", client_cons->at(i)->soc, rc );
+            wish_disconnect( state, client_cons->at(i) );
+            free( client_cons->at(i) );
+            (*client_cons)[i] = NULL;
+         }
+      }
+   }
+   pthread_mutex_unlock( &state->client_cons_lock );
+   
+   wish_free_strings_packet( &wssp );
+   wish_free_strings_packet( &to_client );
+   wish_free_packet( &to_client_packet );
+   
+   // let the executor send more
+   if( consumed > 0 ) {
+      gpid_entry_lock( &spawn->ent );
+      bool removed = spawn->ent.removed;
+      gpid_entry_unlock( &spawn->ent );
+      
+      if( !removed ) {
+         rc = process_spawned_send( state, spawn, PROCESS_TYPE_CREDIT, 0, consumed );
+         if( rc != 0 ) {
+            errorf("process_spawned_eventloop_func: failed to grant %u bytes of credit to %lu, rc = %d\n", consumed, spawn->ent.gpid, rc );
+         }
+      }
+   }
+   
+   return rc;
+}
+
+
+// eventloop--read and process packets from remotely-running processes.
+// the spawn table is only locked long enough to take references to its entries, so joins, signals,
+// and new spawns don't wait on us; each spawned process is locked on its own while we read from it.
+// There is one of these threads per part of the spawn table.
+void* process_spawned_eventloop_func( void* arg ) {
+   struct process_loop_args* args = (struct process_loop_args*)arg;
+   struct wish_state* state = args->state;
+   
+   fd_set rfds;
+   struct timeval tv;
+   
+   while( 1 ) {
+      tv.tv_sec = 0;
+      tv.tv_usec = 100;
+   
+      FD_ZERO( &rfds );
+      int max_fd = -1;
+      
+      // see if any of our spawned processes have input for us to process.
+      // (timeouts are handled by process_spawned_timeout)
+      GpidEntryList ents;
+      gpid_table_snapshot_part( &spawned, args->part, num_output_loops, &ents );
+      
+      for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+         struct wish_spawn* spawn = (struct wish_spawn*)ents[i];
+         
+         // add to our fdset
+         gpid_entry_lock( &spawn->ent );
+         if( !spawn->ent.removed && spawn->con->soc >= 0 ) {
+            FD_SET( spawn->con->soc, &rfds );
+            max_fd = MAX( spawn->con->soc, max_fd );
+         }
+         gpid_entry_unlock( &spawn->ent );
+      }
       
       if( max_fd > 0 ) {
          
          int fds_ready = select( max_fd + 1, &rfds, NULL, NULL, &tv );
          if( fds_ready > 0 ) {
             // we have work to do!
-            for( SpawnTable::iterator itr = spawned.begin(); itr != spawned.end(); itr++ ) {
-               if( itr->second == NULL ) {
-                  continue;
-               }
-               if( itr->second->con->soc < 0 )
-                  continue;
-               if( !FD_ISSET( itr->second->con->soc, &rfds ) )
-                  continue;
+            for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+               struct wish_spawn* spawn = (struct wish_spawn*)ents[i];
                
                struct wish_packet pkt;
                pkt.hdr.type = -1;
                
-               int rc = wish_read_packet_noblock( state, itr->second->con, &pkt );
+               gpid_entry_lock( &spawn->ent );
+               if( spawn->ent.removed || spawn->con->soc < 0 || !FD_ISSET( spawn->con->soc, &rfds ) ) {
+                  gpid_entry_unlock( &spawn->ent );
+                  continue;
+               }
+               
+               int rc = wish_read_packet_noblock( state, spawn->con, &pkt );
+               gpid_entry_unlock( &spawn->ent );
+               
                if( rc != 0 ) {
                   if( rc != -EAGAIN && rc != -EHOSTDOWN ) {
                      errorf("process_spawned_eventloop_func: wish_read_packet rc = %d\n", rc );
@@ -492,72 +1083,30 @@ void* process_spawned_eventloop_func( void* arg ) {
                      struct wish_process_packet wpp;
                      wish_unpack_process_packet( state, &pkt, &wpp );
                      rc = process_update( state, &wpp );
-                     if( rc != 0 ) {
-                        if( rc == PROCESS_UPDATE_DESTROYED ) {
-                           // the process died
-                           dead.push_back( itr->first );
-                        }
-                        else {
-                           errorf("process_spawned_eventloop_func: process_update rc = %d\n", rc );
-                        }
+                     if( rc != 0 && rc != PROCESS_UPDATE_DESTROYED ) {
+                        errorf("process_spawned_eventloop_func: process_update rc = %d\n", rc );
                      }
                   }
-                  else if( pkt.hdr.type == PACKET_TYPE_STRINGS ) {
-                     // stdout/stderr data
-                     
-                     vector<struct wish_string_packet*> unwritten;
-                     
-                     // redirect the appropriate strings
-                     struct wish_strings_packet wssp;
-                     wish_unpack_strings_packet( state, &pkt, &wssp );
-                     
-                     for( int i = 0; i < wssp.count; i++ ) {
-                        
-                        if( wssp.packets[i].which == STRING_STDOUT && itr->second->stdout != NULL ) {
-                           fwrite( wssp.packets[i].str, 1, strlen(wssp.packets[i].str), itr->second->stdout );
-                           wish_free_string_packet( &wssp.packets[i] );
-                        }
-                        else if( wssp.packets[i].which == STRING_STDERR && itr->second->stderr != NULL ) {
-                           fwrite( wssp.packets[i].str, 1, strlen(wssp.packets[i].str), itr->second->stderr );
-                           wish_free_string_packet( &wssp.packets[i] );
-                        }
-                        else {
-                           unwritten.push_back( &wssp.packets[i] );
-                        }
-                     }
+                  else if( pkt.hdr.type == PACKET_TYPE_USAGE ) {
+                     // resource usage of a finished process.  Its exit packet comes next.
+                     struct wish_usage_packet usage;
+                     wish_unpack_usage_packet( state, &pkt, &usage );
                      
-                     struct wish_strings_packet to_client;
-                     wish_init_strings_packet( state, &to_client, unwritten.size() );
-                     for( unsigned int i = 0; i < unwritten.size(); i++ ) {
-                        wish_add_string_packet( state, &to_client, unwritten[i] );
-                     }
-                     
-                     struct wish_packet to_client_packet;
-                     wish_pack_strings_packet( state, &to_client_packet, &to_client );
+                     gpid_entry_lock( &spawn->ent );
                      
-                     // forward to the client
-                     rc = 0;
+                     usage.gpid = spawn->ent.gpid;
+                     usage.owner = spawn->owner;
                      
-                     wish_state_rlock( state );
-                     vector<struct wish_connection*>* client_cons = state->client_cons;
-                     
-                     if( client_cons->size() > 0 ) {
-                        for( uint64_t i = 0; i < client_cons->size(); i++ ) {
-                           rc = wish_write_packet( state, client_cons->at(i), &to_client_packet );
-                           if( rc != 0 ) {
-                              errorf("process_spawned_eventloop_func: wish_write_packet to client on %d rc = %d\n", client_cons->at(i)->soc, rc );
-                              wish_disconnect( state, client_cons->at(i) );
-                              free( client_cons->at(i) );
-                              (*client_cons)[i] = NULL;
-                           }
-                        }
-                     }
-                     wish_state_unlock( state );
+                     spawn->usage = usage;
+                     spawn->have_usage = true;
                      
-                     wish_free_strings_packet( &wssp );
-                     wish_free_strings_packet( &to_client );
-                     wish_free_packet( &to_client_packet );
+                     gpid_entry_unlock( &spawn->ent );
                      
+                     usage_account( &usage );
+                  }
+                  else if( pkt.hdr.type == PACKET_TYPE_STRINGS ) {
+                     // stdout/stderr data
+                     process_spawned_strings( state, spawn, &pkt );
                   }
                   
                   else {
@@ -565,7 +1114,10 @@ void* process_spawned_eventloop_func( void* arg ) {
                      errorf("process_spawned_eventloop_func: unknown packet type %d\n", pkt.hdr.type );
                      
                      // drain the socket--probably have some garbage in it
-                     wish_clear_connection( state, itr->second->con );
+                     gpid_entry_lock( &spawn->ent );
+                     if( !spawn->ent.removed )
+                        wish_clear_connection( state, spawn->con );
+                     gpid_entry_unlock( &spawn->ent );
                   }
                   
                   wish_free_packet( &pkt );
@@ -576,37 +1128,37 @@ void* process_spawned_eventloop_func( void* arg ) {
             errorf("process_spawned_eventloop_func: select errno = %d\n", -errno );
             
             // find the offending socket
-            for( SpawnTable::iterator itr = spawned.begin(); itr != spawned.end(); itr++ ) {
-               if( itr->second->con->soc < 0 ) {
+            for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+               struct wish_spawn* spawn = (struct wish_spawn*)ents[i];
+               
+               gpid_entry_lock( &spawn->ent );
+               if( spawn->con->soc < 0 ) {
                   // connection dead
-                  errorf("process_spanwed_eventloop_func: lost connection to %lu\n", itr->second->gpid );
-                  wish_spawned_destroy( state, itr->second );
-                  free( itr->second );
-                  dead.push_back( itr->first );
-                  continue;
+                  errorf("process_spanwed_eventloop_func: lost connection to %lu\n", spawn->gpid );
+                  gpid_table_remove( &spawned, &spawn->ent );
                }
-               
-               // see if we can do a socket op on it....
-               struct timeval tv;
-               socklen_t sz = sizeof(tv);
-               int rc = getsockopt( itr->second->con->soc, SOL_SOCKET, SO_RCVTIMEO, &tv, &sz );
-               if( rc == -1 && errno == -EBADF ) {
-                  // it's bad
-                  errorf("process_spanwed_eventloop_func: lost connection to %lu\n", itr->second->gpid );
-                  wish_spawned_destroy( state, itr->second );
-                  free( itr->second );
-                  dead.push_back( itr->first );
+               else {
+                  // see if we can do a socket op on it....
+                  struct timeval tv;
+                  socklen_t sz = sizeof(tv);
+                  int rc = getsockopt( spawn->con->soc, SOL_SOCKET, SO_RCVTIMEO, &tv, &sz );
+                  if( rc == -1 && errno == -EBADF ) {
+                     // it's bad
+                     errorf("process_spanwed_eventloop_func: lost connection to %lu\n", spawn->gpid );
+                     gpid_table_remove( &spawned, &spawn->ent );
+                  }
                }
+               gpid_entry_unlock( &spawn->ent );
             }
             errno = 0;
          }
-         
-         // clear out dead processes
-         for( vector<uint64_t>::size_type i = 0; i < dead.size(); i++ ) {
-            spawned.erase( dead[i] );
-         }
       }
-      spawned_unlock();
+      
+      for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+         process_spawned_catch_up( state, (struct wish_spawn*)ents[i] );
+      }
+      
+      gpid_table_put_all( &spawned, &ents );
       usleep( 10000 );
    }
    
@@ -614,7 +1166,8 @@ void* process_spawned_eventloop_func( void* arg ) {
 }
 
 
-// eventloop--read and process packets from locally-running processes
+// eventloop--read and process packets from locally-running processes.
+// like the writeback thread, this only holds the process table's locks long enough to take references to its entries.
 void* process_proc_eventloop_func( void* arg ) {
    struct wish_state* state = (struct wish_state*)arg;
    
@@ -628,64 +1181,50 @@ void* process_proc_eventloop_func( void* arg ) {
       FD_ZERO( &rfds );
       int max_fd = -1;
       
-      vector<uint64_t> dead;
+      // see if any of our running processes have input for us to process.
+      // (timeouts are handled by process_expire)
+      GpidEntryList ents;
+      gpid_table_snapshot( &procs, &ents );
       
-      time_t current_time = time(NULL);
-      
-      // see if any of our running processes have input for us to process
-      procs_wlock();
-      for( ProcessTable::iterator itr = procs.begin(); itr != procs.end(); itr++ ) {
-         if( itr->second == NULL ) {
-            dead.push_back( itr->first );
-            continue;
-         }
-         
-         if( 0 < itr->second->expire && itr->second->expire < current_time ) {
-            
-            // kill this process--it's timed out
-            errorf("process_proc_eventloop_func: process %lu timed out\n", itr->second->gpid );
-            wish_kill_process( state, itr->second );
-            wish_process_reply( state, itr->second->con, PROCESS_TYPE_TIMEOUT, itr->second->gpid, 0 );
-            wish_finish_process( state, &itr->second );
-            dead.push_back( itr->first );
-            continue;
-         }
+      for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+         struct wish_process* proc = (struct wish_process*)ents[i];
          
-         // otherwise, add to our fdset
-         if( itr->second->con->soc >= 0 ) {
-            FD_SET( itr->second->con->soc, &rfds );
-            max_fd = MAX( itr->second->con->soc, max_fd );
+         // add to our fdset
+         gpid_entry_lock( &proc->ent );
+         if( !proc->ent.removed && proc->con->soc >= 0 ) {
+            FD_SET( proc->con->soc, &rfds );
+            max_fd = MAX( proc->con->soc, max_fd );
          }
+         gpid_entry_unlock( &proc->ent );
       }
       
       if( max_fd > 0 ) {
          int fds_ready = select( max_fd + 1, &rfds, NULL, NULL, &tv );
          if( fds_ready > 0 ) {
             // we have work to do!
-            for( ProcessTable::iterator itr = procs.begin(); itr != procs.end(); itr++ ) {
-               if( itr->second == NULL ) {
-                  continue;
-               }
-               if( itr->second->con->soc < 0 )
-                  continue;
-               
-               if( !FD_ISSET( itr->second->con->soc, &rfds ) )
-                  continue;
+            for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+               struct wish_process* proc = (struct wish_process*)ents[i];
                
                struct wish_packet pkt;
                pkt.hdr.type = -1;
                
+               gpid_entry_lock( &proc->ent );
+               if( proc->ent.removed || proc->con->soc < 0 || !FD_ISSET( proc->con->soc, &rfds ) ) {
+                  gpid_entry_unlock( &proc->ent );
+                  continue;
+               }
+               
                // NOTE: no need for non-blocking I/O--processes are children of us
-               int rc = wish_read_packet_noblock( state, itr->second->con, &pkt );
+               int rc = wish_read_packet_noblock( state, proc->con, &pkt );
                
-               if( rc != 0 ) {
-                  if( rc != -EAGAIN ) {
-                     errorf("process_proc_eventloop_func: wish_read_packet rc = %d\n", rc );
-                     wish_disconnect( state, itr->second->con );
-                     dead.push_back( itr->first );
-                  }
+               if( rc != 0 && rc != -EAGAIN ) {
+                  // lost the originator.  The connection gets closed once nothing else is using it.
+                  errorf("process_proc_eventloop_func: wish_read_packet rc = %d\n", rc );
+                  gpid_table_remove( &procs, &proc->ent );
                }
-               else {
+               gpid_entry_unlock( &proc->ent );
+               
+               if( rc == 0 ) {
                   if( pkt.hdr.type == PACKET_TYPE_PROCESS ) {
                      // process control packet
                      struct wish_process_packet wpp;
@@ -709,6 +1248,14 @@ void* process_proc_eventloop_func( void* arg ) {
                            }
                            break;
                         }
+                        case PROCESS_TYPE_CREDIT: {
+                           // originator consumed some output
+                           rc = process_recv_credit( state, wpp.gpid, wpp.data );
+                           if( rc != 0 ) {
+                              errorf("process_proc_eventloop_func: failed to credit %lu\n", wpp.gpid );
+                           }
+                           break;
+                        }
                         default: {
                            // unknown
                            errorf("process_proc_eventloop_func: unknown process packet %d\n", wpp.type );
@@ -720,7 +1267,10 @@ void* process_proc_eventloop_func( void* arg ) {
                      errorf("process_proc_eventloop_func: unknown packet type %d\n", pkt.hdr.type );
                      
                      // drain the socket--probably have some garbage in it
-                     wish_clear_connection( state, itr->second->con );
+                     gpid_entry_lock( &proc->ent );
+                     if( !proc->ent.removed )
+                        wish_clear_connection( state, proc->con );
+                     gpid_entry_unlock( &proc->ent );
                   }
                   
                   wish_free_packet( &pkt );
@@ -732,24 +1282,24 @@ void* process_proc_eventloop_func( void* arg ) {
                errorf("process_proc_eventloop_func: select errno = %d\n", -errno );
             
             // find the offending socket
-            for( ProcessTable::iterator itr = procs.begin(); itr != procs.end(); itr++ ) {
+            for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+               struct wish_process* proc = (struct wish_process*)ents[i];
+               
+               gpid_entry_lock( &proc->ent );
                struct timeval tv;
                socklen_t sz = sizeof(tv);
-               int rc = getsockopt( itr->second->con->soc, SOL_SOCKET, SO_RCVTIMEO, &tv, &sz );
+               int rc = getsockopt( proc->con->soc, SOL_SOCKET, SO_RCVTIMEO, &tv, &sz );
                if( rc == -1 && errno == -EBADF ) {
-                  // it's bad--disconnect
-                  wish_disconnect( state, itr->second->con );
+                  // it's bad--stop using it
+                  gpid_table_remove( &procs, &proc->ent );
                }
+               gpid_entry_unlock( &proc->ent );
             }
             errno = 0;
          }
-         
-         // clear out dead processes
-         for( vector<uint64_t>::size_type i = 0; i < dead.size(); i++ ) {
-            procs.erase( dead[i] );
-         }
       }
-      procs_unlock();
+      
+      gpid_table_put_all( &procs, &ents );
       usleep( 10000 );
    }
    
@@ -780,6 +1330,90 @@ static ssize_t read_bytes( int fd, void* dest, size_t count ) {
 
 
 
+// close every file descriptor we inherited across a fork, except for stdin, stdout, stderr, and the ones in keep.
+// the daemon is multithreaded, so a forked child can hold copies of descriptors that belong to other jobs
+// (such as the write end of another job's stdin pipe, which would keep that job from ever seeing EOF).
+static void process_close_inherited_fds( int* keep, int num_keep ) {
+   // this runs between fork() and exec() in a multithreaded process, so it may only make system calls:
+   // no malloc, and no opendir().  Sort what we keep (insertion sort on the stack), and close the gaps between them.
+   int sorted[PROCESS_MAX_KEEP_FDS];
+   int num_sorted = 0;
+   for( int i = 0; i < num_keep && num_sorted < PROCESS_MAX_KEEP_FDS; i++ ) {
+      if( keep[i] <= STDERR_FILENO )
+         continue;
+      
+      int j = num_sorted;
+      while( j > 0 && sorted[j-1] > keep[i] ) {
+         sorted[j] = sorted[j-1];
+         j--;
+      }
+      sorted[j] = keep[i];
+      num_sorted++;
+   }
+   
+#ifdef SYS_close_range
+   unsigned int lo = STDERR_FILENO + 1;
+   bool closed = true;
+   for( int i = 0; i <= num_sorted && closed; i++ ) {
+      unsigned int hi = (i < num_sorted ? (unsigned int)sorted[i] : ~0U);
+      if( lo < hi ) {
+         closed = (syscall( SYS_close_range, lo, hi - 1, 0 ) == 0);
+      }
+      if( i < num_sorted )
+         lo = sorted[i] + 1;
+   }
+   
+   if( closed )
+      return;
+#endif
+   
+   // no close_range(2) (kernels before 5.9).  Read /proc/self/fd with raw getdents64 into a buffer on the stack.
+   int dir_fd = open( "/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+   if( dir_fd >= 0 ) {
+      char buf[4096];
+      long nread = 0;
+      while( (nread = syscall( SYS_getdents64, dir_fd, buf, sizeof(buf) )) > 0 ) {
+         for( long off = 0; off < nread; ) {
+            struct process_dirent64* dent = (struct process_dirent64*)(buf + off);
+            off += dent->d_reclen;
+            
+            if( dent->d_name[0] < '0' || dent->d_name[0] > '9' )
+               continue;
+            
+            // atoi isn't on the async-signal-safe list either
+            int fd = 0;
+            for( char* c = dent->d_name; *c >= '0' && *c <= '9'; c++ ) {
+               fd = fd * 10 + (*c - '0');
+            }
+            
+            bool keep_fd = (fd <= STDERR_FILENO || fd == dir_fd);
+            for( int j = 0; j < num_sorted && !keep_fd; j++ ) {
+               keep_fd = (sorted[j] == fd);
+            }
+            
+            if( !keep_fd )
+               close( fd );
+         }
+      }
+      close( dir_fd );
+   }
+   else {
+      // no /proc either; try them all
+      struct rlimit rl;
+      int max_fd = (getrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur != RLIM_INFINITY ? (int)rl.rlim_cur : 65536);
+      for( int fd = STDERR_FILENO + 1; fd < max_fd; fd++ ) {
+         bool keep_fd = false;
+         for( int j = 0; j < num_sorted && !keep_fd; j++ ) {
+            keep_fd = (sorted[j] == fd);
+         }
+         
+         if( !keep_fd )
+            close( fd );
+      }
+   }
+}
+
+
 // run a shell command, and write the stdout and stderr to disk for recovery.
 static int process_run( struct wish_state* state,
                         struct wish_connection* con,
@@ -789,7 +1423,8 @@ static int process_run( struct wish_state* state,
                         int child_stdout,
                         int child_stderr,
                         char* stdout_path,
-                        char* stderr_path) {
+                        char* stderr_path,
+                        struct pin_set* pin ) {
    
    int rc = 0;
    
@@ -810,8 +1445,38 @@ static int process_run( struct wish_state* state,
    int wrapper_fds[2];
    pipe( wrapper_fds );
    
-   // need to fork a wrapper process first to safely close stdin, stdout, stderr.
-   pid_t pid1 = fork();
+   struct timeval launch_start;
+   gettimeofday( &launch_start, NULL );
+   
+   // account for the job in a cgroup of its own, if we can
+   char* cgroup_procs = usage_cgroup_create( job->gpid );
+   
+   // keep a pinned job to its cores in its cgroup too, so nothing it starts can wander off them
+   if( cgroup_procs && pin && pin->cpus )
+      usage_cgroup_cpuset( job->gpid, pin->cpus, pin->mems );
+   
+   // try to have a zygote worker act as the wrapper, so we don't have to fork the daemon
+   bool zygote_launched = false;
+   if( zygote_running() ) {
+      rc = zygote_launch( state, job, cgroup_procs, (pin ? &pin->mask : NULL), child_stdin, child_stdout, child_stderr, wrapper_fds[1] );
+      if( rc == 0 ) {
+         zygote_launched = true;
+         
+         // only the worker may hold the write end, so we see EOF if it dies
+         close( wrapper_fds[1] );
+         wrapper_fds[1] = -1;
+      }
+      else {
+         errorf("process_run: zygote_launch rc = %d, forking %lu instead\n", rc, job->gpid );
+         rc = 0;
+      }
+   }
+   
+   // otherwise, need to fork a wrapper process first to safely close stdin, stdout, stderr.
+   pid_t pid1 = -1;
+   if( !zygote_launched )
+      pid1 = fork();
+   
    if( pid1 == 0 ) {
       // wrapper process (shell process parent)
       // save old stdin, stdout, stderr
@@ -830,6 +1495,10 @@ static int process_run( struct wish_state* state,
       dup2( child_stdout, STDOUT_FILENO );
       dup2( child_stderr, STDERR_FILENO );
       
+      // drop everything else we got from the daemon
+      int keep_fds[] = { old_stdin, old_stdout, old_stderr, wrapper_fds[1] };
+      process_close_inherited_fds( keep_fds, 4 );
+      
       // fork again to run the shell command
       pid_t shell_pid = fork();
       if( shell_pid == 0 ) {
@@ -837,7 +1506,7 @@ static int process_run( struct wish_state* state,
          // extract hostname and portnum from the origin daemon
          char hostname[HOST_NAME_MAX+1];
          char portnum_txt[10];
-         char gpid_txt[20];
+         char gpid_txt[21];
          char portnum_buf[10];
          
          int rc = getnameinfo( (struct sockaddr*)&job->visited[0], sizeof(struct sockaddr_storage), hostname, HOST_NAME_MAX, portnum_txt, 10, NI_NUMERICSERV );
@@ -854,6 +1523,12 @@ static int process_run( struct wish_state* state,
          setenv( WISH_GPID_ENV, gpid_txt, 1 );
          setenv( WISH_HTTP_PORTNUM_ENV, portnum_buf, 1 );
          
+         if( cgroup_procs )
+            usage_cgroup_join( cgroup_procs );
+         
+         if( pin )
+            sched_setaffinity( 0, sizeof(cpu_set_t), &pin->mask );
+         
          // run the shell command.
          execv( shell_argv[0], shell_argv );
       }
@@ -871,17 +1546,20 @@ static int process_run( struct wish_state* state,
          // write back the shell process's pid
          write( wrapper_fds[1], &shell_pid, sizeof(shell_pid) );
          
-         // join with shell process to get its exit and signal
+         // join with shell process to get its exit, signal, and resource usage
          int shell_rc = 0;
+         struct rusage ru;
+         memset( &ru, 0, sizeof(ru) );
          errno = 0;
-         rc = waitpid( shell_pid, &shell_rc, 0 );
+         rc = wait4( shell_pid, &shell_rc, 0, &ru );
          
-         // send back the shell rc
+         // send back the shell rc and usage
          if( rc > 0 ) {
             write( wrapper_fds[1], &shell_rc, sizeof(shell_rc) );
+            write( wrapper_fds[1], &ru, sizeof(ru) );
          }
          else {
-            errorf("wrapper: failed to waitpid; errno = %d\n", -errno);
+            errorf("wrapper: failed to wait4; errno = %d\n", -errno);
             rc = -errno;
          }
             
@@ -891,7 +1569,7 @@ static int process_run( struct wish_state* state,
          exit(-errno);
       }
    }
-   else if( pid1 > 0 ) {
+   else if( zygote_launched || pid1 > 0 ) {
       // daemon
       
       // read the shell process id
@@ -900,19 +1578,21 @@ static int process_run( struct wish_state* state,
       if( rc == sizeof(shell_pid) ) {
          dbprintf("process_run: PID = %d\n", shell_pid);
          
+         struct timeval launched;
+         gettimeofday( &launched, NULL );
+         
+         process_latency_add( &launch_latency[ zygote_launched ? PROCESS_LAUNCH_ZYGOTE : PROCESS_LAUNCH_FORK ], &launch_start );
+         
          // record this process's information
          int proc_stdout = open( stdout_path, O_RDONLY );
          int proc_stderr = open( stderr_path, O_RDONLY );
-         wish_process_init( state, proc, shell_pid, job->gpid, con, proc_stdout, proc_stderr, job->timeout );
+         wish_process_init( state, proc, shell_pid, job, con, proc_stdout, proc_stderr );
          
          proc->stdout_path = stdout_path;
          proc->stderr_path = stderr_path;
          
-         procs_wlock();
-         procs[ proc->gpid ] = proc;
-         procs_unlock();
-         
-         // tell the remote caller that this process started
+         // tell the remote caller that this process started.
+         // do so before the writeback thread can see the process, since from then on it owns the connection.
          rc = wish_process_reply( state, con, PROCESS_TYPE_STARTED, job->gpid, 0 );
          
          if( rc != 0 ) {
@@ -920,41 +1600,99 @@ static int process_run( struct wish_state* state,
             errorf("process_run: wish_write_packet (started) rc = %d\n", rc );
          }
          
+         // the table and we each hold a reference; ours keeps proc around until we've recorded how it ended
+         int insert_rc = gpid_table_insert( &procs, &proc->ent, proc->gpid );
+         if( insert_rc != 0 ) {
+            errorf("process_run: gpid_table_insert(%lu) rc = %d\n", proc->gpid, insert_rc );
+         }
+         else if( job->timeout > 0 ) {
+            gpid_entry_lock( &proc->ent );
+            timer_arm( &proc->expire_timer, (uint64_t)job->timeout * 1000 );
+            gpid_entry_unlock( &proc->ent );
+         }
+         
          // get the wrapper's rc and shell rc information
          int wrapper_rc = 0;
          int shell_rc = 0;
+         int exit_type = PROCESS_TYPE_ERROR;
          
-         rc = waitpid( pid1, &wrapper_rc, 0 );
-         if( rc > 0 && wrapper_rc > 0 ) {
+         if( zygote_launched ) {
+            // the zygote worker is the wrapper, but it isn't our child.
+            // it closes the pipe without writing a status if it fails.
+            rc = read_bytes( wrapper_fds[0], &shell_rc, sizeof(shell_rc) );
+            if( rc == sizeof(shell_rc) ) {
+               dbprintf("process_run: exit code %d for %lu\n", WEXITSTATUS(shell_rc), job->gpid );
+               exit_type = PROCESS_TYPE_EXIT;
+            }
+            else {
+               errorf("process_run: zygote worker for %lu failed, rc = %d\n", job->gpid, rc );
+               shell_rc = 0;
+            }
+         }
+         else if( (rc = waitpid( pid1, &wrapper_rc, 0 )) > 0 && wrapper_rc > 0 ) {
             // wrapper returned successfully
             rc = read_bytes( wrapper_fds[0], &shell_rc, sizeof(shell_rc) );
             if( rc == sizeof(shell_rc) ) {
                dbprintf("process_run: exit code %d for %lu\n", WEXITSTATUS(shell_rc), job->gpid );
-               rc = wish_process_reply( state, con, PROCESS_TYPE_EXIT, job->gpid, shell_rc );
-               
-               if( rc != 0 ) {
-                  errorf("process_run: wish_write_packet (exited) rc = %d on %d\n", rc, con->soc );
-               }
+               exit_type = PROCESS_TYPE_EXIT;
             }
             else {
                errorf("process_run: read_bytes from wrapper pipe rc = %d\n", rc );
+               shell_rc = 0;
             }
          }
          else {
             // wrapper failure
             errorf("process_run: waitpid rc = %d, wrapper process rc = %d, for job %lu\n", rc, wrapper_rc, job->gpid );
             rc = wrapper_rc;
-            
-            wish_process_reply( state, con, PROCESS_TYPE_ERROR, job->gpid, 0 );
          }
+         
+         // work out what the process used
+         struct timeval exited;
+         gettimeofday( &exited, NULL );
+         
+         struct wish_usage_packet usage;
+         wish_init_usage_packet( state, &usage, job->gpid );
+         
+         if( exit_type == PROCESS_TYPE_EXIT ) {
+            struct rusage ru;
+            int ru_rc = read_bytes( wrapper_fds[0], &ru, sizeof(ru) );
+            if( ru_rc == sizeof(ru) ) {
+               wish_usage_packet_rusage( &usage, &ru );
+            }
+            else {
+               errorf("process_run: no rusage for %lu, rc = %d\n", job->gpid, ru_rc );
+            }
+         }
+         
+         if( cgroup_procs ) {
+            // the cgroup's numbers cover everything the job started, so prefer them
+            usage_cgroup_collect( job->gpid, &usage );
+         }
+         
+         usage.wall_time = process_usec_between( &launched, &exited );
+         usage.queue_delay = process_usec_between( &proc->job_start, &launch_start );
+         usage.launch_delay = process_usec_between( &launch_start, &launched );
       
          // mark the process as terminated.
-         // the writeback function will clear it.
-         procs_wlock();
-         if( procs.find( proc->gpid ) != procs.end() ) {
-            procs[ proc->gpid ]->finished = true;
+         // the writeback function will send the exit status once all of the output has been sent, and then clear it.
+         if( insert_rc == 0 ) {
+            gpid_entry_lock( &proc->ent );
+            proc->exit_type = (proc->timed_out ? PROCESS_TYPE_TIMEOUT : exit_type);
+            proc->exit_data = shell_rc;
+            proc->usage = usage;
+            proc->have_usage = true;
+            proc->finished = true;
+            
+            timer_cancel( &proc->expire_timer );
+            gpid_entry_unlock( &proc->ent );
+            
+            procs_put( proc );
+         }
+         else {
+            // nothing else ever saw it
+            wish_finish_process( state, &proc );
          }
-         procs_unlock();
       }
       else {
          // broken pipe, somehow
@@ -971,7 +1709,13 @@ static int process_run( struct wish_state* state,
    }
    
    close( wrapper_fds[0] );
-   close( wrapper_fds[1] );
+   if( wrapper_fds[1] >= 0 )
+      close( wrapper_fds[1] );
+   
+   if( cgroup_procs ) {
+      usage_cgroup_remove( job->gpid );
+      free( cgroup_procs );
+   }
    
    // free memory
    for( int i = 0; shell_argv[i] != NULL; i++ ) {
@@ -1011,80 +1755,185 @@ static char* process_url_reformat( struct wish_state* state, char* url, uint64_t
 }
 
 
-// get a file and put it into place
-static int process_get_file( struct wish_state* state, struct wish_connection* con, struct wish_job_packet* job, char* url, int fd ) {
+// convert a job file URL into one we can download from.
+// return NULL if it can't be determined.
+static char* process_full_url( struct wish_state* state, char* url ) {
    wish_state_rlock( state );
    bool https = state->conf.use_https;
    wish_state_unlock( state );
    
-   // get stdin and put it into place
-   if( strlen(url) > 0 ) {
-      
-      dbprintf("process_get_file: url = %s\n", url );
-      char* full_url = NULL;
-      
-      // no protocol?  does this look like $NUMBER/path, or $HOSTNAME/path?
-      if( strstr( url, "://" ) == NULL ) {
-         char* tmp = NULL;
-         char* stdin_url_dup = strdup( url );
-         
-         char* host_id = strtok_r( stdin_url_dup, "/", &tmp );
-         
-         char* endptr = NULL;
-         uint64_t nid = (uint64_t)strtol( host_id, &endptr, 10 );
-         if( endptr == host_id ) {
-            full_url = process_url_reformat( state, url, nid, NULL, (https ? "https" : "http") );
-         }
-         else {
-            full_url = process_url_reformat( state, url, nid, NULL, (https ? "https" : "http") );
-         }
-         free( stdin_url_dup );
-      }
-      
-      // is this http:// or https:// or ftp://?
-      if( strstr(url, "http://") == url || strstr(url,"https://") == url || strstr(url,"ftp://") == url) {
-         full_url = strdup( url );
-      }
+   char* full_url = NULL;
+   
+   // no protocol?  does this look like $NUMBER/path, or $HOSTNAME/path?
+   if( strstr( url, "://" ) == NULL ) {
+      char* tmp = NULL;
+      char* stdin_url_dup = strdup( url );
       
-      if( full_url ) {
-         struct wish_HTTP_info resp_stdin;
-         memset( &resp_stdin, 0, sizeof(resp_stdin) );
-         
-         int rc = wish_HTTP_download_file( state, &resp_stdin, full_url, NULL, NULL, fd );
-         
-         if( rc != 0 || resp_stdin.status != 200 ) {
-            // failed to get stdin
-            errorf("process_get_file: could not download from %s (original url = %s), HTTP status = %d, rc = %d\n", full_url, url, resp_stdin.status, rc );
+      char* host_id = strtok_r( stdin_url_dup, "/", &tmp );
       
-            wish_process_reply( state, con, PROCESS_TYPE_FAILURE, job->gpid, 0 );
-            
-            return -abs(rc);
-         }
-         
-         free( full_url );
-         wish_free_HTTP_info( &resp_stdin );
+      char* endptr = NULL;
+      uint64_t nid = (uint64_t)strtol( host_id, &endptr, 10 );
+      if( endptr == host_id ) {
+         full_url = process_url_reformat( state, url, nid, NULL, (https ? "https" : "http") );
       }
       else {
-         // no protocol determined
-         errorf("process_get_file: could not determine HTTP URL for %s\n", url );
-         return -EINVAL;
+         full_url = process_url_reformat( state, url, nid, NULL, (https ? "https" : "http") );
       }
+      free( stdin_url_dup );
    }
    
-   return 0;
+   // is this http:// or https:// or ftp://?
+   if( strstr(url, "http://") == url || strstr(url,"https://") == url || strstr(url,"ftp://") == url) {
+      full_url = strdup( url );
+   }
+   
+   return full_url;
 }
 
-// start up a job, given a job packet
-int process_run_job( struct wish_state* state, struct wish_connection* con, struct wish_job_packet* job ) {
-   // create stdin, stdout, and stderr for this process
-   wish_state_rlock( state );
-   char* tmp_dir = strdup( state->conf.tmp_dir );
-   wish_state_unlock( state );
+
+// start getting a job file into fd: copy in our cached copy if we have one with the given hash, or queue a download.
+// hash can be NULL, in which case the file is always downloaded.
+// return 1 if a download was queued (done will be posted when it finishes), 0 on a cache hit, or negative on error
+static int process_fetch_file( struct wish_state* state, char* url, char* hash, int fd, struct fetch_request* req, sem_t* done ) {
+   if( hash && cache_get( state, hash, fd ) == 0 ) {
+      dbprintf("process_fetch_file: cache hit for %s (%s)\n", url, hash );
+      return 0;
+   }
    
-   // make stdin
-   char* stdin_path = (char*)calloc( strlen(tmp_dir) + 1 + strlen(WISH_STDIN_TEMPLATE) + 1, 1 );
-   sprintf( stdin_path, "%s/%s", tmp_dir, WISH_STDIN_TEMPLATE );
-   int stdin_fd = mkstemp( stdin_path );
+   char* full_url = process_full_url( state, url );
+   if( full_url == NULL ) {
+      // no protocol determined
+      errorf("process_fetch_file: could not determine HTTP URL for %s\n", url );
+      return -EINVAL;
+   }
+   
+   dbprintf("process_fetch_file: url = %s\n", full_url );
+   
+   fetch_request_init( req, full_url, fd, done );
+   free( full_url );
+   
+   int rc = fetch_start( req );
+   if( rc != 0 ) {
+      errorf("process_fetch_file: fetch_start rc = %d\n", rc );
+      fetch_request_free( req );
+      return rc;
+   }
+   
+   return 1;
+}
+
+
+// check how a queued download went, and cache what we got
+static int process_fetch_finish( struct wish_state* state, struct fetch_request* req, char* hash ) {
+   int rc = req->rc;
+   
+   if( rc != 0 || req->status != 200 ) {
+      errorf("process_fetch_finish: could not download from %s, HTTP status = %ld, rc = %d\n", req->url, req->status, rc );
+      if( rc == 0 )
+         rc = -EIO;
+   }
+   else if( hash && cache_enabled() ) {
+      int cache_rc = cache_put( state, hash, req->fd );
+      if( cache_rc != 0 ) {
+         errorf("process_fetch_finish: cache_put %s rc = %d\n", hash, cache_rc );
+      }
+   }
+   
+   fetch_request_free( req );
+   return rc;
+}
+
+
+// feed a job's stdin as it downloads
+static void* process_feed_stdin_pthread( void* arg ) {
+   struct process_feed_args* args = (struct process_feed_args*)arg;
+   
+   struct wish_HTTP_info resp;
+   memset( &resp, 0, sizeof(resp) );
+   
+   // writes to the pipe block while it's full, so the download only goes as fast as the job reads
+   int rc = wish_HTTP_download_file( args->state, &resp, args->url, NULL, NULL, args->fd );
+   if( rc != 0 || resp.status != 200 ) {
+      // the job has already started, so all we can do is cut its stdin short
+      errorf("process_feed_stdin_pthread: could not download stdin for %lu from %s, HTTP status = %d, rc = %d\n", args->gpid, args->url, resp.status, rc );
+   }
+   else {
+      dbprintf("process_feed_stdin_pthread: streamed stdin for %lu from %s\n", args->gpid, args->url );
+   }
+   
+   // job sees EOF
+   close( args->fd );
+   
+   wish_free_HTTP_info( &resp );
+   free( args->url );
+   free( args );
+   return NULL;
+}
+
+
+// start downloading a file into a pipe, and give back the read end.
+// return 0 on success; negative on error
+static int process_stream_file( struct wish_state* state, struct wish_job_packet* job, char* url, int* read_fd ) {
+   char* full_url = process_full_url( state, url );
+   if( full_url == NULL ) {
+      errorf("process_stream_file: could not determine HTTP URL for %s\n", url );
+      return -EINVAL;
+   }
+   
+   int pipe_fds[2];
+   int rc = pipe( pipe_fds );
+   if( rc != 0 ) {
+      rc = -errno;
+      errorf("process_stream_file: pipe errno = %d\n", rc );
+      free( full_url );
+      return rc;
+   }
+   
+   // only the feeder may hold the write end
+   fcntl( pipe_fds[1], F_SETFD, FD_CLOEXEC );
+   
+   struct process_feed_args* args = (struct process_feed_args*)calloc( sizeof(struct process_feed_args), 1 );
+   args->state = state;
+   args->url = full_url;
+   args->fd = pipe_fds[1];
+   args->gpid = job->gpid;
+   
+   pthread_attr_t attrs;
+   pthread_attr_init( &attrs );
+   pthread_attr_setdetachstate( &attrs, PTHREAD_CREATE_DETACHED );
+   
+   pthread_t feed_thread;
+   rc = pthread_create( &feed_thread, &attrs, process_feed_stdin_pthread, args );
+   pthread_attr_destroy( &attrs );
+   
+   if( rc != 0 ) {
+      errorf("process_stream_file: pthread_create rc = %d\n", rc );
+      close( pipe_fds[0] );
+      close( pipe_fds[1] );
+      free( full_url );
+      free( args );
+      return -rc;
+   }
+   
+   *read_fd = pipe_fds[0];
+   return 0;
+}
+
+
+// start up a job, given a job packet and the cores it may run on (NULL for anywhere; pin->cpus is NULL if it wasn't pinned)
+static int process_run_job_impl( struct wish_state* state, struct wish_connection* con, struct wish_job_packet* job, struct pin_set* pin ) {
+   struct timeval job_start;
+   gettimeofday( &job_start, NULL );
+   
+   // create stdin, stdout, and stderr for this process
+   wish_state_rlock( state );
+   char* tmp_dir = strdup( state->conf.tmp_dir );
+   wish_state_unlock( state );
+   
+   // make stdin
+   char* stdin_path = (char*)calloc( strlen(tmp_dir) + 1 + strlen(WISH_STDIN_TEMPLATE) + 1, 1 );
+   sprintf( stdin_path, "%s/%s", tmp_dir, WISH_STDIN_TEMPLATE );
+   int stdin_fd = mkstemp( stdin_path );
    
    if( stdin_fd < 0 ) {
       errorf("process_run_job: could not open stdin %s, errno = %d\n", stdin_path, -errno );
@@ -1095,22 +1944,44 @@ int process_run_job( struct wish_state* state, struct wish_connection* con, stru
       return -errno;
    }
    
-   // get stdin and put it into place
+   // get the job's inputs (stdin and the file to run) into place.
+   // whatever we have to download is fetched concurrently, and we start once the last of it lands.
+   sem_t fetched;
+   sem_init( &fetched, 0, 0 );
+   
+   int num_fetching = 0;
+   int fetch_rc = 0;
+   
+   struct fetch_request stdin_req;
+   struct fetch_request bin_req;
+   bool stdin_fetching = false;
+   bool bin_fetching = false;
+   
+   int stdin_mode = PROCESS_STDIN_SPOOLED;
+   int stdin_stream_fd = -1;
+   off_t stdin_spooled = 0;
+   
    if( job->stdin_url ) {
-      int rc = process_get_file( state, con, job, job->stdin_url, stdin_fd );
-      if( rc != 0 ) {
-         // failure, but try to run anyway
-         errorf("process_run_job: could not get stdin from %s\n", job->stdin_url );
-         free( stdin_path );
-         free( tmp_dir );
-         wish_process_reply( state, con, PROCESS_TYPE_FAILURE, job->gpid, 0 );
-         wish_disconnect( state, con );
-         close( stdin_fd );
-         return rc;
+      if( job->flags & JOB_STREAM_STDIN ) {
+         // use our cached copy if we have one; otherwise, feed it to the job as it arrives
+         if( job->stdin_hash == NULL || cache_get( state, job->stdin_hash, stdin_fd ) != 0 ) {
+            fetch_rc = process_stream_file( state, job, job->stdin_url, &stdin_stream_fd );
+            if( fetch_rc == 0 ) {
+               stdin_mode = PROCESS_STDIN_STREAMED;
+            }
+         }
       }
       else {
-         dbprintf("process_run_job: downloaded stdin %s to %s\n", job->stdin_url, stdin_path );
-         lseek( stdin_fd, 0, SEEK_SET );
+         fetch_rc = process_fetch_file( state, job->stdin_url, job->stdin_hash, stdin_fd, &stdin_req, &fetched );
+         if( fetch_rc > 0 ) {
+            stdin_fetching = true;
+            num_fetching++;
+            fetch_rc = 0;
+         }
+      }
+      
+      if( fetch_rc != 0 ) {
+         errorf("process_run_job: could not get stdin from %s\n", job->stdin_url );
       }
    }
    
@@ -1119,7 +1990,7 @@ int process_run_job( struct wish_state* state, struct wish_connection* con, stru
    int job_bin_fd = -1;
    
    // if we're supposed to spawn a file, get it and put it into place
-   if( job->flags & JOB_USE_FILE ) {
+   if( fetch_rc == 0 && (job->flags & JOB_USE_FILE) ) {
       // job->cmd_text is the url on the remote host
       char* name = wish_basename( job->cmd_text, NULL );
       
@@ -1128,39 +1999,82 @@ int process_run_job( struct wish_state* state, struct wish_connection* con, stru
       free( name );
       
       job_bin_fd = mkstemp( job_bin_path );
-      int rc = 0;
       
-      if( job_bin_fd > 0 ) {
-         rc = process_get_file( state, con, job, job->cmd_text, job_bin_fd );
-         if( rc == 0 ) {
-            rc = chmod( job_bin_path, 0700 );
-            if( rc != 0 ) {
-               errorf("chmod %s errno = %d\n", job_bin_path, -errno );
-            }
-         }
-         
-         if( rc != 0 ) {
-            // failed to download or chmod
-            close( job_bin_fd );
-            unlink( job_bin_path );
+      if( job_bin_fd >= 0 ) {
+         fetch_rc = process_fetch_file( state, job->cmd_text, job->cmd_hash, job_bin_fd, &bin_req, &fetched );
+         if( fetch_rc > 0 ) {
+            bin_fetching = true;
+            num_fetching++;
+            fetch_rc = 0;
          }
       }
       else {
-         rc = -errno;
+         fetch_rc = -errno;
+         errorf("process_run_job: could not create %s, errno = %d\n", job_bin_path, fetch_rc );
       }
+   }
+   
+   // wait for the downloads to land
+   for( int i = 0; i < num_fetching; i++ ) {
+      while( sem_wait( &fetched ) != 0 && errno == EINTR );
+   }
+   sem_destroy( &fetched );
+   
+   if( stdin_fetching ) {
+      int rc = process_fetch_finish( state, &stdin_req, job->stdin_hash );
+      if( rc != 0 && fetch_rc == 0 )
+         fetch_rc = rc;
+   }
+   
+   if( bin_fetching ) {
+      int rc = process_fetch_finish( state, &bin_req, job->cmd_hash );
+      if( rc != 0 && fetch_rc == 0 )
+         fetch_rc = rc;
+   }
+   
+   if( fetch_rc == 0 && job_bin_path ) {
+      if( chmod( job_bin_path, 0700 ) != 0 ) {
+         fetch_rc = -errno;
+         errorf("chmod %s errno = %d\n", job_bin_path, fetch_rc );
+      }
+   }
+   
+   if( fetch_rc != 0 ) {
+      // failed to get an input
+      if( stdin_stream_fd >= 0 )
+         close( stdin_stream_fd );
       
-      if( job_bin_fd < 0 || rc != 0 ) {
-         
-         unlink( stdin_path );
+      if( job_bin_path ) {
+         if( job_bin_fd >= 0 )
+            close( job_bin_fd );
+         unlink( job_bin_path );
          free( job_bin_path );
-         free( stdin_path );
-         free( tmp_dir );
-         close( stdin_fd );
-         wish_process_reply( state, con, PROCESS_TYPE_FAILURE, job->gpid, 0 );
-         wish_disconnect( state, con );
-         return rc;
       }
       
+      close( stdin_fd );
+      unlink( stdin_path );
+      free( stdin_path );
+      free( tmp_dir );
+      wish_process_reply( state, con, PROCESS_TYPE_FAILURE, job->gpid, 0 );
+      wish_disconnect( state, con );
+      return fetch_rc;
+   }
+   
+   if( stdin_mode == PROCESS_STDIN_STREAMED ) {
+      dbprintf("process_run_job: streaming stdin from %s\n", job->stdin_url );
+   }
+   else if( job->stdin_url ) {
+      dbprintf("process_run_job: downloaded stdin %s to %s\n", job->stdin_url, stdin_path );
+      lseek( stdin_fd, 0, SEEK_SET );
+      
+      struct stat sb;
+      if( fstat( stdin_fd, &sb ) == 0 ) {
+         stdin_spooled = sb.st_size;
+         process_stdin_spool_add( stdin_spooled );
+      }
+   }
+   
+   if( job_bin_path ) {
       // change the command to refer to this binary
       free( job->cmd_text );
       job->cmd_text = (char*)calloc( strlen("exec ") + strlen(job_bin_path) + 1, 1 );
@@ -1204,6 +2118,11 @@ int process_run_job( struct wish_state* state, struct wish_connection* con, stru
          unlink( job_bin_path );
          free( job_bin_path );
       }
+      
+      if( stdin_stream_fd >= 0 )
+         close( stdin_stream_fd );
+      
+      process_stdin_spool_add( -stdin_spooled );
          
       free( stdin_path );
       free( stdout_path );
@@ -1221,11 +2140,17 @@ int process_run_job( struct wish_state* state, struct wish_connection* con, stru
    struct wish_process* proc = (struct wish_process*)calloc( sizeof(struct wish_process), 1 );
    
    // NOTE: proc and its associated data will be freed by process_writeback_func, which gets used by process_run
+   proc->job_start = job_start;
+   proc->stdin_mode = stdin_mode;
    
    // run the process, and send the URLs of our stdout and stderr back to the caller
-   int rc = process_run( state, con, job, proc, stdin_fd, stdout_fd, stderr_fd, stdout_path, stderr_path );
+   int rc = process_run( state, con, job, proc, (stdin_stream_fd >= 0 ? stdin_stream_fd : stdin_fd), stdout_fd, stderr_fd, stdout_path, stderr_path, pin );
    
    // no more need for stdin
+   if( stdin_stream_fd >= 0 )
+      close( stdin_stream_fd );
+   
+   process_stdin_spool_add( -stdin_spooled );
    close( stdin_fd );
    unlink( stdin_path );
    free( stdin_path );
@@ -1240,6 +2165,36 @@ int process_run_job( struct wish_state* state, struct wish_connection* con, stru
    return rc;
 }
 
+
+// start up a job, given a job packet.
+// if it asks for cores of its own, it gets them for as long as it runs.  Otherwise it keeps off the cores pinned jobs hold.
+int process_run_job( struct wish_state* state, struct wish_connection* con, struct wish_job_packet* job ) {
+   if( job->cpus == 0 && (job->flags & JOB_NUMA_NODE) == 0 ) {
+      struct pin_set unpinned;
+      int rc = pin_unreserved( state, &unpinned );
+      return process_run_job_impl( state, con, job, (rc == 0 ? &unpinned : NULL) );
+   }
+   
+   uint64_t gpid = job->gpid;
+   
+   struct pin_set pin;
+   memset( &pin, 0, sizeof(pin) );
+   
+   int rc = pin_reserve( state, gpid, job->cpus, (job->flags & JOB_NUMA_NODE) != 0, &pin );
+   if( rc != 0 ) {
+      errorf("process_run_job: could not pin %lu to %u cores (NUMA node = %d), rc = %d\n", gpid, job->cpus, (job->flags & JOB_NUMA_NODE) != 0, rc );
+      wish_process_reply( state, con, PROCESS_TYPE_ERROR, gpid, rc );
+      wish_disconnect( state, con );
+      return rc;
+   }
+   
+   rc = process_run_job_impl( state, con, job, &pin );
+   
+   pin_release( state, gpid );
+   pin_set_free( &pin );
+   return rc;
+}
+
 // pthread bootstrapper for process_run_job
 void* process_run_job_pthread( void* arg ) {
    struct process_run_args* args = (struct process_run_args*)arg;
@@ -1335,12 +2290,12 @@ static char* public_url( struct wish_state* state, char* flatp ) {
 
 
 // make an output file
-FILE* make_output( char* path, uid_t user, gid_t group, int umask ) {
-   FILE* f = fopen( path, "w" );
-   if( f ) {
+struct sink_file* make_output( char* path, uid_t user, gid_t group, int umask ) {
+   struct sink_file* f = NULL;
+   int fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666 );
+   if( fd >= 0 ) {
       int rc = 0;
       // make it so it has the right owner
-      int fd = fileno( f );
       rc = fchown( fd, user, group );
       if( rc != 0 ) {
          errorf("make_output: fchown %s errno = %d\n", path, -errno );
@@ -1349,6 +2304,8 @@ FILE* make_output( char* path, uid_t user, gid_t group, int umask ) {
       if( rc != 0 ) {
          errorf("make_output: fchmod %s errno = %d\n", path, -errno );
       }
+      
+      f = sink_open( fd, path );
    }
    else {
       errorf("process_spawn: failed to create stdout %s\n", path );
@@ -1360,26 +2317,10 @@ FILE* make_output( char* path, uid_t user, gid_t group, int umask ) {
 
 // spawn a running process, but on a remote host.
 // record local information on it first.
-int process_spawn( struct wish_state* state, struct wish_job_packet* job, struct wish_connection* client_con, uint64_t nid ) {
-   // sanity check--make sure this process does not exist
-   spawned_rlock();
-   if( spawned.find(job->gpid) != spawned.end() ) {
-      errorf("process_spawn: process ID collision on %lu\n", job->gpid);
-      spawned_unlock();
-      return -EEXIST;
-   }
-   spawned_unlock();
-   
-   // sanity check--if this nid matches the nid of one of the possible "localhost" nids, then rewrite
-   // it to be the nid of the canonical hostname
-   for( vector<uint64_t>::size_type i = 0; i < localhost_nids.size(); i++ ) {
-      if( localhost_nids[i] == nid ) {
-         wish_state_rlock( state );
-         nid = state->nid;
-         wish_state_unlock( state );
-         break;
-      }
-   }
+// rewrite a client's job so executors can get its files: the file to run (with JOB_USE_FILE) and stdin become
+// URLs on this host, and their hashes are recorded.  Does nothing to jobs from other daemons.
+// return 0 on success; negative on error
+int process_publish_job( struct wish_state* state, struct wish_job_packet* job ) {
    
    // sanity check--if we have JOB_USE_FILE as a flag, make sure it's publicly accessible
    if( !(job->flags & JOB_WISH_ORIGIN) && (job->flags & JOB_USE_FILE) ) {
@@ -1387,26 +2328,30 @@ int process_spawn( struct wish_state* state, struct wish_job_packet* job, struct
       
       if( flatp == NULL ) {
          // does not exist
-         errorf("process_spawn: %s is not a valid path\n", job->cmd_text );
+         errorf("process_publish_job: %s is not a valid path\n", job->cmd_text );
          return -errno;
       }
       
       int rc = is_regular_file( flatp, S_IXUSR );
       if( rc ) {
-         errorf("process_spawn: invalid job file %s\n", flatp);
+         errorf("process_publish_job: invalid job file %s\n", flatp);
          free( flatp );
          return rc;
       }
       
       rc = is_publicly_visible( state, flatp );
       if( rc ) {
-         errorf("process_spawn: inaccessable job file %s\n", flatp );
+         errorf("process_publish_job: inaccessable job file %s\n", flatp );
          free( flatp );
          return rc;
       }
       
       char* file_url = public_url( state, flatp );
       
+      // remember its hash, so executors can use their cached copies (if we don't cache, we don't hash)
+      if( cache_enabled() )
+         job->cmd_hash = cache_hash_file( flatp );
+      
       free( job->cmd_text );
       job->cmd_text = file_url;
       free( flatp );
@@ -1418,36 +2363,96 @@ int process_spawn( struct wish_state* state, struct wish_job_packet* job, struct
       
       if( flatp == NULL ) {
          // does not exist
-         errorf("process_spawn: %s is not a valid path for stdin\n", job->stdin_url );
+         errorf("process_publish_job: %s is not a valid path for stdin\n", job->stdin_url );
          return -errno;
       }
       
       int rc = is_regular_file( flatp, S_IRUSR );
       if( rc ) {
-         errorf("process_spawn: invalid stdin file %s\n", flatp);
+         errorf("process_publish_job: invalid stdin file %s\n", flatp);
          free( flatp );
          return rc;
       }
       
       rc = is_publicly_visible( state, flatp );
       if( rc ) {
-         errorf("process_spawn: inaccessable stdin file %s\n", flatp );
+         errorf("process_publish_job: inaccessable stdin file %s\n", flatp );
          free( flatp );
          return rc;
       }
       
       char* file_url = public_url( state, flatp );
       
+      if( cache_enabled() )
+         job->stdin_hash = cache_hash_file( flatp );
+      
       free( job->stdin_url );
       job->stdin_url = file_url;
       free( flatp );
    }
    
+   return 0;
+}
+
+
+// is nid one of the names for this host?
+bool process_is_localhost( struct wish_state* state, uint64_t nid ) {
+   wish_state_rlock( state );
+   uint64_t my_nid = state->nid;
+   wish_state_unlock( state );
+   
+   if( nid == my_nid )
+      return true;
+   
+   for( vector<uint64_t>::size_type i = 0; i < localhost_nids.size(); i++ ) {
+      if( localhost_nids[i] == nid )
+         return true;
+   }
+   return false;
+}
+
+
+// how many jobs are running here
+uint32_t process_num_running( struct wish_state* state ) {
+   return gpid_table_count( &procs );
+}
+
+
+// spawn a job, on behalf of a client or a DAG
+static int process_spawn_impl( struct wish_state* state, struct wish_job_packet* job, struct wish_connection* client_con, uint64_t nid, struct dag_run* dag, uint32_t dag_node ) {
+   // sanity check--make sure this process does not exist
+   struct wish_spawn* existing = spawned_get( job->gpid );
+   if( existing != NULL ) {
+      errorf("process_spawn: process ID collision on %lu\n", job->gpid);
+      spawned_put( existing );
+      return -EEXIST;
+   }
+   
+   // sanity check--if this nid matches the nid of one of the possible "localhost" nids, then rewrite
+   // it to be the nid of the canonical hostname
+   for( vector<uint64_t>::size_type i = 0; i < localhost_nids.size(); i++ ) {
+      if( localhost_nids[i] == nid ) {
+         wish_state_rlock( state );
+         nid = state->nid;
+         wish_state_unlock( state );
+         break;
+      }
+   }
+   
+   // make the job's files available to the executor
+   int rc = process_publish_job( state, job );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
    // get a connection to this host
    struct wish_connection* con = (struct wish_connection*)calloc( sizeof(struct wish_connection), 1 );
-   int rc = heartbeat_get_nid( state, nid, con );
+   rc = heartbeat_get_nid( state, nid, con );
    if( rc != 0 ) {
       errorf("process_spawn: heartbeat_get_nid rc = %d\n", rc );
+      
+      // never connected
+      free( con );
       return rc;
    }
    printf("spawned process %lu connected on %d\n", job->gpid, con->soc );
@@ -1463,8 +2468,22 @@ int process_spawn( struct wish_state* state, struct wish_job_packet* job, struct
    memcpy( &addr, state->addr->ai_addr, state->addr->ai_addrlen );
    wish_state_unlock( state );
    
-   wish_init_job_packet( state, &jobpkt, nid, job->ttl, &addr, 1, job->cmd_text, job->stdin_url, job->flags | JOB_WISH_ORIGIN, job->timeout, http_portnum );
+   // we're first in its path, followed by wherever it has been handed on to already (e.g. a daemon that took it from our queue)
+   int num_visited = 1 + job->visited_len;
+   struct sockaddr_storage* visited = (struct sockaddr_storage*)calloc( sizeof(struct sockaddr_storage) * num_visited, 1 );
+   memcpy( &visited[0], &addr, sizeof(struct sockaddr_storage) );
+   if( job->visited_len > 0 )
+      memcpy( &visited[1], job->visited, sizeof(struct sockaddr_storage) * job->visited_len );
+   
+   wish_init_job_packet( state, &jobpkt, nid, job->ttl, visited, num_visited, job->cmd_text, job->stdin_url, job->flags | JOB_WISH_ORIGIN | JOB_CREDIT, job->timeout, http_portnum );
+   free( visited );
    jobpkt.gpid = job->gpid;
+   jobpkt.cpus = job->cpus;
+   
+   if( job->cmd_hash )
+      jobpkt.cmd_hash = strdup( job->cmd_hash );
+   if( job->stdin_hash )
+      jobpkt.stdin_hash = strdup( job->stdin_hash );
    
    // send off this job
    struct wish_packet pkt;
@@ -1477,6 +2496,9 @@ int process_spawn( struct wish_state* state, struct wish_job_packet* job, struct
    if( rc != 0 ) {
       // failed to send
       errorf("process_spawn: wish_write_packet rc = %d\n", rc );
+      
+      wish_disconnect( state, con );
+      free( con );
    }
    else {
       // new process...
@@ -1484,6 +2506,9 @@ int process_spawn( struct wish_state* state, struct wish_job_packet* job, struct
       wish_spawned_init( state, new_proc, job );
       new_proc->con = con;
       new_proc->client = client_con;
+      new_proc->dag = dag;
+      new_proc->dag_node = dag_node;
+      new_proc->nid = nid;
       
       // attempt to open the stdout and stderr files
       if( job->stdout_path ) {
@@ -1499,113 +2524,579 @@ int process_spawn( struct wish_state* state, struct wish_job_packet* job, struct
          new_proc->stderr = NULL;
       }
       
-      spawned_wlock();
-      spawned[ job->gpid ] = new_proc;
-      spawned_unlock();
+      // the scheduler reserved a slot for this job; it's released when the job ends
+      new_proc->sched_slot = ((job->flags & JOB_SCHEDULE) != 0);
+      
+      // keep its output for clients that attach to it
+      new_proc->has_log = (outlog_open( state, job->gpid ) == 0);
+      
+      rc = gpid_table_insert( &spawned, &new_proc->ent, job->gpid );
+      if( rc != 0 ) {
+         errorf("process_spawn: process ID collision on %lu\n", job->gpid);
+         
+         // the client connection, DAG, and scheduler slot are still the caller's.
+         // (if the other process had ended, we reopened its log; destroying this one closes it again)
+         new_proc->client = NULL;
+         new_proc->dag = NULL;
+         new_proc->sched_slot = false;
+         wish_spawned_destroy( state, new_proc );
+         free( new_proc );
+      }
+      else {
+         spawned_put( new_proc );
+      }
    }
    
    return rc;
 }
 
 
-// do the join
-static int process_do_join( struct wish_state* state, struct wish_spawn** spawn, int type, uint64_t gpid, int exit ) {
-   int rc = 0;
-   if( (*spawn)->join ) {
-      rc = wish_process_reply( state, (*spawn)->join, type, gpid, exit );
+int process_spawn( struct wish_state* state, struct wish_job_packet* job, struct wish_connection* client_con, uint64_t nid ) {
+   return process_spawn_impl( state, job, client_con, nid, NULL, 0 );
+}
+
+
+// spawn a DAG's node
+int process_spawn_dag( struct wish_state* state, struct wish_job_packet* job, uint64_t nid, struct dag_run* dag, uint32_t dag_node ) {
+   return process_spawn_impl( state, job, NULL, nid, dag, dag_node );
+}
+
+
+// pick a random id
+uint64_t process_random_id(void) {
+   uint64_t id = 0;
+   while( id == 0 ) {
+      if( read( process_urandom_fd, &id, sizeof(id) ) != sizeof(id) )
+         return 0;
+   }
+   return id;
+}
+
+// start job array instances until there are none left (dispatch thread)
+static void* process_array_dispatch_pthread( void* arg ) {
+   struct process_array_dispatch* d = (struct process_array_dispatch*)arg;
+   struct wish_job_array_packet* arr = d->arr;
+   
+   while( true ) {
+      pthread_mutex_lock( &d->lock );
+      uint32_t i = d->next++;
+      pthread_mutex_unlock( &d->lock );
+      
+      if( i >= arr->count )
+         break;
+      
+      if( d->nids[i] == 0 ) {
+         // nowhere to run it
+         continue;
+      }
+      
+      char* cmd = wish_job_array_expand( arr->cmd_text, i, d->hostnames[i] );
+      char* stdin_path = wish_job_array_expand( arr->stdin_path, i, d->hostnames[i] );
+      char* stdout_path = wish_job_array_expand( arr->stdout_path, i, d->hostnames[i] );
+      char* stderr_path = wish_job_array_expand( arr->stderr_path, i, d->hostnames[i] );
+      
+      struct wish_job_packet job;
+      wish_init_job_packet_client( d->state, &job, 0, d->nids[i], 1, cmd, stdin_path, stdout_path, stderr_path, arr->owner, arr->group, arr->umask, arr->flags, arr->timeout );
+      
+      // no stdin is "" in a client's job packet
+      if( job.stdin_url && strlen(job.stdin_url) == 0 ) {
+         free( job.stdin_url );
+         job.stdin_url = NULL;
+      }
+      
+      int rc = process_spawn( d->state, &job, NULL, d->nids[i] );
       if( rc != 0 ) {
-         errorf("process_do_join: could not reply %d to client, rc = %d\n", type, rc );
+         errorf("process_array_dispatch_pthread: instance %u of %lu on %s: process_spawn rc = %d\n", i, arr->array_id, d->hostnames[i], rc );
       }
       else {
-         wish_spawned_destroy( state, *spawn );
-         free( *spawn );
-         *spawn = NULL;
-         rc = PROCESS_UPDATE_DESTROYED;
+         d->gpids[i] = job.gpid;
       }
+      
+      if( job.stdout_path )
+         free( job.stdout_path );
+      if( job.stderr_path )
+         free( job.stderr_path );
+      wish_free_job_packet( &job );
+      
+      free( cmd );
+      if( stdin_path )
+         free( stdin_path );
+      if( stdout_path )
+         free( stdout_path );
+      if( stderr_path )
+         free( stderr_path );
    }
-   return rc;
+   
+   return NULL;
+}
+
+// check that a job array can be spawned, and give it an id if it doesn't have one
+static int process_array_check( struct wish_state* state, struct wish_job_array_packet* arr ) {
+   if( arr->count == 0 || arr->count > JOB_ARRAY_MAX_INSTANCES )
+      return -EINVAL;
+   
+   if( arr->array_id == 0 )
+      arr->array_id = process_random_id();
+   
+   if( arr->array_id == 0 )
+      return -EIO;
+   
+   // sanity check--make sure the array's id isn't taken
+   struct wish_spawn* existing = spawned_get( arr->array_id );
+   if( existing != NULL ) {
+      spawned_put( existing );
+      return -EEXIST;
+   }
+   
+   pthread_rwlock_rdlock( &arrays_lock );
+   bool taken = (arrays.find( arr->array_id ) != arrays.end());
+   pthread_rwlock_unlock( &arrays_lock );
+   
+   if( taken )
+      return -EEXIST;
+   
+   // the client can't pose as a daemon
+   arr->flags &= ~JOB_WISH_ORIGIN;
+   return 0;
+}
+
+// spawn every instance of a job array, and reply their gpids to the client
+static int process_array_run( struct wish_state* state, struct wish_job_array_packet* arr, struct wish_connection* con ) {
+   // work out where each instance runs
+   uint64_t* nids = (uint64_t*)calloc( sizeof(uint64_t) * arr->count, 1 );
+   char** hostnames = (char**)calloc( sizeof(char*) * arr->count, 1 );
+   uint64_t* gpids = (uint64_t*)calloc( sizeof(uint64_t) * arr->count, 1 );
+   
+   unsigned int num_known = heartbeat_count_hosts( state ) + 1;
+   
+   for( uint32_t i = 0; i < arr->count; i++ ) {
+      if( arr->num_hosts > 0 ) {
+         hostnames[i] = strdup( arr->hosts[ i % arr->num_hosts ] );
+         nids[i] = wish_host_nid( hostnames[i] );
+         continue;
+      }
+      
+      // spread instances over the hosts we know of, best first
+      unsigned int rank = i % num_known;
+      uint64_t nid = 0;
+      switch( arr->select ) {
+         case HEARTBEAT_PROP_LATENCY:
+            nid = heartbeat_best_latency( state, rank );
+            break;
+         case HEARTBEAT_PROP_CPU:
+            nid = heartbeat_best_cpu( state, rank );
+            break;
+         case HEARTBEAT_PROP_RAM:
+            nid = heartbeat_best_ram( state, rank );
+            break;
+         case HEARTBEAT_PROP_DISK:
+            nid = heartbeat_best_disk( state, rank );
+            break;
+         default:
+            nid = heartbeat_index( state, rank );
+            break;
+      }
+      
+      if( nid != 0 )
+         hostnames[i] = heartbeat_nid_to_hostname( state, nid );
+      
+      if( hostnames[i] != NULL )
+         nids[i] = nid;
+      else
+         errorf("process_spawn_array: no host for instance %u of %lu\n", i, arr->array_id );
+   }
+   
+   // start the instances in parallel
+   struct process_array_dispatch d;
+   memset( &d, 0, sizeof(d) );
+   d.state = state;
+   d.arr = arr;
+   d.nids = nids;
+   d.hostnames = hostnames;
+   d.gpids = gpids;
+   d.next = 0;
+   pthread_mutex_init( &d.lock, NULL );
+   
+   int num_threads = MIN( arr->count, PROCESS_ARRAY_DISPATCH_THREADS );
+   pthread_t threads[PROCESS_ARRAY_DISPATCH_THREADS];
+   int num_started = 0;
+   
+   for( int i = 0; i < num_threads; i++ ) {
+      if( pthread_create( &threads[i], NULL, process_array_dispatch_pthread, &d ) != 0 )
+         break;
+      num_started++;
+   }
+   
+   if( num_started == 0 ) {
+      // do it ourselves
+      process_array_dispatch_pthread( &d );
+   }
+   
+   for( int i = 0; i < num_started; i++ ) {
+      pthread_join( threads[i], NULL );
+   }
+   
+   pthread_mutex_destroy( &d.lock );
+   
+   // remember the members, so pjoin can wait on the whole array
+   if( !(arr->flags & JOB_DETACHED) ) {
+      vector<uint64_t> members;
+      for( uint32_t i = 0; i < arr->count; i++ ) {
+         if( gpids[i] != 0 )
+            members.push_back( gpids[i] );
+      }
+      
+      if( members.size() > 0 ) {
+         pthread_rwlock_wrlock( &arrays_lock );
+         arrays[ arr->array_id ] = members;
+         pthread_rwlock_unlock( &arrays_lock );
+      }
+   }
+   
+   for( uint32_t i = 0; i < arr->count; i++ ) {
+      if( hostnames[i] )
+         free( hostnames[i] );
+   }
+   free( hostnames );
+   free( nids );
+   
+   // reply the gpids in one batch
+   if( arr->gpids )
+      free( arr->gpids );
+   arr->gpids = gpids;
+   arr->num_gpids = arr->count;
+   
+   struct wish_packet pkt;
+   wish_pack_job_array_packet( state, &pkt, arr );
+   int rc = wish_write_packet( state, con, &pkt );
+   wish_free_packet( &pkt );
+   
+   if( rc != 0 ) {
+      errorf("process_spawn_array: could not reply gpids of %lu to client, rc = %d\n", arr->array_id, rc );
+   }
+   
+   return 0;
+}
+
+// spawn a job array in the background, so the main loop isn't held up while its instances start
+static void* process_array_pthread( void* arg ) {
+   struct process_array_args* args = (struct process_array_args*)arg;
+   
+   int rc = process_array_run( args->state, args->arr, args->con );
+   if( rc != 0 ) {
+      errorf("process_spawn_array: array %lu rc = %d\n", args->arr->array_id, rc );
+      wish_process_reply( args->state, args->con, PROCESS_TYPE_ERROR, args->arr->array_id, rc );
+   }
+   
+   wish_disconnect( args->state, args->con );
+   free( args->con );
+   
+   wish_free_job_array_packet( args->arr );
+   free( args->arr );
+   free( args );
+   
+   return NULL;
+}
+
+// start every instance of a job array in the background
+int process_spawn_array( struct wish_state* state, struct wish_job_array_packet* arr, struct wish_connection* con ) {
+   int rc = process_array_check( state, arr );
+   if( rc != 0 )
+      return rc;
+   
+   struct process_array_args* args = (struct process_array_args*)calloc( sizeof(struct process_array_args), 1 );
+   args->state = state;
+   args->arr = arr;
+   args->con = con;
+   
+   pthread_attr_t attrs;
+   pthread_attr_init( &attrs );
+   pthread_attr_setdetachstate( &attrs, PTHREAD_CREATE_DETACHED );
+   
+   pthread_t thread;
+   rc = pthread_create( &thread, &attrs, process_array_pthread, args );
+   pthread_attr_destroy( &attrs );
+   
+   if( rc != 0 ) {
+      free( args );
+      return -rc;
+   }
+   return 0;
+}
+
+
+// what a spawned process used (blank if the executor didn't say)
+static void process_spawned_usage( struct wish_state* state, struct wish_spawn* spawn, uint64_t gpid, struct wish_usage_packet* usage ) {
+   if( spawn->have_usage ) {
+      *usage = spawn->usage;
+   }
+   else {
+      wish_init_usage_packet( state, usage, gpid );
+      usage->owner = spawn->owner;
+   }
+}
+
+// let go of a join on a job array, and hang up on the client once every member has been replied
+static void process_array_join_put( struct wish_state* state, struct process_array_join* aj ) {
+   pthread_mutex_lock( &aj->lock );
+   aj->refs--;
+   bool last = (aj->refs == 0);
+   pthread_mutex_unlock( &aj->lock );
+   
+   if( last ) {
+      if( aj->con ) {
+         wish_disconnect( state, aj->con );
+         free( aj->con );
+      }
+      pthread_mutex_destroy( &aj->lock );
+      free( aj );
+   }
+}
+
+// tell a client joined on a job array how one of its members ended, and let go of the join.
+// usage (if not NULL) follows the reply if the client asked for it.
+static void process_array_join_reply( struct wish_state* state, struct process_array_join* aj, int type, uint64_t gpid, int data, struct wish_usage_packet* usage ) {
+   pthread_mutex_lock( &aj->lock );
+   
+   if( aj->con ) {
+      int rc = wish_process_reply( state, aj->con, type, gpid, data );
+      if( rc == 0 && aj->want_usage && usage != NULL ) {
+         struct wish_packet pkt;
+         wish_pack_usage_packet( state, &pkt, usage );
+         rc = wish_write_packet( state, aj->con, &pkt );
+         wish_free_packet( &pkt );
+      }
+      
+      if( rc != 0 ) {
+         // client went away; nobody else to tell
+         errorf("process_array_join_reply: could not reply %d for %lu to client, rc = %d\n", type, gpid, rc );
+         wish_disconnect( state, aj->con );
+         free( aj->con );
+         aj->con = NULL;
+      }
+   }
+   
+   pthread_mutex_unlock( &aj->lock );
+   
+   process_array_join_put( state, aj );
+}
+
+// reply an ended member's outcome to a join on its job array, from the result cache
+static void process_array_join_result( struct wish_state* state, struct process_array_join* aj, uint64_t gpid ) {
+   struct job_result result;
+   if( results_get( state, gpid, &result ) != 0 ) {
+      // long gone
+      process_array_join_reply( state, aj, PROCESS_TYPE_ERROR, gpid, -ENOENT, NULL );
+      return;
+   }
+   
+   bool ended = (result.type == PROCESS_TYPE_EXIT || result.type == PROCESS_TYPE_TIMEOUT);
+   process_array_join_reply( state, aj, result.type, gpid, result.data, ended ? &result.usage : NULL );
+}
+
+// the process has ended: remember how it ended for whoever joins later, and take everyone waiting on it into replies.
+// spawn must be locked.  The caller should take spawn out of the table afterwards.
+// return PROCESS_UPDATE_DESTROYED
+static int process_do_join( struct wish_state* state, struct wish_spawn* spawn, int type, uint64_t gpid, int exit, struct process_join_replies* replies ) {
+   struct job_result& result = replies->result;
+   result.gpid = gpid;
+   result.type = type;
+   result.data = exit;
+   result.start_time = spawn->start_time;
+   result.end_time = time(NULL);
+   
+   // follow up with what the process used
+   process_spawned_usage( state, spawn, gpid, &result.usage );
+   
+   results_add( state, &result );
+   replies->ended = true;
+   
+   // take the whole array's join and the DAG waiting on it too, if any
+   replies->array_join = spawn->array_join;
+   replies->dag = spawn->dag;
+   replies->dag_node = spawn->dag_node;
+   spawn->array_join = NULL;
+   spawn->dag = NULL;
+   
+   // take every joiner, to wake them all at once when spawn is unlocked (see process_join_reply)
+   replies->joins.swap( *spawn->joins );
+   
+   return PROCESS_UPDATE_DESTROYED;
+}
+
+
+// send what process_do_join gathered: the array join's reply, the DAG's notice, and the joiners' replies.
+// spawn must NOT be locked.  The joiners are hung up on once they're answered.
+static void process_join_reply( struct wish_state* state, struct process_join_replies* replies ) {
+   if( !replies->ended )
+      return;
+   
+   struct job_result* result = &replies->result;
+   bool ended = (result->type == PROCESS_TYPE_EXIT || result->type == PROCESS_TYPE_TIMEOUT);
+   
+   if( replies->array_join ) {
+      // the whole array is being waited on
+      process_array_join_reply( state, replies->array_join, result->type, result->gpid, result->data, ended ? &result->usage : NULL );
+      replies->array_join = NULL;
+   }
+   
+   if( replies->dag ) {
+      // its DAG is waiting on it
+      dag_node_ended( state, replies->dag, replies->dag_node, result->type, result->data, ended ? &result->usage : NULL );
+      replies->dag = NULL;
+   }
+   
+   for( vector<struct process_joiner>::size_type i = 0; i < replies->joins.size(); i++ ) {
+      int rc = results_reply( state, replies->joins[i].con, &replies->result, replies->joins[i].want_usage );
+      if( rc != 0 ) {
+         errorf("process_join_reply: could not reply %d to client, rc = %d\n", replies->result.type, rc );
+      }
+      
+      wish_disconnect( state, replies->joins[i].con );
+      free( replies->joins[i].con );
+   }
+   replies->joins.clear();
+   replies->ended = false;
+}
+
+// give back a spawned process's scheduler slot, if it holds one.
+// spawned must be locked (or not yet in the table)
+static void process_spawned_release_slot( struct wish_state* state, struct wish_spawn* spawned ) {
+   if( spawned->sched_slot ) {
+      scheduler_release( state, spawned->nid );
+      spawned->sched_slot = false;
+   }
+}
+
+// a spawned process has ended, so its output log is complete.
+// spawned must be locked (or not in the table)
+static void process_spawned_close_log( struct wish_state* state, struct wish_spawn* spawned ) {
+   if( spawned->has_log ) {
+      outlog_close( state, spawned->gpid );
+      spawned->has_log = false;
+   }
+}
+
+// a spawned process is long past its timeout, and its executor still hasn't told us it ended (called from the timer thread).
+// tell the executor to kill it, and give up on it.
+static void process_spawned_timeout( struct wish_state* state, uint64_t gpid ) {
+   struct wish_spawn* spawn = spawned_get( gpid );
+   if( spawn == NULL )
+      return;
+   
+   bool give_up = false;
+   
+   struct process_join_replies replies;
+   replies.ended = false;
+   
+   gpid_entry_lock( &spawn->ent );
+   
+   if( !spawn->ent.removed && spawn->status != PROCESS_STATUS_FINISHED ) {
+      errorf("process_spawned_timeout: no word from the executor of %lu; giving up on it\n", gpid );
+      
+      process_do_join( state, spawn, PROCESS_TYPE_TIMEOUT, gpid, 0, &replies );
+      process_spawned_release_slot( state, spawn );
+      process_spawned_close_log( state, spawn );
+      
+      gpid_table_remove( &spawned, &spawn->ent );
+      give_up = true;
+   }
+   
+   gpid_entry_unlock( &spawn->ent );
+   
+   process_join_reply( state, &replies );
+   
+   if( give_up ) {
+      // tell the executor to kill it.  Our reference keeps the connection open until we're done.
+      int rc = process_spawned_send( state, spawn, PROCESS_TYPE_PSIG, SIGKILL, 0 );
+      if( rc != 0 ) {
+         errorf("process_spawned_timeout: could not signal %lu, rc = %d\n", gpid, rc );
+      }
+   }
+   
+   spawned_put( spawn );
 }
 
 // process a process packet (on the originator)
-// spawned should be write-locked
 // return 0 on success
 // return negative on error
 // return 1 if the spawned process has died
 int process_update( struct wish_state* state, struct wish_process_packet* pkt ) {
    int rc = 0;
    
-   if( spawned.find( pkt->gpid ) != spawned.end() ) {
+   struct wish_spawn* spawn = spawned_get( pkt->gpid );
+   if( spawn == NULL ) {
+      errorf("process_update: no process with gpid = %lu\n", pkt->gpid );
+      return -ENOENT;
+   }
+   
+   struct process_join_replies replies;
+   replies.ended = false;
+   
+   gpid_entry_lock( &spawn->ent );
+   
+   if( spawn->ent.removed ) {
+      errorf("process_update: no process with gpid = %lu\n", pkt->gpid );
+      rc = -ENOENT;
+   }
+   else {
       dbprintf("process_update: packet type %d\n", pkt->type );
       switch( pkt->type ) {
          case PROCESS_TYPE_STARTED: {
             // mark this prcoess as having started up
-            spawned[ pkt->gpid ]->start_time = time(NULL);
-            spawned[ pkt->gpid ]->status = PROCESS_STATUS_STARTED;
-            if( spawned[pkt->gpid]->client ) {
+            spawn->start_time = time(NULL);
+            spawn->status = PROCESS_STATUS_STARTED;
+            
+            // the executor enforces the timeout; only step in if it never tells us about it
+            if( spawn->timeout > 0 ) {
+               timer_arm( &spawn->timeout_timer, (uint64_t)spawn->timeout * 1000 + PROCESS_TIMEOUT_SLACK_MS );
+            }
+            if( spawn->client ) {
                // pass this along to the client program
-               rc = wish_process_reply( state, spawned[pkt->gpid]->client, PROCESS_TYPE_STARTED, pkt->gpid, 0 );
+               rc = wish_process_reply( state, spawn->client, PROCESS_TYPE_STARTED, pkt->gpid, 0 );
                if( rc != 0 ) {
                   errorf("process_update: could not reply START to client, rc = %d\n", rc );
                }
                
-               wish_disconnect( state, spawned[pkt->gpid]->client );
-               free( spawned[pkt->gpid]->client = NULL );
-               spawned[pkt->gpid]->client = NULL;
+               wish_disconnect( state, spawn->client );
+               free( spawn->client );
+               spawn->client = NULL;
             }
             break;
          }
          case PROCESS_TYPE_EXIT: {
             // mark this process as having finished
-            spawned[ pkt->gpid ]->status = PROCESS_STATUS_FINISHED;
-            spawned[ pkt->gpid ]->exit_code = pkt->data;
-            
-            if( spawned[pkt->gpid]->flags & JOB_DETACHED ) {
-               // no need to wait for join
-               wish_spawned_destroy( state, spawned[pkt->gpid] );
-               free( spawned[pkt->gpid] );
-               spawned[pkt->gpid] = NULL;
-               rc = PROCESS_UPDATE_DESTROYED;
+            spawn->status = PROCESS_STATUS_FINISHED;
+            spawn->exit_code = pkt->data;
+            process_spawned_release_slot( state, spawn );
+            process_spawned_close_log( state, spawn );
             
+            if( !(spawn->flags & JOB_DETACHED) && !process_spawned_written( spawn ) ) {
+               // the joiners are told once stdout and stderr are written (by our output loop), so they see all of it
+               spawn->join_pending = true;
+               break;
             }
-            else {
-               // flush stdout and stderr nevertheless
-               if( spawned[pkt->gpid]->stdout )
-                  fflush( spawned[pkt->gpid]->stdout );
-               if( spawned[pkt->gpid]->stderr )
-                  fflush( spawned[pkt->gpid]->stderr );
-               
-               rc = process_do_join( state, &spawned[pkt->gpid], pkt->type, pkt->gpid, pkt->data );
-            }
+            
+            // its outcome stays in the result cache for joins that come later
+            rc = process_do_join( state, spawn, pkt->type, pkt->gpid, pkt->data, &replies );
             
             break;
          }
          case PROCESS_TYPE_ERROR:
          case PROCESS_TYPE_FAILURE: {
             // erase this process--it failed to run
-            if( spawned.find( pkt->gpid ) != spawned.end() ) {
-               rc = process_do_join( state, &spawned[pkt->gpid], pkt->type, pkt->gpid, pkt->data );
-               
-               if( rc != PROCESS_UPDATE_DESTROYED ) {
-                  wish_spawned_destroy( state, spawned[ pkt->gpid ] );
-                  free( spawned[pkt->gpid] );
-                  spawned[pkt->gpid] = NULL;
-                  rc = PROCESS_UPDATE_DESTROYED;
-               }
-               errorf("process_update: process %lu has failed\n", pkt->gpid );
-            }
-            else {
-               errorf("process_update: unknown process %lu failed\n", pkt->gpid );
-            }
+            process_do_join( state, spawn, pkt->type, pkt->gpid, pkt->data, &replies );
+            process_spawned_release_slot( state, spawn );
+            process_spawned_close_log( state, spawn );
+            rc = PROCESS_UPDATE_DESTROYED;
+            errorf("process_update: process %lu has failed\n", pkt->gpid );
             break;
          }
          case PROCESS_TYPE_TIMEOUT: {
             // erase this process--it timed out
-            
-            rc = process_do_join( state, &spawned[pkt->gpid], pkt->type, pkt->gpid, pkt->data );
-            
-            wish_spawned_destroy( state, spawned[ pkt->gpid ] );
-            free( spawned[pkt->gpid] );
-            spawned[pkt->gpid] = NULL;
+            process_do_join( state, spawn, pkt->type, pkt->gpid, pkt->data, &replies );
+            process_spawned_release_slot( state, spawn );
+            process_spawned_close_log( state, spawn );
             rc = PROCESS_UPDATE_DESTROYED;
             errorf("process_update: process %lu has timed out\n", pkt->gpid );
             break;
@@ -1616,11 +3107,17 @@ int process_update( struct wish_state* state, struct wish_process_packet* pkt )
             break;
          }
       }
+      
+      if( rc == PROCESS_UPDATE_DESTROYED ) {
+         // freed once the last reference to it is gone
+         gpid_table_remove( &spawned, &spawn->ent );
+      }
    }
-   else {
-      errorf("process_update: no process with gpid = %lu\n", pkt->gpid );
-      rc = -ENOENT;
-   }
+   
+   gpid_entry_unlock( &spawn->ent );
+   
+   process_join_reply( state, &replies );
+   spawned_put( spawn );
    
    return rc;
 }
@@ -1630,14 +3127,15 @@ int process_recv_signal( struct wish_state* state, uint64_t gpid, int signal ) {
    int rc = 0;
    
    dbprintf("process_recv_signal: got signal %d for gpid %lu\n", signal, gpid );
-   ProcessTable::iterator itr = procs.find( gpid );
-   if( itr != procs.end() ) {
-      struct wish_process* proc = itr->second;
+   struct wish_process* proc = procs_get( gpid );
+   if( proc != NULL ) {
+      // pid never changes once the process is in the table
       rc = kill( proc->pid, signal );
       dbprintf("process_recv_signal: sent signal %d for gpid %lu (pid = %d), rc = %d\n", signal, gpid, proc->pid, rc );
       if( rc != 0 ) {
          rc = -errno;
       }
+      procs_put( proc );
    }
    else {
       rc = -ENOENT;
@@ -1651,38 +3149,54 @@ int process_recv_signal( struct wish_state* state, uint64_t gpid, int signal ) {
 int process_recv_signal_all( struct wish_state* state, int signal ) {
    int rc = 0;
    
-   for( ProcessTable::iterator itr = procs.begin(); itr != procs.end(); itr++ ) {
-      struct wish_process* proc = itr->second;
+   GpidEntryList ents;
+   gpid_table_snapshot( &procs, &ents );
+   
+   for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+      struct wish_process* proc = (struct wish_process*)ents[i];
       int kill_rc = kill( proc->pid, signal );
       if( kill_rc != 0 ) {
          rc++;
       }
    }
    
+   gpid_table_put_all( &procs, &ents );
    return rc;
 }
 
+// give a running process (that is local) more output credit.
+int process_recv_credit( struct wish_state* state, uint64_t gpid, uint32_t bytes ) {
+   struct wish_process* proc = procs_get( gpid );
+   if( proc == NULL )
+      return -ENOENT;
+   
+   gpid_entry_lock( &proc->ent );
+   if( proc->credits < PROCESS_OUTPUT_UNMETERED - bytes )
+      proc->credits += bytes;
+   gpid_entry_unlock( &proc->ent );
+   
+   procs_put( proc );
+   return 0;
+}
+
 // signal a running process (that is remote)
 int process_send_signal( struct wish_state* state, uint64_t gpid, int signal ) {
    int rc = 0;
    
-   spawned_rlock();
-   SpawnTable::iterator itr = spawned.find( gpid );
-   if( itr != spawned.end() ) {
-      struct wish_process_packet pkt;
-      wish_init_process_packet( state, &pkt, PROCESS_TYPE_PSIG, gpid, signal, 0 );
-      
-      struct wish_packet wpkt;
-      wish_pack_process_packet( state, &wpkt, &pkt );
-      
-      rc = wish_write_packet( state, itr->second->con, &wpkt );
-      
-      wish_free_packet( &wpkt );
-   }
-   else {
+   struct wish_spawn* spawn = spawned_get( gpid );
+   if( spawn == NULL )
+      return -ENOENT;
+   
+   gpid_entry_lock( &spawn->ent );
+   bool removed = spawn->ent.removed;
+   gpid_entry_unlock( &spawn->ent );
+   
+   if( !removed )
+      rc = process_spawned_send( state, spawn, PROCESS_TYPE_PSIG, signal, 0 );
+   else
       rc = -ENOENT;
-   }
-   spawned_unlock();
+   
+   spawned_put( spawn );
    return rc;
 }
 
@@ -1691,65 +3205,202 @@ int process_send_signal( struct wish_state* state, uint64_t gpid, int signal ) {
 int process_send_signal_all( struct wish_state* state, int signal ) {
    int rc = -ENONET;
    
-   spawned_rlock();
-   for( SpawnTable::iterator itr = spawned.begin(); itr != spawned.end(); itr++ ) {
-      struct wish_process_packet pkt;
-      wish_init_process_packet( state, &pkt, PROCESS_TYPE_PSIGALL, itr->second->gpid, signal, 0 );
+   GpidEntryList ents;
+   gpid_table_snapshot( &spawned, &ents );
+   
+   for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+      struct wish_spawn* spawn = (struct wish_spawn*)ents[i];
       
-      struct wish_packet wpkt;
-      wish_pack_process_packet( state, &wpkt, &pkt );
+      gpid_entry_lock( &spawn->ent );
+      bool removed = spawn->ent.removed;
+      gpid_entry_unlock( &spawn->ent );
       
-      int write_rc = wish_write_packet( state, itr->second->con, &wpkt );
-      if( write_rc != 0 ) {
-         errorf("process_send_signal_all: wish_write_packet to %lu rc = %d\n", itr->second->gpid, write_rc );
+      int write_rc = -ENOENT;
+      if( !removed ) {
+         write_rc = process_spawned_send( state, spawn, PROCESS_TYPE_PSIGALL, signal, 0 );
+         if( write_rc != 0 ) {
+            errorf("process_send_signal_all: wish_write_packet to %lu rc = %d\n", spawn->gpid, write_rc );
+         }
       }
       
-      wish_free_packet( &wpkt );
-      
       if( write_rc == 0 ) {
          rc = 0;
          break;
       }
    }
-   spawned_unlock();
+   
+   gpid_table_put_all( &spawned, &ents );
    return rc;
 }
 
-// join on a running process (on the origin).  return 0 on success; negative on error.
-int process_join( struct wish_state* state, struct wish_connection* con, uint64_t gpid, bool block ) {
-   int rc = 0;
+// join on every member of a job array (on the origin).  Members are replied to as they end.
+// return 0 on success (in which case con belongs to the join); negative on error.
+static int process_join_array( struct wish_state* state, struct wish_connection* con, uint64_t array_id, bool block, bool want_usage ) {
+   vector<uint64_t> members;
+   
+   pthread_rwlock_wrlock( &arrays_lock );
+   
+   ArrayTable::iterator itr = arrays.find( array_id );
+   if( itr == arrays.end() ) {
+      pthread_rwlock_unlock( &arrays_lock );
+      return -ENOENT;
+   }
    
-   spawned_wlock();
-   SpawnTable::iterator itr = spawned.find( gpid );
-   if( itr != spawned.end() ) {
-      if( itr->second->status == PROCESS_STATUS_FINISHED ) {
-         // process already terminated--reply the exit status
-         itr->second->join = con;
-         rc = process_do_join( state, &itr->second, PROCESS_TYPE_EXIT, gpid, itr->second->exit_code );
+   members = itr->second;
+   
+   if( !block ) {
+      // only join if every member is done
+      for( vector<uint64_t>::size_type i = 0; i < members.size(); i++ ) {
+         struct wish_spawn* spawn = spawned_get( members[i] );
+         if( spawn == NULL )
+            continue;
          
-         if( rc > 0 )
-            // this is fine.
-            rc = 0;
+         gpid_entry_lock( &spawn->ent );
+         bool running = !spawn->ent.removed && spawn->status != PROCESS_STATUS_FINISHED;
+         gpid_entry_unlock( &spawn->ent );
+         spawned_put( spawn );
          
-         spawned.erase( gpid );
-      }
-      else if( block ) {
-         // register this connection to be replied to when the process dies
-         if( itr->second->join ) {
-            wish_disconnect( state, itr->second->join );
-            free( itr->second->join );
+         if( running ) {
+            pthread_rwlock_unlock( &arrays_lock );
+            
+            // reply that it's still working
+            int rc = wish_process_reply( state, con, PROCESS_TYPE_ERROR, array_id, -EAGAIN );
+            if( rc != 0 )
+               return rc;
+            
+            wish_disconnect( state, con );
+            free( con );
+            return 0;
          }
-         itr->second->join = con;
+      }
+   }
+   
+   arrays.erase( itr );
+   pthread_rwlock_unlock( &arrays_lock );
+   
+   // tell the client how many replies to expect
+   int rc = wish_process_reply( state, con, PROCESS_TYPE_ARRAY, array_id, members.size() );
+   if( rc != 0 ) {
+      // someone else can join it
+      pthread_rwlock_wrlock( &arrays_lock );
+      arrays[ array_id ] = members;
+      pthread_rwlock_unlock( &arrays_lock );
+      return rc;
+   }
+   
+   // each member holds a reference to the join until it's replied; we hold one until they've all been visited
+   struct process_array_join* aj = (struct process_array_join*)calloc( sizeof(struct process_array_join), 1 );
+   aj->con = con;
+   aj->want_usage = want_usage;
+   aj->refs = members.size() + 1;
+   pthread_mutex_init( &aj->lock, NULL );
+   
+   for( vector<uint64_t>::size_type i = 0; i < members.size(); i++ ) {
+      struct wish_spawn* spawn = spawned_get( members[i] );
+      if( spawn == NULL ) {
+         // already ended
+         process_array_join_result( state, aj, members[i] );
+         continue;
+      }
+      
+      gpid_entry_lock( &spawn->ent );
+      
+      if( spawn->ent.removed ) {
+         process_array_join_result( state, aj, members[i] );
+      }
+      else if( spawn->status == PROCESS_STATUS_FINISHED && !spawn->join_pending ) {
+         // already terminated--reply the exit status
+         struct wish_usage_packet usage;
+         process_spawned_usage( state, spawn, members[i], &usage );
+         process_array_join_reply( state, aj, PROCESS_TYPE_EXIT, members[i], spawn->exit_code, &usage );
+         
+         gpid_table_remove( &spawned, &spawn->ent );
       }
       else {
-         // reply that it's still working
-         rc = wish_process_reply( state, con, PROCESS_TYPE_ERROR, gpid, -EAGAIN );
+         // reply when it dies
+         spawn->array_join = aj;
       }
+      
+      gpid_entry_unlock( &spawn->ent );
+      spawned_put( spawn );
    }
-   else {
+   
+   process_array_join_put( state, aj );
+   return 0;
+}
+
+// join on a process that has already ended, from the result cache.  Takes ownership of con on success.
+// return 0 on success; -ENOENT if its outcome isn't known; other negative on error
+static int process_join_result( struct wish_state* state, struct wish_connection* con, uint64_t gpid, bool want_usage ) {
+   struct job_result result;
+   int rc = results_get( state, gpid, &result );
+   if( rc != 0 )
+      return rc;
+   
+   rc = results_reply( state, con, &result, want_usage );
+   if( rc == 0 ) {
+      wish_disconnect( state, con );
+      free( con );
+   }
+   return rc;
+}
+
+// join on a running process, job array, or DAG (on the origin).  return 0 on success; negative on error.
+int process_join( struct wish_state* state, struct wish_connection* con, uint64_t gpid, bool block, bool want_usage ) {
+   int rc = 0;
+   
+   struct wish_spawn* spawn = spawned_get( gpid );
+   if( spawn == NULL ) {
+      // maybe it has already ended
+      rc = process_join_result( state, con, gpid, want_usage );
+      if( rc != -ENOENT )
+         return rc;
+      
+      // maybe it's a job array or a DAG
+      rc = process_join_array( state, con, gpid, block, want_usage );
+      if( rc == -ENOENT )
+         rc = dag_join( state, con, gpid, block, want_usage );
+      return rc;
+   }
+   
+   struct process_joiner joiner;
+   joiner.con = con;
+   joiner.want_usage = want_usage;
+   
+   struct process_join_replies replies;
+   replies.ended = false;
+   
+   gpid_entry_lock( &spawn->ent );
+   if( spawn->ent.removed ) {
       rc = -ENOENT;
    }
-   spawned_unlock();
+   else if( spawn->status == PROCESS_STATUS_FINISHED && !spawn->join_pending ) {
+      // process already terminated--reply the exit status
+      spawn->joins->push_back( joiner );
+      process_do_join( state, spawn, PROCESS_TYPE_EXIT, gpid, spawn->exit_code, &replies );
+      gpid_table_remove( &spawned, &spawn->ent );
+   }
+   else if( block ) {
+      // reply to this connection (along with any others) when the process dies
+      spawn->joins->push_back( joiner );
+   }
+   else {
+      // reply that it's still working
+      rc = wish_process_reply( state, con, PROCESS_TYPE_ERROR, gpid, -EAGAIN );
+      if( rc == 0 ) {
+         wish_disconnect( state, con );
+         free( con );
+      }
+   }
+   gpid_entry_unlock( &spawn->ent );
+   
+   process_join_reply( state, &replies );
+   spawned_put( spawn );
+   
+   if( rc == -ENOENT ) {
+      // it ended while we were looking
+      rc = process_join_result( state, con, gpid, want_usage );
+   }
    
    return rc;
 }
@@ -1776,18 +3427,19 @@ int process_start( struct wish_state* state, struct wish_connection* con, struct
 // look up the gpid of a process that is executing here.
 // return 0 on failure
 uint64_t process_get_gpid( struct wish_state* state, pid_t pid ) {
-   procs_rlock();
+   GpidEntryList ents;
+   gpid_table_snapshot( &procs, &ents );
    
    uint64_t ret = 0;
-   for( ProcessTable::iterator itr = procs.begin(); itr != procs.end(); itr++ ) {
-      if( itr->second->pid == pid ) {
-         ret = itr->first;
+   for( GpidEntryList::size_type i = 0; i < ents.size(); i++ ) {
+      struct wish_process* proc = (struct wish_process*)ents[i];
+      if( proc->pid == pid ) {
+         ret = proc->gpid;
          break;
       }
    }
    
-   procs_unlock();
+   gpid_table_put_all( &procs, &ents );
    
    return ret;
 }
-
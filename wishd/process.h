@@ -4,7 +4,23 @@
 #include "libwish.h"
 #include "http.h"
 #include "heartbeat.h"
+#include "zygote.h"
+#include "cache.h"
+#include "fetch.h"
+#include "usage.h"
+#include "timer.h"
+#include "gpidtable.h"
+#include "scheduler.h"
+#include "dag.h"
+#include "outlog.h"
+#include "pinning.h"
+#include "sink.h"
+#include "results.h"
 #include <map>
+#include <vector>
+#include <algorithm>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 
 using namespace std;
 
@@ -17,11 +33,60 @@ using namespace std;
 
 #define PROCESS_READ_SIZE 4096
 
+// most fds a forked child keeps from the daemon (besides stdin, stdout, and stderr)
+#define PROCESS_MAX_KEEP_FDS 16
+
+// directory entry, as getdents64(2) gives it (glibc has no wrapper on older systems)
+struct process_dirent64 {
+   uint64_t d_ino;
+   int64_t d_off;
+   unsigned short d_reclen;
+   unsigned char d_type;
+   char d_name[];
+};
+
+// how many bytes of output an executor may send for a job before the origin grants it more credit.
+// anything beyond this stays in the job's output file on the executor's disk until the origin catches up.
+#define PROCESS_OUTPUT_WINDOW (PROCESS_READ_SIZE * 16)
+
+// credit of a job whose origin doesn't grant any (see JOB_CREDIT)
+#define PROCESS_OUTPUT_UNMETERED INT64_MAX
+
 #define PROCESS_UPDATE_DESTROYED 1
 
+// how long a timed-out job gets to exit after SIGTERM before it's sent SIGKILL
+#define PROCESS_KILL_GRACE_MS    5000
+
+// how long past a job's timeout the origin waits for the executor to report it, before giving up on the job
+#define PROCESS_TIMEOUT_SLACK_MS 30000
+
+// ways a job can be launched
+#define PROCESS_LAUNCH_FORK      0        // forked by the daemon
+#define PROCESS_LAUNCH_ZYGOTE    1        // handed to a pre-forked zygote worker
+
+// how a job gets its stdin
+#define PROCESS_STDIN_SPOOLED    0        // downloaded to disk before the job starts
+#define PROCESS_STDIN_STREAMED   1        // fed through a pipe as it downloads
+
+// most output threads per side.  Each one serves at least one shard of the process tables.
+#define PROCESS_MAX_OUTPUT_LOOPS GPID_TABLE_SHARDS
+
+// most instances of a job array the origin dispatches at once
+#define PROCESS_ARRAY_DISPATCH_THREADS 16
+
+// how many recent latencies to remember per measurement
+#define PROCESS_LATENCY_SAMPLES  1024
+
+// ring of recent latency samples (in microseconds)
+struct process_latency {
+   uint64_t samples[PROCESS_LATENCY_SAMPLES];
+   uint64_t count;                           // total number of samples ever taken
+};
+
 // running process info.
 // contains information about processes running locally.
 struct wish_process {
+   struct gpid_entry ent;        // process table entry (must come first)
    uint64_t gpid;                // WISH-wide pid
    pid_t pid;                    // the PID of the process running locally
    struct wish_connection* con;  // connection to the originator
@@ -29,24 +94,82 @@ struct wish_process {
    int stderr_fd;                // fd to stderr on disk
    char* stdout_path;            // path to stdout
    char* stderr_path;            // path to stderr
-   time_t expire;                // when this process should expire (-1 for never)
+   struct timer expire_timer;    // fires when this process times out (and again if it ignores SIGTERM)
    bool finished;                // set to true once the process terminates
+   bool timed_out;               // set to true if we killed the process because it expired
+   int exit_type;                // process packet type to send to the originator once all output has been sent
+   int exit_data;                // data to send with exit_type
+   bool exit_queued;             // has the exit packet been put into outbuf?
+   
+   // output flow control
+   uint8_t* outbuf;              // serialized packets waiting to be sent to the originator
+   size_t outbuf_len;            // number of bytes in outbuf
+   size_t outbuf_cap;            // number of bytes outbuf has room for
+   size_t outbuf_sent;           // number of bytes of outbuf that have been sent
+   int64_t credits;              // number of output bytes the originator will still accept
+   
+   // measurements
+   struct timeval job_start;     // when we got the job
+   int stdin_mode;               // PROCESS_STDIN_SPOOLED or PROCESS_STDIN_STREAMED
+   bool have_output;             // have we sent any output yet?
+   struct wish_usage_packet usage;  // resources the process used (sent to the originator before the exit packet)
+   bool have_usage;              // has usage been filled in?
+};
+
+// a pjoin waiting on a whole job array.
+// each member of the array replies to it as the member ends, and the last one closes the connection.
+struct process_array_join {
+   struct wish_connection* con;  // connection to the joining client (NULL if it broke)
+   bool want_usage;              // send each member's resource usage after its exit status?
+   int refs;                     // members that have yet to reply, plus one while the join is being set up
+   pthread_mutex_t lock;
+};
+
+// a client joined on a process
+struct process_joiner {
+   struct wish_connection* con;
+   bool want_usage;              // send the process's resource usage after its exit status?
+};
+
+// what a process's joiners are owed once it has ended.  Gathered under the process's entry lock (see
+// process_do_join) and sent once it's unlocked, so a slow joiner holds up neither the entry nor the others.
+struct process_join_replies {
+   bool ended;                   // is anything owed?
+   struct job_result result;
+   vector<struct process_joiner> joins;
+   struct process_array_join* array_join;   // join on the process's job array, to tell of it (NULL if none)
+   struct dag_run* dag;          // DAG the process is a node of, to tell of it (NULL if none)
+   uint32_t dag_node;
 };
 
 // spawned process info
 // contains information about processes spawned locally.
 struct wish_spawn {
+   struct gpid_entry ent;        // spawn table entry (must come first)
    uint64_t gpid;                // WISH-wide pid
    struct wish_connection* con;  // connection to the daemon running the process
+   pthread_mutex_t send_lock;    // serializes writes to con (taken without the entry lock, so a slow executor only holds up its own job)
    struct wish_connection* client;  // connection to the client program that spawned the process
-   struct wish_connection* join;    // connection to the client program that wants to join with this process
+   vector<struct process_joiner>* joins;  // clients waiting for this process to end (all answered at once)
    time_t start_time;            // when did we spawn the process?
    time_t timeout;               // how long until we can kill this process due to timeout
+   struct timer timeout_timer;   // fires if the executor hasn't reported the process's end well after its timeout
    int status;                   // what state is the process known to be in?
    uint32_t flags;               // process properties
    int exit_code;                // process's exit code
-   FILE* stdout;                 // file stream to the process's stdout
-   FILE* stderr;                 // file stream to the process's stderr
+   uint32_t owner;               // uid of the user that spawned the process
+   struct wish_usage_packet usage;  // resources the process used, as reported by the executor
+   bool have_usage;              // has the executor reported usage?
+   struct process_array_join* array_join;   // join on the job array this process is in, waiting on it too (NULL if none)
+   struct dag_run* dag;          // DAG this process is a node of, waiting on it (NULL if none)
+   uint32_t dag_node;            // which node of it
+   uint64_t nid;                 // host the process runs on
+   bool sched_slot;              // does the process hold one of the scheduler's slots on that host?
+   bool has_log;                 // does it have an output log to close when it ends?
+   struct sink_file* stdout;     // file the process's stdout is written to
+   struct sink_file* stderr;     // file the process's stderr is written to
+   uint32_t credit_owed;         // output credit withheld from the executor until those files catch up
+   bool join_pending;            // it has exited; its joiners are told once those files are written
 };
 
 struct process_run_args {
@@ -55,6 +178,37 @@ struct process_run_args {
    struct wish_job_packet* job;
 };
 
+// arguments to an output thread
+struct process_loop_args {
+   struct wish_state* state;
+   int part;                     // which part of the process table (by gpid) this thread serves
+};
+
+// arguments to the threads dispatching a job array's instances
+struct process_array_dispatch {
+   struct wish_state* state;
+   struct wish_job_array_packet* arr;
+   uint64_t* nids;               // where each instance runs (0 if nowhere)
+   char** hostnames;             // name of the host each instance runs on
+   uint64_t* gpids;              // gpid of each instance, filled in as they start (0 if it couldn't be)
+   uint32_t next;                // next instance to start
+   pthread_mutex_t lock;         // protects next
+};
+
+// arguments to the thread spawning a job array
+struct process_array_args {
+   struct wish_state* state;
+   struct wish_job_array_packet* arr;
+   struct wish_connection* con;  // client to reply the instances' gpids to
+};
+
+struct process_feed_args {
+   struct wish_state* state;
+   char* url;                    // URL to download the job's stdin from
+   int fd;                       // write end of the job's stdin pipe
+   uint64_t gpid;                // job we're feeding
+};
+
 
 // initialize processes
 int process_init( struct wish_state* state );
@@ -65,6 +219,26 @@ int process_shutdown( struct wish_state* state );
 // start a process (called by an origin daemon to send off a process)
 int process_spawn( struct wish_state* state, struct wish_job_packet* job, struct wish_connection* con, uint64_t nid);
 
+// make a client's job files available to executors, as URLs on this host
+int process_publish_job( struct wish_state* state, struct wish_job_packet* job );
+
+// is nid one of the names for this host?
+bool process_is_localhost( struct wish_state* state, uint64_t nid );
+
+// how many jobs are running here (as an executor)
+uint32_t process_num_running( struct wish_state* state );
+
+// spawn a job as a node of a DAG (called by an origin daemon).  The DAG is told how the job ends, instead of a client.
+int process_spawn_dag( struct wish_state* state, struct wish_job_packet* job, uint64_t nid, struct dag_run* dag, uint32_t dag_node );
+
+// pick a random id for something that can be joined on like a process (a job array or a DAG)
+uint64_t process_random_id(void);
+
+// start every instance of a job array in the background (called by an origin daemon), and reply the instances' gpids
+// to the client on con.  Takes ownership of arr and con (both allocated with malloc) on success.
+// return 0 on success; negative on error (in which case nothing has been sent to the client, and arr and con are still the caller's)
+int process_spawn_array( struct wish_state* state, struct wish_job_array_packet* arr, struct wish_connection* con );
+
 // update the status of a process (called by an origin daemon as it receives status updates from a remote executor)
 int process_update( struct wish_state* state, struct wish_process_packet* pkt );
 
@@ -81,6 +255,9 @@ int process_recv_signal( struct wish_state* state, uint64_t gpid, int signal );
 // signal all running processes (called on an executing daemon)
 int process_recv_signal_all( struct wish_state* state, int signal );
 
+// give a running process more output credit (called on an executing daemon, when the origin has consumed output)
+int process_recv_credit( struct wish_state* state, uint64_t gpid, uint32_t bytes );
+
 // signal a running process (called on an origin daemon)
 int process_send_signal( struct wish_state* state, uint64_t gpid, int signal );
 
@@ -90,11 +267,25 @@ int process_send_signal_all( struct wish_state* state, int signal );
 
 // join on a running process (called on an origin daemon).   return 0 on success; negative on error.
 // only gets called on an origin daemon.
-int process_join( struct wish_state* state, struct wish_connection* con, uint64_t gpid, bool block );
+// if want_usage is true, the process's resource usage is sent back after its exit status.
+// if gpid is a job array, a PROCESS_TYPE_ARRAY reply goes back first, followed by one reply per instance as each one ends.
+int process_join( struct wish_state* state, struct wish_connection* con, uint64_t gpid, bool block, bool want_usage );
 
 // reply a process packet
 int wish_process_reply( struct wish_state* state, struct wish_connection* con, int type, uint64_t gpid, int data );
 
+// get the number of jobs launched with the given method, and the median and 99th percentile launch latency (in microseconds) of the most recent ones.
+// return 0 on success; negative on error
+int process_launch_stats( int method, uint64_t* count, uint64_t* p50, uint64_t* p99 );
+
+// get the number of jobs that produced output with the given stdin mode, and the median and 99th percentile
+// time (in microseconds) from receiving the job to sending its first output.
+// return 0 on success; negative on error
+int process_first_output_stats( int stdin_mode, uint64_t* count, uint64_t* p50, uint64_t* p99 );
+
+// get the number of bytes of stdin currently spooled to disk, and the most that has ever been spooled at once
+void process_stdin_spool_stats( uint64_t* current, uint64_t* peak );
+
 // translate a local PID to the GPID of a process this daemon is running (called on the executing daemon)
 uint64_t process_get_gpid( struct wish_state* state, pid_t pid );
 
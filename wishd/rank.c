@@ -0,0 +1,190 @@
+#include "rank.h"
+
+// make a node with a given number of levels
+static struct rank_node* rank_node_new( int height, double key, uint64_t nid ) {
+   struct rank_node* n = (struct rank_node*)calloc( sizeof(struct rank_node) + (height - 1) * sizeof(struct rank_link), 1 );
+   if( n == NULL )
+      return NULL;
+   
+   n->key = key;
+   n->nid = nid;
+   n->height = height;
+   return n;
+}
+
+
+// does a node sort ahead of (key, nid)?
+static bool rank_before( struct rank_node* n, double key, uint64_t nid ) {
+   return n->key < key || (n->key == key && n->nid < nid);
+}
+
+
+// how many levels a new node gets
+static int rank_random_level( struct rank_list* r ) {
+   int level = 1;
+   while( level < RANK_MAX_LEVEL ) {
+      // xorshift; we only need it cheap and well spread
+      r->seed ^= r->seed << 13;
+      r->seed ^= r->seed >> 17;
+      r->seed ^= r->seed << 5;
+   
+      if( r->seed % RANK_BRANCHING != 0 )
+         break;
+   
+      level++;
+   }
+   return level;
+}
+
+
+// set up an empty list
+int rank_init( struct rank_list* r ) {
+   r->head = rank_node_new( RANK_MAX_LEVEL, 0, 0 );
+   if( r->head == NULL )
+      return -ENOMEM;
+   
+   r->level = 1;
+   r->size = 0;
+   r->seed = 2463534242U;
+   return 0;
+}
+
+
+// free the list and everything in it
+void rank_free( struct rank_list* r ) {
+   struct rank_node* n = r->head;
+   while( n != NULL ) {
+      struct rank_node* next = n->links[0].next;
+      free( n );
+      n = next;
+   }
+   
+   memset( r, 0, sizeof(struct rank_list) );
+}
+
+
+// find the last node on each level that sorts ahead of (key, nid), and how many hosts precede it
+static void rank_find( struct rank_list* r, double key, uint64_t nid, struct rank_node** update, uint32_t* rank ) {
+   struct rank_node* x = r->head;
+   for( int i = r->level - 1; i >= 0; i-- ) {
+      rank[i] = (i == r->level - 1 ? 0 : rank[i+1]);
+   
+      while( x->links[i].next != NULL && rank_before( x->links[i].next, key, nid ) ) {
+         rank[i] += x->links[i].span;
+         x = x->links[i].next;
+      }
+   
+      update[i] = x;
+   }
+}
+
+
+// file a host under a key
+int rank_insert( struct rank_list* r, double key, uint64_t nid ) {
+   struct rank_node* update[RANK_MAX_LEVEL];
+   uint32_t rank[RANK_MAX_LEVEL];
+   
+   rank_find( r, key, nid, update, rank );
+   
+   int height = rank_random_level( r );
+   struct rank_node* n = rank_node_new( height, key, nid );
+   if( n == NULL )
+      return -ENOMEM;
+   
+   if( height > r->level ) {
+      for( int i = r->level; i < height; i++ ) {
+         rank[i] = 0;
+         update[i] = r->head;
+         update[i]->links[i].span = r->size;
+      }
+      r->level = height;
+   }
+   
+   for( int i = 0; i < height; i++ ) {
+      n->links[i].next = update[i]->links[i].next;
+      update[i]->links[i].next = n;
+   
+      // split the span of the link we cut in two
+      n->links[i].span = update[i]->links[i].span - (rank[0] - rank[i]);
+      update[i]->links[i].span = (rank[0] - rank[i]) + 1;
+   }
+   
+   // links over the new node now pass one more host
+   for( int i = height; i < r->level; i++ ) {
+      update[i]->links[i].span++;
+   }
+   
+   r->size++;
+   return 0;
+}
+
+
+// drop a host filed under a key
+int rank_remove( struct rank_list* r, double key, uint64_t nid ) {
+   struct rank_node* update[RANK_MAX_LEVEL];
+   uint32_t rank[RANK_MAX_LEVEL];
+   
+   rank_find( r, key, nid, update, rank );
+   
+   struct rank_node* x = update[0]->links[0].next;
+   if( x == NULL || x->key != key || x->nid != nid )
+      return -ENOENT;
+   
+   for( int i = 0; i < r->level; i++ ) {
+      if( update[i]->links[i].next == x ) {
+         update[i]->links[i].span += x->links[i].span - 1;
+         update[i]->links[i].next = x->links[i].next;
+      }
+      else {
+         update[i]->links[i].span--;
+      }
+   }
+   
+   while( r->level > 1 && r->head->links[ r->level - 1 ].next == NULL ) {
+      r->level--;
+   }
+   
+   free( x );
+   r->size--;
+   return 0;
+}
+
+
+// how many hosts sort ahead of (key, nid)
+uint32_t rank_count_below( struct rank_list* r, double key, uint64_t nid ) {
+   uint32_t count = 0;
+   struct rank_node* x = r->head;
+   for( int i = r->level - 1; i >= 0; i-- ) {
+      while( x->links[i].next != NULL && rank_before( x->links[i].next, key, nid ) ) {
+         count += x->links[i].span;
+         x = x->links[i].next;
+      }
+   }
+   return count;
+}
+
+
+// get the nids of the hosts of rank first, first+1, ...
+uint32_t rank_range( struct rank_list* r, uint32_t first, uint32_t count, uint64_t* nids ) {
+   if( first >= r->size || count == 0 )
+      return 0;
+   
+   // skip down to the host of rank first (first+1 hosts in)
+   uint32_t traversed = 0;
+   struct rank_node* x = r->head;
+   for( int i = r->level - 1; i >= 0; i-- ) {
+      while( x->links[i].next != NULL && traversed + x->links[i].span <= first + 1 ) {
+         traversed += x->links[i].span;
+         x = x->links[i].next;
+      }
+   }
+   
+   // then walk the bottom level
+   uint32_t num = 0;
+   while( x != NULL && num < count ) {
+      nids[num] = x->nid;
+      num++;
+      x = x->links[0].next;
+   }
+   return num;
+}
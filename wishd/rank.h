@@ -0,0 +1,57 @@
+// hosts ranked by a metric, in an indexable skip list (after Pugh, with each link counting the hosts it skips).
+// filing, refiling, and dropping a host, and finding the host of a given rank, are O(log n), so answering
+// nget for every rank is O(n log n) rather than a sort per query.
+//
+// a rank_list holds no locks; the caller serializes access.
+#ifndef _RANK_H_
+#define _RANK_H_
+
+#include "libwish.h"
+
+#define RANK_MAX_LEVEL     16    // enough for 4^16 hosts
+#define RANK_BRANCHING     4     // each level links about 1 in this many of the hosts of the level below
+
+// a link from a node to the next one on a level
+struct rank_link {
+   struct rank_node* next;
+   uint32_t span;                // hosts passed by following it (the host it leads to included)
+};
+
+// a host, filed under its metric.  Ties are broken by nid.
+struct rank_node {
+   double key;
+   uint64_t nid;
+   int height;
+   struct rank_link links[1];    // height of them
+};
+
+struct rank_list {
+   struct rank_node* head;       // links into every level
+   int level;                    // levels in use
+   uint32_t size;
+   uint32_t seed;                // for choosing node heights
+};
+
+// set up an empty list.
+// return 0 on success, or -ENOMEM
+int rank_init( struct rank_list* r );
+
+// free the list and everything in it
+void rank_free( struct rank_list* r );
+
+// file a host under a key.
+// return 0 on success, or -ENOMEM
+int rank_insert( struct rank_list* r, double key, uint64_t nid );
+
+// drop a host filed under a key.
+// return 0 on success, or -ENOENT if it isn't filed under that key
+int rank_remove( struct rank_list* r, double key, uint64_t nid );
+
+// how many hosts sort ahead of (key, nid)
+uint32_t rank_count_below( struct rank_list* r, double key, uint64_t nid );
+
+// get the nids of the hosts of rank first, first+1, ... (0 being the lowest key) into nids, at most count of them.
+// return how many there were
+uint32_t rank_range( struct rank_list* r, uint32_t first, uint32_t count, uint64_t* nids );
+
+#endif
@@ -0,0 +1,93 @@
+#include "results.h"
+#include "process.h"
+
+// oldest first
+static ResultList results;
+static ResultTable by_gpid;
+static pthread_rwlock_t results_lock;
+
+static unsigned int max_results = RESULTS_DEFAULT_MAX;
+static time_t ttl = RESULTS_DEFAULT_TTL;
+
+
+// set up the cache
+int results_init( struct wish_state* state ) {
+   pthread_rwlock_init( &results_lock, NULL );
+   
+   wish_state_rlock( state );
+   if( state->conf.results_max > 0 )
+      max_results = state->conf.results_max;
+   if( state->conf.results_ttl > 0 )
+      ttl = state->conf.results_ttl;
+   wish_state_unlock( state );
+   
+   return 0;
+}
+
+
+// empty the cache
+int results_shutdown( struct wish_state* state ) {
+   pthread_rwlock_wrlock( &results_lock );
+   results.clear();
+   by_gpid.clear();
+   pthread_rwlock_unlock( &results_lock );
+   
+   pthread_rwlock_destroy( &results_lock );
+   return 0;
+}
+
+
+// remember how a job ended
+void results_add( struct wish_state* state, struct job_result* r ) {
+   time_t now = time(NULL);
+   
+   pthread_rwlock_wrlock( &results_lock );
+   
+   ResultTable::iterator itr = by_gpid.find( r->gpid );
+   if( itr != by_gpid.end() ) {
+      results.erase( itr->second );
+      by_gpid.erase( itr );
+   }
+   
+   results.push_back( *r );
+   by_gpid[ r->gpid ] = --results.end();
+   
+   // forget the expired, and the oldest beyond the limit
+   while( results.size() > 0 && (results.size() > max_results || results.front().end_time + ttl <= now) ) {
+      by_gpid.erase( results.front().gpid );
+      results.pop_front();
+   }
+   
+   pthread_rwlock_unlock( &results_lock );
+}
+
+
+// look up how a job ended
+int results_get( struct wish_state* state, uint64_t gpid, struct job_result* r ) {
+   int rc = -ENOENT;
+   
+   pthread_rwlock_rdlock( &results_lock );
+   
+   ResultTable::iterator itr = by_gpid.find( gpid );
+   if( itr != by_gpid.end() && itr->second->end_time + ttl > time(NULL) ) {
+      *r = *(itr->second);
+      rc = 0;
+   }
+   
+   pthread_rwlock_unlock( &results_lock );
+   return rc;
+}
+
+
+// reply a job's outcome to a joining client
+int results_reply( struct wish_state* state, struct wish_connection* con, struct job_result* r, bool want_usage ) {
+   int rc = wish_process_reply( state, con, r->type, r->gpid, r->data );
+   if( rc == 0 && want_usage && (r->type == PROCESS_TYPE_EXIT || r->type == PROCESS_TYPE_TIMEOUT) ) {
+      struct wish_packet pkt;
+      wish_pack_usage_packet( state, &pkt, &r->usage );
+      rc = wish_write_packet( state, con, &pkt );
+      wish_free_packet( &pkt );
+   }
+   
+   return rc;
+}
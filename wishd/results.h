@@ -0,0 +1,48 @@
+// outcomes of finished jobs, kept by the origin for late joiners.
+// when a job ends, every client joined on it is answered at once, and its outcome (how it ended, its resource usage,
+// and when it started and ended) goes into a bounded cache.  A join that comes after the job has ended is answered
+// from the cache right away.  Outcomes are dropped once they're older than the configured TTL, or, oldest first,
+// once there are more than the configured number of them.
+#ifndef _RESULTS_H_
+#define _RESULTS_H_
+
+#include "libwish.h"
+#include <map>
+#include <list>
+
+using namespace std;
+
+#define RESULTS_DEFAULT_MAX   4096     // outcomes to keep
+#define RESULTS_DEFAULT_TTL   600      // seconds to keep each
+
+// how a job ended
+struct job_result {
+   uint64_t gpid;
+   int type;                     // PROCESS_TYPE_EXIT, PROCESS_TYPE_TIMEOUT, PROCESS_TYPE_ERROR, or PROCESS_TYPE_FAILURE
+   int data;                     // exit status, or -errno
+   time_t start_time;            // when it started (-1 if it never did)
+   time_t end_time;              // when we learned it ended
+   struct wish_usage_packet usage;  // what it used (zeroed if unknown)
+};
+
+typedef list<struct job_result> ResultList;
+typedef map<uint64_t, ResultList::iterator> ResultTable;
+
+// set up the cache
+int results_init( struct wish_state* state );
+
+// empty the cache
+int results_shutdown( struct wish_state* state );
+
+// remember how a job ended, replacing whatever was remembered of it before
+void results_add( struct wish_state* state, struct job_result* r );
+
+// look up how a job ended.
+// return 0 on success; -ENOENT if it isn't (or is no longer) known
+int results_get( struct wish_state* state, uint64_t gpid, struct job_result* r );
+
+// reply a job's outcome to a joining client: the process reply, then its resource usage if want_usage is set and it ran to the end.
+// return 0 on success; negative on error
+int results_reply( struct wish_state* state, struct wish_connection* con, struct job_result* r, bool want_usage );
+
+#endif
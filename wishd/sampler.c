@@ -0,0 +1,304 @@
+#include "sampler.h"
+#include "scheduler.h"
+#include "process.h"
+#include "pinning.h"
+
+static struct sampler_reading latest;
+
+static pthread_mutex_t sampler_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sampler_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t sampler_thread;
+static bool sampler_running = false;
+static int64_t sample_interval = SAMPLER_DEFAULT_INTERVAL;
+
+// counters as of the last reading, to take rates against (only the sampler thread touches these)
+static uint64_t last_busy = 0;
+static uint64_t last_total = 0;
+static uint64_t last_rx = 0;
+static uint64_t last_tx = 0;
+static struct timespec last_time;
+
+
+// read the time spent busy and in total by all cores, in clock ticks
+static int sampler_read_cpu( uint64_t* busy, uint64_t* total ) {
+   FILE* f = fopen( SAMPLER_PROC_STAT, "r" );
+   if( f == NULL )
+      return -errno;
+   
+   // cpu  user nice system idle iowait irq softirq steal
+   unsigned long long v[8];
+   memset( v, 0, sizeof(v) );
+   int n = fscanf( f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7] );
+   fclose( f );
+   
+   if( n < 4 )
+      return -EINVAL;
+   
+   *total = 0;
+   for( int i = 0; i < 8; i++ ) {
+      *total += v[i];
+   }
+   
+   // idle and waiting on I/O aren't busy
+   *busy = *total - v[3] - v[4];
+   return 0;
+}
+
+
+// read the share of the last 10 seconds that some task stalled on a resource, in thousandths (0 if the kernel doesn't say)
+static uint32_t sampler_read_pressure( char const* resource ) {
+   char path[PATH_MAX];
+   sprintf( path, "%s/%s", SAMPLER_PROC_PRESSURE, resource );
+   
+   FILE* f = fopen( path, "r" );
+   if( f == NULL )
+      return 0;
+   
+   // some avg10=1.23 avg60=... (percentages)
+   double avg10 = 0;
+   if( fscanf( f, "some avg10=%lf", &avg10 ) != 1 )
+      avg10 = 0;
+   
+   fclose( f );
+   return (uint32_t)(avg10 * 10);
+}
+
+
+// read the bytes received and sent over every interface but loopback
+static int sampler_read_net( uint64_t* rx, uint64_t* tx ) {
+   FILE* f = fopen( SAMPLER_PROC_NET_DEV, "r" );
+   if( f == NULL )
+      return -errno;
+   
+   *rx = 0;
+   *tx = 0;
+   
+   char line[512];
+   int line_cnt = 0;
+   while( fgets( line, sizeof(line), f ) != NULL ) {
+      // two lines of headers
+      line_cnt++;
+      if( line_cnt <= 2 )
+         continue;
+   
+      char* colon = strchr( line, ':' );
+      if( colon == NULL )
+         continue;
+   
+      *colon = 0;
+      char* name = line;
+      while( *name == ' ' )
+         name++;
+   
+      if( strcmp( name, "lo" ) == 0 )
+         continue;
+   
+      // iface: rx_bytes and 7 more receive fields, then tx_bytes
+      unsigned long long v[9];
+      if( sscanf( colon + 1, "%llu %llu %llu %llu %llu %llu %llu %llu %llu", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8] ) == 9 ) {
+         *rx += v[0];
+         *tx += v[8];
+      }
+   }
+   
+   fclose( f );
+   return 0;
+}
+
+
+// a rate, from two readings of a counter
+static uint64_t sampler_rate( uint64_t now, uint64_t then, double secs ) {
+   if( now < then || secs <= 0 )
+      return 0;     // counter reset, or first reading
+   
+   return (uint64_t)((now - then) / secs);
+}
+
+
+// take a reading
+static void sampler_take( struct wish_state* state, struct sampler_reading* r ) {
+   memset( r, 0, sizeof(struct sampler_reading) );
+   
+   struct sysinfo sys;
+   if( sysinfo( &sys ) == 0 ) {
+      r->loads[0] = sys.loads[0];
+      r->loads[1] = sys.loads[1];
+      r->loads[2] = sys.loads[2];
+      r->ram_total = sys.totalram;
+      r->ram_free = sys.freeram + sys.bufferram;
+   }
+   
+   wish_state_rlock( state );
+   struct statfs fs;
+   int rc = statfs( state->conf.files_root, &fs );
+   wish_state_unlock( state );
+   
+   if( rc == 0 ) {
+      r->disk_total = fs.f_blocks * fs.f_bsize;
+      r->disk_free = fs.f_bavail * fs.f_bsize;
+   }
+   
+   r->queue_depth = scheduler_queue_depth( state );
+   r->running = process_num_running( state );
+   r->cpus_free = pin_free_cpus( state );
+   r->nodes_free = pin_free_nodes( state );
+   
+   struct wish_host_metrics* m = &r->metrics;
+   m->version = HEARTBEAT_METRICS_VERSION;
+   
+   long ncpus = sysconf( _SC_NPROCESSORS_ONLN );
+   m->ncpus = (ncpus > 0 ? ncpus : 1);
+   
+   struct timespec now;
+   clock_gettime( CLOCK_MONOTONIC, &now );
+   double secs = (now.tv_sec - last_time.tv_sec) + (now.tv_nsec - last_time.tv_nsec) / 1e9;
+   if( last_time.tv_sec == 0 && last_time.tv_nsec == 0 )
+      secs = 0;
+   
+   uint64_t busy = 0, total = 0;
+   if( sampler_read_cpu( &busy, &total ) == 0 ) {
+      if( total > last_total && busy >= last_busy )
+         m->cpu_busy = (uint32_t)(1000 * (busy - last_busy) / (total - last_total));
+   
+      last_busy = busy;
+      last_total = total;
+   }
+   
+   m->psi_cpu = sampler_read_pressure( "cpu" );
+   m->psi_mem = sampler_read_pressure( "memory" );
+   m->psi_io = sampler_read_pressure( "io" );
+   
+   uint64_t rx = 0, tx = 0;
+   if( sampler_read_net( &rx, &tx ) == 0 ) {
+      m->net_rx = (uint32_t)(sampler_rate( rx, last_rx, secs ) / 1024);
+      m->net_tx = (uint32_t)(sampler_rate( tx, last_tx, secs ) / 1024);
+   
+      last_rx = rx;
+      last_tx = tx;
+   }
+   
+   last_time = now;
+   
+   // the busier of the two: cores can be all busy with more work waiting, or a load can be spread thin
+   m->util = (uint32_t)(sampler_util( r->loads[0], m ) * 1000);
+}
+
+
+// utilization of a host that sent a given load and metrics block
+double sampler_util( uint64_t load, struct wish_host_metrics* m ) {
+   double ncpus = (m->version > 0 && m->ncpus > 0 ? m->ncpus : 1);
+   double util = (double)load / (1 << SI_LOAD_SHIFT) / ncpus;
+   
+   if( m->version > 0 && m->cpu_busy / 1000.0 > util )
+      util = m->cpu_busy / 1000.0;
+   
+   return util;
+}
+
+
+// wait out a sample interval, or until we're shut down.  Called with sampler_lock held.
+static void sampler_timedwait( int64_t timeout_ms ) {
+   struct timespec deadline;
+   clock_gettime( CLOCK_REALTIME, &deadline );
+   deadline.tv_sec += timeout_ms / 1000;
+   deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+   if( deadline.tv_nsec >= 1000000000 ) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+   }
+   
+   pthread_cond_timedwait( &sampler_cond, &sampler_lock, &deadline );
+}
+
+
+static void* sampler_thread_func( void* arg ) {
+   struct wish_state* state = (struct wish_state*)arg;
+   
+   pthread_mutex_lock( &sampler_lock );
+   while( sampler_running ) {
+      sampler_timedwait( sample_interval );
+      if( !sampler_running )
+         break;
+   
+      // read the system without holding up readers
+      pthread_mutex_unlock( &sampler_lock );
+   
+      struct sampler_reading r;
+      sampler_take( state, &r );
+   
+      pthread_mutex_lock( &sampler_lock );
+      latest = r;
+   }
+   pthread_mutex_unlock( &sampler_lock );
+   
+   return NULL;
+}
+
+
+// take a first reading, and start the sampler thread
+int sampler_init( struct wish_state* state ) {
+   wish_state_rlock( state );
+   if( state->conf.sample_interval > 0 )
+      sample_interval = state->conf.sample_interval;
+   wish_state_unlock( state );
+   
+   struct sampler_reading r;
+   sampler_take( state, &r );
+   
+   pthread_mutex_lock( &sampler_lock );
+   latest = r;
+   sampler_running = true;
+   pthread_mutex_unlock( &sampler_lock );
+   
+   int rc = pthread_create( &sampler_thread, NULL, sampler_thread_func, state );
+   if( rc != 0 ) {
+      errorf("sampler_init: pthread_create rc = %d\n", rc );
+      sampler_running = false;
+      return -rc;
+   }
+   
+   return 0;
+}
+
+
+// stop the sampler thread
+int sampler_shutdown( struct wish_state* state ) {
+   if( !sampler_running )
+      return 0;
+   
+   pthread_mutex_lock( &sampler_lock );
+   sampler_running = false;
+   pthread_cond_signal( &sampler_cond );
+   pthread_mutex_unlock( &sampler_lock );
+   
+   pthread_join( sampler_thread, NULL );
+   return 0;
+}
+
+
+// get the latest reading
+void sampler_read( struct sampler_reading* r ) {
+   pthread_mutex_lock( &sampler_lock );
+   *r = latest;
+   pthread_mutex_unlock( &sampler_lock );
+}
+
+
+// put the latest reading in a heartbeat we're about to send
+void sampler_fill_heartbeat( struct wish_heartbeat_packet* h ) {
+   struct sampler_reading r;
+   sampler_read( &r );
+   
+   h->loads[0] = r.loads[0];
+   h->loads[1] = r.loads[1];
+   h->loads[2] = r.loads[2];
+   h->ram_total = r.ram_total;
+   h->ram_free = r.ram_free;
+   h->disk_total = r.disk_total;
+   h->disk_free = r.disk_free;
+   h->queue_depth = r.queue_depth;
+   h->running = r.running;
+   h->cpus_free = r.cpus_free;
+   h->nodes_free = r.nodes_free;
+   h->metrics = r.metrics;
+}
@@ -0,0 +1,47 @@
+// how busy this host is, read by a thread of its own every SAMPLE_INTERVAL milliseconds: load and memory (sysinfo),
+// free disk under the files root, CPU utilization (/proc/stat), pressure stalls (/proc/pressure), network throughput
+// (/proc/net/dev), and the daemon's own queued, running, and pinned jobs.  Heartbeats and placement queries take the
+// latest reading instead of reading the system themselves.
+#ifndef _SAMPLER_H_
+#define _SAMPLER_H_
+
+#include "libwish.h"
+
+#define SAMPLER_DEFAULT_INTERVAL   1000     // milliseconds between readings
+#define SAMPLER_PROC_STAT          "/proc/stat"
+#define SAMPLER_PROC_PRESSURE      "/proc/pressure"
+#define SAMPLER_PROC_NET_DEV       "/proc/net/dev"
+
+// one reading
+struct sampler_reading {
+   uint64_t loads[3];            // as sysinfo() gives them
+   uint64_t ram_total;
+   uint64_t ram_free;            // free and buffer RAM
+   uint64_t disk_total;          // under the files root
+   uint64_t disk_free;
+
+   uint32_t queue_depth;         // jobs waiting in our scheduler queue
+   uint32_t running;             // jobs running here
+   uint32_t cpus_free;           // cores free to pin jobs to
+   uint32_t nodes_free;          // NUMA nodes free to pin a job to
+
+   struct wish_host_metrics metrics;
+};
+
+// take a first reading, and start the sampler thread
+int sampler_init( struct wish_state* state );
+
+// stop the sampler thread
+int sampler_shutdown( struct wish_state* state );
+
+// get the latest reading (all zeros if there hasn't been one)
+void sampler_read( struct sampler_reading* r );
+
+// put the latest reading in a heartbeat we're about to send
+void sampler_fill_heartbeat( struct wish_heartbeat_packet* h );
+
+// utilization (1 when every core is busy) of a host that sent a given load and metrics block.
+// hosts that send no block are taken to have a single core.
+double sampler_util( uint64_t load, struct wish_host_metrics* m );
+
+#endif
@@ -0,0 +1,733 @@
+#include "scheduler.h"
+#include "process.h"
+
+// queued jobs, oldest first
+static SchedulerQueue queue;
+
+// length of the queue, readable without the lock (heartbeats are sent before the scheduler starts)
+static volatile uint32_t queued = 0;
+
+// our jobs on each host
+static SchedulerHosts hosts;
+
+// placed jobs waiting to be started on their hosts
+static SchedulerPlaced placed_jobs;
+
+// protects queue, hosts, and placed_jobs
+static pthread_mutex_t scheduler_lock;
+static pthread_cond_t scheduler_cond;
+static pthread_cond_t dispatch_cond;
+
+static pthread_t scheduler_thread;
+static volatile bool scheduler_running = false;
+
+static pthread_t dispatch_threads[SCHEDULER_DISPATCH_THREADS];
+static int num_dispatch_threads = 0;
+static bool dispatch_running = false;
+
+static int slots = SCHEDULER_DEFAULT_SLOTS;
+static double max_load = 0;
+static int64_t recheck_ms = 1000;
+static int steal_depth = 0;
+static time_t steal_after = 0;
+
+// free a queued job, and hang up on its client (if it's still ours)
+static void scheduler_job_free( struct wish_state* state, struct scheduler_job* sj ) {
+   if( sj->client ) {
+      wish_disconnect( state, sj->client );
+      free( sj->client );
+   }
+   if( sj->job ) {
+      if( sj->job->stdout_path )
+         free( sj->job->stdout_path );
+      if( sj->job->stderr_path )
+         free( sj->job->stderr_path );
+      wish_free_job_packet( sj->job );
+      free( sj->job );
+   }
+   delete sj;
+}
+
+
+// get the condition of every host we know of
+static void scheduler_candidates( struct wish_state* state, vector<struct scheduler_candidate>* cands ) {
+   vector<uint64_t> nids;
+   heartbeat_nids( state, &nids );
+   
+   for( vector<uint64_t>::size_type i = 0; i < nids.size(); i++ ) {
+      struct scheduler_candidate c;
+      c.nid = nids[i];
+      c.placed = 0;
+      c.cpus_placed = 0;
+      c.nodes_placed = 0;
+   
+      if( heartbeat_nid_metrics( state, c.nid, &c.m ) == 0 )
+         cands->push_back( c );
+   }
+}
+
+
+// does a host meet a job's own constraints?
+static bool scheduler_allows( struct scheduler_job* sj, struct scheduler_candidate* c ) {
+   double load = c->m.load + c->placed;
+   
+   if( sj->max_load > 0 && load >= sj->max_load )
+      return false;
+   if( sj->min_ram > 0 && c->m.ram_free < sj->min_ram )
+      return false;
+   if( sj->min_disk > 0 && c->m.disk_free < sj->min_disk )
+      return false;
+   if( sj->nids.size() > 0 && find( sj->nids.begin(), sj->nids.end(), c->nid ) == sj->nids.end() )
+      return false;
+   
+   // not enough unpinned cores (or whole NUMA nodes) left for it
+   if( sj->job->cpus > 0 && c->m.cpus_free < c->cpus_placed + sj->job->cpus )
+      return false;
+   if( (sj->job->flags & JOB_NUMA_NODE) && c->m.nodes_free <= c->nodes_placed )
+      return false;
+   
+   return true;
+}
+
+
+// count a job against a host for the rest of this pass
+static void scheduler_claim( struct scheduler_job* sj, struct scheduler_candidate* c ) {
+   c->placed++;
+   c->cpus_placed += sj->job->cpus;
+   if( sj->job->flags & JOB_NUMA_NODE )
+      c->nodes_placed++;
+}
+
+
+// can a job go on a host?  Called with scheduler_lock held.
+static bool scheduler_fits( struct scheduler_job* sj, struct scheduler_candidate* c, struct scheduler_host* h, time_t now ) {
+   // never heard from it
+   if( c->m.latency == INFINITY )
+      return false;
+   
+   // couldn't send it a job a moment ago
+   if( h->avoid_until > now )
+      return false;
+   
+   // saturated
+   if( h->running >= slots )
+      return false;
+   
+   if( max_load > 0 && c->m.load + c->placed >= max_load )
+      return false;
+   
+   return scheduler_allows( sj, c );
+}
+
+
+// how good a host is for a job, by the job's policy (lower is better).  Called with scheduler_lock held.
+static double scheduler_score( struct scheduler_job* sj, struct scheduler_candidate* c, struct scheduler_host* h ) {
+   switch( sj->policy ) {
+      case SCHED_POLICY_CPU:
+         // each job placed this pass is taken to keep one core busy
+         return c->m.util + (double)c->placed / (c->m.ncpus > 0 ? c->m.ncpus : 1);
+   
+      case SCHED_POLICY_RAM:
+         return -c->m.ram_free;
+   
+      case SCHED_POLICY_LATENCY:
+         return c->m.latency;
+   
+      case SCHED_POLICY_SPREAD:
+         return h->running;
+   
+      case SCHED_POLICY_PACK:
+         return -h->running;
+   }
+   return 0;
+}
+
+
+// place as many queued jobs as will fit, oldest first, and take them off the queue.
+// jobs that fit nowhere stay queued without holding up the ones behind them.  Called with scheduler_lock held.
+static void scheduler_place( vector<struct scheduler_candidate>* cands, vector< pair<struct scheduler_job*, uint64_t> >* placed ) {
+   time_t now = time(NULL);
+   
+   for( SchedulerQueue::iterator itr = queue.begin(); itr != queue.end(); ) {
+      struct scheduler_job* sj = *itr;
+   
+      if( sj->target != 0 ) {
+         // handed to an idle daemon, which already has a slot reserved for it
+         placed->push_back( pair<struct scheduler_job*, uint64_t>( sj, sj->target ) );
+         itr = queue.erase( itr );
+         continue;
+      }
+   
+      int best = -1;
+      double best_score = 0;
+   
+      for( vector<struct scheduler_candidate>::size_type i = 0; i < cands->size(); i++ ) {
+         struct scheduler_candidate* c = &cands->at(i);
+         struct scheduler_host* h = &hosts[ c->nid ];
+   
+         if( !scheduler_fits( sj, c, h, now ) )
+            continue;
+   
+         double score = scheduler_score( sj, c, h );
+         if( best < 0 || score < best_score ) {
+            best = i;
+            best_score = score;
+         }
+      }
+   
+      if( best < 0 ) {
+         itr++;
+         continue;
+      }
+   
+      // reserve its slot
+      uint64_t nid = cands->at(best).nid;
+      hosts[ nid ].running++;
+      scheduler_claim( sj, &cands->at(best) );
+   
+      placed->push_back( pair<struct scheduler_job*, uint64_t>( sj, nid ) );
+      itr = queue.erase( itr );
+   }
+   
+   queued = queue.size();
+}
+
+
+// start a placed job on its host.  If it can't be sent there, place it again elsewhere.
+static void scheduler_dispatch( struct wish_state* state, struct scheduler_job* sj, uint64_t nid ) {
+   dbprintf("scheduler_dispatch: placing %lu on %lu\n", sj->job->gpid, nid );
+   
+   int rc = 0;
+   if( heartbeat_nid_suspect( state, nid ) ) {
+      // it went quiet since the job was placed; don't wait on a connect to it
+      rc = -EHOSTUNREACH;
+   }
+   else {
+      rc = process_spawn( state, sj->job, sj->client, nid );
+      if( rc == 0 ) {
+         // the spawn table has the client and the slot now
+         sj->client = NULL;
+         scheduler_job_free( state, sj );
+         return;
+      }
+   }
+   
+   errorf("scheduler_dispatch: could not start %lu on %lu, rc = %d\n", sj->job->gpid, nid, rc );
+   
+   pthread_mutex_lock( &scheduler_lock );
+   
+   struct scheduler_host* h = &hosts[ nid ];
+   h->running--;
+   h->avoid_until = time(NULL) + SCHEDULER_AVOID_TIME;
+   
+   sj->attempts++;
+   sj->target = 0;
+   bool retry = (scheduler_running && rc != -EEXIST && sj->attempts < SCHEDULER_MAX_ATTEMPTS);
+   if( retry ) {
+      // next in line
+      queue.push_front( sj );
+      queued = queue.size();
+      pthread_cond_signal( &scheduler_cond );
+   }
+   
+   pthread_mutex_unlock( &scheduler_lock );
+   
+   if( !retry ) {
+      wish_process_reply( state, sj->client, PROCESS_TYPE_ERROR, sj->job->gpid, rc );
+      scheduler_job_free( state, sj );
+   }
+}
+
+
+// start placed jobs on their hosts, until the scheduler stops and none are left
+static void* scheduler_dispatch_thread_func( void* arg ) {
+   struct wish_state* state = (struct wish_state*)arg;
+   
+   pthread_mutex_lock( &scheduler_lock );
+   
+   while( true ) {
+      if( placed_jobs.size() == 0 ) {
+         if( !dispatch_running )
+            break;
+   
+         pthread_cond_wait( &dispatch_cond, &scheduler_lock );
+         continue;
+      }
+   
+      pair<struct scheduler_job*, uint64_t> next = placed_jobs.front();
+      placed_jobs.pop_front();
+   
+      pthread_mutex_unlock( &scheduler_lock );
+   
+      scheduler_dispatch( state, next.first, next.second );
+   
+      pthread_mutex_lock( &scheduler_lock );
+   }
+   
+   pthread_mutex_unlock( &scheduler_lock );
+   return NULL;
+}
+
+
+// let the dispatch threads finish the jobs already placed, and wait for them
+static void scheduler_stop_dispatch(void) {
+   pthread_mutex_lock( &scheduler_lock );
+   dispatch_running = false;
+   pthread_cond_broadcast( &dispatch_cond );
+   pthread_mutex_unlock( &scheduler_lock );
+   
+   for( int i = 0; i < num_dispatch_threads; i++ ) {
+      pthread_join( dispatch_threads[i], NULL );
+   }
+   num_dispatch_threads = 0;
+}
+
+
+// wait for a signal, or until timeout_ms passes.  Called with scheduler_lock held.
+static void scheduler_timedwait( int64_t timeout_ms ) {
+   struct timespec deadline;
+   clock_gettime( CLOCK_REALTIME, &deadline );
+   deadline.tv_sec += timeout_ms / 1000;
+   deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+   if( deadline.tv_nsec >= 1000000000 ) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+   }
+   
+   pthread_cond_timedwait( &scheduler_cond, &scheduler_lock, &deadline );
+}
+
+
+// find a host's daemon's address, as it would appear in a job's path
+static int scheduler_nid_addr( struct wish_state* state, uint64_t nid, struct sockaddr_storage* addr ) {
+   char* hostname = heartbeat_nid_to_hostname( state, nid );
+   int portnum = heartbeat_nid_to_portnum( state, nid );
+   if( hostname == NULL || portnum < 0 ) {
+      if( hostname )
+         free( hostname );
+      return -ENOENT;
+   }
+   
+   char portnum_buf[12];
+   sprintf( portnum_buf, "%d", portnum );
+   
+   struct addrinfo hints;
+   memset( &hints, 0, sizeof(hints) );
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   
+   struct addrinfo* result = NULL;
+   int rc = getaddrinfo( hostname, portnum_buf, &hints, &result );
+   free( hostname );
+   
+   if( rc != 0 ) {
+      errorf("scheduler_nid_addr: getaddrinfo: %s\n", gai_strerror( rc ) );
+      return -EHOSTUNREACH;
+   }
+   
+   memset( addr, 0, sizeof(struct sockaddr_storage) );
+   memcpy( addr, result->ai_addr, result->ai_addrlen );
+   freeaddrinfo( result );
+   return 0;
+}
+
+
+// if we're idle, ask the peer with the longest queue for some of its jobs
+static void scheduler_try_steal( struct wish_state* state ) {
+   time_t now = time(NULL);
+   if( now < steal_after )
+      return;
+   
+   wish_state_rlock( state );
+   uint64_t my_nid = state->nid;
+   wish_state_unlock( state );
+   
+   struct heartbeat_metrics me;
+   heartbeat_nid_metrics( state, my_nid, &me );
+   
+   if( (int)me.running >= slots || (max_load > 0 && me.load >= max_load) )
+      return;
+   
+   uint32_t want = slots - me.running;
+   
+   // who has the longest queue?
+   vector<uint64_t> nids;
+   heartbeat_nids( state, &nids );
+   
+   uint64_t victim = 0;
+   uint32_t victim_depth = 0;
+   
+   for( vector<uint64_t>::size_type i = 0; i < nids.size(); i++ ) {
+      if( nids[i] == my_nid )
+         continue;
+   
+      struct heartbeat_metrics m;
+      if( heartbeat_nid_metrics( state, nids[i], &m ) != 0 || m.latency == INFINITY )
+         continue;
+   
+      if( m.queue_depth >= (uint32_t)steal_depth && m.queue_depth > victim_depth ) {
+         victim = nids[i];
+         victim_depth = m.queue_depth;
+      }
+   }
+   
+   if( victim == 0 )
+      return;
+   
+   steal_after = now + SCHEDULER_STEAL_HOLDOFF;
+   
+   struct wish_connection con;
+   int rc = heartbeat_get_nid( state, victim, &con );
+   if( rc != 0 ) {
+      errorf("scheduler_try_steal: heartbeat_get_nid rc = %d\n", rc );
+      return;
+   }
+   
+   wish_recv_timeout( state, &con, SCHEDULER_STEAL_TIMEOUT_MS );
+   
+   struct wish_process_packet req;
+   wish_init_process_packet( state, &req, PROCESS_TYPE_STEAL, my_nid, 0, want );
+   
+   struct wish_packet pkt;
+   wish_pack_process_packet( state, &pkt, &req );
+   rc = wish_write_packet( state, &con, &pkt );
+   wish_free_packet( &pkt );
+   
+   if( rc == 0 )
+      rc = wish_read_packet( state, &con, &pkt );
+   
+   if( rc == 0 ) {
+      struct wish_process_packet resp;
+      wish_unpack_process_packet( state, &pkt, &resp );
+      wish_free_packet( &pkt );
+   
+      dbprintf("scheduler_try_steal: asked %lu (queue of %u) for %u jobs, got %u\n", victim, victim_depth, want, resp.data );
+   }
+   else {
+      errorf("scheduler_try_steal: request to %lu rc = %d\n", victim, rc );
+   }
+   
+   wish_disconnect( state, &con );
+}
+
+
+// place and start queued jobs, as hosts free up
+static void* scheduler_thread_func( void* arg ) {
+   struct wish_state* state = (struct wish_state*)arg;
+   
+   pthread_mutex_lock( &scheduler_lock );
+   
+   while( scheduler_running ) {
+      if( queue.size() == 0 ) {
+         if( steal_depth <= 0 ) {
+            pthread_cond_wait( &scheduler_cond, &scheduler_lock );
+            continue;
+         }
+   
+         // nothing of our own to do.  Help out a peer with a backlog, if we can.
+         scheduler_timedwait( recheck_ms );
+   
+         if( scheduler_running && queue.size() == 0 ) {
+            pthread_mutex_unlock( &scheduler_lock );
+            scheduler_try_steal( state );
+            pthread_mutex_lock( &scheduler_lock );
+         }
+         continue;
+      }
+   
+      // read the hosts' metrics without holding up submissions and releases
+      pthread_mutex_unlock( &scheduler_lock );
+   
+      vector<struct scheduler_candidate> cands;
+      scheduler_candidates( state, &cands );
+   
+      pthread_mutex_lock( &scheduler_lock );
+   
+      vector< pair<struct scheduler_job*, uint64_t> > placed;
+      scheduler_place( &cands, &placed );
+   
+      // the dispatch threads start them, so a slow host doesn't hold up placing the rest
+      if( placed.size() > 0 ) {
+         placed_jobs.insert( placed_jobs.end(), placed.begin(), placed.end() );
+         pthread_cond_broadcast( &dispatch_cond );
+      }
+   
+      if( placed.size() == 0 && scheduler_running && queue.size() > 0 ) {
+         // everything left is waiting on a host.  Check again when a slot frees up or new heartbeats are in.
+         scheduler_timedwait( recheck_ms );
+      }
+   }
+   
+   pthread_mutex_unlock( &scheduler_lock );
+   return NULL;
+}
+
+
+// start the scheduler
+int scheduler_init( struct wish_state* state ) {
+   wish_state_rlock( state );
+   if( state->conf.sched_slots > 0 )
+      slots = state->conf.sched_slots;
+   max_load = state->conf.sched_max_load;
+   steal_depth = state->conf.sched_steal_depth;
+   if( state->conf.heartbeat_interval > 0 )
+      recheck_ms = state->conf.heartbeat_interval;
+   wish_state_unlock( state );
+   
+   pthread_mutex_init( &scheduler_lock, NULL );
+   pthread_cond_init( &scheduler_cond, NULL );
+   pthread_cond_init( &dispatch_cond, NULL );
+   
+   dispatch_running = true;
+   int rc = 0;
+   for( int i = 0; i < SCHEDULER_DISPATCH_THREADS; i++ ) {
+      rc = pthread_create( &dispatch_threads[i], NULL, scheduler_dispatch_thread_func, state );
+      if( rc != 0 ) {
+         errorf("scheduler_init: pthread_create rc = %d\n", rc );
+         scheduler_stop_dispatch();
+         return -rc;
+      }
+      num_dispatch_threads++;
+   }
+   
+   scheduler_running = true;
+   rc = pthread_create( &scheduler_thread, NULL, scheduler_thread_func, state );
+   if( rc != 0 ) {
+      errorf("scheduler_init: pthread_create rc = %d\n", rc );
+      scheduler_running = false;
+      scheduler_stop_dispatch();
+      return -rc;
+   }
+   
+   return 0;
+}
+
+
+// stop the scheduler
+int scheduler_shutdown( struct wish_state* state ) {
+   if( !scheduler_running )
+      return 0;
+   
+   pthread_mutex_lock( &scheduler_lock );
+   scheduler_running = false;
+   pthread_cond_signal( &scheduler_cond );
+   pthread_mutex_unlock( &scheduler_lock );
+   
+   pthread_join( scheduler_thread, NULL );
+   
+   // jobs already placed are started (or their clients told they can't be)
+   scheduler_stop_dispatch();
+   
+   // nothing left to place the rest
+   pthread_mutex_lock( &scheduler_lock );
+   SchedulerQueue left;
+   left.swap( queue );
+   queued = 0;
+   pthread_mutex_unlock( &scheduler_lock );
+   
+   for( SchedulerQueue::iterator itr = left.begin(); itr != left.end(); itr++ ) {
+      wish_process_reply( state, (*itr)->client, PROCESS_TYPE_ERROR, (*itr)->job->gpid, -ECANCELED );
+      scheduler_job_free( state, *itr );
+   }
+   
+   // the lock stays usable: jobs that are still running give back their slots when the process table shuts down
+   return 0;
+}
+
+
+// queue a job
+int scheduler_submit( struct wish_state* state, struct wish_connection* client, struct wish_job_packet* job, struct wish_sched_packet* sched ) {
+   if( sched->policy < SCHED_POLICY_CPU || sched->policy > SCHED_POLICY_PACK )
+      return -EINVAL;
+   
+   if( !scheduler_running )
+      return -ESHUTDOWN;
+   
+   // check and publish its files now, so a bad path fails before the job waits in the queue.
+   // they're published once; the job counts as the origin's own from here on, so placing it again doesn't republish them.
+   int rc = process_publish_job( state, job );
+   if( rc != 0 )
+      return rc;
+   
+   job->flags |= JOB_WISH_ORIGIN | JOB_SCHEDULE;
+   
+   struct scheduler_job* sj = new scheduler_job();
+   sj->job = job;
+   sj->client = client;
+   sj->policy = sched->policy;
+   sj->min_ram = sched->min_ram;
+   sj->min_disk = sched->min_disk;
+   sj->max_load = (double)sched->max_load / 100.0;
+   sj->attempts = 0;
+   sj->target = 0;
+   
+   for( uint32_t i = 0; i < sched->num_hosts; i++ ) {
+      uint64_t nid = wish_host_nid( sched->hosts[i] );
+   
+      // every name for this host means this host
+      if( process_is_localhost( state, nid ) ) {
+         wish_state_rlock( state );
+         nid = state->nid;
+         wish_state_unlock( state );
+      }
+   
+      sj->nids.push_back( nid );
+   }
+   
+   pthread_mutex_lock( &scheduler_lock );
+   queue.push_back( sj );
+   queued = queue.size();
+   pthread_cond_signal( &scheduler_cond );
+   pthread_mutex_unlock( &scheduler_lock );
+   
+   dbprintf("scheduler_submit: queued %lu with policy %u\n", job->gpid, sched->policy );
+   return 0;
+}
+
+
+// read a job's placement policy from its client, and queue it
+static void* scheduler_submit_pthread( void* arg ) {
+   struct scheduler_submit_args* args = (struct scheduler_submit_args*)arg;
+   
+   struct wish_sched_packet sched;
+   memset( &sched, 0, sizeof(struct wish_sched_packet) );
+   struct wish_packet sched_packet;
+   
+   int rc = wish_read_packet( args->state, args->client, &sched_packet );
+   if( rc == 0 ) {
+      if( sched_packet.hdr.type == PACKET_TYPE_SCHED )
+         rc = wish_unpack_sched_packet( args->state, &sched_packet, &sched );
+      else
+         rc = -EBADMSG;
+   
+      wish_free_packet( &sched_packet );
+   }
+   
+   if( rc == 0 )
+      rc = scheduler_submit( args->state, args->client, args->job, &sched );
+   
+   if( rc != 0 ) {
+      errorf("scheduler_submit_pthread: scheduler_submit of %lu rc = %d\n", args->job->gpid, rc );
+      wish_process_reply( args->state, args->client, PROCESS_TYPE_ERROR, args->job->gpid, rc );
+      wish_disconnect( args->state, args->client );
+      free( args->client );
+      wish_free_job_packet( args->job );
+      free( args->job );
+   }
+   
+   wish_free_sched_packet( &sched );
+   free( args );
+   return NULL;
+}
+
+
+// queue a job in the background, once its placement policy has been read
+int scheduler_submit_start( struct wish_state* state, struct wish_connection* client, struct wish_job_packet* job ) {
+   struct scheduler_submit_args* args = (struct scheduler_submit_args*)calloc( sizeof(struct scheduler_submit_args), 1 );
+   args->state = state;
+   args->client = client;
+   args->job = job;
+   
+   pthread_attr_t attrs;
+   pthread_attr_init( &attrs );
+   pthread_attr_setdetachstate( &attrs, PTHREAD_CREATE_DETACHED );
+   
+   pthread_t thread;
+   int rc = pthread_create( &thread, &attrs, scheduler_submit_pthread, args );
+   pthread_attr_destroy( &attrs );
+   
+   if( rc != 0 ) {
+      free( args );
+      return -rc;
+   }
+   return 0;
+}
+
+
+// a slot on a host is free
+void scheduler_release( struct wish_state* state, uint64_t nid ) {
+   pthread_mutex_lock( &scheduler_lock );
+   
+   SchedulerHosts::iterator itr = hosts.find( nid );
+   if( itr != hosts.end() && itr->second.running > 0 ) {
+      itr->second.running--;
+      pthread_cond_signal( &scheduler_cond );
+   }
+   
+   pthread_mutex_unlock( &scheduler_lock );
+}
+
+
+// how many jobs are waiting
+uint32_t scheduler_queue_depth( struct wish_state* state ) {
+   return queued;
+}
+
+
+// hand some of our newest queued jobs to an idle daemon
+int scheduler_steal( struct wish_state* state, uint64_t thief_nid, uint32_t max ) {
+   if( steal_depth <= 0 || !scheduler_running || process_is_localhost( state, thief_nid ) )
+      return 0;
+   
+   // what we know of it, to check the jobs' constraints against
+   struct scheduler_candidate c;
+   c.nid = thief_nid;
+   c.placed = 0;
+   c.cpus_placed = 0;
+   c.nodes_placed = 0;
+   
+   int rc = heartbeat_nid_metrics( state, thief_nid, &c.m );
+   if( rc != 0 )
+      return rc;
+   
+   struct sockaddr_storage thief_addr;
+   rc = scheduler_nid_addr( state, thief_nid, &thief_addr );
+   if( rc != 0 )
+      return rc;
+   
+   uint32_t taken = 0;
+   
+   pthread_mutex_lock( &scheduler_lock );
+   
+   // only give from a real backlog, and keep at least half of it
+   uint32_t len = queue.size();
+   if( len >= (uint32_t)steal_depth && max > len / 2 )
+      max = len / 2;
+   
+   for( SchedulerQueue::reverse_iterator itr = queue.rbegin(); itr != queue.rend() && len >= (uint32_t)steal_depth && taken < max; itr++ ) {
+      struct scheduler_job* sj = *itr;
+      struct wish_job_packet* job = sj->job;
+   
+      if( sj->target != 0 || job->ttl == 0 || !scheduler_allows( sj, &c ) )
+         continue;
+   
+      // never hand it to a daemon it was already handed to
+      bool visited = false;
+      for( uint32_t i = 0; i < job->visited_len; i++ ) {
+         if( memcmp( &job->visited[i], &thief_addr, sizeof(struct sockaddr_storage) ) == 0 ) {
+            visited = true;
+            break;
+         }
+      }
+      if( visited )
+         continue;
+   
+      job->ttl--;
+      job->visited = (struct sockaddr_storage*)realloc( job->visited, sizeof(struct sockaddr_storage) * (job->visited_len + 1) );
+      memcpy( &job->visited[ job->visited_len ], &thief_addr, sizeof(struct sockaddr_storage) );
+      job->visited_len++;
+   
+      sj->target = thief_nid;
+      hosts[ thief_nid ].running++;
+      scheduler_claim( sj, &c );
+      taken++;
+   }
+   
+   if( taken > 0 )
+      pthread_cond_signal( &scheduler_cond );
+   
+   pthread_mutex_unlock( &scheduler_lock );
+   
+   dbprintf("scheduler_steal: %lu takes %u of %u queued jobs\n", thief_nid, taken, len );
+   return taken;
+}
@@ -0,0 +1,108 @@
+// queued jobs on the origin.
+// clients submit jobs with a placement policy instead of a host.  The origin holds them in a queue, and places each one
+// on the best host by its policy, using the hosts' heartbeat metrics.  A host is saturated while it runs as many of
+// our queued jobs as it has slots, or while its load is at the limit; jobs wait (or go elsewhere) until it frees up.
+// jobs that can't be sent to the host they were placed on are placed again, on another host.
+//
+// daemons advertise their queue depth in their heartbeats.  A daemon with nothing queued and free slots of its own
+// asks the peer with the longest queue for some of its newest jobs.  The peer stays the jobs' origin (so clients,
+// output, and joins are unaffected), and forwards them to the idle daemon with their ttl decremented and the idle
+// daemon added to their path, so a job is never handed back to a daemon it has already been handed to.
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include "libwish.h"
+#include "heartbeat.h"
+#include <map>
+#include <list>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+#define SCHEDULER_DEFAULT_SLOTS     4
+
+// how long to pass over a host after a job couldn't be sent to it, in seconds
+#define SCHEDULER_AVOID_TIME        10
+
+// how many hosts a job may fail to be sent to before the client is told it can't run
+#define SCHEDULER_MAX_ATTEMPTS      3
+
+// how long an idle daemon waits for a peer to answer a request for jobs, in milliseconds
+#define SCHEDULER_STEAL_TIMEOUT_MS  5000
+
+// how long an idle daemon waits after asking for jobs before asking again, in seconds,
+// so the jobs it was given have time to show up in its own heartbeats
+#define SCHEDULER_STEAL_HOLDOFF     2
+
+// how many threads start placed jobs on their hosts, so one slow or unreachable host doesn't hold up the rest
+#define SCHEDULER_DISPATCH_THREADS  8
+
+// a queued job
+struct scheduler_job {
+   struct wish_job_packet* job;
+   struct wish_connection* client;     // client waiting for the job to start
+   uint32_t policy;                    // SCHED_POLICY_*
+   uint64_t min_ram;
+   uint64_t min_disk;
+   double max_load;                    // 0 for none
+   vector<uint64_t> nids;              // hosts the job may run on (empty for any)
+   int attempts;                       // hosts the job couldn't be sent to so far
+   uint64_t target;                    // idle daemon the job was handed to, with a slot reserved (0 if none)
+};
+
+// what the scheduler knows of a host
+struct scheduler_host {
+   int running;                        // our queued jobs running on it
+   time_t avoid_until;                 // don't place jobs on it until then
+};
+
+// a host a job could be placed on, as seen by one placement pass
+struct scheduler_candidate {
+   uint64_t nid;
+   struct heartbeat_metrics m;
+   int placed;                         // jobs placed on it in this pass (not yet reflected in its load)
+   uint32_t cpus_placed;               // cores those jobs will pin
+   uint32_t nodes_placed;              // NUMA nodes those jobs will pin
+};
+
+// arguments to a thread reading a job's placement policy
+struct scheduler_submit_args {
+   struct wish_state* state;
+   struct wish_connection* client;
+   struct wish_job_packet* job;
+};
+
+typedef list<struct scheduler_job*> SchedulerQueue;
+typedef list< pair<struct scheduler_job*, uint64_t> > SchedulerPlaced;
+typedef map<uint64_t, struct scheduler_host> SchedulerHosts;
+
+// start the scheduler
+int scheduler_init( struct wish_state* state );
+
+// stop the scheduler, and tell the clients of jobs still in the queue that they won't run
+int scheduler_shutdown( struct wish_state* state );
+
+// queue a job from a client.  Takes ownership of client and job (allocated with malloc) on success.
+// the client gets the job's STARTED reply once it has been placed and started.
+// return 0 on success; negative on error (in which case the caller keeps ownership)
+int scheduler_submit( struct wish_state* state, struct wish_connection* client, struct wish_job_packet* job, struct wish_sched_packet* sched );
+
+// queue a job from a client in the background, once its placement policy (a PACKET_TYPE_SCHED packet, which
+// follows it on client) has been read, so a slow client holds up only its own job.  Takes ownership of client and
+// job (allocated with malloc) on success; if the policy can't be read or the job can't be queued, the client gets an
+// error reply.
+// return 0 on success; negative on error (in which case the caller keeps ownership)
+int scheduler_submit_start( struct wish_state* state, struct wish_connection* client, struct wish_job_packet* job );
+
+// a job placed on a host has ended, and its slot there is free
+void scheduler_release( struct wish_state* state, uint64_t nid );
+
+// how many jobs are waiting in the queue
+uint32_t scheduler_queue_depth( struct wish_state* state );
+
+// an idle daemon (thief_nid) asks for up to max of our queued jobs.  Hand it some of the newest ones that may run there.
+// return how many it will be sent
+int scheduler_steal( struct wish_state* state, uint64_t thief_nid, uint32_t max );
+
+#endif
@@ -0,0 +1,323 @@
+#include "sink.h"
+
+// files with output waiting for a writer, oldest first
+static list<struct sink_file*> work;
+static pthread_mutex_t sink_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sink_cond = PTHREAD_COND_INITIALIZER;
+
+static vector<pthread_t> writers;
+static bool sink_running = false;
+
+static int fsync_policy = SINK_FSYNC_NONE;
+
+
+// write a batch of chunks to a file, with as few system calls as we can.
+// return 0 on success; -errno on error
+static int sink_writev( int fd, vector<struct sink_chunk>* batch ) {
+   struct iovec iov[IOV_MAX];
+   
+   vector<struct sink_chunk>::size_type next = 0;
+   while( next < batch->size() ) {
+      int cnt = 0;
+      for( ; next + cnt < batch->size() && cnt < IOV_MAX; cnt++ ) {
+         iov[cnt].iov_base = batch->at(next + cnt).data;
+         iov[cnt].iov_len = batch->at(next + cnt).len;
+      }
+   
+      // write it all, even if the kernel takes it a piece at a time
+      int first = 0;
+      while( first < cnt ) {
+         ssize_t nw = writev( fd, iov + first, cnt - first );
+         if( nw < 0 ) {
+            if( errno == EINTR )
+               continue;
+   
+            return -errno;
+         }
+   
+         while( first < cnt && (size_t)nw >= iov[first].iov_len ) {
+            nw -= iov[first].iov_len;
+            first++;
+         }
+         if( first < cnt ) {
+            iov[first].iov_base = (char*)iov[first].iov_base + nw;
+            iov[first].iov_len -= nw;
+         }
+      }
+   
+      next += cnt;
+   }
+   
+   return 0;
+}
+
+
+// free a batch of chunks
+static void sink_free_batch( vector<struct sink_chunk>* batch ) {
+   for( vector<struct sink_chunk>::size_type i = 0; i < batch->size(); i++ ) {
+      free( batch->at(i).data );
+   }
+   batch->clear();
+}
+
+
+// write out whatever is still queued on a file that's being closed, sync it if asked, and free it.
+// nobody else may be using it.
+static void sink_finish( struct sink_file* f ) {
+   if( f->pending.size() > 0 ) {
+      if( f->error == 0 )
+         f->error = sink_writev( f->fd, &f->pending );
+   
+      sink_free_batch( &f->pending );
+   }
+   
+   if( f->error == 0 && fsync_policy == SINK_FSYNC_CLOSE && fsync( f->fd ) != 0 ) {
+      f->error = -errno;
+      errorf("sink_finish: fsync %s errno = %d\n", f->path, f->error );
+   }
+   
+   if( f->error != 0 )
+      errorf("sink_finish: %s is incomplete, rc = %d\n", f->path, f->error );
+   
+   close( f->fd );
+   
+   pthread_mutex_destroy( &f->lock );
+   free( f->path );
+   delete f;
+}
+
+
+// write out everything queued on a file.  The caller must have marked it queued.
+static void sink_drain( struct sink_file* f ) {
+   vector<struct sink_chunk> batch;
+   size_t batch_bytes = 0;
+   
+   pthread_mutex_lock( &f->lock );
+   batch.swap( f->pending );
+   pthread_mutex_unlock( &f->lock );
+   
+   for( vector<struct sink_chunk>::size_type i = 0; i < batch.size(); i++ ) {
+      batch_bytes += batch[i].len;
+   }
+   
+   int rc = 0;
+   if( f->error == 0 ) {
+      rc = sink_writev( f->fd, &batch );
+      if( rc == 0 && fsync_policy == SINK_FSYNC_BATCH && fdatasync( f->fd ) != 0 )
+         rc = -errno;
+   
+      if( rc != 0 )
+         errorf("sink_drain: could not write %s, rc = %d\n", f->path, rc );
+   }
+   
+   sink_free_batch( &batch );
+   
+   pthread_mutex_lock( &f->lock );
+   
+   if( rc != 0 && f->error == 0 )
+      f->error = rc;
+   
+   f->pending_bytes -= batch_bytes;
+   
+   // more came in while we were writing?  Back of the line, so one busy file doesn't starve the rest.
+   bool more = (f->pending.size() > 0 && sink_running);
+   if( !more )
+      f->queued = false;
+   
+   bool finish = (!more && f->closing);
+   
+   pthread_mutex_unlock( &f->lock );
+   
+   if( more ) {
+      pthread_mutex_lock( &sink_lock );
+      work.push_back( f );
+      pthread_cond_signal( &sink_cond );
+      pthread_mutex_unlock( &sink_lock );
+   }
+   else if( finish ) {
+      // its owner let go of it, and it's all written
+      sink_finish( f );
+   }
+}
+
+
+// writer thread
+static void* sink_writer( void* arg ) {
+   while( true ) {
+      pthread_mutex_lock( &sink_lock );
+   
+      while( sink_running && work.size() == 0 ) {
+         pthread_cond_wait( &sink_cond, &sink_lock );
+      }
+   
+      // write out everything that was queued before we stop
+      if( work.size() == 0 ) {
+         pthread_mutex_unlock( &sink_lock );
+         break;
+      }
+   
+      struct sink_file* f = work.front();
+      work.pop_front();
+   
+      pthread_mutex_unlock( &sink_lock );
+   
+      sink_drain( f );
+   }
+   
+   return NULL;
+}
+
+
+// start the writer threads
+int sink_init( struct wish_state* state ) {
+   wish_state_rlock( state );
+   int num_threads = state->conf.sink_threads;
+   fsync_policy = state->conf.sink_fsync;
+   wish_state_unlock( state );
+   
+   if( num_threads <= 0 )
+      num_threads = SINK_DEFAULT_THREADS;
+   
+   if( fsync_policy < SINK_FSYNC_NONE || fsync_policy > SINK_FSYNC_BATCH ) {
+      errorf("sink_init: unknown %s %d; not syncing output files\n", SINK_FSYNC_KEY, fsync_policy );
+      fsync_policy = SINK_FSYNC_NONE;
+   }
+   
+   sink_running = true;
+   
+   for( int i = 0; i < num_threads; i++ ) {
+      pthread_t writer;
+      int rc = pthread_create( &writer, NULL, sink_writer, NULL );
+      if( rc != 0 ) {
+         errorf("sink_init: pthread_create rc = %d\n", rc );
+         break;
+      }
+      writers.push_back( writer );
+   }
+   
+   if( writers.size() == 0 ) {
+      // files will be written by whoever queues output on them
+      sink_running = false;
+      return -EAGAIN;
+   }
+   
+   dbprintf("sink_init: %zu output writers\n", writers.size() );
+   return 0;
+}
+
+
+// write out whatever is queued, and stop the writer threads
+int sink_shutdown( struct wish_state* state ) {
+   pthread_mutex_lock( &sink_lock );
+   sink_running = false;
+   pthread_cond_broadcast( &sink_cond );
+   pthread_mutex_unlock( &sink_lock );
+   
+   for( vector<pthread_t>::size_type i = 0; i < writers.size(); i++ ) {
+      pthread_join( writers[i], NULL );
+   }
+   writers.clear();
+   
+   return 0;
+}
+
+
+// start writing to an open file descriptor
+struct sink_file* sink_open( int fd, char const* path ) {
+   struct sink_file* f = new sink_file();
+   f->fd = fd;
+   f->path = strdup( path );
+   f->pending_bytes = 0;
+   f->queued = false;
+   f->closing = false;
+   f->error = 0;
+   
+   pthread_mutex_init( &f->lock, NULL );
+   
+   return f;
+}
+
+
+// queue output to be written to a file
+void sink_write( struct sink_file* f, char* data, size_t len ) {
+   struct sink_chunk chunk;
+   chunk.data = data;
+   chunk.len = len;
+   
+   pthread_mutex_lock( &f->lock );
+   
+   f->pending.push_back( chunk );
+   f->pending_bytes += len;
+   
+   // hand it to a writer, unless the writers are stopping
+   pthread_mutex_lock( &sink_lock );
+   bool running = sink_running;
+   if( running && !f->queued ) {
+      f->queued = true;
+      work.push_back( f );
+      pthread_cond_signal( &sink_cond );
+   }
+   pthread_mutex_unlock( &sink_lock );
+   
+   if( !running && !f->queued ) {
+      // no writers; do it ourselves
+      if( f->error == 0 )
+         f->error = sink_writev( f->fd, &f->pending );
+   
+      sink_free_batch( &f->pending );
+      f->pending_bytes = 0;
+   }
+   
+   pthread_mutex_unlock( &f->lock );
+}
+
+
+// does a file have too much waiting to be written?
+bool sink_backlogged( struct sink_file* f ) {
+   pthread_mutex_lock( &f->lock );
+   bool ret = (f->pending_bytes >= SINK_MAX_PENDING);
+   pthread_mutex_unlock( &f->lock );
+   
+   return ret;
+}
+
+
+// has everything queued on a file been written?
+bool sink_idle( struct sink_file* f ) {
+   pthread_mutex_lock( &f->lock );
+   bool ret = (f->pending_bytes == 0);
+   pthread_mutex_unlock( &f->lock );
+   
+   return ret;
+}
+
+
+// write out and close a file, and free it, in the background
+void sink_close( struct sink_file* f ) {
+   pthread_mutex_lock( &f->lock );
+   
+   f->closing = true;
+   
+   // a writer has it, and finishes it when it's done
+   if( f->queued ) {
+      pthread_mutex_unlock( &f->lock );
+      return;
+   }
+   
+   // hand it to a writer, unless the writers are stopping
+   pthread_mutex_lock( &sink_lock );
+   bool running = sink_running;
+   if( running ) {
+      f->queued = true;
+      work.push_back( f );
+      pthread_cond_signal( &sink_cond );
+   }
+   pthread_mutex_unlock( &sink_lock );
+   
+   pthread_mutex_unlock( &f->lock );
+   
+   if( !running ) {
+      // no writers; do it ourselves
+      sink_finish( f );
+   }
+}
@@ -0,0 +1,70 @@
+// asynchronous writers for the output files the origin keeps for its jobs.
+// output that arrives from executors is queued on the job's file and handed to a small pool of writer threads,
+// so a slow or networked filesystem never holds up the threads receiving output.  Each writer takes everything
+// queued on a file at once and writes it with as few writev() calls as it can, so many small chunks cost one
+// system call.  A file is only ever written by one writer at a time, and is opened O_APPEND, so output lands in
+// the order it arrived.  Queueing never blocks: a file that falls too far behind says so (sink_backlogged), and the
+// origin stops granting its job's executor credit until it catches up, which bounds how much memory a stalled file
+// can take.  Closing a file is done by a writer too, once everything queued on it is written (and synced, if asked).
+#ifndef _SINK_H_
+#define _SINK_H_
+
+#include "libwish.h"
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <list>
+#include <vector>
+
+using namespace std;
+
+#define SINK_DEFAULT_THREADS     4
+#define SINK_MAX_PENDING         (4 * 1024 * 1024)    // bytes queued on one file before it's backlogged
+
+// when to sync files to disk
+#define SINK_FSYNC_NONE          0     // never; leave it to the kernel
+#define SINK_FSYNC_CLOSE         1     // once, when the job's file is closed
+#define SINK_FSYNC_BATCH         2     // after every batch written
+
+// a chunk of queued output
+struct sink_chunk {
+   char* data;
+   size_t len;
+};
+
+// an output file
+struct sink_file {
+   int fd;
+   char* path;
+
+   vector<struct sink_chunk> pending;     // output not yet handed to a writer
+   size_t pending_bytes;                  // bytes queued and not yet written (including those a writer has now)
+   bool queued;                           // waiting for or being written by a writer
+   bool closing;                          // close and free it once everything queued is written
+   int error;                             // first write error (0 if none)
+
+   pthread_mutex_t lock;
+};
+
+// start the writer threads
+int sink_init( struct wish_state* state );
+
+// write out whatever is queued, and stop the writer threads
+int sink_shutdown( struct wish_state* state );
+
+// start writing to an open file descriptor (opened with O_APPEND), which the sink_file now owns.
+// return the new sink_file
+struct sink_file* sink_open( int fd, char const* path );
+
+// queue output to be written to a file.  Takes ownership of data (allocated with malloc).  Never blocks.
+void sink_write( struct sink_file* f, char* data, size_t len );
+
+// does a file have SINK_MAX_PENDING or more bytes waiting to be written?
+bool sink_backlogged( struct sink_file* f );
+
+// has everything queued on a file been written?
+bool sink_idle( struct sink_file* f );
+
+// write out and close a file, and free it, in the background.  The caller must not use f again.
+void sink_close( struct sink_file* f );
+
+#endif
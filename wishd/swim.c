@@ -0,0 +1,598 @@
+#include "swim.h"
+
+// how many messages each piece of news rides on
+static int swim_retransmits( struct swim* s ) {
+   return SWIM_RETRANSMIT_MULT * (int)ceil( log2( (double)s->members.size() + 2 ) );
+}
+
+
+// how long a suspect has to refute it
+static uint64_t swim_suspect_timeout( struct swim* s ) {
+   double mult = log10( (double)s->members.size() + 1 );
+   if( mult < 1 )
+      mult = 1;
+   
+   return (uint64_t)(SWIM_SUSPECT_MULT * mult * s->period);
+}
+
+
+// is this news that can't wait?
+static bool swim_urgent( struct swim* s, struct wish_member_update* u ) {
+   return (u->state != MEMBER_ALIVE || u->nid == s->self.nid);
+}
+
+
+// spread news of a host, replacing any older news of it
+static void swim_gossip( struct swim* s, struct wish_member_update* u ) {
+   for( list<struct swim_news>::iterator itr = s->news.begin(); itr != s->news.end(); itr++ ) {
+      if( itr->update.nid == u->nid ) {
+         s->news.erase( itr );
+         break;
+      }
+   }
+   
+   struct swim_news n;
+   n.update = *u;
+   n.sends_left = swim_retransmits( s );
+   
+   // failures, and our own refutations, go out first, so a burst of joins (e.g. when a big instance starts) can't hold them up.
+   // otherwise freshest first.
+   if( swim_urgent( s, u ) ) {
+      s->news.push_front( n );
+      return;
+   }
+   
+   list<struct swim_news>::iterator itr = s->news.begin();
+   while( itr != s->news.end() && swim_urgent( s, &itr->update ) )
+      itr++;
+   
+   s->news.insert( itr, n );
+}
+
+
+// a random live host other than skip (0 if there is none)
+static uint64_t swim_random_member( struct swim* s, uint64_t skip ) {
+   if( s->order.size() == 0 )
+      return 0;
+   
+   for( int tries = 0; tries < 8; tries++ ) {
+      uint64_t nid = s->order[ random() % s->order.size() ];
+      if( nid == skip )
+         continue;
+   
+      map<uint64_t, struct swim_member>::iterator itr = s->members.find( nid );
+      if( itr != s->members.end() && itr->second.info.state == MEMBER_ALIVE )
+         return nid;
+   }
+   
+   return 0;
+}
+
+
+// piggyback news on a heartbeat
+static void swim_fill_updates( struct swim* s, struct wish_heartbeat_packet* h ) {
+   h->updates = (struct wish_member_update*)calloc( sizeof(struct wish_member_update) * HEARTBEAT_MAX_UPDATES, 1 );
+   h->num_updates = 0;
+   
+   for( list<struct swim_news>::iterator itr = s->news.begin(); itr != s->news.end() && h->num_updates < HEARTBEAT_MAX_UPDATES; ) {
+      h->updates[ h->num_updates ] = itr->update;
+      h->num_updates++;
+   
+      itr->sends_left--;
+      if( itr->sends_left <= 0 )
+         itr = s->news.erase( itr );
+      else
+         itr++;
+   }
+   
+   // use some of the room left to pass on how loaded other hosts are
+   uint32_t max_metrics = h->num_updates + HEARTBEAT_MAX_UPDATES / 2;
+   if( max_metrics > HEARTBEAT_MAX_UPDATES )
+      max_metrics = HEARTBEAT_MAX_UPDATES;
+   
+   for( int tries = 0; h->num_updates < max_metrics && tries < HEARTBEAT_MAX_UPDATES; tries++ ) {
+      uint64_t nid = swim_random_member( s, 0 );
+      if( nid == 0 )
+         break;
+   
+      struct swim_member* m = &s->members[ nid ];
+      if( m->info.seq == 0 )
+         continue;
+   
+      bool dup = false;
+      for( uint32_t i = 0; i < h->num_updates; i++ ) {
+         if( h->updates[i].nid == nid ) {
+            dup = true;
+            break;
+         }
+      }
+   
+      if( !dup ) {
+         h->updates[ h->num_updates ] = m->info;
+         h->num_updates++;
+      }
+   }
+   
+   if( h->num_updates == 0 ) {
+      free( h->updates );
+      h->updates = NULL;
+   }
+}
+
+
+// send a heartbeat to a host (answering, if it's the ack of one)
+static int swim_send( struct swim* s, uint64_t nid, uint32_t kind, uint32_t id, uint64_t target, struct wish_heartbeat_packet* answering ) {
+   struct wish_heartbeat_packet h;
+   memset( &h, 0, sizeof(h) );
+   
+   h.kind = kind;
+   h.id = id;
+   h.target = target;
+   
+   // echo the probe's send time, so its sender can time us without remembering it
+   if( answering != NULL ) {
+      h.echo_mono = answering->send_mono;
+      h.recv_mono = answering->recv_mono;
+   }
+   h.nid = s->self.nid;
+   h.incarnation = s->self.incarnation;
+   h.seq = s->self.seq;
+   h.portnum = s->self.portnum;
+   strcpy( h.hostname, s->self.hostname );
+   strcpy( h.labels, s->self.labels );
+   
+   swim_fill_updates( s, &h );
+   
+   int rc = (*s->ops.send)( s, nid, &h );
+   s->sent++;
+   
+   wish_free_heartbeat_packet( &h );
+   return rc;
+}
+
+
+// start tracking a host
+static struct swim_member* swim_add_member( struct swim* s, struct wish_member_update* u, uint64_t now ) {
+   struct swim_member* m = &s->members[ u->nid ];
+   m->info = *u;
+   m->since = now;
+   
+   s->dead.erase( u->nid );
+   
+   // probe it sometime later this round
+   size_t pos = s->next + random() % (s->order.size() - s->next + 1);
+   s->order.insert( s->order.begin() + pos, u->nid );
+   
+   return m;
+}
+
+
+// a host is gone
+static void swim_remove( struct swim* s, uint64_t nid, uint32_t state, uint32_t incarnation, uint64_t now ) {
+   map<uint64_t, struct swim_member>::iterator itr = s->members.find( nid );
+   if( itr == s->members.end() )
+      return;
+   
+   struct wish_member_update u = itr->second.info;
+   u.state = state;
+   u.incarnation = incarnation;
+   
+   s->members.erase( itr );
+   
+   struct swim_tombstone t;
+   t.incarnation = incarnation;
+   t.expires = now + SWIM_TOMBSTONE_PERIODS * s->period;
+   s->dead[ nid ] = t;
+   
+   swim_gossip( s, &u );
+   (*s->ops.changed)( s, &u );
+}
+
+
+// we couldn't reach a host
+static void swim_suspect( struct swim* s, uint64_t nid, uint64_t now ) {
+   map<uint64_t, struct swim_member>::iterator itr = s->members.find( nid );
+   if( itr == s->members.end() || itr->second.info.state != MEMBER_ALIVE )
+      return;
+   
+   itr->second.info.state = MEMBER_SUSPECT;
+   itr->second.since = now;
+   
+   swim_gossip( s, &itr->second.info );
+   (*s->ops.changed)( s, &itr->second.info );
+}
+
+
+// take in news of a host.  direct is true if it came from the host itself.
+static void swim_apply( struct swim* s, struct wish_member_update* u, uint64_t now, bool direct ) {
+   if( u->nid == s->self.nid ) {
+      // someone thinks we're in trouble; outrank it
+      if( (u->state == MEMBER_SUSPECT || u->state == MEMBER_DEAD) && u->incarnation >= s->self.incarnation && s->self.state == MEMBER_ALIVE ) {
+         s->self.incarnation = u->incarnation + 1;
+         swim_gossip( s, &s->self );
+      }
+      return;
+   }
+   
+   map<uint64_t, struct swim_member>::iterator itr = s->members.find( u->nid );
+   if( itr == s->members.end() ) {
+      map<uint64_t, struct swim_tombstone>::iterator ditr = s->dead.find( u->nid );
+   
+      if( u->state == MEMBER_SUSPECT ) {
+         // only the host itself, or news that it's alive, brings in a host we don't know
+         return;
+      }
+   
+      if( u->state == MEMBER_DEAD || u->state == MEMBER_LEFT ) {
+         // remember it, so older news doesn't bring it back
+         if( ditr == s->dead.end() || ditr->second.incarnation < u->incarnation ) {
+            struct swim_tombstone t;
+            t.incarnation = u->incarnation;
+            t.expires = now + SWIM_TOMBSTONE_PERIODS * s->period;
+            s->dead[ u->nid ] = t;
+         }
+         return;
+      }
+   
+      if( ditr != s->dead.end() && u->incarnation <= ditr->second.incarnation ) {
+         // stale.  If it's the host itself talking, it needs to hear it's been declared dead, so it can refute it.
+         if( direct ) {
+            struct wish_member_update d = *u;
+            d.state = MEMBER_DEAD;
+            d.incarnation = ditr->second.incarnation;
+            swim_gossip( s, &d );
+         }
+         return;
+      }
+   
+      // a new host
+      struct swim_member* m = swim_add_member( s, u, now );
+   
+      swim_gossip( s, &m->info );
+      (*s->ops.changed)( s, &m->info );
+   
+      if( !direct && u->seq != 0 )
+         (*s->ops.metrics)( s, &m->info );
+   
+      return;
+   }
+   
+   struct swim_member* m = &itr->second;
+   
+   bool newer_metrics = (u->seq != 0 && (u->incarnation > m->info.incarnation || (u->incarnation == m->info.incarnation && u->seq > m->info.seq)));
+   
+   switch( u->state ) {
+      case MEMBER_ALIVE: {
+         if( u->incarnation > m->info.incarnation ) {
+            bool was_suspect = (m->info.state != MEMBER_ALIVE);
+   
+            m->info.state = MEMBER_ALIVE;
+            m->info.incarnation = u->incarnation;
+            m->info.portnum = u->portnum;
+            strcpy( m->info.hostname, u->hostname );
+            m->since = now;
+   
+            swim_gossip( s, &m->info );
+            if( was_suspect )
+               (*s->ops.changed)( s, &m->info );
+         }
+         break;
+      }
+   
+      case MEMBER_SUSPECT: {
+         if( (m->info.state == MEMBER_ALIVE && u->incarnation >= m->info.incarnation) || (m->info.state == MEMBER_SUSPECT && u->incarnation > m->info.incarnation) ) {
+            bool was_alive = (m->info.state == MEMBER_ALIVE);
+   
+            m->info.state = MEMBER_SUSPECT;
+            m->info.incarnation = u->incarnation;
+            if( was_alive )
+               m->since = now;
+   
+            swim_gossip( s, &m->info );
+            if( was_alive )
+               (*s->ops.changed)( s, &m->info );
+         }
+         break;
+      }
+   
+      case MEMBER_DEAD:
+      case MEMBER_LEFT: {
+         if( u->incarnation >= m->info.incarnation ) {
+            swim_remove( s, u->nid, u->state, u->incarnation, now );
+            return;
+         }
+         break;
+      }
+   
+      default:
+         return;
+   }
+   
+   if( newer_metrics ) {
+      m->info.seq = u->seq;
+      m->info.load = u->load;
+      m->info.ram_free = u->ram_free;
+      m->info.disk_free = u->disk_free;
+      m->info.queue_depth = u->queue_depth;
+      m->info.running = u->running;
+      m->info.cpus_free = u->cpus_free;
+      m->info.nodes_free = u->nodes_free;
+      
+      if( u->labels[0] != 0 )
+         strcpy( m->info.labels, u->labels );
+      if( u->metrics.version != 0 )
+         m->info.metrics = u->metrics;
+   
+      if( !direct )
+         (*s->ops.metrics)( s, &m->info );
+   }
+}
+
+
+// set up a swim for this host
+void swim_init( struct swim* s, uint64_t nid, char const* hostname, int portnum, uint32_t incarnation, uint64_t period, int indirect, struct swim_ops* ops, void* cls ) {
+   memset( &s->self, 0, sizeof(s->self) );
+   s->self.state = MEMBER_ALIVE;
+   s->self.nid = nid;
+   s->self.incarnation = incarnation;
+   strncpy( s->self.hostname, hostname, HOST_NAME_MAX );
+   s->self.portnum = portnum;
+   
+   s->next = 0;
+   s->period = period;
+   s->indirect = (indirect > 0 ? indirect : SWIM_DEFAULT_INDIRECT);
+   
+   s->probe_target = 0;
+   s->probe_id = 0;
+   s->probe_acked = false;
+   s->probe_indirect = false;
+   s->next_id = 1;
+   
+   s->ops = *ops;
+   s->cls = cls;
+   s->sent = 0;
+}
+
+
+// forget everything
+void swim_free( struct swim* s ) {
+   s->members.clear();
+   s->dead.clear();
+   s->news.clear();
+   s->relays.clear();
+   s->order.clear();
+   s->next = 0;
+}
+
+
+// learn of a host out of band.  It'll be told about us when we first probe it.
+void swim_add( struct swim* s, uint64_t nid, char const* hostname, int portnum, uint64_t now ) {
+   if( nid == s->self.nid || s->members.count( nid ) > 0 )
+      return;
+   
+   struct wish_member_update u;
+   memset( &u, 0, sizeof(u) );
+   u.state = MEMBER_ALIVE;
+   u.nid = nid;
+   strncpy( u.hostname, hostname, HOST_NAME_MAX );
+   u.portnum = portnum;
+   
+   swim_add_member( s, &u, now );
+}
+
+
+// stop tracking a host that turned out to be one we know by another name, without telling anyone
+void swim_forget( struct swim* s, uint64_t nid ) {
+   s->members.erase( nid );
+   
+   if( s->probe_target == nid )
+      s->probe_target = 0;
+}
+
+
+// the next host to probe (0 if there are none)
+static uint64_t swim_next_target( struct swim* s ) {
+   while( true ) {
+      if( s->next >= s->order.size() ) {
+         // new round, in a new order
+         s->order.clear();
+         for( map<uint64_t, struct swim_member>::iterator itr = s->members.begin(); itr != s->members.end(); itr++ ) {
+            s->order.push_back( itr->first );
+         }
+         for( size_t i = s->order.size(); i > 1; i-- ) {
+            swap( s->order[i-1], s->order[ random() % i ] );
+         }
+         s->next = 0;
+   
+         if( s->order.size() == 0 )
+            return 0;
+      }
+   
+      uint64_t nid = s->order[ s->next ];
+      s->next++;
+   
+      // skip hosts that have gone since the round started
+      if( s->members.count( nid ) > 0 )
+         return nid;
+   }
+}
+
+
+// start a protocol period
+void swim_tick( struct swim* s, uint64_t now ) {
+   if( s->self.state != MEMBER_ALIVE )
+      return;
+   
+   // the last probe went unanswered, even through others
+   if( s->probe_target != 0 && !s->probe_acked )
+      swim_suspect( s, s->probe_target, now );
+   
+   s->probe_target = 0;
+   
+   // suspects that didn't refute it in time are dead
+   uint64_t timeout = swim_suspect_timeout( s );
+   vector<struct swim_member> expired;
+   for( map<uint64_t, struct swim_member>::iterator itr = s->members.begin(); itr != s->members.end(); itr++ ) {
+      if( itr->second.info.state == MEMBER_SUSPECT && now - itr->second.since >= timeout )
+         expired.push_back( itr->second );
+   }
+   for( vector<struct swim_member>::size_type i = 0; i < expired.size(); i++ ) {
+      swim_remove( s, expired[i].info.nid, MEMBER_DEAD, expired[i].info.incarnation, now );
+   }
+   
+   // forget relays nobody answered, and hosts long dead
+   for( map<uint32_t, struct swim_relay>::iterator itr = s->relays.begin(); itr != s->relays.end(); ) {
+      if( itr->second.expires <= now )
+         s->relays.erase( itr++ );
+      else
+         itr++;
+   }
+   for( map<uint64_t, struct swim_tombstone>::iterator itr = s->dead.begin(); itr != s->dead.end(); ) {
+      if( itr->second.expires <= now )
+         s->dead.erase( itr++ );
+      else
+         itr++;
+   }
+   
+   // our condition has a new reading
+   s->self.seq++;
+   
+   uint64_t target = swim_next_target( s );
+   if( target == 0 )
+      return;
+   
+   s->probe_target = target;
+   s->probe_id = s->next_id++;
+   s->probe_acked = false;
+   s->probe_indirect = false;
+   
+   int rc = swim_send( s, target, HEARTBEAT_PING, s->probe_id, 0, NULL );
+   if( rc != 0 ) {
+      // can't even reach it; see if others can, right away
+      swim_probe_timeout( s, now );
+   }
+}
+
+
+// ask others to probe a host that hasn't acked
+void swim_probe_timeout( struct swim* s, uint64_t now ) {
+   if( s->probe_target == 0 || s->probe_acked || s->probe_indirect )
+      return;
+   
+   s->probe_indirect = true;
+   
+   vector<uint64_t> helpers;
+   for( int tries = 0; (int)helpers.size() < s->indirect && tries < 3 * s->indirect; tries++ ) {
+      uint64_t nid = swim_random_member( s, s->probe_target );
+      if( nid != 0 && find( helpers.begin(), helpers.end(), nid ) == helpers.end() )
+         helpers.push_back( nid );
+   }
+   
+   for( vector<uint64_t>::size_type i = 0; i < helpers.size(); i++ ) {
+      swim_send( s, helpers[i], HEARTBEAT_PING_REQ, s->probe_id, s->probe_target, NULL );
+   }
+}
+
+
+// handle a heartbeat from another host
+void swim_recv( struct swim* s, struct wish_heartbeat_packet* h, uint64_t now ) {
+   if( h->nid == s->self.nid )
+      return;
+   
+   if( h->nid != 0 ) {
+      // whoever sends us anything is alive
+      struct wish_member_update sender;
+      memset( &sender, 0, sizeof(sender) );
+      sender.state = MEMBER_ALIVE;
+      sender.nid = h->nid;
+      sender.incarnation = h->incarnation;
+      strcpy( sender.hostname, h->hostname );
+      sender.portnum = h->portnum;
+      sender.seq = h->seq;
+      sender.load = h->loads[0];
+      sender.ram_free = h->ram_free;
+      sender.disk_free = h->disk_free;
+      sender.queue_depth = h->queue_depth;
+      sender.running = h->running;
+      sender.cpus_free = h->cpus_free;
+      sender.nodes_free = h->nodes_free;
+      strcpy( sender.labels, h->labels );
+      sender.metrics = h->metrics;
+   
+      swim_apply( s, &sender, now, true );
+   }
+   
+   for( uint32_t i = 0; i < h->num_updates && h->updates != NULL; i++ ) {
+      swim_apply( s, &h->updates[i], now, false );
+   }
+   
+   if( h->nid == 0 )
+      return;
+   
+   switch( h->kind ) {
+      case HEARTBEAT_PING: {
+         swim_send( s, h->nid, HEARTBEAT_ACK, h->id, 0, h );
+         break;
+      }
+   
+      case HEARTBEAT_ACK: {
+         uint64_t acked = (h->target != 0 ? h->target : h->nid);
+   
+         if( h->target == 0 ) {
+            // an answer to a probe we made for someone else?
+            map<uint32_t, struct swim_relay>::iterator itr = s->relays.find( h->id );
+            if( itr != s->relays.end() && itr->second.target == h->nid ) {
+               swim_send( s, itr->second.requester, HEARTBEAT_ACK, itr->second.requester_id, h->nid, NULL );
+               s->relays.erase( itr );
+               break;
+            }
+         }
+   
+         if( h->id == s->probe_id && acked == s->probe_target )
+            s->probe_acked = true;
+   
+         break;
+      }
+   
+      case HEARTBEAT_PING_REQ: {
+         struct swim_relay r;
+         r.requester = h->nid;
+         r.requester_id = h->id;
+         r.target = h->target;
+         r.expires = now + s->period;
+   
+         uint32_t id = s->next_id++;
+         s->relays[ id ] = r;
+   
+         swim_send( s, h->target, HEARTBEAT_PING, id, 0, NULL );
+         break;
+      }
+   
+      default:
+         break;
+   }
+}
+
+
+// tell a few hosts we're leaving
+void swim_leave( struct swim* s ) {
+   s->self.state = MEMBER_LEFT;
+   swim_gossip( s, &s->self );
+   
+   vector<uint64_t> told;
+   for( int tries = 0; (int)told.size() < s->indirect && tries < 3 * s->indirect; tries++ ) {
+      uint64_t nid = swim_random_member( s, 0 );
+      if( nid != 0 && find( told.begin(), told.end(), nid ) == told.end() )
+         told.push_back( nid );
+   }
+   
+   for( vector<uint64_t>::size_type i = 0; i < told.size(); i++ ) {
+      swim_send( s, told[i], HEARTBEAT_PING, s->next_id++, 0, NULL );
+   }
+}
+
+
+// how many other hosts are alive or suspect
+size_t swim_size( struct swim* s ) {
+   return s->members.size();
+}
@@ -0,0 +1,126 @@
+// group membership by gossip (after SWIM, Das et al.).
+// each protocol period a host probes one other host, chosen round-robin over a shuffled list, and if it gets no ack
+// within a fraction of the period, asks a few others to probe it on its behalf.  A host nobody can reach is only
+// suspected at first; news of that spreads, and the host has a few periods to refute it by raising its incarnation
+// before everyone declares it dead.  Joins, leaves, deaths, and each host's load are not broadcast, but piggybacked
+// a few at a time on the probes and acks, so each host sends a constant number of messages per period no matter
+// how large the instance is, and news still reaches everyone in O(log n) periods.
+//
+// a swim holds no locks and reads no clocks: the caller passes in the time and serializes calls, and messages go
+// out through callbacks, so the same code can run many hosts in one process.
+#ifndef _SWIM_H_
+#define _SWIM_H_
+
+#include "libwish.h"
+#include <map>
+#include <list>
+#include <vector>
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+#define SWIM_DEFAULT_INDIRECT     3     // hosts asked to probe a host that didn't ack us directly
+#define SWIM_RETRANSMIT_MULT      3     // each piece of news is piggybacked this many times log2(n) times
+#define SWIM_SUSPECT_MULT         4     // a suspect is declared dead after this many times log10(n) periods (at least this many)
+#define SWIM_TOMBSTONE_PERIODS    120   // how long we remember a dead host's incarnation, so stale news can't revive it
+
+// a host we know of
+struct swim_member {
+   struct wish_member_update info;     // state, incarnation, address, and the newest condition we have of it
+   uint64_t since;                     // when it entered its state
+};
+
+// news waiting to be piggybacked
+struct swim_news {
+   struct wish_member_update update;
+   int sends_left;
+};
+
+// a probe we're making on another host's behalf
+struct swim_relay {
+   uint64_t requester;
+   uint32_t requester_id;
+   uint64_t target;
+   uint64_t expires;
+};
+
+// a dead host
+struct swim_tombstone {
+   uint32_t incarnation;
+   uint64_t expires;
+};
+
+struct swim;
+
+// how a swim reaches the world
+struct swim_ops {
+   // send a heartbeat to a host.  The caller fills in this host's condition, and stamps it with send_mono (and, if it
+   // echoes a probe, with how long since that probe's recv_mono) as it goes out.
+   // It may only be queued here; it must not wait on the network, since it's called with the caller's lock held.
+   // return 0 if it went out (or will), or -errno if the host couldn't be reached
+   int (*send)( struct swim* s, uint64_t nid, struct wish_heartbeat_packet* h );
+   
+   // a host joined, or changed state (MEMBER_DEAD and MEMBER_LEFT mean it's gone)
+   void (*changed)( struct swim* s, struct wish_member_update* m );
+   
+   // newer news of a host's condition came in second hand (the caller sees what hosts send it directly)
+   void (*metrics)( struct swim* s, struct wish_member_update* m );
+};
+
+struct swim {
+   struct wish_member_update self;              // this host, as we announce it
+   
+   map<uint64_t, struct swim_member> members;   // every other live (or suspect) host
+   map<uint64_t, struct swim_tombstone> dead;
+   list<struct swim_news> news;
+   map<uint32_t, struct swim_relay> relays;     // by the id of the probe we sent for them
+   
+   vector<uint64_t> order;                      // probe order for this round
+   size_t next;
+   
+   uint64_t period;                             // protocol period, in milliseconds
+   int indirect;                                // hosts asked to help with a failed probe
+   
+   // the probe of this period
+   uint64_t probe_target;
+   uint32_t probe_id;
+   bool probe_acked;
+   bool probe_indirect;
+   
+   uint32_t next_id;
+   
+   struct swim_ops ops;
+   void* cls;
+   
+   uint64_t sent;                               // messages sent, for accounting
+};
+
+// set up a swim for this host (set s->self.labels after, to announce any)
+void swim_init( struct swim* s, uint64_t nid, char const* hostname, int portnum, uint32_t incarnation, uint64_t period, int indirect, struct swim_ops* ops, void* cls );
+
+// forget everything
+void swim_free( struct swim* s );
+
+// learn of a host out of band (e.g. from the config file)
+void swim_add( struct swim* s, uint64_t nid, char const* hostname, int portnum, uint64_t now );
+
+// stop tracking a host that turned out to be one we know by another name, without telling anyone
+void swim_forget( struct swim* s, uint64_t nid );
+
+// start a protocol period: judge the last probe, time out suspects, and probe the next host
+void swim_tick( struct swim* s, uint64_t now );
+
+// part way through the period: ask others to probe a host that hasn't acked
+void swim_probe_timeout( struct swim* s, uint64_t now );
+
+// handle a heartbeat from another host
+void swim_recv( struct swim* s, struct wish_heartbeat_packet* h, uint64_t now );
+
+// tell a few hosts we're leaving
+void swim_leave( struct swim* s );
+
+// how many other hosts are alive or suspect
+size_t swim_size( struct swim* s );
+
+#endif
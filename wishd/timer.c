@@ -0,0 +1,254 @@
+#include "timer.h"
+
+// wheel slots.  Each slot is a circular list with a sentinel head.
+static struct timer wheel[TIMER_LEVELS][TIMER_LEVEL_SIZE];
+
+// next tick to process
+static uint64_t current_tick = 0;
+
+// monotonic time (in milliseconds) of tick 0
+static uint64_t base_ms = 0;
+
+// number of armed timers
+static uint64_t num_armed = 0;
+
+static pthread_mutex_t wheel_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wheel_cond;
+
+static pthread_t timer_thread;
+static volatile bool timer_running = false;
+
+
+// monotonic time in milliseconds
+static uint64_t timer_now_ms(void) {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+// remove a timer from its slot.  wheel_lock must be held.
+static void timer_unlink( struct timer* t ) {
+   t->prev->next = t->next;
+   t->next->prev = t->prev;
+   t->next = NULL;
+   t->prev = NULL;
+   t->armed = false;
+   num_armed--;
+}
+
+
+// put a timer into the slot for its deadline.  wheel_lock must be held.
+static void timer_link( struct timer* t ) {
+   uint64_t expires = t->expires;
+   if( expires < current_tick )
+      expires = current_tick;
+   
+   uint64_t delta = expires - current_tick;
+   
+   // find the lowest level whose range covers the deadline
+   int level = 0;
+   while( level < TIMER_LEVELS - 1 && delta >= ((uint64_t)1 << (TIMER_LEVEL_BITS * (level + 1))) ) {
+      level++;
+   }
+   
+   if( level == TIMER_LEVELS - 1 && delta >= ((uint64_t)1 << (TIMER_LEVEL_BITS * TIMER_LEVELS)) ) {
+      // beyond the wheel; park it in the furthest slot, and it'll be re-cascaded when we get there
+      expires = current_tick + ((uint64_t)1 << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1;
+   }
+   
+   struct timer* head = &wheel[level][ (expires >> (TIMER_LEVEL_BITS * level)) & TIMER_LEVEL_MASK ];
+   
+   t->next = head;
+   t->prev = head->prev;
+   head->prev->next = t;
+   head->prev = t;
+   t->armed = true;
+   num_armed++;
+}
+
+
+// move every timer in a higher-level slot down to where it belongs now.  wheel_lock must be held.
+static void timer_cascade( int level, int slot ) {
+   struct timer* head = &wheel[level][slot];
+   
+   while( head->next != head ) {
+      struct timer* t = head->next;
+      timer_unlink( t );
+      timer_link( t );
+   }
+}
+
+
+// timer thread: advance the wheel, and fire whatever comes due
+static void* timer_thread_func( void* arg ) {
+   struct wish_state* state = (struct wish_state*)arg;
+   
+   typedef pair<timer_func, uint64_t> TimerCall;
+   vector<TimerCall> due;
+   
+   pthread_mutex_lock( &wheel_lock );
+   
+   while( timer_running ) {
+      uint64_t now_tick = (timer_now_ms() - base_ms) / TIMER_TICK_MS;
+      
+      while( current_tick <= now_tick ) {
+         int slot = current_tick & TIMER_LEVEL_MASK;
+         
+         // at each wrap of a level, pull the next slot of the level above down
+         for( int level = 1; level < TIMER_LEVELS && slot == 0; level++ ) {
+            slot = (current_tick >> (TIMER_LEVEL_BITS * level)) & TIMER_LEVEL_MASK;
+            timer_cascade( level, slot );
+         }
+         
+         struct timer* head = &wheel[0][ current_tick & TIMER_LEVEL_MASK ];
+         while( head->next != head ) {
+            struct timer* t = head->next;
+            timer_unlink( t );
+            
+            // only remember what to call; the owner may free the timer as soon as we unlock
+            due.push_back( TimerCall( t->func, t->arg ) );
+         }
+         
+         current_tick++;
+      }
+      
+      if( due.size() > 0 ) {
+         pthread_mutex_unlock( &wheel_lock );
+         
+         for( vector<TimerCall>::size_type i = 0; i < due.size(); i++ ) {
+            (*due[i].first)( state, due[i].second );
+         }
+         due.clear();
+         
+         pthread_mutex_lock( &wheel_lock );
+         continue;
+      }
+      
+      if( num_armed == 0 ) {
+         // nothing to do until someone arms a timer
+         pthread_cond_wait( &wheel_cond, &wheel_lock );
+      }
+      else {
+         // sleep until the next tick
+         uint64_t wake_ms = base_ms + current_tick * TIMER_TICK_MS;
+         
+         struct timespec ts;
+         ts.tv_sec = wake_ms / 1000;
+         ts.tv_nsec = (wake_ms % 1000) * 1000000;
+         pthread_cond_timedwait( &wheel_cond, &wheel_lock, &ts );
+      }
+   }
+   
+   pthread_mutex_unlock( &wheel_lock );
+   return NULL;
+}
+
+
+// start the timer thread
+int timer_init( struct wish_state* state ) {
+   for( int i = 0; i < TIMER_LEVELS; i++ ) {
+      for( int j = 0; j < TIMER_LEVEL_SIZE; j++ ) {
+         wheel[i][j].next = &wheel[i][j];
+         wheel[i][j].prev = &wheel[i][j];
+      }
+   }
+   
+   // time out on the same clock we tick on
+   pthread_condattr_t attr;
+   pthread_condattr_init( &attr );
+   pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+   pthread_cond_init( &wheel_cond, &attr );
+   pthread_condattr_destroy( &attr );
+   
+   base_ms = timer_now_ms();
+   current_tick = 0;
+   num_armed = 0;
+   
+   timer_running = true;
+   int rc = pthread_create( &timer_thread, NULL, timer_thread_func, state );
+   if( rc != 0 ) {
+      errorf("timer_init: pthread_create rc = %d\n", rc );
+      timer_running = false;
+      pthread_cond_destroy( &wheel_cond );
+      return -rc;
+   }
+   
+   return 0;
+}
+
+
+// stop the timer thread
+int timer_shutdown( struct wish_state* state ) {
+   if( !timer_running )
+      return 0;
+   
+   pthread_mutex_lock( &wheel_lock );
+   timer_running = false;
+   pthread_cond_signal( &wheel_cond );
+   pthread_mutex_unlock( &wheel_lock );
+   
+   pthread_join( timer_thread, NULL );
+   
+   // drop whatever is left
+   pthread_mutex_lock( &wheel_lock );
+   for( int i = 0; i < TIMER_LEVELS; i++ ) {
+      for( int j = 0; j < TIMER_LEVEL_SIZE; j++ ) {
+         while( wheel[i][j].next != &wheel[i][j] ) {
+            timer_unlink( wheel[i][j].next );
+         }
+      }
+   }
+   pthread_mutex_unlock( &wheel_lock );
+   
+   pthread_cond_destroy( &wheel_cond );
+   return 0;
+}
+
+
+// set up a timer
+void timer_setup( struct timer* t, timer_func func, uint64_t arg ) {
+   memset( t, 0, sizeof(struct timer) );
+   t->func = func;
+   t->arg = arg;
+}
+
+
+// arm a timer
+int timer_arm( struct timer* t, uint64_t delay_ms ) {
+   if( !timer_running )
+      return -ENOTCONN;
+   
+   pthread_mutex_lock( &wheel_lock );
+   
+   if( t->armed )
+      timer_unlink( t );
+   
+   // round up, so we never fire early
+   uint64_t now_ms = timer_now_ms() - base_ms;
+   t->expires = (now_ms + delay_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+   
+   bool was_idle = (num_armed == 0);
+   timer_link( t );
+   
+   if( was_idle )
+      pthread_cond_signal( &wheel_cond );
+   
+   pthread_mutex_unlock( &wheel_lock );
+   return 0;
+}
+
+
+// disarm a timer
+int timer_cancel( struct timer* t ) {
+   int rc = -ENOENT;
+   
+   pthread_mutex_lock( &wheel_lock );
+   if( t->armed ) {
+      timer_unlink( t );
+      rc = 0;
+   }
+   pthread_mutex_unlock( &wheel_lock );
+   
+   return rc;
+}
@@ -0,0 +1,47 @@
+// hierarchical timer wheel for the daemon's deadlines (job timeouts, barrier expiry, heartbeats).
+// arming and cancelling a timer is O(1), and timers fire from a single timer thread within one tick of their deadline.
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include "libwish.h"
+
+#define TIMER_TICK_MS      10                            // wheel resolution, in milliseconds
+#define TIMER_LEVEL_BITS   6
+#define TIMER_LEVEL_SIZE   (1 << TIMER_LEVEL_BITS)       // slots per level
+#define TIMER_LEVEL_MASK   (TIMER_LEVEL_SIZE - 1)
+#define TIMER_LEVELS       4                             // 4 levels of 64 slots at 10ms covers about 46 hours; later timers get re-cascaded
+
+// called on the timer thread when a timer fires, with no timer locks held.
+// by the time this runs, whoever armed the timer may have cancelled it and freed it, so arg should
+// identify what to act on (e.g. a gpid to look up) rather than point to memory the timer's owner frees.
+typedef void (*timer_func)( struct wish_state* state, uint64_t arg );
+
+// a timer.  Owners embed one of these in their own structures.
+struct timer {
+   struct timer* next;           // wheel slot list links
+   struct timer* prev;
+   uint64_t expires;             // tick at which to fire
+   bool armed;                   // is this timer in the wheel?
+   
+   timer_func func;              // what to call when it fires
+   uint64_t arg;                 // argument to func
+};
+
+// start the timer thread
+int timer_init( struct wish_state* state );
+
+// stop the timer thread.  Armed timers are dropped without firing.
+int timer_shutdown( struct wish_state* state );
+
+// set up a timer (does not arm it)
+void timer_setup( struct timer* t, timer_func func, uint64_t arg );
+
+// arm a timer to fire in delay_ms milliseconds.  Re-arming an armed timer moves its deadline.
+// return 0 on success; negative on error
+int timer_arm( struct timer* t, uint64_t delay_ms );
+
+// disarm a timer.  Must be called before freeing an armed timer.
+// return 0 if the timer was armed, or -ENOENT if it wasn't (e.g. it already fired)
+int timer_cancel( struct timer* t );
+
+#endif
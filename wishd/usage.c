@@ -0,0 +1,296 @@
+#include "usage.h"
+
+// delegated cgroup v2 directory (NULL if not in use)
+static char* cgroup_root = NULL;
+
+// per-uid totals
+static UsageTable totals;
+static pthread_rwlock_t totals_lock;
+
+
+// path to a file in a job's cgroup
+static char* usage_cgroup_path( uint64_t gpid, char const* file ) {
+   char* ret = (char*)calloc( strlen(cgroup_root) + 1 + strlen(USAGE_CGROUP_PREFIX) + 21 + 1 + (file ? strlen(file) : 0) + 1, 1 );
+   sprintf( ret, "%s/%s%lu", cgroup_root, USAGE_CGROUP_PREFIX, gpid );
+   if( file ) {
+      strcat( ret, "/" );
+      strcat( ret, file );
+   }
+   return ret;
+}
+
+
+// read a small file in a job's cgroup.
+// return the number of bytes read, or negative on error
+static ssize_t usage_cgroup_read( uint64_t gpid, char const* file, char* buf, size_t len ) {
+   char* path = usage_cgroup_path( gpid, file );
+   int fd = open( path, O_RDONLY );
+   free( path );
+   
+   if( fd < 0 )
+      return -errno;
+   
+   ssize_t nr = read( fd, buf, len - 1 );
+   int errsv = errno;
+   close( fd );
+   
+   if( nr < 0 )
+      return -errsv;
+   
+   buf[nr] = 0;
+   return nr;
+}
+
+
+// set up accounting, and check the cgroup root (if one is configured)
+int usage_init( struct wish_state* state ) {
+   pthread_rwlock_init( &totals_lock, NULL );
+   
+   wish_state_rlock( state );
+   char* root = state->conf.cgroup_root ? strdup( state->conf.cgroup_root ) : NULL;
+   wish_state_unlock( state );
+   
+   if( root == NULL )
+      return 0;
+   
+   // must be a cgroup v2 directory we can make children in
+   char* controllers = (char*)calloc( strlen(root) + strlen("/cgroup.controllers") + 1, 1 );
+   sprintf( controllers, "%s/cgroup.controllers", root );
+   
+   int rc = 0;
+   if( access( controllers, R_OK ) != 0 || access( root, W_OK ) != 0 ) {
+      rc = -errno;
+      errorf("usage_init: %s is not a writable cgroup v2 directory (errno = %d); using rusage instead\n", root, rc );
+      free( controllers );
+      free( root );
+      return rc;
+   }
+   free( controllers );
+   
+   // turn on the controllers we read from (and cpuset, for pinned jobs).  It's fine if some aren't available; we'll fall back to rusage for those numbers.
+   char* subtree = (char*)calloc( strlen(root) + strlen("/cgroup.subtree_control") + 1, 1 );
+   sprintf( subtree, "%s/cgroup.subtree_control", root );
+   
+   char const* enable[] = { "+cpu", "+memory", "+io", "+cpuset" };
+   for( int i = 0; i < 4; i++ ) {
+      int fd = open( subtree, O_WRONLY );
+      if( fd < 0 )
+         break;
+      
+      if( write( fd, enable[i], strlen(enable[i]) ) < 0 ) {
+         dbprintf("usage_init: could not enable %s in %s, errno = %d\n", enable[i] + 1, root, -errno );
+      }
+      close( fd );
+   }
+   free( subtree );
+   
+   cgroup_root = root;
+   dbprintf("usage_init: accounting for jobs in cgroups under %s\n", cgroup_root );
+   return 0;
+}
+
+
+// shut down accounting
+int usage_shutdown( struct wish_state* state ) {
+   if( cgroup_root ) {
+      free( cgroup_root );
+      cgroup_root = NULL;
+   }
+   
+   pthread_rwlock_wrlock( &totals_lock );
+   totals.clear();
+   pthread_rwlock_unlock( &totals_lock );
+   
+   pthread_rwlock_destroy( &totals_lock );
+   return 0;
+}
+
+
+// make a cgroup for a job
+char* usage_cgroup_create( uint64_t gpid ) {
+   if( cgroup_root == NULL )
+      return NULL;
+   
+   char* dir = usage_cgroup_path( gpid, NULL );
+   int rc = mkdir( dir, 0755 );
+   if( rc != 0 && errno != EEXIST ) {
+      errorf("usage_cgroup_create: mkdir %s errno = %d\n", dir, -errno );
+      free( dir );
+      return NULL;
+   }
+   free( dir );
+   
+   return usage_cgroup_path( gpid, "cgroup.procs" );
+}
+
+
+// move the calling process into a cgroup.
+// only uses async-signal-safe calls, since it runs in a child of a multithreaded process.
+int usage_cgroup_join( char const* procs_path ) {
+   int fd = open( procs_path, O_WRONLY );
+   if( fd < 0 )
+      return -errno;
+   
+   // "0" means the writing process
+   int rc = 0;
+   if( write( fd, "0", 1 ) < 0 )
+      rc = -errno;
+   
+   close( fd );
+   return rc;
+}
+
+
+// confine a job's cgroup to some cores and NUMA nodes' memory
+int usage_cgroup_cpuset( uint64_t gpid, char const* cpus, char const* mems ) {
+   if( cgroup_root == NULL )
+      return 0;
+   
+   char const* files[] = { "cpuset.cpus", "cpuset.mems" };
+   char const* values[] = { cpus, mems };
+   int rc = 0;
+   
+   for( int i = 0; i < 2; i++ ) {
+      char* path = usage_cgroup_path( gpid, files[i] );
+      int fd = open( path, O_WRONLY );
+      if( fd < 0 ) {
+         rc = -errno;
+         errorf("usage_cgroup_cpuset: could not open %s, errno = %d\n", path, rc );
+         free( path );
+         break;
+      }
+      
+      if( write( fd, values[i], strlen(values[i]) ) < 0 ) {
+         rc = -errno;
+         errorf("usage_cgroup_cpuset: could not write \"%s\" to %s, errno = %d\n", values[i], path, rc );
+      }
+      close( fd );
+      free( path );
+      
+      if( rc != 0 )
+         break;
+   }
+   
+   return rc;
+}
+
+
+// read a job's cgroup's usage, and remove it
+int usage_cgroup_collect( uint64_t gpid, struct wish_usage_packet* p ) {
+   if( cgroup_root == NULL )
+      return -ENOENT;
+   
+   char buf[4096];
+   
+   // CPU time (always available)
+   ssize_t nr = usage_cgroup_read( gpid, "cpu.stat", buf, sizeof(buf) );
+   if( nr < 0 ) {
+      errorf("usage_cgroup_collect: could not read cpu.stat for %lu, rc = %ld\n", gpid, nr );
+      return nr;
+   }
+   
+   // no CPU time at all means the job never made it into the cgroup
+   char* line = strstr( buf, "usage_usec " );
+   if( line == NULL || strtoull( line + strlen("usage_usec "), NULL, 10 ) == 0 ) {
+      errorf("usage_cgroup_collect: job %lu did not run in its cgroup\n", gpid );
+      return -ENODATA;
+   }
+   
+   line = strstr( buf, "user_usec " );
+   if( line )
+      p->utime = strtoull( line + strlen("user_usec "), NULL, 10 );
+   
+   line = strstr( buf, "system_usec " );
+   if( line )
+      p->stime = strtoull( line + strlen("system_usec "), NULL, 10 );
+   
+   p->source = USAGE_SOURCE_CGROUP;
+   
+   // peak memory (needs the memory controller, and Linux 5.19 or later)
+   nr = usage_cgroup_read( gpid, "memory.peak", buf, sizeof(buf) );
+   if( nr > 0 ) {
+      p->maxrss = strtoull( buf, NULL, 10 ) / 1024;
+   }
+   
+   // block I/O, summed over all devices (needs the io controller)
+   nr = usage_cgroup_read( gpid, "io.stat", buf, sizeof(buf) );
+   if( nr >= 0 ) {
+      uint64_t rbytes = 0, wbytes = 0;
+      
+      for( char* s = strstr( buf, "rbytes=" ); s != NULL; s = strstr( s + 1, "rbytes=" ) )
+         rbytes += strtoull( s + strlen("rbytes="), NULL, 10 );
+      
+      for( char* s = strstr( buf, "wbytes=" ); s != NULL; s = strstr( s + 1, "wbytes=" ) )
+         wbytes += strtoull( s + strlen("wbytes="), NULL, 10 );
+      
+      p->read_bytes = rbytes;
+      p->write_bytes = wbytes;
+   }
+   
+   return 0;
+}
+
+
+// remove a job's cgroup
+int usage_cgroup_remove( uint64_t gpid ) {
+   if( cgroup_root == NULL )
+      return 0;
+   
+   char* dir = usage_cgroup_path( gpid, NULL );
+   int rc = rmdir( dir );
+   if( rc != 0 ) {
+      rc = -errno;
+      errorf("usage_cgroup_remove: rmdir %s rc = %d\n", dir, rc );
+   }
+   free( dir );
+   return rc;
+}
+
+
+// add a finished job's usage to its owner's totals
+void usage_account( struct wish_usage_packet* p ) {
+   pthread_rwlock_wrlock( &totals_lock );
+   
+   struct usage_totals* t = &totals[ p->owner ];
+   t->jobs++;
+   t->utime += p->utime;
+   t->stime += p->stime;
+   t->maxrss = MAX( t->maxrss, p->maxrss );
+   t->read_bytes += p->read_bytes;
+   t->write_bytes += p->write_bytes;
+   t->wall_time += p->wall_time;
+   t->queue_delay += p->queue_delay;
+   t->launch_delay += p->launch_delay;
+   
+   pthread_rwlock_unlock( &totals_lock );
+}
+
+
+// write the per-user totals into buf
+size_t usage_print_stats( char* buf, size_t len ) {
+   size_t off = 0;
+   
+   pthread_rwlock_rdlock( &totals_lock );
+   for( UsageTable::iterator itr = totals.begin(); itr != totals.end(); itr++ ) {
+      struct usage_totals* t = &itr->second;
+      uint32_t uid = itr->first;
+      
+      char line[1024];
+      int n = snprintf( line, sizeof(line),
+                        "usage.uid.%u.jobs %lu\nusage.uid.%u.utime_usec %lu\nusage.uid.%u.stime_usec %lu\nusage.uid.%u.max_rss_kb %lu\n"
+                        "usage.uid.%u.read_bytes %lu\nusage.uid.%u.write_bytes %lu\nusage.uid.%u.wall_usec %lu\n"
+                        "usage.uid.%u.queue_usec %lu\nusage.uid.%u.launch_usec %lu\n",
+                        uid, t->jobs, uid, t->utime, uid, t->stime, uid, t->maxrss,
+                        uid, t->read_bytes, uid, t->write_bytes, uid, t->wall_time,
+                        uid, t->queue_delay, uid, t->launch_delay );
+      
+      if( n < 0 || off + n >= len )
+         break;
+      
+      memcpy( buf + off, line, n + 1 );
+      off += n;
+   }
+   pthread_rwlock_unlock( &totals_lock );
+   
+   return off;
+}
@@ -0,0 +1,64 @@
+// per-job resource accounting.
+// executors measure what each job used (from its own cgroup if we have been delegated a cgroup v2 tree, or from wait4() otherwise),
+// and origins keep running totals per user.
+#ifndef _USAGE_H_
+#define _USAGE_H_
+
+#include "libwish.h"
+#include <map>
+
+using namespace std;
+
+#define USAGE_CGROUP_PREFIX "wish-job-"      // name prefix of each job's cgroup, under the configured cgroup root
+
+// resources used by one user's finished jobs
+struct usage_totals {
+   uint64_t jobs;                // number of jobs
+   uint64_t utime;               // total user CPU time, in microseconds
+   uint64_t stime;               // total system CPU time, in microseconds
+   uint64_t maxrss;              // largest peak RSS of any single job, in kilobytes
+   uint64_t read_bytes;          // total bytes read from block devices
+   uint64_t write_bytes;         // total bytes written to block devices
+   uint64_t wall_time;           // total run time, in microseconds
+   uint64_t queue_delay;         // total time spent getting inputs, in microseconds
+   uint64_t launch_delay;        // total time spent launching, in microseconds
+};
+
+typedef map<uint32_t, struct usage_totals> UsageTable;
+
+// set up accounting, and check the cgroup root (if one is configured)
+int usage_init( struct wish_state* state );
+
+// shut down accounting
+int usage_shutdown( struct wish_state* state );
+
+// make a cgroup for a job.
+// return the path to its cgroup.procs file (which the caller must free), or NULL if cgroups are not in use or it could not be made.
+char* usage_cgroup_create( uint64_t gpid );
+
+// move the calling process into the cgroup with the given cgroup.procs file.
+// safe to call between fork() and exec().
+// return 0 on success; negative on error
+int usage_cgroup_join( char const* procs_path );
+
+// confine a job's cgroup to the given cores and NUMA nodes (cpuset lists, e.g. "0-3").
+// does nothing if cgroups are not in use.
+// return 0 on success; negative on error (e.g. if the cpuset controller isn't available)
+int usage_cgroup_cpuset( uint64_t gpid, char const* cpus, char const* mems );
+
+// read the CPU, memory, and I/O usage of a job's cgroup into p (leaving alone whatever could not be read).
+// return 0 on success; negative on error
+int usage_cgroup_collect( uint64_t gpid, struct wish_usage_packet* p );
+
+// remove a job's cgroup.  This fails with -EBUSY if the job left processes behind.
+// return 0 on success; negative on error
+int usage_cgroup_remove( uint64_t gpid );
+
+// add a finished job's usage to its owner's totals (called on the origin)
+void usage_account( struct wish_usage_packet* p );
+
+// write the per-user totals into buf as "key value" lines, stopping before buf fills up.
+// return the number of bytes written
+size_t usage_print_stats( char* buf, size_t len );
+
+#endif
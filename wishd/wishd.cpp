@@ -67,8 +67,20 @@ int wishd_main( struct wish_state* state ) {
             wish_unpack_job_packet( state, &packet, job );
             printf("wishd_main: Got a job packet: dest nid = %lu, gpid = %lu, cmd = '%s', stdin = '%s', flags = %x\n", job->nid_dest, job->gpid, job->cmd_text, job->stdin_url, job->flags );
             
+            // is this a broadcast?  then the hosts to run it on come next, which the broadcast reads in the background
+            if( job->flags & JOB_BROADCAST ) {
+               rc = broadcast_start( state, con, job );
+               if( rc != 0 ) {
+                  errorf("wishd_main: broadcast of %lu rc = %d\n", job->gpid, rc );
+                  wish_process_reply( state, con, PROCESS_TYPE_ERROR, job->gpid, rc );
+                  wish_disconnect( state, con );
+                  free( con );
+                  wish_free_job_packet( job );
+                  free( job );
+               }
+            }
             // is this a wish-created job request?
-            if( job->flags & JOB_WISH_ORIGIN ) {
+            else if( job->flags & JOB_WISH_ORIGIN ) {
                // process this job here
                dbprintf("starting %lu here...\n", job->gpid);
                int rc = process_start( state, con, job );
@@ -82,6 +94,19 @@ int wishd_main( struct wish_state* state ) {
                   dbprintf("started %lu\n", job->gpid);
                }
             }
+            // is this a client-created job to queue?  then the placement policy comes next, which the scheduler
+            // reads in the background
+            else if( job->flags & JOB_SCHEDULE ) {
+               rc = scheduler_submit_start( state, con, job );
+               if( rc != 0 ) {
+                  errorf("wishd_main: scheduler_submit_start of %lu rc = %d\n", job->gpid, rc );
+                  wish_process_reply( state, con, PROCESS_TYPE_ERROR, job->gpid, rc );
+                  wish_disconnect( state, con );
+                  free( con );
+                  wish_free_job_packet( job );
+                  free( job );
+               }
+            }
             // this is a client-created job request
             else {
                dbprintf("spawning %lu...\n", job->gpid );
@@ -100,6 +125,71 @@ int wishd_main( struct wish_state* state ) {
             break;
          }
          
+         case PACKET_TYPE_JOB_ARRAY: {
+            // spawn every instance of a job array, and reply their gpids
+            struct wish_job_array_packet* arr = (struct wish_job_array_packet*)calloc( sizeof(struct wish_job_array_packet), 1 );
+            int rc = wish_unpack_job_array_packet( state, &packet, arr );
+            if( rc == 0 ) {
+               printf("wishd_main: Got a job array packet: array id = %lu, count = %u, hosts = %u, cmd = '%s', flags = %x\n", arr->array_id, arr->count, arr->num_hosts, arr->cmd_text, arr->flags );
+               rc = process_spawn_array( state, arr, con );
+            }
+            
+            if( rc != 0 ) {
+               errorf("wishd_main: process_spawn_array rc = %d\n", rc );
+               wish_process_reply( state, con, PROCESS_TYPE_ERROR, arr->array_id, rc );
+               wish_disconnect( state, con );
+               free( con );
+               wish_free_job_array_packet( arr );
+               free( arr );
+            }
+            // otherwise arr and con belong to the array's launcher now
+            
+            break;
+         }
+         
+         case PACKET_TYPE_DAG: {
+            // run a DAG of jobs, and reply its id and its nodes' gpids
+            struct wish_dag_packet* dag = (struct wish_dag_packet*)calloc( sizeof(struct wish_dag_packet), 1 );
+            int rc = wish_unpack_dag_packet( state, &packet, dag );
+            if( rc == 0 ) {
+               printf("wishd_main: Got a DAG packet: dag id = %lu, nodes = %u\n", dag->dag_id, dag->num_nodes );
+               rc = dag_start( state, dag, con );
+            }
+            
+            if( rc != 0 ) {
+               errorf("wishd_main: DAG packet rc = %d\n", rc );
+               wish_process_reply( state, con, PROCESS_TYPE_ERROR, dag->dag_id, rc );
+               wish_free_dag_packet( dag );
+               free( dag );
+            }
+            // otherwise dag belongs to the DAG's launcher now, and may already be gone
+            
+            wish_disconnect( state, con );
+            free( con );
+            break;
+         }
+         
+         case PACKET_TYPE_OUTPUT: {
+            // replay (and maybe follow) a job's output
+            struct wish_output_packet opkt;
+            wish_unpack_output_packet( state, &packet, &opkt );
+            printf("wishd_main: Got an output packet: type = %d, gpid = %lu, offset = %lu, flags = %x\n", opkt.type, opkt.gpid, opkt.offset, opkt.flags );
+            
+            int rc = -EINVAL;
+            if( opkt.type == OUTPUT_ATTACH )
+               rc = outlog_attach( state, con, opkt.gpid, opkt.offset, (opkt.flags & OUTPUT_FOLLOW) != 0 );
+            
+            if( rc != 0 ) {
+               errorf("wishd_main: outlog_attach rc = %d\n", rc );
+               wish_process_reply( state, con, PROCESS_TYPE_ERROR, opkt.gpid, rc );
+               wish_disconnect( state, con );
+               free( con );
+            }
+            
+            wish_free_output_packet( &opkt );
+            break;
+         }
+         
          case PACKET_TYPE_PROCESS: {
             struct wish_process_packet wpp;
             wish_unpack_process_packet( state, &packet, &wpp );
@@ -108,7 +198,8 @@ int wishd_main( struct wish_state* state ) {
             if( wpp.type == PROCESS_TYPE_PJOIN ) {
                // join request
                int blocking = wpp.data;
-               int rc = process_join( state, con, wpp.gpid, (blocking != 0 ? true : false));
+               bool want_usage = (wpp.signal & PROCESS_JOIN_USAGE) != 0;
+               int rc = process_join( state, con, wpp.gpid, (blocking != 0 ? true : false), want_usage );
                if( rc != 0 ) {
                   errorf("wishd_main: process_join rc = %d\n", rc );
                   wish_process_reply( state, con, PROCESS_TYPE_ERROR, wpp.gpid, rc );
@@ -162,6 +253,23 @@ int wishd_main( struct wish_state* state ) {
                wish_disconnect( state, con );
                free( con );
             }
+            else if( wpp.type == PROCESS_TYPE_STEAL ) {
+               // an idle daemon wants some of our queued jobs
+               int taken = scheduler_steal( state, wpp.gpid, wpp.data );
+               if( taken < 0 ) {
+                  errorf("wishd_main: scheduler_steal rc = %d\n", taken );
+                  taken = 0;
+               }
+               
+               rc = wish_process_reply( state, con, PROCESS_TYPE_STEAL, wpp.gpid, taken );
+               
+               if( rc != 0 ) {
+                  errorf("wishd_main: reply to steal request rc = %d\n", rc );
+               }
+               
+               wish_disconnect( state, con );
+               free( con );
+            }
             else {
                errorf("wishd_main: cannot handle process packet of type %d\n", wpp.type );
                wish_disconnect( state, con );
@@ -192,27 +300,46 @@ int wishd_main( struct wish_state* state ) {
                wish_init_string_packet( state, &wsp, STRING_STDOUT, buf );
             }
             else {
-               uint64_t best_node = 0;
                unsigned int rank = nget_pkt.rank - 1;
+               unsigned int count = (nget_pkt.count > 0 ? nget_pkt.count : 1);
                
-               if( rank >= 0 && rank <= heartbeat_count_hosts( state ) ) {
-                  if( nget_pkt.props == HEARTBEAT_PROP_LATENCY )
-                     best_node = heartbeat_best_latency( state, rank );
-                  else if( nget_pkt.props == HEARTBEAT_PROP_CPU )
-                     best_node = heartbeat_best_cpu( state, rank );
-                  else if( nget_pkt.props == HEARTBEAT_PROP_DISK )
-                     best_node = heartbeat_best_disk( state, rank );
-                  else if( nget_pkt.props == HEARTBEAT_PROP_RAM )
-                     best_node = heartbeat_best_ram( state, rank );
-                  else
-                     best_node = heartbeat_index( state, rank );
+               vector<struct heartbeat_match> best_nodes;
+               if( nget_pkt.props == HEARTBEAT_PROP_QUERY ) {
+                  heartbeat_query( state, &nget_pkt, rank, count, &best_nodes );
+               }
+               else {
+                  vector<uint64_t> nids;
+                  heartbeat_best_range( state, nget_pkt.props, rank, count, &nids );
+                  for( unsigned int i = 0; i < nids.size(); i++ ) {
+                     struct heartbeat_match match;
+                     match.nid = nids[i];
+                     match.score = 0;
+                     best_nodes.push_back( match );
+                  }
                }
                
-               if( best_node != 0 ) {
-                  char* hostname = heartbeat_nid_to_hostname( state, best_node );
-                  wish_init_string_packet( state, &wsp, STRING_STDOUT, hostname );
-                  dbprintf("best_node = %lu, hostname = '%s'\n", best_node, hostname );
+               // one host per line (with its score, if it was a query)
+               string hostnames;
+               for( unsigned int i = 0; i < best_nodes.size(); i++ ) {
+                  char* hostname = heartbeat_nid_to_hostname( state, best_nodes[i].nid );
+                  if( hostname == NULL )
+                     continue;
+                  
+                  dbprintf("best_node = %lu, hostname = '%s'\n", best_nodes[i].nid, hostname );
+                  if( hostnames.size() > 0 )
+                     hostnames += "\n";
+                  hostnames += hostname;
                   free( hostname );
+                  
+                  if( nget_pkt.props == HEARTBEAT_PROP_QUERY ) {
+                     char score[64];
+                     sprintf( score, " %.3f", best_nodes[i].score );
+                     hostnames += score;
+                  }
+               }
+               
+               if( hostnames.size() > 0 ) {
+                  wish_init_string_packet( state, &wsp, STRING_STDOUT, hostnames.c_str() );
                }
                else {
                   wish_init_string_packet( state, &wsp, STRING_STDOUT, "NONE" );
@@ -296,7 +423,7 @@ int wishd_main( struct wish_state* state ) {
          case PACKET_TYPE_CLIENT: {
             // got a client connection
             printf("Client connection request, socket %d\n", con->soc);
-            wish_state_wlock( state );
+            pthread_mutex_lock( &state->client_cons_lock );
             
             // insert over a NULL, or append if none found
             bool found = false;
@@ -310,7 +437,7 @@ int wishd_main( struct wish_state* state ) {
             if( !found ) {
                state->client_cons->push_back( con );
             }
-            wish_state_unlock( state );
+            pthread_mutex_unlock( &state->client_cons_lock );
             break;
          }
          
@@ -507,6 +634,45 @@ static struct HTTP_response* HTTP_GET_handler( struct HTTP* http, struct HTTP_us
       
       free( request_path );
    }
+   
+   // request for daemon statistics?
+   else if( strcmp( path, WISH_HTTP_STATS ) == 0 ) {
+      char buf[16384];
+      char* p = buf;
+      
+      char const* method_names[] = { "fork", "zygote" };
+      int methods[] = { PROCESS_LAUNCH_FORK, PROCESS_LAUNCH_ZYGOTE };
+      
+      for( int i = 0; i < 2; i++ ) {
+         uint64_t count = 0, p50 = 0, p99 = 0;
+         process_launch_stats( methods[i], &count, &p50, &p99 );
+         p += sprintf( p, "launch.%s.count %lu\nlaunch.%s.p50_usec %lu\nlaunch.%s.p99_usec %lu\n", method_names[i], count, method_names[i], p50, method_names[i], p99 );
+      }
+      
+      char const* stdin_names[] = { "spooled", "streamed" };
+      int stdin_modes[] = { PROCESS_STDIN_SPOOLED, PROCESS_STDIN_STREAMED };
+      
+      for( int i = 0; i < 2; i++ ) {
+         uint64_t count = 0, p50 = 0, p99 = 0;
+         process_first_output_stats( stdin_modes[i], &count, &p50, &p99 );
+         p += sprintf( p, "first_output.%s.count %lu\nfirst_output.%s.p50_usec %lu\nfirst_output.%s.p99_usec %lu\n", stdin_names[i], count, stdin_names[i], p50, stdin_names[i], p99 );
+      }
+      
+      uint64_t spool_bytes = 0, spool_peak = 0;
+      process_stdin_spool_stats( &spool_bytes, &spool_peak );
+      p += sprintf( p, "stdin.spool_bytes %lu\nstdin.spool_peak_bytes %lu\n", spool_bytes, spool_peak );
+      
+      struct cache_stats cstats;
+      cache_get_stats( &cstats );
+      
+      uint64_t lookups = cstats.hits + cstats.misses;
+      p += sprintf( p, "cache.hits %lu\ncache.misses %lu\ncache.hit_rate %.3f\ncache.bytes_saved %lu\ncache.evictions %lu\ncache.entries %lu\ncache.size %lu\ncache.max_size %lu\n",
+                    cstats.hits, cstats.misses, (lookups > 0 ? (double)cstats.hits / lookups : 0.0), cstats.bytes_saved, cstats.evictions, cstats.num_entries, cstats.size, cstats.max_size );
+      
+      p += usage_print_stats( p, buf + sizeof(buf) - p );
+      
+      make_HTTP_text_response( &response, 200, buf );
+   }
    else {
       make_HTTP_text_response( &response, 400, "400 Bad Request" );
    }
@@ -590,13 +756,72 @@ int main( int argc, char** argv ) {
       exit(1);
    }
    
-   // set up heartbeats
-   rc = heartbeat_init( &g_state );
+   // start the zygote, while we're still single-threaded
+   rc = zygote_init( &g_state );
    if( rc < 0 ) {
-      errorf("main: heartbeat_init rc = %d\n", rc );
+      errorf("main: zygote_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   // start the timer wheel
+   rc = timer_init( &g_state );
+   if( rc < 0 ) {
+      errorf("main: timer_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   // set up barriers
+   rc = barrier_init( &g_state );
+   if( rc < 0 ) {
+      errorf("main: barrier_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   // set up the job file cache
+   rc = cache_init( &g_state );
+   if( rc < 0 ) {
+      errorf("main: cache_init rc = %d (cache disabled)\n", rc );
+   }
+   
+   // set up job resource accounting
+   rc = usage_init( &g_state );
+   if( rc < 0 ) {
+      errorf("main: usage_init rc = %d (using rusage for job accounting)\n", rc );
+   }
+   
+   // find the cores jobs can be pinned to
+   rc = pin_init( &g_state );
+   if( rc < 0 ) {
+      errorf("main: pin_init rc = %d (jobs cannot be pinned)\n", rc );
+   }
+   
+   // set up the job file downloader
+   rc = fetch_init( &g_state );
+   if( rc < 0 ) {
+      errorf("main: fetch_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   // set up job output logs
+   rc = outlog_init( &g_state );
+   if( rc < 0 ) {
+      errorf("main: outlog_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   // set up the cache of finished jobs' outcomes
+   rc = results_init( &g_state );
+   if( rc < 0 ) {
+      errorf("main: results_init rc = %d\n", rc );
       exit(1);
    }
    
+   // set up the writers of job output files
+   rc = sink_init( &g_state );
+   if( rc < 0 ) {
+      errorf("main: sink_init rc = %d (writing job output files inline)\n", rc );
+   }
+   
    // set up processes
    rc = process_init( &g_state );
    if( rc < 0 ) {
@@ -604,6 +829,34 @@ int main( int argc, char** argv ) {
       exit(1);
    }
    
+   // set up the job queue
+   rc = scheduler_init( &g_state );
+   if( rc < 0 ) {
+      errorf("main: scheduler_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   // read this host's condition for heartbeats (once the job counts it reads are set up)
+   rc = sampler_init( &g_state );
+   if( rc < 0 ) {
+      errorf("main: sampler_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   // set up heartbeats (once the sampler has a reading for the first of them)
+   rc = heartbeat_init( &g_state );
+   if( rc < 0 ) {
+      errorf("main: heartbeat_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   // set up job DAGs
+   rc = dag_init( &g_state );
+   if( rc < 0 ) {
+      errorf("main: dag_init rc = %d\n", rc );
+      exit(1);
+   }
+   
    // set up HTTP
    struct HTTP_user_entry** users = NULL;
    if( g_state.conf.http_secrets )
@@ -637,15 +890,60 @@ int main( int argc, char** argv ) {
    rc = wishd_main( &g_state );
    dbprintf("main: wishd_main returned %d\n", rc );
    
+   // stop firing deadlines before tearing down what they refer to
+   rc = timer_shutdown( &g_state );
+   dbprintf("main: timer shutdown rc = %d\n", rc );
+   
+   // stop reading job counts before the process table goes away
+   rc = sampler_shutdown( &g_state );
+   dbprintf("main: sampler shutdown rc = %d\n", rc );
+   
+   // stop placing queued jobs before the process table goes away
+   rc = scheduler_shutdown( &g_state );
+   dbprintf("main: scheduler shutdown rc = %d\n", rc );
+   
+   // stop launching DAG nodes
+   rc = dag_shutdown( &g_state );
+   dbprintf("main: dag shutdown rc = %d\n", rc );
+   
    rc = process_shutdown( &g_state );
    dbprintf("main: process shutdown rc = %d\n", rc );
    
+   // after the processes, which close their logs as they go
+   rc = outlog_shutdown( &g_state );
+   dbprintf("main: outlog shutdown rc = %d\n", rc );
+   
+   rc = results_shutdown( &g_state );
+   dbprintf("main: results shutdown rc = %d\n", rc );
+   
+   // after the processes, which close their output files as they go
+   rc = sink_shutdown( &g_state );
+   dbprintf("main: sink shutdown rc = %d\n", rc );
+   
+   rc = pin_shutdown( &g_state );
+   dbprintf("main: pin shutdown rc = %d\n", rc );
+   
+   rc = zygote_shutdown( &g_state );
+   dbprintf("main: zygote shutdown rc = %d\n", rc );
+   
+   rc = fetch_shutdown( &g_state );
+   dbprintf("main: fetch shutdown rc = %d\n", rc );
+   
+   rc = cache_shutdown( &g_state );
+   dbprintf("main: cache shutdown rc = %d\n", rc );
+   
+   rc = usage_shutdown( &g_state );
+   dbprintf("main: usage shutdown rc = %d\n", rc );
+   
    rc = wish_stop_HTTP( &http );
    dbprintf("main: HTTP shutdown rc = %d\n", rc );
    
    rc = heartbeat_shutdown( &g_state );
    dbprintf("main: heartbeat shutdown rc = %d\n", rc );
    
+   rc = barrier_shutdown( &g_state );
+   dbprintf("main: barrier shutdown rc = %d\n", rc );
+   
    rc = wish_shutdown( &g_state );
    dbprintf("main: wish shutdown rc = %d\n", rc );
    
@@ -9,11 +9,22 @@
 #include "libwish.h"
 #include "heartbeat.h"
 #include "process.h"
+#include "broadcast.h"
+#include "scheduler.h"
+#include "dag.h"
+#include "outlog.h"
 #include "http.h"
 #include "envar.h"
 #include "barrier.h"
-
-#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#include "zygote.h"
+#include "cache.h"
+#include "fetch.h"
+#include "usage.h"
+#include "pinning.h"
+#include "sink.h"
+#include "results.h"
+#include "timer.h"
+#include "sampler.h"
 
 #define DEFAULT_CONFIG_PATH "/etc/wish/wishd.conf"
 
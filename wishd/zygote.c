@@ -0,0 +1,377 @@
+#include "zygote.h"
+
+// zygote's pid (as seen by the daemon)
+static pid_t zygote_pid = -1;
+
+// daemon's end of the control socket
+static int zygote_sock = -1;
+
+// set to false once we can no longer talk to the zygote
+static bool zygote_alive = false;
+
+
+// send a launch request and its file descriptors over the control socket
+static int zygote_send_request( int soc, struct zygote_request* req, int* fds ) {
+   struct msghdr msg;
+   struct iovec iov;
+   char cbuf[ CMSG_SPACE( sizeof(int) * ZYGOTE_NUM_FDS ) ];
+
+   memset( &msg, 0, sizeof(msg) );
+   memset( cbuf, 0, sizeof(cbuf) );
+
+   // only send as much of the command as we need
+   iov.iov_base = req;
+   iov.iov_len = offsetof( struct zygote_request, cmd_text ) + strlen( req->cmd_text ) + 1;
+
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = cbuf;
+   msg.msg_controllen = sizeof(cbuf);
+
+   struct cmsghdr* cmsg = CMSG_FIRSTHDR( &msg );
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type = SCM_RIGHTS;
+   cmsg->cmsg_len = CMSG_LEN( sizeof(int) * ZYGOTE_NUM_FDS );
+   memcpy( CMSG_DATA( cmsg ), fds, sizeof(int) * ZYGOTE_NUM_FDS );
+
+   ssize_t rc = sendmsg( soc, &msg, MSG_NOSIGNAL );
+   if( rc < 0 ) {
+      return -errno;
+   }
+   return 0;
+}
+
+
+// receive a launch request and its file descriptors from the control socket
+static int zygote_recv_request( int soc, struct zygote_request* req, int* fds ) {
+   struct msghdr msg;
+   struct iovec iov;
+   char cbuf[ CMSG_SPACE( sizeof(int) * ZYGOTE_NUM_FDS ) ];
+
+   memset( &msg, 0, sizeof(msg) );
+   memset( cbuf, 0, sizeof(cbuf) );
+   memset( req, 0, sizeof(struct zygote_request) );
+
+   iov.iov_base = req;
+   iov.iov_len = sizeof(struct zygote_request);
+
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = cbuf;
+   msg.msg_controllen = sizeof(cbuf);
+
+   ssize_t rc = recvmsg( soc, &msg, 0 );
+   if( rc <= 0 ) {
+      return rc == 0 ? -ENOTCONN : -errno;
+   }
+
+   struct cmsghdr* cmsg = CMSG_FIRSTHDR( &msg );
+   if( cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN( sizeof(int) * ZYGOTE_NUM_FDS ) ) {
+      return -EINVAL;
+   }
+
+   memcpy( fds, CMSG_DATA( cmsg ), sizeof(int) * ZYGOTE_NUM_FDS );
+
+   req->cmd_text[ ZYGOTE_CMD_MAX - 1 ] = 0;
+   return 0;
+}
+
+
+// zygote worker: wait for a job, tell the zygote we're busy, and then act as the shell's wrapper process.
+// never returns.
+static void zygote_worker( int ctl, int taken_fd, char** shell_argv, int shell_argc ) {
+
+   // die if the zygote goes away while we're idle
+   prctl( PR_SET_PDEATHSIG, SIGKILL );
+
+   struct zygote_request* req = (struct zygote_request*)calloc( sizeof(struct zygote_request), 1 );
+   int fds[ZYGOTE_NUM_FDS];
+
+   int rc = zygote_recv_request( ctl, req, fds );
+   if( rc != 0 ) {
+      // -ENOTCONN just means the daemon is shutting down
+      if( rc != -ENOTCONN )
+         errorf("zygote_worker: zygote_recv_request rc = %d\n", rc );
+      exit(1);
+   }
+
+   // we're running a job now--stick around even if the zygote exits
+   prctl( PR_SET_PDEATHSIG, 0 );
+
+   // have the zygote replace us
+   pid_t me = getpid();
+   write( taken_fd, &me, sizeof(me) );
+
+   close( ctl );
+   close( taken_fd );
+
+   int child_stdin = fds[0];
+   int child_stdout = fds[1];
+   int child_stderr = fds[2];
+   int status_fd = fds[3];
+
+   shell_argv[ shell_argc + 1 ] = req->cmd_text;
+
+   pid_t shell_pid = fork();
+   if( shell_pid == 0 ) {
+      // set up stdin, stdout, stderr
+      dup2( child_stdin, STDIN_FILENO );
+      dup2( child_stdout, STDOUT_FILENO );
+      dup2( child_stderr, STDERR_FILENO );
+
+      close( child_stdin );
+      close( child_stdout );
+      close( child_stderr );
+      close( status_fd );
+
+      // set up environment
+      char gpid_txt[21];
+      char portnum_buf[10];
+
+      sprintf(gpid_txt, "%lu", req->gpid );
+      sprintf(portnum_buf, "%d", req->http_portnum );
+
+      setenv( WISH_ORIGIN_ENV, req->origin_host, 1 );
+      setenv( WISH_PORTNUM_ENV, req->origin_port, 1 );
+      setenv( WISH_GPID_ENV, gpid_txt, 1 );
+      setenv( WISH_HTTP_PORTNUM_ENV, portnum_buf, 1 );
+
+      // account for the job in its own cgroup
+      if( req->cgroup_procs[0] != 0 ) {
+         usage_cgroup_join( req->cgroup_procs );
+      }
+
+      // keep to the job's own cores
+      if( req->pinned ) {
+         sched_setaffinity( 0, sizeof(cpu_set_t), &req->cpus );
+      }
+
+      // run the shell command.
+      execv( shell_argv[0], shell_argv );
+      exit(-1);
+   }
+
+   close( child_stdin );
+   close( child_stdout );
+   close( child_stderr );
+
+   if( shell_pid < 0 ) {
+      // daemon will see the pipe close without a pid
+      exit(1);
+   }
+
+   // the daemon might go away before the shell exits
+   signal( SIGPIPE, SIG_IGN );
+
+   // write back the shell process's pid
+   write( status_fd, &shell_pid, sizeof(shell_pid) );
+
+   // join with shell process to get its exit, signal, and resource usage, and send them back
+   int shell_rc = 0;
+   struct rusage ru;
+   memset( &ru, 0, sizeof(ru) );
+
+   rc = wait4( shell_pid, &shell_rc, 0, &ru );
+   if( rc > 0 ) {
+      write( status_fd, &shell_rc, sizeof(shell_rc) );
+      write( status_fd, &ru, sizeof(ru) );
+      exit(0);
+   }
+
+   errorf("zygote_worker: failed to wait4; errno = %d\n", -errno);
+   exit(1);
+}
+
+
+// zygote main loop: keep num_workers idle workers waiting on the control socket.
+// never returns.
+static void zygote_main( struct wish_state* state, int ctl, int num_workers ) {
+
+   // go away with the daemon
+   prctl( PR_SET_PDEATHSIG, SIGTERM );
+   pid_t daemon_pid = getppid();
+
+   // don't hold the daemon's listening socket
+   close( state->daemon_sock );
+
+   // build the shell command once; workers fill in the last argument
+   char** shell_argv = (char**)calloc( sizeof(char*) * (state->conf.shell_argc + 3), 1 );
+   shell_argv[0] = state->conf.shell;
+   for( int i = 0; i < state->conf.shell_argc; i++ ) {
+      shell_argv[i+1] = state->conf.shell_argv[i];
+   }
+
+   // workers write their pids here when they pick up a job
+   int taken_fds[2];
+   if( pipe( taken_fds ) != 0 ) {
+      errorf("zygote_main: pipe errno = %d\n", -errno );
+      exit(1);
+   }
+
+   set<pid_t> idle;
+
+   while( true ) {
+      if( getppid() != daemon_pid ) {
+         // daemon died
+         exit(0);
+      }
+
+      // top up the pool
+      while( (signed)idle.size() < num_workers ) {
+         pid_t pid = fork();
+         if( pid == 0 ) {
+            close( taken_fds[0] );
+            zygote_worker( ctl, taken_fds[1], shell_argv, state->conf.shell_argc );
+         }
+         else if( pid > 0 ) {
+            idle.insert( pid );
+         }
+         else {
+            errorf("zygote_main: fork errno = %d\n", -errno );
+            break;
+         }
+      }
+
+      // wait for a worker to be taken
+      struct pollfd pfd;
+      pfd.fd = taken_fds[0];
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+
+      int rc = poll( &pfd, 1, 1000 );
+      if( rc > 0 && (pfd.revents & POLLIN) ) {
+         pid_t taken[64];
+         ssize_t nr = read( taken_fds[0], taken, sizeof(taken) );
+         for( ssize_t i = 0; i < nr / (signed)sizeof(pid_t); i++ ) {
+            idle.erase( taken[i] );
+         }
+      }
+
+      // reap workers whose jobs are done (and any idle ones that died)
+      pid_t dead;
+      while( (dead = waitpid( -1, NULL, WNOHANG )) > 0 ) {
+         idle.erase( dead );
+      }
+   }
+}
+
+
+// fork the zygote.  Must be called before any threads are started.
+int zygote_init( struct wish_state* state ) {
+   int num_workers = state->conf.zygote_workers;
+   if( num_workers <= 0 ) {
+      return 0;
+   }
+
+   int ctl[2];
+   int rc = socketpair( AF_UNIX, SOCK_SEQPACKET, 0, ctl );
+   if( rc != 0 ) {
+      rc = -errno;
+      errorf("zygote_init: socketpair rc = %d\n", rc );
+      return rc;
+   }
+
+   pid_t pid = fork();
+   if( pid == 0 ) {
+      close( ctl[0] );
+      zygote_main( state, ctl[1], num_workers );
+   }
+   else if( pid < 0 ) {
+      rc = -errno;
+      errorf("zygote_init: fork rc = %d\n", rc );
+      close( ctl[0] );
+      close( ctl[1] );
+      return rc;
+   }
+
+   close( ctl[1] );
+
+   // don't leak the control socket into jobs the daemon forks itself
+   fcntl( ctl[0], F_SETFD, FD_CLOEXEC );
+
+   zygote_pid = pid;
+   zygote_sock = ctl[0];
+   zygote_alive = true;
+
+   dbprintf("zygote_init: zygote %d started with %d workers\n", zygote_pid, num_workers );
+   return 0;
+}
+
+
+// stop the zygote and its idle workers
+int zygote_shutdown( struct wish_state* state ) {
+   if( zygote_pid <= 0 ) {
+      return 0;
+   }
+
+   zygote_alive = false;
+
+   close( zygote_sock );
+   zygote_sock = -1;
+
+   kill( zygote_pid, SIGTERM );
+   waitpid( zygote_pid, NULL, 0 );
+   zygote_pid = -1;
+
+   return 0;
+}
+
+
+// is the zygote available to run jobs?
+bool zygote_running(void) {
+   return zygote_alive;
+}
+
+
+// have an idle zygote worker run a job.
+int zygote_launch( struct wish_state* state, struct wish_job_packet* job, char const* cgroup_procs, cpu_set_t const* cpus, int child_stdin, int child_stdout, int child_stderr, int status_fd ) {
+   if( !zygote_alive ) {
+      return -ENOTCONN;
+   }
+
+   size_t cmd_len = strlen( job->cmd_text );
+   if( cmd_len >= ZYGOTE_CMD_MAX ) {
+      return -E2BIG;
+   }
+
+   struct zygote_request* req = (struct zygote_request*)calloc( sizeof(struct zygote_request), 1 );
+
+   // extract hostname and portnum from the origin daemon
+   int rc = getnameinfo( (struct sockaddr*)&job->visited[0], sizeof(struct sockaddr_storage), req->origin_host, HOST_NAME_MAX, req->origin_port, 10, NI_NUMERICSERV );
+   if( rc != 0 ) {
+      errorf("zygote_launch: getnameinfo rc = %d (%s)\n", rc, gai_strerror(rc) );
+      free( req );
+      return -EINVAL;
+   }
+
+   req->gpid = job->gpid;
+   req->http_portnum = job->origin_http_portnum;
+   memcpy( req->cmd_text, job->cmd_text, cmd_len + 1 );
+
+   if( cgroup_procs != NULL ) {
+      strncpy( req->cgroup_procs, cgroup_procs, PATH_MAX - 1 );
+   }
+
+   if( cpus != NULL ) {
+      req->pinned = 1;
+      req->cpus = *cpus;
+   }
+
+   int fds[ZYGOTE_NUM_FDS];
+   fds[0] = child_stdin;
+   fds[1] = child_stdout;
+   fds[2] = child_stderr;
+   fds[3] = status_fd;
+
+   rc = zygote_send_request( zygote_sock, req, fds );
+   if( rc != 0 ) {
+      errorf("zygote_launch: zygote_send_request rc = %d\n", rc );
+      if( rc == -EPIPE || rc == -ECONNRESET || rc == -ENOTCONN ) {
+         // zygote is gone
+         zygote_alive = false;
+      }
+   }
+
+   free( req );
+   return rc;
+}
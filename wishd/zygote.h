@@ -0,0 +1,52 @@
+// zygote process--a small helper forked before the daemon starts any threads,
+// which keeps a pool of pre-forked workers ready to exec jobs.
+#ifndef _ZYGOTE_H_
+#define _ZYGOTE_H_
+
+#include "libwish.h"
+#include "usage.h"
+#include <sys/prctl.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <sched.h>
+#include <set>
+
+using namespace std;
+
+#define ZYGOTE_CMD_MAX 65536          // longest command the zygote will run; longer ones get forked by the daemon
+
+// number of file descriptors that accompany a launch request:
+// the job's stdin, stdout, stderr, and the pipe to write the shell's pid, exit status, and rusage to
+#define ZYGOTE_NUM_FDS 4
+
+// launch request, sent from the daemon to an idle zygote worker
+struct zygote_request {
+   uint64_t gpid;                               // gpid of the job
+   int http_portnum;                            // origin daemon's HTTP port
+   char origin_host[HOST_NAME_MAX+1];           // origin daemon's hostname
+   char origin_port[10];                        // origin daemon's port
+   char cgroup_procs[PATH_MAX];                 // cgroup.procs file of the cgroup to run the job in (empty for none)
+   int pinned;                                  // run the job on only the cores in cpus?
+   cpu_set_t cpus;                              // cores the job was given
+   char cmd_text[ZYGOTE_CMD_MAX];               // command to run (only strlen+1 bytes are sent)
+};
+
+// fork the zygote.  Must be called before any threads are started.
+// does nothing if no zygote workers are configured.
+int zygote_init( struct wish_state* state );
+
+// stop the zygote and its idle workers.  Running jobs are left alone.
+int zygote_shutdown( struct wish_state* state );
+
+// is the zygote available to run jobs?
+bool zygote_running(void);
+
+// have an idle zygote worker run a job.
+// the worker will write the shell's pid to status_fd, and then its wait status and struct rusage once it exits
+// (the same as the daemon's own wrapper process).
+// if cgroup_procs is not NULL, the shell is moved into that cgroup before it runs.
+// if cpus is not NULL, the shell runs on only those cores.
+// return 0 on success; negative on error.
+int zygote_launch( struct wish_state* state, struct wish_job_packet* job, char const* cgroup_procs, cpu_set_t const* cpus, int child_stdin, int child_stdout, int child_stderr, int status_fd );
+
+#endif